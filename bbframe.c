@@ -0,0 +1,595 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: bbframe.c                                                                   */
+/*    - reassembles BBFRAMEs from the generic stream and decapsulates GSE to IP datagrams             */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "errors.h"
+#include "bbframe.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* DVB-S2 CRC-8, x^8+x^7+x^6+x^4+x^2+1 */
+#define BBFRAME_CRC8_POLY 0xD5
+
+/* SYNCD value for a data field in which no packet starts */
+#define BBFRAME_SYNCD_NONE 0xFFFF
+
+/* GSE packet header, ETSI TS 102 606-1 */
+#define GSE_FIXED_HEADER_LEN 2
+#define GSE_MAX_PACKET_LEN   (GSE_FIXED_HEADER_LEN + 4095)
+#define GSE_MAX_PDU_LEN      65536
+#define GSE_CRC_LEN          4
+#define GSE_FRAG_IDS         256
+
+#define GSE_LABEL_6_BYTE     0
+#define GSE_LABEL_3_BYTE     1
+#define GSE_LABEL_BROADCAST  2
+#define GSE_LABEL_REUSE      3
+
+#define GSE_PROTOCOL_IPV4    0x0800
+#define GSE_PROTOCOL_IPV6    0x86DD
+
+#define PCAP_MAGIC           0xa1b2c3d4
+#define PCAP_LINKTYPE_RAW    101
+#define PCAP_WRITE_BUFFER    (1024 * 1024)
+
+typedef struct {
+    uint8_t *data;     /* from the total length field on, as covered by the CRC-32 */
+    uint32_t len;
+    uint32_t expected; /* total length field + the 2 bytes of the field itself */
+    uint8_t label_type;
+    bool active;
+} gse_fragment_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_header_t;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static uint8_t bbframe_crc8_table[256];
+static bool bbframe_crc8_ready = false;
+
+/* Frame reassembly, frame_needed is 0 while hunting for a header */
+static uint8_t bbframe_frame[BBFRAME_MAX_LEN];
+static uint32_t bbframe_frame_len = 0;
+static uint32_t bbframe_frame_needed = 0;
+static bool bbframe_in_sync = false;
+
+static bbframe_stats_t bbframe_stats;
+
+/* GSE packet that runs over the end of one data field into the next, only when SYNCD says so */
+static uint8_t gse_carry[GSE_MAX_PACKET_LEN];
+static uint32_t gse_carry_len = 0;
+static gse_fragment_t gse_fragments[GSE_FRAG_IDS];
+static uint32_t crc32_table[256];
+
+static bool gse_enabled = false;
+static FILE *gse_pcap = NULL;
+static int gse_socket = -1;
+static struct sockaddr_un gse_socket_addr;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void bbframe_build_tables(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t crc;
+
+    for (int i = 0; i < 256; i++) {
+        crc = 0;
+        for (int j = 7; j >= 0; j--) {
+            if (((i >> j) & 1) ^ ((crc & 0x80) ? 1 : 0)) crc = ((crc << 1) ^ BBFRAME_CRC8_POLY) & 0xff;
+            else crc = (crc << 1) & 0xff;
+        }
+        bbframe_crc8_table[i] = crc;
+
+        /* MPEG-2 CRC-32, as used by GSE */
+        crc = (uint32_t)i << 24;
+        for (int j = 0; j < 8; j++) crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        crc32_table[i] = crc;
+    }
+
+    bbframe_crc8_ready = true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t bbframe_crc8(const uint8_t *data, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the CRC-8 (polynomial BBFRAME_CRC8_POLY) that protects a BBHEADER                                  */
+/*  *data: the bytes to check, the first 9 of a BBHEADER                                              */
+/*    len: how many                                                                                   */
+/* return: the CRC                                                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t crc = 0;
+
+    if (!bbframe_crc8_ready) bbframe_build_tables();
+    while (len--) crc = bbframe_crc8_table[*data++ ^ crc];
+
+    return crc;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool bbframe_header_valid(uint8_t *header) {
+/* -------------------------------------------------------------------------------------------------- */
+/* checks the CRC-8 and DFL of a candidate BBHEADER                                                   */
+/* The CRC-8 is XORed with 1 in high efficiency mode, so accept either. An empty data field is        */
+/* rejected too, otherwise runs of zero padding would pass as headers                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t crc = bbframe_crc8(header, BBFRAME_HEADER_LEN - 1);
+    uint32_t dfl;
+
+    if (header[9] != crc && header[9] != (crc ^ 1)) return false;
+
+    dfl = ((uint32_t)header[4] << 8) | header[5];
+    return (dfl != 0) && (dfl % 8 == 0) && (BBFRAME_HEADER_LEN + dfl / 8 <= BBFRAME_MAX_LEN);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t gse_crc32(uint8_t *data, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *data++) & 0xFF];
+    return crc;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void gse_output(uint16_t protocol, uint8_t *pdu, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sends one IP datagram to the pcap file or the Unix socket                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    pcap_record_header_t record;
+    struct timespec now;
+
+    if (protocol != GSE_PROTOCOL_IPV4 && protocol != GSE_PROTOCOL_IPV6) {
+        bbframe_stats.gse_dropped++;
+        return;
+    }
+
+    bbframe_stats.gse_pdus++;
+
+    if (gse_pcap != NULL) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        record.ts_sec = (uint32_t)now.tv_sec;
+        record.ts_usec = (uint32_t)(now.tv_nsec / 1000);
+        record.incl_len = len;
+        record.orig_len = len;
+        if (fwrite(&record, sizeof(record), 1, gse_pcap) != 1 || fwrite(pdu, len, 1, gse_pcap) != 1) {
+            bbframe_stats.output_errors++;
+        }
+    } else if (gse_socket >= 0) {
+        /* Never block the TS thread on a slow or absent reader */
+        if (sendto(gse_socket, pdu, len, MSG_DONTWAIT, (struct sockaddr *)&gse_socket_addr, sizeof(gse_socket_addr)) < 0) {
+            bbframe_stats.output_errors++;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t gse_label_len(uint8_t label_type) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (label_type == GSE_LABEL_6_BYTE) return 6;
+    if (label_type == GSE_LABEL_3_BYTE) return 3;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void gse_packet(uint8_t *packet, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* handles one complete GSE packet: a whole PDU, or the first, a middle or the last fragment of one   */
+/* -------------------------------------------------------------------------------------------------- */
+    bool start = (packet[0] & 0x80) != 0;
+    bool end = (packet[0] & 0x40) != 0;
+    uint8_t label_type = (packet[0] >> 4) & 0x03;
+    uint32_t pos = GSE_FIXED_HEADER_LEN;
+    uint32_t payload_len, total_len;
+    gse_fragment_t *fragment = NULL;
+    uint32_t crc;
+
+    bbframe_stats.gse_packets++;
+
+    if (!(start && end)) {
+        if (pos + 1 > len) {
+            bbframe_stats.gse_dropped++;
+            return;
+        }
+        fragment = &gse_fragments[packet[pos++]];
+    }
+
+    if (start && end) {
+        /* Complete PDU */
+        pos += 2 + gse_label_len(label_type);
+        if (pos > len) {
+            bbframe_stats.gse_dropped++;
+            return;
+        }
+        gse_output(((uint16_t)packet[GSE_FIXED_HEADER_LEN] << 8) | packet[GSE_FIXED_HEADER_LEN + 1],
+                   &packet[pos], len - pos);
+    } else if (start) {
+        /* First fragment, keep everything from the total length field on for the CRC */
+        if (pos + 2 > len) {
+            bbframe_stats.gse_dropped++;
+            return;
+        }
+        if (fragment->active) bbframe_stats.gse_dropped++;
+        total_len = (((uint32_t)packet[pos] << 8) | packet[pos + 1]) + 2;
+        if (fragment->data == NULL) fragment->data = (uint8_t *)malloc(GSE_MAX_PDU_LEN + 2);
+        if (fragment->data == NULL || len - pos > total_len) {
+            fragment->active = false;
+            bbframe_stats.gse_dropped++;
+            return;
+        }
+        memcpy(fragment->data, &packet[pos], len - pos);
+        fragment->len = len - pos;
+        fragment->expected = total_len;
+        fragment->label_type = label_type;
+        fragment->active = true;
+    } else {
+        /* Middle or last fragment */
+        payload_len = len - pos - (end ? GSE_CRC_LEN : 0);
+        if (!fragment->active || pos + (end ? GSE_CRC_LEN : 0) > len
+            || fragment->len + payload_len > fragment->expected) {
+            if (fragment->active || end) bbframe_stats.gse_dropped++;
+            fragment->active = false;
+            return;
+        }
+        memcpy(&fragment->data[fragment->len], &packet[pos], payload_len);
+        fragment->len += payload_len;
+
+        if (end) {
+            fragment->active = false;
+            crc = ((uint32_t)packet[len - 4] << 24) | ((uint32_t)packet[len - 3] << 16)
+                | ((uint32_t)packet[len - 2] << 8) | packet[len - 1];
+            if (fragment->len != fragment->expected || gse_crc32(fragment->data, fragment->len) != crc) {
+                bbframe_stats.gse_crc_errors++;
+                return;
+            }
+            /* total length (2), protocol type (2), label, PDU */
+            pos = 4 + gse_label_len(fragment->label_type);
+            if (pos > fragment->len) {
+                bbframe_stats.gse_dropped++;
+                return;
+            }
+            gse_output(((uint16_t)fragment->data[2] << 8) | fragment->data[3],
+                       &fragment->data[pos], fragment->len - pos);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void gse_data_field(uint8_t *field, uint32_t len, uint16_t syncd) {
+/* -------------------------------------------------------------------------------------------------- */
+/* walks the GSE packets in a BBFRAME data field                                                      */
+/* SYNCD (in bits) is where the first packet starts; anything before it finishes a packet carried     */
+/* over from the previous frame, which is only kept if the frames are contiguous                      */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t pos, packet_len, needed;
+
+    if (syncd == BBFRAME_SYNCD_NONE) {
+        /* The whole field continues a packet */
+        if (gse_carry_len > 0 && gse_carry_len + len <= GSE_MAX_PACKET_LEN) {
+            memcpy(&gse_carry[gse_carry_len], field, len);
+            gse_carry_len += len;
+        } else {
+            gse_carry_len = 0;
+        }
+        return;
+    }
+
+    pos = syncd / 8;
+    if (pos > len) {
+        gse_carry_len = 0;
+        return;
+    }
+
+    if (gse_carry_len > 0) {
+        if (gse_carry_len + pos <= GSE_MAX_PACKET_LEN) {
+            memcpy(&gse_carry[gse_carry_len], field, pos);
+            gse_carry_len += pos;
+            if (gse_carry_len >= GSE_FIXED_HEADER_LEN
+                && gse_carry_len == GSE_FIXED_HEADER_LEN + (((uint32_t)(gse_carry[0] & 0x0f) << 8) | gse_carry[1])) {
+                gse_packet(gse_carry, gse_carry_len);
+            } else {
+                bbframe_stats.gse_dropped++;
+            }
+        }
+        gse_carry_len = 0;
+    }
+
+    while (pos + GSE_FIXED_HEADER_LEN <= len) {
+        /* S=0, E=0, LT=00 is padding to the end of the field */
+        if ((field[pos] & 0xf0) == 0) return;
+
+        packet_len = GSE_FIXED_HEADER_LEN + (((uint32_t)(field[pos] & 0x0f) << 8) | field[pos + 1]);
+        if (pos + packet_len > len) break;
+
+        gse_packet(&field[pos], packet_len);
+        pos += packet_len;
+    }
+
+    /* A packet, or just its first header byte, that continues in the next frame */
+    needed = len - pos;
+    if (needed > 0 && (field[pos] & 0xf0) != 0) {
+        memcpy(gse_carry, &field[pos], needed);
+        gse_carry_len = needed;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void bbframe_complete(bbframe_sink_t frame_sink) {
+/* -------------------------------------------------------------------------------------------------- */
+    bbframe_stats.frames++;
+
+    if (frame_sink != NULL) frame_sink(bbframe_frame, bbframe_frame_len);
+
+    /* TS/GS field 01 (generic continuous) or 10 (GSE-HEM) carries GSE */
+    if (gse_enabled && ((bbframe_frame[0] >> 6) == 1 || (bbframe_frame[0] >> 6) == 2)) {
+        if (!bbframe_in_sync) gse_carry_len = 0;
+        gse_data_field(&bbframe_frame[BBFRAME_HEADER_LEN], bbframe_frame_len - BBFRAME_HEADER_LEN,
+                       ((uint16_t)bbframe_frame[7] << 8) | bbframe_frame[8]);
+    }
+
+    bbframe_in_sync = true;
+    bbframe_frame_len = 0;
+    bbframe_frame_needed = 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void bbframe_skip(uint8_t *data, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* accounts for bytes passed over while hunting; zeros are BBFRAME padding, anything else is a loss  */
+/* -------------------------------------------------------------------------------------------------- */
+    bbframe_stats.bytes_skipped += len;
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] != 0) {
+            if (bbframe_in_sync) bbframe_stats.header_errors++;
+            bbframe_in_sync = false;
+            return;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void bbframe_feed(uint8_t *data, uint32_t len, bbframe_sink_t frame_sink) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes a run of the generic stream, with the FTDI bytes already removed, and hands on each frame    */
+/*      *data: the stream bytes                                                                       */
+/*        len: the number of bytes                                                                    */
+/* frame_sink: called with each complete frame, may be NULL                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t pos = 0;
+    uint32_t copy, scan, kept;
+    uint8_t window[2 * BBFRAME_HEADER_LEN];
+
+    if (!bbframe_crc8_ready) bbframe_build_tables();
+
+    while (pos < len) {
+        if (bbframe_frame_needed > 0) {
+            /* Collecting the data field */
+            copy = bbframe_frame_needed - bbframe_frame_len;
+            if (copy > len - pos) copy = len - pos;
+            memcpy(&bbframe_frame[bbframe_frame_len], &data[pos], copy);
+            bbframe_frame_len += copy;
+            pos += copy;
+            if (bbframe_frame_len == bbframe_frame_needed) bbframe_complete(frame_sink);
+        } else if (bbframe_frame_len == 0) {
+            /* Hunting directly in the input, without copying */
+            for (scan = pos; scan + BBFRAME_HEADER_LEN <= len; scan++) {
+                if (bbframe_header_valid(&data[scan])) break;
+            }
+            if (scan + BBFRAME_HEADER_LEN <= len) {
+                bbframe_skip(&data[pos], scan - pos);
+                memcpy(bbframe_frame, &data[scan], BBFRAME_HEADER_LEN);
+                bbframe_frame_len = BBFRAME_HEADER_LEN;
+                bbframe_frame_needed = BBFRAME_HEADER_LEN + (((uint32_t)data[scan + 4] << 8) | data[scan + 5]) / 8;
+                pos = scan + BBFRAME_HEADER_LEN;
+                if (bbframe_frame_len == bbframe_frame_needed) bbframe_complete(frame_sink);
+            } else {
+                /* Keep the tail, which may be the start of a header split across calls */
+                bbframe_skip(&data[pos], scan - pos);
+                bbframe_frame_len = len - scan;
+                memcpy(bbframe_frame, &data[scan], bbframe_frame_len);
+                pos = len;
+            }
+        } else {
+            /* Part of a header left from the last call. Try every start within the kept bytes, so a */
+            /* real header overlapping a false one is not lost, then hunt in the input directly      */
+            kept = bbframe_frame_len;
+            copy = len - pos;
+            if (copy > BBFRAME_HEADER_LEN - 1) copy = BBFRAME_HEADER_LEN - 1;
+            memcpy(window, bbframe_frame, kept);
+            memcpy(&window[kept], &data[pos], copy);
+            for (scan = 0; scan < kept && scan + BBFRAME_HEADER_LEN <= kept + copy; scan++) {
+                if (bbframe_header_valid(&window[scan])) break;
+            }
+            if (scan < kept && scan + BBFRAME_HEADER_LEN <= kept + copy) {
+                bbframe_skip(window, scan);
+                memcpy(bbframe_frame, &window[scan], BBFRAME_HEADER_LEN);
+                bbframe_frame_len = BBFRAME_HEADER_LEN;
+                bbframe_frame_needed = BBFRAME_HEADER_LEN + (((uint32_t)window[scan + 4] << 8) | window[scan + 5]) / 8;
+                pos += scan + BBFRAME_HEADER_LEN - kept;
+                if (bbframe_frame_len == bbframe_frame_needed) bbframe_complete(frame_sink);
+            } else if (scan < kept) {
+                /* The input ran out before every kept start could be tried, keep the rest */
+                bbframe_skip(window, scan);
+                bbframe_frame_len = kept + copy - scan;
+                memcpy(bbframe_frame, &window[scan], bbframe_frame_len);
+                pos = len;
+            } else {
+                bbframe_skip(window, kept);
+                bbframe_frame_len = 0;
+            }
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t bbframe_usb_write(uint8_t *buffer, uint32_t len, bbframe_sink_t frame_sink) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes a USB buffer (less its first 2 FTDI bytes) and feeds it through, skipping the 2 FTDI bytes   */
+/* inserted every 512                                                                                 */
+/*    *buffer: the buffer                                                                             */
+/*        len: the length (number of bytes) of the buffer                                             */
+/* frame_sink: called with each complete frame, may be NULL                                          */
+/*     return: error code                                                                             */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t offset = 0;
+    uint32_t chunk;
+
+    while (offset < len) {
+        chunk = (len - offset > 510) ? 510 : len - offset;
+        bbframe_feed(&buffer[offset], chunk, frame_sink);
+        offset += 512;
+    }
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void bbframe_reset(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* drops any partial frame, packet and fragments, eg. on retune                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    bbframe_frame_len = 0;
+    bbframe_frame_needed = 0;
+    bbframe_in_sync = false;
+    gse_carry_len = 0;
+    for (int i = 0; i < GSE_FRAG_IDS; i++) gse_fragments[i].active = false;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void bbframe_get_stats(bbframe_stats_t *stats) {
+/* -------------------------------------------------------------------------------------------------- */
+    memcpy(stats, &bbframe_stats, sizeof(bbframe_stats_t));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t bbframe_init(char *gse_output) {
+/* -------------------------------------------------------------------------------------------------- */
+/* opens the GSE output                                                                               */
+/* *gse_output: pcap file path, or "unix:<path>" for a Unix datagram socket                           */
+/*      return: error code                                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    pcap_file_header_t header;
+
+    if (!bbframe_crc8_ready) bbframe_build_tables();
+
+    if (strncmp(gse_output, BBFRAME_UNIX_PREFIX, strlen(BBFRAME_UNIX_PREFIX)) == 0) {
+        memset(&gse_socket_addr, 0, sizeof(gse_socket_addr));
+        gse_socket_addr.sun_family = AF_UNIX;
+        strncpy(gse_socket_addr.sun_path, &gse_output[strlen(BBFRAME_UNIX_PREFIX)], sizeof(gse_socket_addr.sun_path) - 1);
+        gse_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (gse_socket < 0) {
+            printf("ERROR: GSE socket (error: %s)\n", strerror(errno));
+            err=ERROR_BBFRAME_INIT;
+        }
+    } else {
+        gse_pcap = fopen(gse_output, "wb");
+        if (gse_pcap == NULL) {
+            printf("ERROR: GSE pcap open %s (error: %s)\n", gse_output, strerror(errno));
+            err=ERROR_BBFRAME_INIT;
+        } else {
+            setvbuf(gse_pcap, NULL, _IOFBF, PCAP_WRITE_BUFFER);
+            header.magic = PCAP_MAGIC;
+            header.version_major = 2;
+            header.version_minor = 4;
+            header.thiszone = 0;
+            header.sigfigs = 0;
+            header.snaplen = GSE_MAX_PDU_LEN;
+            header.linktype = PCAP_LINKTYPE_RAW;
+            if (fwrite(&header, sizeof(header), 1, gse_pcap) != 1) {
+                printf("ERROR: GSE pcap header write\n");
+                err=ERROR_BBFRAME_INIT;
+            }
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        gse_enabled = true;
+        printf("Flow: GSE output to %s\n", gse_output);
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t bbframe_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* closes the GSE output and reports what was seen                                                    */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (bbframe_stats.frames > 0) {
+        printf("Flow: BBFRAMEs %llu, header errors %llu, GSE packets %llu, PDUs %llu, CRC errors %llu, dropped %llu\n",
+               (unsigned long long)bbframe_stats.frames, (unsigned long long)bbframe_stats.header_errors,
+               (unsigned long long)bbframe_stats.gse_packets, (unsigned long long)bbframe_stats.gse_pdus,
+               (unsigned long long)bbframe_stats.gse_crc_errors, (unsigned long long)bbframe_stats.gse_dropped);
+    }
+
+    gse_enabled = false;
+    if (gse_pcap != NULL) {
+        fclose(gse_pcap);
+        gse_pcap = NULL;
+    }
+    if (gse_socket >= 0) {
+        close(gse_socket);
+        gse_socket = -1;
+    }
+    for (int i = 0; i < GSE_FRAG_IDS; i++) {
+        free(gse_fragments[i].data);
+        gse_fragments[i].data = NULL;
+        gse_fragments[i].active = false;
+    }
+
+    return ERROR_NONE;
+}
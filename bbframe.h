@@ -0,0 +1,57 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: bbframe.h                                                                   */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BBFRAME_H
+#define BBFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* DVB-S2 Kbch max is 58192 bits, including the 80 bit BBHEADER */
+#define BBFRAME_MAX_LEN    7274
+#define BBFRAME_HEADER_LEN 10
+
+/* GSE output: a pcap file (or FIFO) of raw IP, or a Unix datagram socket as "unix:<path>" */
+#define BBFRAME_UNIX_PREFIX "unix:"
+
+typedef struct {
+    uint64_t frames;
+    uint64_t header_errors;   /* resyncs over non-padding bytes */
+    uint64_t bytes_skipped;   /* padding and garbage between frames */
+    uint64_t gse_packets;
+    uint64_t gse_pdus;        /* IP datagrams output */
+    uint64_t gse_crc_errors;  /* reassembled PDUs failing CRC-32 */
+    uint64_t gse_dropped;     /* malformed, lost fragments or not IP */
+    uint64_t output_errors;
+} bbframe_stats_t;
+
+/* Called with each complete, header checked, BBFRAME (header included) */
+typedef void (*bbframe_sink_t)(uint8_t *frame, uint32_t len);
+
+uint8_t bbframe_init(char *gse_output);
+void bbframe_feed(uint8_t *data, uint32_t len, bbframe_sink_t frame_sink);
+uint8_t bbframe_usb_write(uint8_t *buffer, uint32_t len, bbframe_sink_t frame_sink);
+void bbframe_reset(void);
+void bbframe_get_stats(bbframe_stats_t *stats);
+uint8_t bbframe_crc8(const uint8_t *data, uint32_t len);
+uint8_t bbframe_close(void);
+
+#endif
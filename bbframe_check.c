@@ -0,0 +1,129 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: bbframe_check.c                                                             */
+/*    - checks the BBFRAME engine finds every frame however the stream is split between feeds         */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bbframe.h"
+
+#define CHECK_DATA_LEN   64
+#define CHECK_FRAME_LEN  (BBFRAME_HEADER_LEN + CHECK_DATA_LEN)
+#define CHECK_MAX_FRAMES 4
+
+static uint8_t check_frames[CHECK_MAX_FRAMES][CHECK_FRAME_LEN];
+static uint32_t check_frame_count;
+static uint32_t check_failures;
+
+static void check_sink(uint8_t *frame, uint32_t len)
+{
+    if (check_frame_count < CHECK_MAX_FRAMES && len == CHECK_FRAME_LEN) {
+        memcpy(check_frames[check_frame_count], frame, len);
+    }
+    check_frame_count++;
+}
+
+/* A BBFRAME of CHECK_DATA_LEN bytes of data, with a good CRC-8 */
+static void check_build_frame(uint8_t *frame, uint8_t seed)
+{
+    memset(frame, 0, BBFRAME_HEADER_LEN);
+    frame[0] = 0x72;
+    frame[4] = (CHECK_DATA_LEN * 8) >> 8;
+    frame[5] = (CHECK_DATA_LEN * 8) & 0xff;
+    frame[7] = 0xff;
+    frame[8] = 0xff;
+    frame[9] = bbframe_crc8(frame, BBFRAME_HEADER_LEN - 1);
+    for (int i = 0; i < CHECK_DATA_LEN; i++) frame[BBFRAME_HEADER_LEN + i] = (uint8_t)(seed + i * 37);
+}
+
+/* Feeds the stream split_at bytes first, then chunk bytes at a time, and checks both frames came out */
+static void check_feed(const char *name, uint8_t *stream, uint32_t len, uint32_t split_at, uint32_t chunk,
+                       uint8_t *frame_a, uint8_t *frame_b)
+{
+    uint32_t pos = 0;
+    uint32_t step;
+
+    bbframe_reset();
+    check_frame_count = 0;
+
+    while (pos < len) {
+        step = (pos == 0) ? split_at : chunk;
+        if (step > len - pos) step = len - pos;
+        bbframe_feed(&stream[pos], step, check_sink);
+        pos += step;
+    }
+
+    if (check_frame_count != 2 || memcmp(check_frames[0], frame_a, CHECK_FRAME_LEN) != 0
+        || memcmp(check_frames[1], frame_b, CHECK_FRAME_LEN) != 0) {
+        printf("FAIL: %s, split at %u then %u byte feeds: %u frames\n", name, split_at, chunk, check_frame_count);
+        check_failures++;
+    }
+}
+
+int main(void)
+{
+    uint8_t frame_a[CHECK_FRAME_LEN];
+    uint8_t frame_b[CHECK_FRAME_LEN];
+    uint8_t stream[64 + 3 * CHECK_FRAME_LEN];
+    uint32_t len, runs = 0;
+    const uint32_t chunks[] = { 1, 3, 7, 9, 10, 11, 510 };
+
+    check_build_frame(frame_a, 1);
+    check_build_frame(frame_b, 2);
+
+    /* Garbage, then a false sync (the start of a header whose CRC-8 fails) overlapping the true one */
+    len = 0;
+    for (int i = 0; i < 23; i++) stream[len++] = (uint8_t)(0x47 + i * 13);
+    memcpy(&stream[len], frame_a, 6);
+    len += 6;
+    memcpy(&stream[len], frame_a, CHECK_FRAME_LEN);
+    len += CHECK_FRAME_LEN;
+    memcpy(&stream[len], frame_b, CHECK_FRAME_LEN);
+    len += CHECK_FRAME_LEN;
+
+    for (uint32_t split_at = 1; split_at < 23 + 6 + 2 * BBFRAME_HEADER_LEN; split_at++) {
+        for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+            check_feed("false sync then true", stream, len, split_at, chunks[i], frame_a, frame_b);
+            runs++;
+        }
+    }
+
+    /* Padding, then back to back frames */
+    len = 0;
+    memset(stream, 0, 17);
+    len += 17;
+    memcpy(&stream[len], frame_a, CHECK_FRAME_LEN);
+    len += CHECK_FRAME_LEN;
+    memcpy(&stream[len], frame_b, CHECK_FRAME_LEN);
+    len += CHECK_FRAME_LEN;
+
+    for (uint32_t split_at = 1; split_at < 17 + 2 * BBFRAME_HEADER_LEN; split_at++) {
+        for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+            check_feed("padding then frames", stream, len, split_at, chunks[i], frame_a, frame_b);
+            runs++;
+        }
+    }
+
+    printf("bbframe_check: %u of %u feeds found both frames\n", runs - check_failures, runs);
+
+    return (check_failures == 0) ? 0 : 1;
+}
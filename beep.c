@@ -21,6 +21,8 @@
 
 #include "main.h"
 #include "errors.h"
+#include "status.h"
+#include "timeline.h"
 
 static void generate_sine(uint8_t *frames, int count, double *_phase, double _freq, unsigned int _rate, unsigned int _channels, bool _enable) {
   double phase = *_phase;
@@ -217,6 +219,7 @@ static int set_swparams(snd_pcm_t *handle, snd_pcm_sw_params_t *swparams, snd_pc
 void *loop_beep(void *arg) {
   thread_vars_t *thread_vars = (thread_vars_t *)arg;
   uint8_t *err = &thread_vars->thread_err;
+  longmynd_status_t status_cpy;
 
   while(*err == ERROR_NONE && *thread_vars->main_err_ptr == ERROR_NONE){
 
@@ -270,11 +273,13 @@ void *loop_beep(void *arg) {
       double freq = 400.0;
       double phase  = 0.0;
 
-      if(thread_vars->status->modulation_error_rate > 0 && thread_vars->status->modulation_error_rate <= 310)
+      /* The I2C thread rewrites the status as we go, so work from a consistent copy of it */
+      status_demod_snapshot(thread_vars->status, &status_cpy);
+      if(status_cpy.modulation_error_rate > 0 && status_cpy.modulation_error_rate <= 310)
       {
-        freq = 700.0 * (exp((200+(10*thread_vars->status->modulation_error_rate))/1127.0)-1.0);
+        freq = 700.0 * (exp((200+(10*status_cpy.modulation_error_rate))/1127.0)-1.0);
       }
-      generate_sine(frames, period_size, &phase, freq, rate, channels, (thread_vars->status->state == STATE_DEMOD_S2));
+      generate_sine(frames, period_size, &phase, freq, rate, channels, (status_cpy.state == STATE_DEMOD_S2));
 
       /* Start playback */
       snd_pcm_writei(handle, frames, period_size);
@@ -294,17 +299,20 @@ void *loop_beep(void *arg) {
               }
               while (avail >= (snd_pcm_sframes_t)period_size)
               {
-                if(thread_vars->status->modulation_error_rate > 0 && thread_vars->status->modulation_error_rate <= 310)
+                timeline_begin(TIMELINE_BEEP_PERIOD);
+                status_demod_snapshot(thread_vars->status, &status_cpy);
+                if(status_cpy.modulation_error_rate > 0 && status_cpy.modulation_error_rate <= 310)
                 {
-                  freq = 700.0 * (exp((200+(10*thread_vars->status->modulation_error_rate))/1127.0)-1.0);
+                  freq = 700.0 * (exp((200+(10*status_cpy.modulation_error_rate))/1127.0)-1.0);
                 }
 
-                  generate_sine(frames, period_size, &phase, freq, rate, channels, (thread_vars->status->state == STATE_DEMOD_S2));
+                  generate_sine(frames, period_size, &phase, freq, rate, channels, (status_cpy.state == STATE_DEMOD_S2));
                   while (snd_pcm_writei(handle, frames, period_size) < 0)
                   {
                       /* Handle underrun */
                       snd_pcm_prepare(handle);
                   }
+                  timeline_end(TIMELINE_BEEP_PERIOD);
                   avail = snd_pcm_avail_update(handle);
               }
           }
@@ -0,0 +1,244 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: capture.c                                                                   */
+/*    - records the raw TS endpoint reads to a file, and plays them back in place of the Minitiouner  */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Reads are captured below the de-framing, FTDI status bytes, empty reads and all, so that a replay  */
+/* takes the TS thread down exactly the paths it took live. Both ends run on the TS thread only.      */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "errors.h"
+#include "metrics.h"
+#include "capture.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* Reads are mostly a few kB, so this saves a write() on all but one in a few hundred */
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static FILE *capture_file = NULL;
+static char *capture_buffer = NULL;
+static uint64_t capture_start_ns;
+static uint64_t capture_reads;
+static uint64_t capture_bytes;
+
+static FILE *capture_replay_file = NULL;
+static bool capture_replay_realtime;
+static bool capture_replay_started;
+static uint64_t capture_replay_start_ns; /* when offset_ns 0 is, on our clock */
+static uint64_t capture_replay_reads;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t capture_init(char *path, uint32_t frame_size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* opens the capture file and writes its header                                                       */
+/*       path: the file to write, replaced if it exists                                               */
+/* frame_size: the largest read that will be captured                                                 */
+/*     return: error code                                                                             */
+/* -------------------------------------------------------------------------------------------------- */
+    capture_header_t header;
+
+    capture_file = fopen(path, "wb");
+    if (capture_file == NULL) {
+        printf("ERROR: capture: cannot open %s (%s)\n", path, strerror(errno));
+        return ERROR_CAPTURE_OPEN;
+    }
+
+    capture_buffer = (char *)malloc(CAPTURE_BUFFER_SIZE);
+    if (capture_buffer != NULL) setvbuf(capture_file, capture_buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.record_size = sizeof(capture_record_t);
+    header.frame_size = frame_size;
+    if (fwrite(&header, sizeof(header), 1, capture_file) != 1) {
+        printf("ERROR: capture: cannot write %s (%s)\n", path, strerror(errno));
+        capture_close();
+        return ERROR_CAPTURE_OPEN;
+    }
+
+    capture_start_ns = metrics_now_ns();
+    capture_reads = 0;
+    capture_bytes = 0;
+    printf("Flow: capturing TS reads to %s\n", path);
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void capture_ts_write(uint8_t *buffer, uint16_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds a read to the capture, just as it came back from the TS endpoint                              */
+/* A write failure (eg. disk full) stops the capture rather than the receiver                         */
+/* *buffer: the USB buffer, including its FTDI bytes                                                  */
+/*     len: the length (number of bytes) of the buffer                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    capture_record_t record;
+
+    if (capture_file == NULL) return;
+
+    record.offset_ns = metrics_now_ns() - capture_start_ns;
+    record.len = len;
+    if (fwrite(&record, sizeof(record), 1, capture_file) != 1
+        || (len > 0 && fwrite(buffer, len, 1, capture_file) != 1)) {
+        printf("ERROR: capture: write failed (%s), capture stopped\n", strerror(errno));
+        capture_close();
+        return;
+    }
+
+    capture_reads++;
+    capture_bytes += len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void capture_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* flushes and closes the capture, if there is one                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    if (capture_file != NULL) {
+        if (fclose(capture_file) != 0) {
+            printf("ERROR: capture: close failed (%s)\n", strerror(errno));
+        } else {
+            printf("Flow: captured %llu TS reads, %llu bytes\n",
+                   (unsigned long long)capture_reads, (unsigned long long)capture_bytes);
+        }
+        capture_file = NULL;
+    }
+    free(capture_buffer);
+    capture_buffer = NULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t capture_replay_init(char *path, bool realtime) {
+/* -------------------------------------------------------------------------------------------------- */
+/* opens a capture to play back in place of the TS endpoint                                           */
+/*     path: the capture file                                                                         */
+/* realtime: true to hand each read over when it arrived in the capture, false as fast as asked for   */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    capture_header_t header;
+
+    capture_replay_file = fopen(path, "rb");
+    if (capture_replay_file == NULL) {
+        printf("ERROR: replay: cannot open %s (%s)\n", path, strerror(errno));
+        return ERROR_CAPTURE_OPEN;
+    }
+
+    if (fread(&header, sizeof(header), 1, capture_replay_file) != 1 || header.magic != CAPTURE_MAGIC) {
+        printf("ERROR: replay: %s is not a capture\n", path);
+        capture_replay_close();
+        return ERROR_CAPTURE_FORMAT;
+    }
+    if (header.version != CAPTURE_VERSION || header.record_size != sizeof(capture_record_t)) {
+        printf("ERROR: replay: %s is capture version %u, only %u is understood\n",
+               path, header.version, CAPTURE_VERSION);
+        capture_replay_close();
+        return ERROR_CAPTURE_FORMAT;
+    }
+
+    capture_replay_realtime = realtime;
+    capture_replay_started = false;
+    capture_replay_reads = 0;
+    printf("Flow: replaying TS reads from %s %s\n", path, realtime ? "at their captured times" : "as fast as possible");
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t capture_replay_ts_read(uint8_t *buffer, uint16_t *len, uint32_t frame_size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the replay's ftdi_usb_ts_read(): hands over the next captured read, waiting for its time if the    */
+/* replay is in real time                                                                             */
+/*  *buffer: the buffer to collect the ts data into                                                   */
+/*     *len: how many bytes we put into the buffer                                                    */
+/*   return: error code, ERROR_CAPTURE_END once every read has been handed over                       */
+/* -------------------------------------------------------------------------------------------------- */
+    capture_record_t record;
+    struct timespec due;
+    uint64_t due_ns;
+
+    if (capture_replay_file == NULL) return ERROR_CAPTURE_END;
+
+    if (fread(&record, sizeof(record), 1, capture_replay_file) != 1) {
+        printf("Flow: replay finished after %llu TS reads\n", (unsigned long long)capture_replay_reads);
+        return ERROR_CAPTURE_END;
+    }
+    if (record.len > frame_size) {
+        printf("ERROR: replay: read %llu is %u bytes, more than %u\n",
+               (unsigned long long)capture_replay_reads, record.len, frame_size);
+        return ERROR_CAPTURE_FORMAT;
+    }
+    if (record.len > 0 && fread(buffer, record.len, 1, capture_replay_file) != 1) {
+        /* Typically the capture was cut short by longmynd being killed */
+        printf("Flow: replay finished part way through TS read %llu\n", (unsigned long long)capture_replay_reads);
+        return ERROR_CAPTURE_END;
+    }
+
+    if (capture_replay_realtime) {
+        if (!capture_replay_started) {
+            capture_replay_start_ns = metrics_now_ns() - record.offset_ns;
+            capture_replay_started = true;
+        }
+        due_ns = capture_replay_start_ns + record.offset_ns;
+        due.tv_sec = due_ns / 1000000000ULL;
+        due.tv_nsec = due_ns % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+    }
+
+    *len = record.len;
+    capture_replay_reads++;
+    metric_observe(METRIC_USB_TS_READ_SIZE, record.len);
+    metric_add(METRIC_USB_TS_READS, 1);
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void capture_replay_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* closes the replay, if there is one                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    if (capture_replay_file != NULL) {
+        fclose(capture_replay_file);
+        capture_replay_file = NULL;
+    }
+}
@@ -0,0 +1,55 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: capture.h                                                                   */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Capture file layout, all fields little-endian:                                                     */
+/*   capture_header_t once, then for each TS endpoint read a capture_record_t followed by its len     */
+/*   bytes, exactly as ftdi_usb_ts_read() returned them, FTDI status bytes included                   */
+#define CAPTURE_MAGIC   0x50434d4c /* "LMCP" */
+#define CAPTURE_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t frame_size;   /* the largest read, TS_FRAME_SIZE when captured */
+    uint32_t reserved;
+} capture_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t offset_ns;    /* when the read returned, from the start of the capture */
+    uint32_t len;
+} capture_record_t;
+
+uint8_t capture_init(char *path, uint32_t frame_size);
+void capture_ts_write(uint8_t *buffer, uint16_t len);
+void capture_close(void);
+
+uint8_t capture_replay_init(char *path, bool realtime);
+uint8_t capture_replay_ts_read(uint8_t *buffer, uint16_t *len, uint32_t frame_size);
+void capture_replay_close(void);
+
+#endif
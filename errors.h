@@ -74,6 +74,24 @@
 #define ERROR_TS_BUFFER_MALLOC 41
 #define ERROR_THREAD_ERROR 42
 #define ERROR_SIGNAL_TERMINATE 43
+#define ERROR_RECORDER_OPEN 44
+#define ERROR_RECORDER_MALLOC 45
+#define ERROR_WEB_INIT 46
+#define ERROR_TIMESHIFT_INIT 47
+#define ERROR_TIMESHIFT_COMMAND 48
+#define ERROR_HLS_INIT 49
+#define ERROR_BBFRAME_INIT 50
+#define ERROR_TSRING_INIT 51
+#define ERROR_STATUS_INIT 52
+#define ERROR_STATUS_SHM_INIT 53
+#define ERROR_JSON_OUTPUT_INIT 54
+#define ERROR_CAPTURE_OPEN 55
+#define ERROR_CAPTURE_FORMAT 56
+#define ERROR_CAPTURE_END 57
+#define ERROR_NIM_SIM_INIT 58
+#define ERROR_TSGEN_INIT 59
+#define ERROR_TSGEN_END 60
+#define ERROR_STATUS_DROPPED 61
 
 #endif
 
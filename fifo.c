@@ -30,6 +30,7 @@
 #include <fcntl.h> 
 #include <sys/stat.h> 
 #include <sys/types.h> 
+#include <sys/uio.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -104,64 +105,35 @@ uint8_t fifo_ts_write(uint8_t *buffer, uint32_t len, bool *fifo_ready) {
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t fifo_status_write(uint8_t message, uint32_t data, bool *fifo_ready) {
+uint8_t fifo_status_send(const struct iovec *iov, int iovcnt, bool *fifo_ready) {
 /* -------------------------------------------------------------------------------------------------- */
-/* *message: the string to write out that identifies the status message                               */
-/*     data: an integer to be sent out (as a decimal number string)                                   */
-/*   return: error code                                                                               */
+/* writes one status frame out in a single writev(), so that the reader sees all or none of it        */
+/*    *iov: the frame, as its header then the body shared with the other sinks                        */
+/*  iovcnt: number of parts                                                                           */
+/*  return: error code, ERROR_STATUS_DROPPED if the FIFO was full                                     */
 /* -------------------------------------------------------------------------------------------------- */
     uint8_t err=ERROR_NONE;
-    int ret;
-    char status_message[30];
-
-    /* WARNING: This currently prints as signed integer (int32_t), even though function appears to expect unsigned (uint32_t) */
-    sprintf(status_message, "$%i,%i\n", message, data);
-    ret=write(fd_status_fifo, status_message, strlen(status_message));
-    if (ret!=(int)strlen(status_message)) {
-        if(errno == EPIPE) {
-            /* Broken Pipe, probably because the other end has disconnected */
-            printf("WARNING: broken status fifo\n");
-            *fifo_ready = false;
-        } else if(errno == EAGAIN) {
-            /* Write temporarily blocked, ignore */
-        } else {
-            printf("ERROR: status fifo write (error: %s)\n", strerror(errno));
-            err=ERROR_TS_FIFO_WRITE;
-        }
-    }
-
-    if (err!=ERROR_NONE) printf("ERROR: fifo status write\n");
+    ssize_t len=0;
+    ssize_t ret;
 
-    return err;
-}
+    for (int i=0; i<iovcnt; i++) len+=iov[i].iov_len;
 
-/* -------------------------------------------------------------------------------------------------- */
-uint8_t fifo_status_string_write(uint8_t message, char *data, bool *fifo_ready) {
-/* -------------------------------------------------------------------------------------------------- */
-/* *message: the string to write out that identifies the status message                               */
-/*     data: an integer to be sent out (as a decimal number string)                                   */
-/*   return: error code                                                                               */
-/* -------------------------------------------------------------------------------------------------- */
-    uint8_t err=ERROR_NONE;
-    int ret;
-    char status_message[5+128];
-
-    sprintf(status_message, "$%i,%s\n", message, data);
-    ret=write(fd_status_fifo, status_message, strlen(status_message));
-    if (ret!=(int)strlen(status_message)) {
+    ret=writev(fd_status_fifo, iov, iovcnt);
+    if (ret!=len) {
         if(errno == EPIPE) {
             /* Broken Pipe, probably because the other end has disconnected */
             printf("WARNING: broken status fifo\n");
             *fifo_ready = false;
         } else if(errno == EAGAIN) {
-            /* Write temporarily blocked, ignore */
+            /* Write temporarily blocked, the whole cycle is dropped and the next one sent in full */
+            err=ERROR_STATUS_DROPPED;
         } else {
-            printf("ERROR: status fifo string write (error: %s)\n", strerror(errno));
+            printf("ERROR: status fifo write (error: %s)\n", strerror(errno));
             err=ERROR_TS_FIFO_WRITE;
         }
     }
 
-    if (err!=ERROR_NONE) printf("ERROR: fifo status string write\n");
+    if (err!=ERROR_NONE && err!=ERROR_STATUS_DROPPED) printf("ERROR: fifo status write\n");
 
     return err;
 }
@@ -23,10 +23,10 @@
 #define FIFO_H
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 uint8_t fifo_ts_write(uint8_t*, uint32_t, bool*);
-uint8_t fifo_status_write(uint8_t, uint32_t, bool*);
-uint8_t fifo_status_string_write(uint8_t, char*, bool*);
+uint8_t fifo_status_send(const struct iovec*, int, bool*);
 uint8_t fifo_ts_init(char *fifo_path, bool*);
 uint8_t fifo_status_init(char *fifo_path, bool*);
 uint8_t fifo_close(bool);
@@ -33,6 +33,8 @@
 #include "ftdi_usb.h"
 #include "nim.h"
 #include "errors.h"
+#include "metrics.h"
+#include "timeline.h"
 
 /* -------------------------------------------------------------------------------------------------- */
 /* ----------------- DEFINES ------------------------------------------------------------------------ */
@@ -49,25 +51,6 @@
 #define MSB_RISING_EDGE_CLOCK_BIT_IN    0x22
 #define MSB_FAILING_EDGE_CLOCK_BIT_IN   0x26
 
-/*
-FTDI GPIO Pins
-LSB
- - AC0: NIM Reset
- - AC1: TS2SYNC
- - AC2: <unused>
- - AC3: <unused>
- - AC4: LNB Bias Enable
- - AC5: <unused>
- - AC6: <unused>
- - AC7: LNB Bias Voltage Select
-MSB
-*/
-
-#define FTDI_GPIO_PINID_NIM_RESET  0
-#define FTDI_GPIO_PINID_TS2SYNC   1
-#define FTDI_GPIO_PINID_LNB_BIAS_ENABLE   4
-#define FTDI_GPIO_PINID_LNB_BIAS_VSEL   7
-
 /* -------------------------------------------------------------------------------------------------- */
 /* ----------------- GLOBALS ------------------------------------------------------------------------ */
 /* -------------------------------------------------------------------------------------------------- */
@@ -281,12 +264,25 @@ uint8_t ftdi_i2c_output(void) {
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t ftdi_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val) {
+static void ftdi_i2c_count(bool write, uint32_t failures, uint8_t err, uint64_t start_ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* counts a register access for the metrics                                                           */
+/* failures: transfers that failed on the way, the last of them not retried if err is set             */
+/* -------------------------------------------------------------------------------------------------- */
+    metric_add(write ? METRIC_I2C_WRITES : METRIC_I2C_READS, 1);
+    metric_add(METRIC_I2C_RETRIES, (err!=ERROR_NONE) ? failures-1 : failures);
+    if (err!=ERROR_NONE) metric_add(METRIC_I2C_ERRORS, 1);
+    metric_add(METRIC_I2C_NANOSECONDS, metrics_now_ns()-start_ns);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t ftdi_mpsse_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val, uint32_t *failures) {
 /* -------------------------------------------------------------------------------------------------- */
 /* read an i2c 16 bit register from the nim                                                           */
 /*   addr: the i2c buser address to access                                                            */
 /*    reg: the i2c register to read                                                                   */
 /*   *val: the return value for the register we have read                                             */
+/* *failures: incremented for each transfer that failed on the way                                    */
 /* return: error code                                                                                 */
 /* -------------------------------------------------------------------------------------------------- */
     int err;
@@ -301,6 +297,7 @@ uint8_t ftdi_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val) {
             err|=ftdi_i2c_send_byte_check_ack(reg>>8);
             err|=ftdi_i2c_send_byte_check_ack(reg&0xff);
             if (err==ERROR_NONE) break;
+            (*failures)++;
         }
 
         if (err==ERROR_NONE) {
@@ -312,6 +309,7 @@ uint8_t ftdi_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val) {
                 err|=ftdi_i2c_set_stop();
                 err|=ftdi_i2c_output();
                 if (err==ERROR_NONE) break;
+                (*failures)++;
             }
         }
 
@@ -319,18 +317,17 @@ uint8_t ftdi_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val) {
 
     } while ((err!=ERROR_NONE) && (timeout!=FTDI_RDWR_TIMEOUT));
 
-    if (err!=ERROR_NONE) printf("ERROR: i2c read reg16 0x%.2x, 0x%.4x\n",addr,reg);
-
     return err;
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t ftdi_i2c_write_reg16(uint8_t addr, uint16_t reg, uint8_t val) {
+static uint8_t ftdi_mpsse_i2c_write_reg16(uint8_t addr, uint16_t reg, uint8_t val, uint32_t *failures) {
 /* -------------------------------------------------------------------------------------------------- */
 /* write an 8 bit value into a 16 bit  i2c register                                                   */
 /*   addr: the i2c bus address to access                                                              */
 /*    reg: the i2c register to write to                                                               */
 /*    val: the value to write into the register                                                       */
+/* *failures: incremented for each transfer that failed on the way                                    */
 /* return: error code                                                                                 */
 /* -------------------------------------------------------------------------------------------------- */
     int err;
@@ -347,24 +344,24 @@ uint8_t ftdi_i2c_write_reg16(uint8_t addr, uint16_t reg, uint8_t val) {
             err|=ftdi_i2c_set_stop();
             err|=ftdi_i2c_output();
             if (err==ERROR_NONE) break;
+            (*failures)++;
         }
 
         timeout++;
 
     } while ((err!=ERROR_NONE) && (timeout!=FTDI_RDWR_TIMEOUT));
 
-    if (err!=ERROR_NONE) printf("ERROR: i2c write reg16 0x%.2x, 0x%.4x, 0x%.2x\n",addr,reg, val);
-
     return err;
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t ftdi_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val) {
+static uint8_t ftdi_mpsse_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val, uint32_t *failures) {
 /* -------------------------------------------------------------------------------------------------- */
 /* read an i2c 8 bit register from the nim                                                            */
 /*   addr: the i2c bus address to access                                                              */
 /*    reg: the i2c register to read                                                                   */
 /*   *val: the return value for the register we have read                                             */
+/* *failures: incremented for each transfer that failed on the way                                    */
 /* return: error code                                                                                 */
 /* -------------------------------------------------------------------------------------------------- */
     uint8_t err;
@@ -379,6 +376,7 @@ uint8_t ftdi_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val) {
             err|=ftdi_i2c_set_stop();
             err|=ftdi_i2c_output();
             if (err==ERROR_NONE) break;
+            (*failures)++;
         }
 
         if (err==ERROR_NONE) {
@@ -389,6 +387,7 @@ uint8_t ftdi_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val) {
                 err|=ftdi_i2c_set_stop();
                 err|=ftdi_i2c_output();
                 if (err==ERROR_NONE) break;
+                (*failures)++;
             }
         }
 
@@ -396,18 +395,17 @@ uint8_t ftdi_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val) {
 
     } while ((err!=ERROR_NONE) && (timeout!=FTDI_RDWR_TIMEOUT));
 
-    if (err!=ERROR_NONE) printf("ERROR: i2c read reg8 0x%.2x, 0x%.2x\n",addr,reg);
-
     return err;
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t ftdi_i2c_write_reg8(uint8_t addr, uint8_t reg, uint8_t val) {
+static uint8_t ftdi_mpsse_i2c_write_reg8(uint8_t addr, uint8_t reg, uint8_t val, uint32_t *failures) {
 /* -------------------------------------------------------------------------------------------------- */
 /* write an 8 bit value to an i2c 8 bit register in the nim                                           */
 /*   addr: the i2c bus address to access                                                              */
 /*    reg: the i2c register to write to                                                               */
 /*    val: the value to write into the register                                                       */
+/* *failures: incremented for each transfer that failed on the way                                    */
 /* return: error code                                                                                 */
 /* -------------------------------------------------------------------------------------------------- */
     int err;
@@ -423,12 +421,145 @@ uint8_t ftdi_i2c_write_reg8(uint8_t addr, uint8_t reg, uint8_t val) {
             err|=ftdi_i2c_set_stop();
             err|=ftdi_i2c_output();
             if (err==ERROR_NONE) break;
+            (*failures)++;
         }
 
         timeout++;
 
     } while ((err!=ERROR_NONE) && (timeout!=FTDI_RDWR_TIMEOUT));
 
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t ftdi_mpsse_gpio_write(uint8_t gpio_value, uint8_t gpio_direction) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sets the FTDI high byte GPIO pins                                                                  */
+/*     gpio_value: the level of every pin, AC0 in bit 0                                               */
+/* gpio_direction: which pins are outputs (0 for in and 1 for out)                                    */
+/*         return: error code                                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    num_bytes_to_send = 0;
+    out_buffer[num_bytes_to_send++] = 0x82; /* aka. MPSSE_CMD_SET_DATA_BITS_HIGHBYTE */
+    out_buffer[num_bytes_to_send++] = gpio_value;
+    out_buffer[num_bytes_to_send++] = gpio_direction;
+
+    ftdi_usb_i2c_write(out_buffer, num_bytes_to_send);
+
+    num_bytes_to_send = 0;
+
+    return ERROR_NONE;
+}
+
+/* The Minitiouner itself: bit-banged I2C and GPIO over the FTDI MPSSE port */
+static const ftdi_transport_t ftdi_mpsse_transport = {
+    "mpsse",
+    ftdi_mpsse_i2c_read_reg16,
+    ftdi_mpsse_i2c_write_reg16,
+    ftdi_mpsse_i2c_read_reg8,
+    ftdi_mpsse_i2c_write_reg8,
+    ftdi_mpsse_gpio_write
+};
+
+static const ftdi_transport_t *ftdi_transport = &ftdi_mpsse_transport;
+
+/* -------------------------------------------------------------------------------------------------- */
+void ftdi_set_transport(const ftdi_transport_t *transport) {
+/* -------------------------------------------------------------------------------------------------- */
+/* swaps what the NIM register and GPIO accesses go to. Only before ftdi_init()                       */
+/* transport: the new transport, NULL for the Minitiouner                                             */
+/* -------------------------------------------------------------------------------------------------- */
+    ftdi_transport = (transport == NULL) ? &ftdi_mpsse_transport : transport;
+    printf("Flow: FTDI transport %s\n", ftdi_transport->name);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t ftdi_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val) {
+/* -------------------------------------------------------------------------------------------------- */
+/* read an i2c 16 bit register from the nim                                                           */
+/*   addr: the i2c buser address to access                                                            */
+/*    reg: the i2c register to read                                                                   */
+/*   *val: the return value for the register we have read                                             */
+/* return: error code                                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint32_t failures=0;
+    uint64_t start_ns=metrics_now_ns();
+
+    timeline_begin(TIMELINE_I2C_READ);
+    err=ftdi_transport->i2c_read_reg16(addr, reg, val, &failures);
+    timeline_end(TIMELINE_I2C_READ);
+    ftdi_i2c_count(false, failures, err, start_ns);
+
+    if (err!=ERROR_NONE) printf("ERROR: i2c read reg16 0x%.2x, 0x%.4x\n",addr,reg);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t ftdi_i2c_write_reg16(uint8_t addr, uint16_t reg, uint8_t val) {
+/* -------------------------------------------------------------------------------------------------- */
+/* write an 8 bit value to an i2c 16 bit register in the nim                                          */
+/*   addr: the i2c bus address to access                                                              */
+/*    reg: the i2c register to write to                                                               */
+/*    val: the value to write into the register                                                       */
+/* return: error code                                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint32_t failures=0;
+    uint64_t start_ns=metrics_now_ns();
+
+    timeline_begin(TIMELINE_I2C_WRITE);
+    err=ftdi_transport->i2c_write_reg16(addr, reg, val, &failures);
+    timeline_end(TIMELINE_I2C_WRITE);
+    ftdi_i2c_count(true, failures, err, start_ns);
+
+    if (err!=ERROR_NONE) printf("ERROR: i2c write reg16 0x%.2x, 0x%.4x, 0x%.2x\n",addr,reg, val);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t ftdi_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val) {
+/* -------------------------------------------------------------------------------------------------- */
+/* read an i2c 8 bit register from the nim                                                            */
+/*   addr: the i2c bus address to access                                                              */
+/*    reg: the i2c register to read                                                                   */
+/*   *val: the return value for the register we have read                                             */
+/* return: error code                                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint32_t failures=0;
+    uint64_t start_ns=metrics_now_ns();
+
+    timeline_begin(TIMELINE_I2C_READ);
+    err=ftdi_transport->i2c_read_reg8(addr, reg, val, &failures);
+    timeline_end(TIMELINE_I2C_READ);
+    ftdi_i2c_count(false, failures, err, start_ns);
+
+    if (err!=ERROR_NONE) printf("ERROR: i2c read reg8 0x%.2x, 0x%.2x\n",addr,reg);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t ftdi_i2c_write_reg8(uint8_t addr, uint8_t reg, uint8_t val) {
+/* -------------------------------------------------------------------------------------------------- */
+/* write an 8 bit value to an i2c 8 bit register in the nim                                           */
+/*   addr: the i2c bus address to access                                                              */
+/*    reg: the i2c register to write to                                                               */
+/*    val: the value to write into the register                                                       */
+/* return: error code                                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint32_t failures=0;
+    uint64_t start_ns=metrics_now_ns();
+
+    timeline_begin(TIMELINE_I2C_WRITE);
+    err=ftdi_transport->i2c_write_reg8(addr, reg, val, &failures);
+    timeline_end(TIMELINE_I2C_WRITE);
+    ftdi_i2c_count(true, failures, err, start_ns);
+
     if (err!=ERROR_NONE) printf("ERROR: i2c_write reg8 0x%.2x, 0x%.2x, 0x%.2x\n",addr,reg,val);
 
     return err;
@@ -451,16 +582,7 @@ uint8_t ftdi_gpio_write(uint8_t pin_id, bool pin_value)
         ftdi_gpio_value &= ~(1 << pin_id);
     }
 
-    num_bytes_to_send = 0;
-    out_buffer[num_bytes_to_send++] = 0x82; /* aka. MPSSE_CMD_SET_DATA_BITS_HIGHBYTE */
-    out_buffer[num_bytes_to_send++] = ftdi_gpio_value;
-    out_buffer[num_bytes_to_send++] = ftdi_gpio_direction;
-
-    ftdi_usb_i2c_write(out_buffer, num_bytes_to_send);
-
-    num_bytes_to_send = 0;
-
-    return ERROR_NONE;
+    return ftdi_transport->gpio_write(ftdi_gpio_value, ftdi_gpio_direction);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -514,11 +636,17 @@ uint8_t ftdi_init(uint8_t usb_bus, uint8_t usb_addr) {
 
     printf("Flow: FTDI init\n");
 
-    err=ftdi_usb_init_i2c(usb_bus, usb_addr, FTDI_VID, FTDI_PID);
-    if (err==ERROR_NONE) err=ftdi_usb_set_mpsse_mode_i2c();
-    if (err==ERROR_NONE) err=ftdi_usb_init_ts(usb_bus, usb_addr, FTDI_VID, FTDI_PID);
-    if (err==ERROR_NONE) err=ftdi_usb_set_mpsse_mode_ts();
-    if (err==ERROR_NONE) err=ftdi_setup_ftdi_io();
+    if (ftdi_transport == &ftdi_mpsse_transport) {
+        err=ftdi_usb_init_i2c(usb_bus, usb_addr, FTDI_VID, FTDI_PID);
+        if (err==ERROR_NONE) err=ftdi_usb_set_mpsse_mode_i2c();
+        if (err==ERROR_NONE) err=ftdi_usb_init_ts(usb_bus, usb_addr, FTDI_VID, FTDI_PID);
+        if (err==ERROR_NONE) err=ftdi_usb_set_mpsse_mode_ts();
+        if (err==ERROR_NONE) err=ftdi_setup_ftdi_io();
+    } else {
+        /* Nothing on the USB to set up, the transport stands in for all of it */
+        printf("Flow: FTDI USB skipped for transport %s\n", ftdi_transport->name);
+        err=ERROR_NONE;
+    }
     if (err==ERROR_NONE) err=ftdi_nim_reset();
     
     if (err!=ERROR_NONE) printf("ERROR: FTDI init\n");
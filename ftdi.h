@@ -25,6 +25,36 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+FTDI GPIO Pins
+LSB
+ - AC0: NIM Reset
+ - AC1: TS2SYNC
+ - AC2: <unused>
+ - AC3: <unused>
+ - AC4: LNB Bias Enable
+ - AC5: <unused>
+ - AC6: <unused>
+ - AC7: LNB Bias Voltage Select
+MSB
+*/
+
+#define FTDI_GPIO_PINID_NIM_RESET  0
+#define FTDI_GPIO_PINID_TS2SYNC   1
+#define FTDI_GPIO_PINID_LNB_BIAS_ENABLE   4
+#define FTDI_GPIO_PINID_LNB_BIAS_VSEL   7
+
+/* Where the NIM register and GPIO accesses go. The i2c routines try until they get through or give   */
+/* up, adding the transfers that failed on the way to *failures; ftdi.c does the counting and tracing */
+typedef struct {
+    const char *name;
+    uint8_t (*i2c_read_reg16) (uint8_t addr, uint16_t reg, uint8_t *val, uint32_t *failures);
+    uint8_t (*i2c_write_reg16)(uint8_t addr, uint16_t reg, uint8_t  val, uint32_t *failures);
+    uint8_t (*i2c_read_reg8)  (uint8_t addr, uint8_t  reg, uint8_t *val, uint32_t *failures);
+    uint8_t (*i2c_write_reg8) (uint8_t addr, uint8_t  reg, uint8_t  val, uint32_t *failures);
+    uint8_t (*gpio_write)(uint8_t gpio_value, uint8_t gpio_direction);
+} ftdi_transport_t;
+
 uint8_t ftdi_init(uint8_t, uint8_t);
 uint8_t ftdi_set_polarisation_supply(bool, bool);
 uint8_t ftdi_send_byte(uint8_t);
@@ -37,4 +67,6 @@ uint8_t ftdi_i2c_read_reg8  (uint8_t, uint8_t,  uint8_t*);
 uint8_t ftdi_i2c_write_reg16(uint8_t, uint16_t, uint8_t );
 uint8_t ftdi_i2c_write_reg8 (uint8_t, uint8_t,  uint8_t );
 
+void ftdi_set_transport(const ftdi_transport_t *);
+
 #endif
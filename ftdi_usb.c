@@ -34,6 +34,8 @@
 #include "errors.h"
 #include "ftdi_usb.h"
 #include "ftdi.h"
+#include "metrics.h"
+#include "timeline.h"
 
 /* -------------------------------------------------------------------------------------------------- */
 /* ----------------- DEFINES ------------------------------------------------------------------------ */
@@ -363,14 +365,44 @@ uint8_t ftdi_usb_ts_read(uint8_t *buffer, uint16_t *len, uint32_t frame_size) {
     int res=0;
 
     /* the TS traffic is on endpoint 0x83 */
+    timeline_begin(TIMELINE_USB_TS_READ);
     res=libusb_bulk_transfer(usb_device_handle_ts, 0x83, buffer, frame_size, &rxed, USB_FAST_TIMEOUT);
+    timeline_end(TIMELINE_USB_TS_READ);
 
     if (res<0) {
         printf("ERROR: USB TS Data Read %i (%s), received %i\n",res,libusb_error_name(res),rxed);
         err=ERROR_USB_TS_READ;
-    } else *len=rxed; /* just type converting */
+        metric_add(METRIC_USB_TS_READ_ERRORS, 1);
+    } else {
+        *len=rxed; /* just type converting */
+        metric_observe(METRIC_USB_TS_READ_SIZE, rxed);
+    }
+    metric_add(METRIC_USB_TS_READS, 1);
 
     if (err!=ERROR_NONE) printf("ERROR: FTDI USB ts read\n");
 
     return err;
 }
+
+/* -------------------------------------------------------------------------------------------------- */
+void ftdi_usb_ts_status(const uint8_t *buffer, uint16_t len, ftdi_ts_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* decodes the line status the FTDI puts at the start of each 512 byte packet of a TS read            */
+/* *buffer: the buffer ftdi_usb_ts_read() filled                                                      */
+/*     len: how many bytes it put into it                                                             */
+/* *status: set to the number of packets and of each error flag seen                                  */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t line;
+
+    memset(status, 0, sizeof(ftdi_ts_status_t));
+
+    for (uint32_t offset=0; offset+FTDI_STATUS_BYTES<=len; offset+=FTDI_PACKET_SIZE) {
+        line=buffer[offset+1];
+        status->packets++;
+        if (line & FTDI_LINE_STATUS_OVERRUN) status->overruns++;
+        if (line & FTDI_LINE_STATUS_PARITY) status->parity_errors++;
+        if (line & FTDI_LINE_STATUS_FRAMING) status->framing_errors++;
+        if (line & FTDI_LINE_STATUS_BREAK) status->breaks++;
+        if (line & FTDI_LINE_STATUS_FIFO_ERROR) status->fifo_errors++;
+    }
+}
@@ -30,11 +30,30 @@
 #define USB_TIMEOUT 5000
 #define USB_FAST_TIMEOUT 500
 
+/* The TS endpoint starts every 512 byte USB packet with two status bytes, modem then line status */
+#define FTDI_PACKET_SIZE            512
+#define FTDI_STATUS_BYTES           2
+#define FTDI_LINE_STATUS_OVERRUN    0x02 /* the FTDI's receive buffer overflowed, TS was lost */
+#define FTDI_LINE_STATUS_PARITY     0x04
+#define FTDI_LINE_STATUS_FRAMING    0x08
+#define FTDI_LINE_STATUS_BREAK      0x10
+#define FTDI_LINE_STATUS_FIFO_ERROR 0x80
+
+typedef struct {
+    uint32_t packets;
+    uint32_t overruns;
+    uint32_t parity_errors;
+    uint32_t framing_errors;
+    uint32_t breaks;
+    uint32_t fifo_errors;
+} ftdi_ts_status_t;
+
 uint8_t ftdi_usb_i2c_write( uint8_t *, uint8_t);
 uint8_t ftdi_usb_i2c_read( uint8_t **);
 uint8_t ftdi_usb_set_mpsse_mode_i2c(void);
 uint8_t ftdi_usb_set_mpsse_mode_ts(void);
 uint8_t ftdi_usb_ts_read(uint8_t *, uint16_t *, uint32_t);
+void ftdi_usb_ts_status(const uint8_t *, uint16_t, ftdi_ts_status_t *);
 uint8_t ftdi_usb_init_i2c(uint8_t, uint8_t, uint16_t, uint16_t);
 uint8_t ftdi_usb_init_ts(uint8_t, uint8_t, uint16_t, uint16_t);
 
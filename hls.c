@@ -0,0 +1,490 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: hls.c                                                                       */
+/*    - cuts the live TS into short in-memory segments and serves them, with a playlist, over HTTP    */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "pcrpts.h"
+#include "web.h"
+#include "hls.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define HLS_PACKET_SIZE 188
+#define HLS_PID_PAT 0x0000
+
+/* Segments that have dropped off the playlist are kept a little longer for clients that are behind */
+#define HLS_SPARE_SEGMENTS 2
+#define HLS_MAX_PLAYLIST_LENGTH 64
+
+#define HLS_INITIAL_CAPACITY (1024 * 1024)
+
+#define HLS_PCR_CLOCK 27000000.0
+#define HLS_PCR_WRAP  ((1ULL << 33) * 300)
+/* A PCR step larger than this is a discontinuity, so fall back to arrival time for the duration */
+#define HLS_PCR_MAX_STEP (60ULL * 27000000)
+
+/* If the stream has not flagged a random access point for this many segment durations, cut at  */
+/* any payload unit start on the video PID instead                                                   */
+#define HLS_KEYFRAME_TIMEOUT_SEGMENTS 3
+
+/* Segments are cached as immutable by name, so each run numbers them on from the wall clock rather */
+/* than from 0, with room for more segments a second than a retune can cut                          */
+#define HLS_SEQUENCE_PER_SECOND 10
+
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+    uint32_t capacity;
+    uint64_t sequence;
+    uint64_t discontinuity_sequence;
+    double duration;
+    bool discontinuity;
+    bool complete;
+    uint32_t readers;
+} hls_segment_t;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+extern uint64_t monotonic_ms(void);
+
+static uint32_t hls_segment_seconds;
+static uint32_t hls_playlist_length;
+
+/* complete, sequence and readers are shared with the HTTP threads under the mutex; the segment being */
+/* filled is only ever touched by the TS thread                                                       */
+static hls_segment_t *hls_segments = NULL;
+static uint32_t hls_segment_count = 0;
+static pthread_mutex_t hls_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int32_t hls_current = -1;
+static uint64_t hls_next_sequence = 0;
+static uint64_t hls_discontinuity_sequence = 0;
+static bool hls_pending_discontinuity = false;
+
+/* The latest PAT and PMT are repeated at the start of every segment so each one decodes alone */
+static uint8_t hls_pat[HLS_PACKET_SIZE];
+static uint8_t hls_pmt[HLS_PACKET_SIZE];
+static bool hls_pat_valid = false;
+static bool hls_pmt_valid = false;
+static int32_t hls_pmt_pid = -1;
+
+static uint64_t hls_segment_start_pcr;
+static uint64_t hls_last_pcr;
+static bool hls_pcr_valid = false;
+static uint64_t hls_segment_start_ms;
+static uint64_t hls_last_keyframe_ms;
+
+static uint64_t hls_packets_dropped = 0;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void hls_parse_pat(uint8_t *packet) {
+/* -------------------------------------------------------------------------------------------------- */
+/* picks the PMT PID of the first programme out of a single packet PAT                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t section = 5 + packet[4];
+    uint32_t section_end, i;
+
+    if (section + 8 > HLS_PACKET_SIZE) return;
+
+    section_end = section + 3 + (((packet[section + 1] & 0x0f) << 8) | packet[section + 2]) - 4;
+    if (section_end > HLS_PACKET_SIZE) section_end = HLS_PACKET_SIZE;
+
+    for (i = section + 8; i + 4 <= section_end; i += 4) {
+        if (((packet[i] << 8) | packet[i + 1]) != 0) {
+            hls_pmt_pid = ((packet[i + 2] & 0x1f) << 8) | packet[i + 3];
+            break;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static double hls_elapsed(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* how long the current segment is, by PCR if there is a sane one, otherwise by arrival time          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t pcr_delta;
+
+    if (hls_pcr_valid) {
+        pcr_delta = (hls_last_pcr + HLS_PCR_WRAP - hls_segment_start_pcr) % HLS_PCR_WRAP;
+        if (pcr_delta < HLS_PCR_MAX_STEP) return pcr_delta / HLS_PCR_CLOCK;
+    }
+
+    return (monotonic_ms() - hls_segment_start_ms) / 1000.0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void hls_append(uint8_t *packet) {
+/* -------------------------------------------------------------------------------------------------- */
+    hls_segment_t *segment = &hls_segments[hls_current];
+    uint32_t capacity;
+    uint8_t *data;
+
+    if (segment->len + HLS_PACKET_SIZE > segment->capacity) {
+        capacity = (segment->capacity == 0) ? HLS_INITIAL_CAPACITY : segment->capacity * 2;
+        data = (uint8_t *)realloc(segment->data, capacity);
+        if (data == NULL) {
+            hls_packets_dropped++;
+            return;
+        }
+        segment->data = data;
+        segment->capacity = capacity;
+    }
+
+    memcpy(&segment->data[segment->len], packet, HLS_PACKET_SIZE);
+    segment->len += HLS_PACKET_SIZE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void hls_finish_segment(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes the current segment to the playlist                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+    if (hls_current < 0) return;
+
+    pthread_mutex_lock(&hls_mutex);
+    hls_segments[hls_current].duration = hls_elapsed();
+    hls_segments[hls_current].complete = true;
+    pthread_mutex_unlock(&hls_mutex);
+
+    hls_current = -1;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool hls_start_segment(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* reuses the oldest slot that is off the playlist and not being sent to anyone                       */
+/*  return: false if there is no free slot, in which case the current segment carries on growing      */
+/* -------------------------------------------------------------------------------------------------- */
+    int32_t slot = -1;
+    uint64_t oldest_listed;
+    hls_segment_t *segment;
+
+    pthread_mutex_lock(&hls_mutex);
+
+    oldest_listed = (hls_next_sequence > hls_playlist_length) ? hls_next_sequence - hls_playlist_length : 0;
+    for (uint32_t i = 0; i < hls_segment_count; i++) {
+        segment = &hls_segments[i];
+        if ((int32_t)i == hls_current || segment->readers > 0) continue;
+        if (!segment->complete) {
+            slot = i;
+            break;
+        }
+        if (segment->sequence < oldest_listed
+            && (slot < 0 || segment->sequence < hls_segments[slot].sequence)) {
+            slot = i;
+        }
+    }
+
+    if (slot >= 0) {
+        segment = &hls_segments[slot];
+        segment->complete = false;
+        segment->len = 0;
+        segment->sequence = hls_next_sequence++;
+        segment->discontinuity = hls_pending_discontinuity;
+        if (hls_pending_discontinuity) hls_discontinuity_sequence++;
+        segment->discontinuity_sequence = hls_discontinuity_sequence;
+    }
+
+    pthread_mutex_unlock(&hls_mutex);
+
+    if (slot < 0) return false;
+
+    hls_finish_segment();
+    hls_current = slot;
+    hls_pending_discontinuity = false;
+    hls_segment_start_pcr = hls_last_pcr;
+    hls_segment_start_ms = monotonic_ms();
+
+    if (hls_pat_valid) hls_append(hls_pat);
+    if (hls_pmt_valid) hls_append(hls_pmt);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void hls_ts_write(uint8_t *packets, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* feeds aligned packets to the segmenter, cutting at random access points on the video PID           */
+/* *packets: the aligned TS packets, as produced by ts_align()                                        */
+/*      len: the length (number of bytes) of the packets, a multiple of 188                           */
+/* -------------------------------------------------------------------------------------------------- */
+    uint16_t video_pid = pcrpts_get_video_pid();
+    uint64_t now_ms = monotonic_ms();
+    uint64_t keyframe_timeout_ms = (uint64_t)hls_segment_seconds * HLS_KEYFRAME_TIMEOUT_SEGMENTS * 1000;
+    uint8_t *packet;
+    uint16_t pid;
+    bool unit_start, adaptation, keyframe, cut_point;
+
+    if (hls_segments == NULL) return;
+
+    for (uint32_t offset = 0; offset + HLS_PACKET_SIZE <= len; offset += HLS_PACKET_SIZE) {
+        packet = &packets[offset];
+        pid = ((packet[1] & 0x1f) << 8) | packet[2];
+        unit_start = (packet[1] & 0x40) != 0;
+        adaptation = (packet[3] & 0x20) && packet[4] != 0;
+
+        if (pid == HLS_PID_PAT && unit_start) {
+            memcpy(hls_pat, packet, HLS_PACKET_SIZE);
+            hls_pat_valid = true;
+            hls_parse_pat(packet);
+        } else if ((int32_t)pid == hls_pmt_pid && unit_start) {
+            memcpy(hls_pmt, packet, HLS_PACKET_SIZE);
+            hls_pmt_valid = true;
+        }
+
+        if (PCRAvailable((char *)packet)) {
+            hls_last_pcr = GetPCRFromPacket(packet);
+            if (!hls_pcr_valid) {
+                hls_segment_start_pcr = hls_last_pcr;
+                hls_pcr_valid = true;
+            }
+        }
+
+        keyframe = (pid == video_pid) && adaptation && (packet[5] & 0x40);
+        if (keyframe) hls_last_keyframe_ms = now_ms;
+
+        cut_point = keyframe
+                 || (pid == video_pid && unit_start
+                     && now_ms - hls_last_keyframe_ms > keyframe_timeout_ms);
+
+        if (cut_point && (hls_current < 0 || hls_elapsed() >= hls_segment_seconds)) {
+            hls_start_segment();
+        }
+
+        /* Nothing is kept until the first access point, a segment must start decodable */
+        if (hls_current >= 0) hls_append(packet);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void hls_reset(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* called on retune: closes the segment in progress and marks a discontinuity before the next one     */
+/* -------------------------------------------------------------------------------------------------- */
+    if (hls_segments == NULL) return;
+
+    hls_finish_segment();
+
+    hls_pending_discontinuity = true;
+    hls_pat_valid = false;
+    hls_pmt_valid = false;
+    hls_pmt_pid = -1;
+    hls_pcr_valid = false;
+    hls_last_keyframe_ms = monotonic_ms();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void hls_send_playlist(struct mg_connection *conn) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t listed[HLS_MAX_PLAYLIST_LENGTH + HLS_SPARE_SEGMENTS + 1];
+    uint32_t count = 0, target = 1, i, j, tmp;
+    size_t size, used = 0;
+    char *playlist;
+    hls_segment_t *segment;
+
+    size = 256 + hls_playlist_length * 64;
+    playlist = (char *)malloc(size);
+    if (playlist == NULL) return;
+
+    pthread_mutex_lock(&hls_mutex);
+
+    /* Newest complete segments, in sequence order */
+    for (i = 0; i < hls_segment_count; i++) {
+        if (hls_segments[i].complete) listed[count++] = i;
+    }
+    for (i = 1; i < count; i++) {
+        for (j = i; j > 0 && hls_segments[listed[j - 1]].sequence > hls_segments[listed[j]].sequence; j--) {
+            tmp = listed[j];
+            listed[j] = listed[j - 1];
+            listed[j - 1] = tmp;
+        }
+    }
+    if (count > hls_playlist_length) {
+        memmove(listed, &listed[count - hls_playlist_length], hls_playlist_length * sizeof(uint32_t));
+        count = hls_playlist_length;
+    }
+
+    for (i = 0; i < count; i++) {
+        if ((uint32_t)(hls_segments[listed[i]].duration + 0.999) > target) target = (uint32_t)(hls_segments[listed[i]].duration + 0.999);
+    }
+
+    if (count > 0) {
+        used += snprintf(&playlist[used], size - used,
+                         "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n"
+                         "#EXT-X-MEDIA-SEQUENCE:%llu\n#EXT-X-DISCONTINUITY-SEQUENCE:%llu\n",
+                         target, (unsigned long long)hls_segments[listed[0]].sequence,
+                         (unsigned long long)(hls_segments[listed[0]].discontinuity_sequence
+                                              - (hls_segments[listed[0]].discontinuity ? 1 : 0)));
+        for (i = 0; i < count && used < size; i++) {
+            segment = &hls_segments[listed[i]];
+            used += snprintf(&playlist[used], size - used, "%s#EXTINF:%.3f,\n%llu.ts\n",
+                             segment->discontinuity ? "#EXT-X-DISCONTINUITY\n" : "",
+                             segment->duration, (unsigned long long)segment->sequence);
+        }
+    }
+
+    pthread_mutex_unlock(&hls_mutex);
+
+    if (count == 0) {
+        mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nCache-Control: no-cache\r\n"
+                        "Connection: close\r\n\r\nNo segments yet\n");
+    } else {
+        if (used > size - 1) used = size - 1;
+        /* The playlist changes every segment, so only let caches collapse requests within half of one */
+        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/vnd.apple.mpegurl\r\n"
+                        "Cache-Control: public, max-age=%u\r\nContent-Length: %zu\r\n\r\n",
+                        (hls_segment_seconds + 1) / 2, used);
+        mg_write(conn, playlist, used);
+    }
+
+    free(playlist);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void hls_send_segment(struct mg_connection *conn, uint64_t sequence) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sends a finished segment straight from its slot, which is pinned for the duration                  */
+/* -------------------------------------------------------------------------------------------------- */
+    hls_segment_t *segment = NULL;
+
+    pthread_mutex_lock(&hls_mutex);
+    for (uint32_t i = 0; i < hls_segment_count; i++) {
+        if (hls_segments[i].complete && hls_segments[i].sequence == sequence) {
+            segment = &hls_segments[i];
+            segment->readers++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hls_mutex);
+
+    if (segment == NULL) {
+        mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nCache-Control: no-cache\r\n"
+                        "Connection: close\r\n\r\nSegment not available\n");
+        return;
+    }
+
+    /* A segment never changes once published, so it can be cached for as long as it could be listed */
+    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: video/mp2t\r\n"
+                    "Cache-Control: public, max-age=%u, immutable\r\nContent-Length: %u\r\n\r\n",
+                    hls_segment_seconds * (hls_playlist_length + HLS_SPARE_SEGMENTS), segment->len);
+    mg_write(conn, segment->data, segment->len);
+
+    pthread_mutex_lock(&hls_mutex);
+    segment->readers--;
+    pthread_mutex_unlock(&hls_mutex);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+class HlsHandler : public CivetHandler
+{
+public:
+    bool handleGet(CivetServer *server, struct mg_connection *conn)
+    {
+        (void)server;
+        const struct mg_request_info *request = mg_get_request_info(conn);
+        unsigned long long sequence;
+        char suffix[4];
+
+        if (strcmp(request->local_uri, "/hls/live.m3u8") == 0) {
+            hls_send_playlist(conn);
+            return true;
+        }
+        if (sscanf(request->local_uri, "/hls/%llu.%3s", &sequence, suffix) == 2 && strcmp(suffix, "ts") == 0) {
+            hls_send_segment(conn, sequence);
+            return true;
+        }
+
+        return false;
+    }
+};
+
+static HlsHandler hls_http_handler;
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t hls_init(uint32_t segment_seconds, uint32_t playlist_length) {
+/* -------------------------------------------------------------------------------------------------- */
+/* allocates the segment slots and registers the playlist and segments on the web server             */
+/* segment_seconds: target duration of each segment, segments end at the first access point after    */
+/* playlist_length: number of segments listed in the playlist                                         */
+/*          return: error code                                                                        */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+
+    if (segment_seconds == 0 || playlist_length == 0 || playlist_length > HLS_MAX_PLAYLIST_LENGTH || !web_is_enabled()) {
+        printf("ERROR: HLS needs the web server, a segment length and 1 to 64 playlist entries\n");
+        err=ERROR_HLS_INIT;
+    }
+
+    if (err==ERROR_NONE) {
+        hls_segment_seconds = segment_seconds;
+        hls_playlist_length = playlist_length;
+        hls_segment_count = playlist_length + HLS_SPARE_SEGMENTS + 1;
+        hls_last_keyframe_ms = monotonic_ms();
+        hls_next_sequence = (uint64_t)time(NULL) * HLS_SEQUENCE_PER_SECOND;
+        hls_segments = (hls_segment_t *)calloc(hls_segment_count, sizeof(hls_segment_t));
+        if (hls_segments == NULL) {
+            printf("ERROR: HLS segment malloc\n");
+            err=ERROR_HLS_INIT;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        web_add_handler("/hls", &hls_http_handler);
+        printf("Flow: HLS %u x %u second segments at /hls/live.m3u8\n", playlist_length, segment_seconds);
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t hls_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* frees the segments, the web server must already have been stopped                                  */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (hls_segments == NULL) return ERROR_NONE;
+
+    if (hls_packets_dropped > 0) printf("Flow: HLS dropped %llu packets\n", (unsigned long long)hls_packets_dropped);
+
+    for (uint32_t i = 0; i < hls_segment_count; i++) free(hls_segments[i].data);
+    free(hls_segments);
+    hls_segments = NULL;
+
+    return ERROR_NONE;
+}
@@ -0,0 +1,40 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: hls.h                                                                       */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef HLS_H
+#define HLS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HLS_DEFAULT_SEGMENT_SECONDS 2
+#define HLS_DEFAULT_PLAYLIST_LENGTH 6
+
+/* Served on the web server (-H) as:                                                                  */
+/*   /hls/live.m3u8     rolling playlist of the last few segments, short cache lifetime               */
+/*   /hls/<seq>.ts      a finished segment, immutable so it can be cached for the playlist window      */
+
+uint8_t hls_init(uint32_t segment_seconds, uint32_t playlist_length);
+void hls_ts_write(uint8_t *packets, uint32_t len);
+void hls_reset(void);
+uint8_t hls_close(void);
+
+#endif
@@ -15,9 +15,21 @@
 #include <windows.h>
 #else
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #endif
 #include "json_output.h"
 #include "main.h"
+#include "errors.h"
+#include "status_format.h"
 
 /* -------------------------------------------------------------------------------------------------- */
 /* GLOBAL VARIABLES                                                                                   */
@@ -34,6 +46,36 @@ static json_output_config_t json_config = {
 
 static uint64_t last_json_output_time = 0;
 
+/* Targets for the writer thread */
+#define JSON_TARGET_STDOUT 0
+#define JSON_TARGET_FILE   1
+#define JSON_TARGET_UNIX   2
+#define JSON_TARGET_UDP    3
+
+typedef struct {
+    uint32_t len;
+    char line[JSON_BUFFER_SIZE_FULL];
+} json_slot_t;
+
+/* One producer (the i2c thread) and one consumer (the writer thread), so the queue needs no lock:   */
+/* each index is only ever advanced by its own side, and the slots between them belong to the writer */
+static json_slot_t json_queue[JSON_QUEUE_SLOTS];
+static uint32_t json_queue_head = 0;  /* next slot to fill */
+static uint32_t json_queue_tail = 0;  /* next slot to write out */
+
+static bool json_writer_running = false;
+static pthread_t json_writer_thread;
+static int json_writer_event_fd = -1;
+static json_output_stats_t json_stats;
+
+static uint8_t json_target = JSON_TARGET_STDOUT;
+static int json_target_fd = -1;
+static char json_target_path[128];
+static struct sockaddr_storage json_target_addr;
+static socklen_t json_target_addr_len = 0;
+static uint64_t json_file_size = 0;
+static uint64_t json_rotate_bytes = 0;
+
 /* -------------------------------------------------------------------------------------------------- */
 /* UTILITY FUNCTIONS                                                                                  */
 /* -------------------------------------------------------------------------------------------------- */
@@ -198,77 +240,17 @@ int json_format_demod_status_full(char *buffer, size_t buffer_size, uint8_t tune
     /* tuner: tuner number                                                                             */
     /* status: status structure                                                                        */
     /* timestamp: timestamp in milliseconds                                                            */
-    /* return: number of characters written, or -1 on error                                           */
+    /* return: number of characters written, or -1 on error or if buffer is too small                 */
     /* -------------------------------------------------------------------------------------------------- */
     if (buffer == NULL || status == NULL || buffer_size == 0) {
         return -1;
     }
 
-    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
-    double actual_freq = status->frequency_requested + (status->frequency_offset / 1000.0);
-    
-    return snprintf(buffer, buffer_size,
-        "{\n"
-        "  \"timestamp\": %llu,\n"
-        "  \"tuner\": %u,\n"
-        "  \"signal\": {\n"
-        "    \"power_i\": %u,\n"
-        "    \"power_q\": %u,\n"
-        "    \"agc1_gain\": %u,\n"
-        "    \"agc2_gain\": %u,\n"
-        "    \"lna_gain\": %u\n"
-        "  },\n"
-        "  \"lock\": {\n"
-        "    \"demod_state\": %u,\n"
-        "    \"state_name\": \"%s\",\n"
-        "    \"locked\": %s\n"
-        "  },\n"
-        "  \"errors\": {\n"
-        "    \"viterbi_rate\": %u,\n"
-        "    \"ber\": %u,\n"
-        "    \"mer\": %d,\n"
-        "    \"bch_uncorrected\": %s,\n"
-        "    \"bch_count\": %u,\n"
-        "    \"ldpc_count\": %u\n"
-        "  },\n"
-        "  \"frequency\": {\n"
-        "    \"requested\": %u,\n"
-        "    \"offset\": %d,\n"
-        "    \"actual\": %.1f\n"
-        "  },\n"
-        "  \"modulation\": {\n"
-        "    \"symbol_rate\": %u,\n"
-        "    \"modcod\": %u,\n"
-        "    \"short_frame\": %s,\n"
-        "    \"pilots\": %s,\n"
-        "    \"rolloff\": %u\n"
-        "  }\n"
-        "}",
-        (unsigned long long)timestamp,
-        tuner,
-        status->power_i,
-        status->power_q,
-        status->agc1_gain,
-        status->agc2_gain,
-        status->lna_gain,
-        status->demod_state,
-        json_get_demod_state_name(status->demod_state),
-        is_locked ? "true" : "false",
-        status->viterbi_error_rate,
-        status->bit_error_rate,
-        status->modulation_error_rate,
-        status->errors_bch_uncorrected ? "true" : "false",
-        status->errors_bch_count,
-        status->errors_ldpc_count,
-        status->frequency_requested,
-        status->frequency_offset,
-        actual_freq,
-        status->symbolrate,
-        status->modcod,
-        status->short_frame ? "true" : "false",
-        status->pilots ? "true" : "false",
-        status->rolloff
-    );
+    status_fmt_t fmt;
+    status_fmt_init(&fmt, buffer, buffer_size);
+    status_format_json(&fmt, JSON_FORMAT_FULL, tuner, status, timestamp, json_config.include_constellation);
+
+    return fmt.truncated ? -1 : (int)fmt.len;
 }
 
 int json_format_demod_status_compact(char *buffer, size_t buffer_size, uint8_t tuner,
@@ -281,34 +263,17 @@ int json_format_demod_status_compact(char *buffer, size_t buffer_size, uint8_t t
     /* tuner: tuner number                                                                             */
     /* status: status structure                                                                        */
     /* timestamp: timestamp in milliseconds                                                            */
-    /* return: number of characters written, or -1 on error                                           */
+    /* return: number of characters written, or -1 on error or if buffer is too small                 */
     /* -------------------------------------------------------------------------------------------------- */
     if (buffer == NULL || status == NULL || buffer_size == 0) {
         return -1;
     }
 
-    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
-    double actual_freq = status->frequency_requested + (status->frequency_offset / 1000.0);
-
-    return snprintf(buffer, buffer_size,
-        "{\"ts\":%llu,\"t\":%u,\"pi\":%u,\"pq\":%u,\"a1\":%u,\"a2\":%u,\"lna\":%u,"
-        "\"ds\":%u,\"lck\":%s,\"vit\":%u,\"ber\":%u,\"mer\":%d,\"freq\":%.1f,\"sr\":%u,\"mc\":%u}",
-        (unsigned long long)timestamp,
-        tuner,
-        status->power_i,
-        status->power_q,
-        status->agc1_gain,
-        status->agc2_gain,
-        status->lna_gain,
-        status->demod_state,
-        is_locked ? "true" : "false",
-        status->viterbi_error_rate,
-        status->bit_error_rate,
-        status->modulation_error_rate,
-        actual_freq,
-        status->symbolrate,
-        status->modcod
-    );
+    status_fmt_t fmt;
+    status_fmt_init(&fmt, buffer, buffer_size);
+    status_format_json(&fmt, JSON_FORMAT_COMPACT, tuner, status, timestamp, false);
+
+    return fmt.truncated ? -1 : (int)fmt.len;
 }
 
 int json_format_demod_status_minimal(char *buffer, size_t buffer_size, uint8_t tuner,
@@ -321,23 +286,340 @@ int json_format_demod_status_minimal(char *buffer, size_t buffer_size, uint8_t t
     /* tuner: tuner number                                                                             */
     /* status: status structure                                                                        */
     /* timestamp: timestamp in milliseconds                                                            */
-    /* return: number of characters written, or -1 on error                                           */
+    /* return: number of characters written, or -1 on error or if buffer is too small                 */
     /* -------------------------------------------------------------------------------------------------- */
     if (buffer == NULL || status == NULL || buffer_size == 0) {
         return -1;
     }
 
-    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
-
-    return snprintf(buffer, buffer_size,
-        "{\"ts\":%llu,\"t\":%u,\"lck\":%s,\"mer\":%d,\"freq\":%u,\"sr\":%u}",
-        (unsigned long long)timestamp,
-        tuner,
-        is_locked ? "true" : "false",
-        status->modulation_error_rate,
-        status->frequency_requested,
-        status->symbolrate
-    );
+    status_fmt_t fmt;
+    status_fmt_init(&fmt, buffer, buffer_size);
+    status_format_json(&fmt, JSON_FORMAT_MINIMAL, tuner, status, timestamp, false);
+
+    return fmt.truncated ? -1 : (int)fmt.len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+/* WRITER THREAD                                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+
+static bool json_file_open(void)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Opens the JSON lines file for appending, carrying on from whatever it already holds            */
+    /* return: true if the file is open                                                                */
+    /* -------------------------------------------------------------------------------------------------- */
+    struct stat st;
+
+    json_target_fd = open(json_target_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (json_target_fd < 0) {
+        return false;
+    }
+    json_file_size = (fstat(json_target_fd, &st) == 0) ? (uint64_t)st.st_size : 0;
+
+    return true;
+}
+
+static void json_file_rotate(void)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Moves PATH to PATH.1, PATH.1 to PATH.2 and so on, dropping the oldest, then starts a new PATH   */
+    /* -------------------------------------------------------------------------------------------------- */
+    char from[160], to[160];
+    int generation;
+
+    close(json_target_fd);
+    json_target_fd = -1;
+
+    for (generation = JSON_OUTPUT_ROTATE_KEEP - 1; generation >= 1; generation--) {
+        snprintf(from, sizeof(from), "%s.%i", json_target_path, generation);
+        snprintf(to, sizeof(to), "%s.%i", json_target_path, generation + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", json_target_path);
+    rename(json_target_path, to);
+
+    __atomic_add_fetch(&json_stats.rotations, 1, __ATOMIC_RELAXED);
+    json_file_open();
+}
+
+static bool json_target_write(const char *line, uint32_t len)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Writes one line to the target; only ever called from the writer thread, so it may block         */
+    /* line: the JSON line, newline included                                                           */
+    /* len: length of the line                                                                         */
+    /* return: true if the target took the whole line                                                  */
+    /* -------------------------------------------------------------------------------------------------- */
+    switch (json_target) {
+        case JSON_TARGET_STDOUT:
+            if (fwrite(line, 1, len, stdout) != len) {
+                return false;
+            }
+            return fflush(stdout) == 0;
+
+        case JSON_TARGET_FILE:
+            if (json_rotate_bytes != 0 && json_file_size > 0 && json_file_size + len > json_rotate_bytes) {
+                json_file_rotate();
+            }
+            /* A file that could not be reopened is tried again on the next line */
+            if (json_target_fd < 0 && !json_file_open()) {
+                return false;
+            }
+            if (write(json_target_fd, line, len) != (ssize_t)len) {
+                return false;
+            }
+            json_file_size += len;
+            return true;
+
+        case JSON_TARGET_UNIX:
+        case JSON_TARGET_UDP:
+            /* Not connected, so a listener that comes and goes is picked up again without a reopen */
+            return sendto(json_target_fd, line, len, MSG_NOSIGNAL, (struct sockaddr *)&json_target_addr,
+                          json_target_addr_len) == (ssize_t)len;
+    }
+
+    return false;
+}
+
+static void *json_writer_loop(void *arg)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Writes out queued lines until stopped, then drains what is left                                 */
+    /* -------------------------------------------------------------------------------------------------- */
+    struct pollfd pfd;
+    uint32_t head, tail;
+    uint64_t count;
+    json_slot_t *slot;
+
+    (void)arg;
+    pfd.fd = json_writer_event_fd;
+    pfd.events = POLLIN;
+
+    while (true) {
+        head = __atomic_load_n(&json_queue_head, __ATOMIC_ACQUIRE);
+        tail = json_queue_tail;
+
+        while (tail != head) {
+            slot = &json_queue[tail % JSON_QUEUE_SLOTS];
+            if (json_target_write(slot->line, slot->len)) {
+                __atomic_add_fetch(&json_stats.written, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch(&json_stats.write_errors, 1, __ATOMIC_RELAXED);
+            }
+            tail++;
+            /* Hands the slot back to the producer */
+            __atomic_store_n(&json_queue_tail, tail, __ATOMIC_RELEASE);
+        }
+
+        if (!__atomic_load_n(&json_writer_running, __ATOMIC_ACQUIRE)
+            && tail == __atomic_load_n(&json_queue_head, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) > 0 && read(json_writer_event_fd, &count, sizeof(count)) < 0) {
+            /* EAGAIN, someone else's wakeup was already consumed */
+        }
+    }
+
+    return NULL;
+}
+
+static bool json_target_parse(const char *target)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Opens the target named by "stdout", file:PATH, unix:PATH or udp:HOST:PORT                       */
+    /* target: the target as given to -O                                                               */
+    /* return: true if the target is ready to write to                                                 */
+    /* -------------------------------------------------------------------------------------------------- */
+    struct sockaddr_un *un = (struct sockaddr_un *)&json_target_addr;
+    struct addrinfo hints, *result;
+    char host[128];
+    const char *port;
+
+    if (strcmp(target, "stdout") == 0 || strcmp(target, "-") == 0) {
+        json_target = JSON_TARGET_STDOUT;
+        return true;
+    }
+
+    if (strncmp(target, "file:", 5) == 0) {
+        json_target = JSON_TARGET_FILE;
+        strncpy(json_target_path, &target[5], sizeof(json_target_path) - 1);
+        return json_file_open();
+    }
+
+    if (strncmp(target, "unix:", 5) == 0) {
+        json_target = JSON_TARGET_UNIX;
+        if (strlen(&target[5]) >= sizeof(un->sun_path)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        memset(&json_target_addr, 0, sizeof(json_target_addr));
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, &target[5]);
+        json_target_addr_len = sizeof(struct sockaddr_un);
+        json_target_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        return json_target_fd >= 0;
+    }
+
+    if (strncmp(target, "udp:", 4) == 0) {
+        json_target = JSON_TARGET_UDP;
+        strncpy(host, &target[4], sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        port = strrchr(host, ':');
+        if (port == NULL) {
+            errno = EINVAL;
+            return false;
+        }
+        host[port - host] = '\0';
+        port++;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host, port, &hints, &result) != 0) {
+            errno = EHOSTUNREACH;
+            return false;
+        }
+        memcpy(&json_target_addr, result->ai_addr, result->ai_addrlen);
+        json_target_addr_len = result->ai_addrlen;
+        json_target_fd = socket(result->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        freeaddrinfo(result);
+        return json_target_fd >= 0;
+    }
+
+    errno = EINVAL;
+    return false;
+}
+
+uint8_t json_output_start(const char *target, uint32_t rotate_mbytes)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Opens the target and starts the writer thread that json_output_demod_cycle queues lines for     */
+    /* target: "stdout", file:PATH, unix:PATH or udp:HOST:PORT                                         */
+    /* rotate_mbytes: size a file target is rotated at, 0 never to rotate                              */
+    /* return: error code                                                                              */
+    /* -------------------------------------------------------------------------------------------------- */
+    uint8_t err = ERROR_NONE;
+
+    memset(&json_stats, 0, sizeof(json_stats));
+    json_queue_head = 0;
+    json_queue_tail = 0;
+    json_rotate_bytes = (uint64_t)rotate_mbytes * 1024 * 1024;
+
+    if (!json_target_parse(target)) {
+        printf("ERROR: JSON output target %s (error: %s)\n", target, strerror(errno));
+        err = ERROR_JSON_OUTPUT_INIT;
+    }
+
+    if (err == ERROR_NONE) {
+        json_writer_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (json_writer_event_fd < 0) {
+            printf("ERROR: JSON output eventfd (error: %s)\n", strerror(errno));
+            err = ERROR_JSON_OUTPUT_INIT;
+        }
+    }
+
+    if (err == ERROR_NONE) {
+        __atomic_store_n(&json_writer_running, true, __ATOMIC_RELEASE);
+        if (pthread_create(&json_writer_thread, NULL, json_writer_loop, NULL) != 0) {
+            printf("ERROR: JSON output writer thread\n");
+            __atomic_store_n(&json_writer_running, false, __ATOMIC_RELEASE);
+            err = ERROR_JSON_OUTPUT_INIT;
+        }
+    }
+
+    if (err != ERROR_NONE) {
+        if (json_target_fd >= 0) close(json_target_fd);
+        if (json_writer_event_fd >= 0) close(json_writer_event_fd);
+        json_target_fd = -1;
+        json_writer_event_fd = -1;
+    }
+
+    return err;
+}
+
+void json_output_stop(void)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Stops the writer once it has written out the queue; nothing may be queued after this            */
+    /* -------------------------------------------------------------------------------------------------- */
+    uint64_t one = 1;
+
+    if (!__atomic_load_n(&json_writer_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    __atomic_store_n(&json_writer_running, false, __ATOMIC_RELEASE);
+    if (write(json_writer_event_fd, &one, sizeof(one)) < 0) {
+        /* only fails if the counter is already non-zero, which wakes the writer anyway */
+    }
+    pthread_join(json_writer_thread, NULL);
+
+    if (json_target_fd >= 0) close(json_target_fd);
+    close(json_writer_event_fd);
+    json_target_fd = -1;
+    json_writer_event_fd = -1;
+
+    printf("Flow: JSON output wrote %llu lines, %llu dropped, %llu write errors\n",
+           (unsigned long long)json_stats.written, (unsigned long long)json_stats.dropped,
+           (unsigned long long)json_stats.write_errors);
+}
+
+void json_output_get_stats(json_output_stats_t *stats)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Gets the writer counters; each is read atomically, though not all at the same instant           */
+    /* stats: filled in with the counters                                                              */
+    /* -------------------------------------------------------------------------------------------------- */
+    stats->queued = __atomic_load_n(&json_stats.queued, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&json_stats.written, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&json_stats.dropped, __ATOMIC_RELAXED);
+    stats->write_errors = __atomic_load_n(&json_stats.write_errors, __ATOMIC_RELAXED);
+    stats->rotations = __atomic_load_n(&json_stats.rotations, __ATOMIC_RELAXED);
+    stats->queue_high_water = __atomic_load_n(&json_stats.queue_high_water, __ATOMIC_RELAXED);
+}
+
+static void json_output_queue(uint8_t tuner, const longmynd_status_t *status)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Formats a line straight into the next free slot and wakes the writer; never blocks              */
+    /* tuner: tuner number                                                                             */
+    /* status: status structure containing demodulator data                                            */
+    /* -------------------------------------------------------------------------------------------------- */
+    uint32_t head = json_queue_head;
+    uint32_t depth = head - __atomic_load_n(&json_queue_tail, __ATOMIC_ACQUIRE);
+    json_slot_t *slot;
+    status_fmt_t fmt;
+    uint64_t one = 1;
+
+    if (depth >= JSON_QUEUE_SLOTS) {
+        __atomic_add_fetch(&json_stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    slot = &json_queue[head % JSON_QUEUE_SLOTS];
+    status_fmt_init(&fmt, slot->line, sizeof(slot->line) - 1);
+    status_format_json(&fmt, json_config.format, tuner, status, json_get_timestamp_ms(),
+                       json_config.include_constellation);
+    if (fmt.truncated || fmt.len == 0) {
+        return;
+    }
+    slot->line[fmt.len++] = '\n';
+    slot->len = fmt.len;
+
+    /* Publishes the slot to the writer */
+    __atomic_store_n(&json_queue_head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&json_stats.queued, 1, __ATOMIC_RELAXED);
+    if (depth + 1 > json_stats.queue_high_water) {
+        __atomic_store_n(&json_stats.queue_high_water, depth + 1, __ATOMIC_RELAXED);
+    }
+
+    if (write(json_writer_event_fd, &one, sizeof(one)) < 0) {
+        /* the counter is saturated, so the writer is already due to wake */
+    }
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -347,7 +629,7 @@ int json_format_demod_status_minimal(char *buffer, size_t buffer_size, uint8_t t
 void json_output_demod_cycle(uint8_t tuner, const longmynd_status_t *status)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* Outputs demodulator cycle data as JSON to stdout                                                */
+    /* Outputs demodulator cycle data as JSON, through the writer thread once it is started           */
     /* tuner: tuner number                                                                             */
     /* status: status structure containing demodulator data                                            */
     /* -------------------------------------------------------------------------------------------------- */
@@ -359,49 +641,23 @@ void json_output_demod_cycle(uint8_t tuner, const longmynd_status_t *status)
         return;
     }
 
-    char *buffer = NULL;
-    size_t buffer_size = 0;
-    int result = -1;
-    uint64_t timestamp = json_get_timestamp_ms();
-
-    /* Allocate buffer based on format */
-    switch (json_config.format) {
-        case JSON_FORMAT_FULL:
-            buffer_size = JSON_BUFFER_SIZE_FULL;
-            buffer = (char*)malloc(buffer_size);
-            if (buffer != NULL) {
-                result = json_format_demod_status_full(buffer, buffer_size, tuner, status, timestamp);
-            }
-            break;
-
-        case JSON_FORMAT_COMPACT:
-            buffer_size = JSON_BUFFER_SIZE_COMPACT;
-            buffer = (char*)malloc(buffer_size);
-            if (buffer != NULL) {
-                result = json_format_demod_status_compact(buffer, buffer_size, tuner, status, timestamp);
-            }
-            break;
+    if (__atomic_load_n(&json_writer_running, __ATOMIC_ACQUIRE)) {
+        json_output_queue(tuner, status);
+        return;
+    }
 
-        case JSON_FORMAT_MINIMAL:
-            buffer_size = JSON_BUFFER_SIZE_MINIMAL;
-            buffer = (char*)malloc(buffer_size);
-            if (buffer != NULL) {
-                result = json_format_demod_status_minimal(buffer, buffer_size, tuner, status, timestamp);
-            }
-            break;
+    static char buffer[JSON_BUFFER_SIZE_FULL];
+    status_fmt_t fmt;
 
-        default:
-            break;
-    }
+    /* One buffer for every cycle, the formats are built in place without printf */
+    status_fmt_init(&fmt, buffer, sizeof(buffer) - 1);
+    status_format_json(&fmt, json_config.format, tuner, status, json_get_timestamp_ms(),
+                       json_config.include_constellation);
 
     /* Output JSON to stdout if formatting succeeded */
-    if (buffer != NULL && result > 0) {
-        printf("%s\n", buffer);
+    if (!fmt.truncated && fmt.len > 0) {
+        buffer[fmt.len++] = '\n';
+        fwrite(buffer, 1, fmt.len, stdout);
         fflush(stdout);
     }
-
-    /* Clean up */
-    if (buffer != NULL) {
-        free(buffer);
-    }
 }
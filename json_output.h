@@ -24,6 +24,24 @@ typedef enum {
     JSON_FORMAT_MINIMAL   /* Essential fields only */
 } json_format_t;
 
+/* Lines are queued by the i2c thread and written out by a thread of their own. When the writer       */
+/* falls behind, lines that do not fit in the queue are dropped and counted, never waited for.        */
+#define JSON_QUEUE_SLOTS 64  /* a power of two */
+
+/* Where the writer sends each line: "stdout", file:PATH (JSON lines, rotated to PATH.1 ... PATH.n),  */
+/* unix:PATH (a datagram socket) or udp:HOST:PORT, one line per datagram                              */
+#define JSON_OUTPUT_DEFAULT_ROTATE_MBYTES 16
+#define JSON_OUTPUT_ROTATE_KEEP           3
+
+typedef struct {
+    uint64_t queued;
+    uint64_t written;
+    uint64_t dropped;       /* lines lost to a full queue */
+    uint64_t write_errors;  /* lines the target would not take */
+    uint32_t rotations;
+    uint32_t queue_high_water;
+} json_output_stats_t;
+
 /* JSON output configuration structure */
 typedef struct {
     bool enabled;                    /* Enable/disable JSON output */
@@ -52,6 +70,11 @@ void json_output_set_format(json_format_t format);
 void json_output_set_interval(uint32_t interval_ms);
 void json_output_set_include_constellation(bool include);
 
+/* Writer thread */
+uint8_t json_output_start(const char *target, uint32_t rotate_mbytes);
+void json_output_stop(void);
+void json_output_get_stats(json_output_stats_t *stats);
+
 /* Main JSON output function */
 void json_output_demod_cycle(uint8_t tuner, const longmynd_status_t *status);
 
@@ -0,0 +1,545 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: kernel_bench.c                                                              */
+/*    - times the per-packet and per-cycle routines on the TS and status paths, on a synthetic or     */
+/*      captured TS, so that builds for different machines and releases can be compared               */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include "main.h"
+#include "errors.h"
+#include "libts.h"
+#include "ts.h"
+#include "udp.h"
+#include "fifo.h"
+#include "pcrpts.h"
+#include "bbframe.h"
+#include "capture.h"
+#include "mymqtt.h"
+#include "json_output.h"
+#include "status.h"
+#include "status_format.h"
+#include "tsgen.h"
+
+/* Each kernel is repeated over the whole input until it has run for at least this long */
+#define BENCH_MIN_NS     500000000ULL
+/* 235 reads of 20 FTDI blocks carry exactly 12750 packets, so every synthetic read is a full one */
+#define BENCH_READS      235
+#define BENCH_CYCLES     1000
+#define BENCH_MAX_RESULTS 32
+
+typedef struct {
+    uint64_t ops;
+    uint64_t bytes;
+} bench_count_t;
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    uint64_t ops;
+    double ns_per_op;
+    double mbytes_per_s;
+} bench_result_t;
+
+/* The input as the TS thread sees it: USB reads, each starting with its 2 FTDI bytes */
+static uint8_t *bench_reads;
+static uint16_t *bench_read_lens;
+static uint32_t bench_read_count;
+/* and the same TS de-framed into whole packets */
+static uint8_t *bench_packets;
+static uint32_t bench_packet_count;
+
+static longmynd_status_t bench_status;
+static bench_result_t bench_results[BENCH_MAX_RESULTS];
+static uint32_t bench_result_count;
+static volatile uint64_t bench_sink;
+
+extern int fd_ts_fifo;
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* mymqtt.c applies commands through these; there are none here */
+void config_set_frequency(uint32_t frequency) { (void)frequency; }
+void config_set_symbolrate(uint32_t symbolrate) { (void)symbolrate; }
+void config_set_lnbv(bool enabled, bool horizontal) { (void)enabled; (void)horizontal; }
+bool config_set_tune(uint32_t frequency, uint32_t symbolrate, bool set_lnbv, bool enabled, bool horizontal)
+{
+    (void)frequency; (void)symbolrate; (void)set_lnbv; (void)enabled; (void)horizontal;
+    return true;
+}
+void config_set_swport(bool sport) { (void)sport; }
+void config_set_tsip(char *tsip) { (void)tsip; }
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Frames a TS into reads as the FTDI delivers it, as the TS generator does */
+static void bench_frame_reads(const uint8_t *ts, size_t len)
+{
+    size_t offset = 0;
+
+    bench_read_count = 0;
+    while (offset < len) {
+        offset += tsgen_frame(&bench_reads[(size_t)bench_read_count * TS_FRAME_SIZE],
+                              &bench_read_lens[bench_read_count], &ts[offset], len - offset);
+        bench_read_count++;
+    }
+}
+
+static uint8_t bench_load_capture(char *path)
+{
+    uint8_t err;
+    uint16_t len;
+
+    err = capture_replay_init(path, false);
+    bench_read_count = 0;
+    while (err == ERROR_NONE && bench_read_count < BENCH_READS * 4) {
+        err = capture_replay_ts_read(&bench_reads[(size_t)bench_read_count * TS_FRAME_SIZE], &len, TS_FRAME_SIZE);
+        /* Empty reads and the bare status bytes of an idle NIM carry no TS */
+        if (err == ERROR_NONE && len > 2) bench_read_lens[bench_read_count++] = len;
+    }
+    capture_replay_close();
+    if (err == ERROR_CAPTURE_END) err = ERROR_NONE;
+
+    return err;
+}
+
+static uint8_t bench_load_ts(char *path)
+{
+    FILE *file = fopen(path, "rb");
+    size_t max = (size_t)BENCH_READS * 4 * TSGEN_READ_TS_BYTES;
+    uint8_t *ts;
+    size_t len;
+    uint32_t magic = 0;
+
+    if (file == NULL) {
+        printf("ERROR: cannot open %s\n", path);
+        return ERROR_CAPTURE_OPEN;
+    }
+    if (fread(&magic, sizeof(magic), 1, file) == 1 && magic == CAPTURE_MAGIC) {
+        fclose(file);
+        return bench_load_capture(path);
+    }
+
+    /* Otherwise a plain TS, as recorded */
+    rewind(file);
+    ts = (uint8_t *)malloc(max);
+    len = fread(ts, 1, max, file);
+    fclose(file);
+    len -= len % TS_PACKET_SIZE;
+    bench_frame_reads(ts, len);
+    free(ts);
+
+    return ERROR_NONE;
+}
+
+/* Callbacks and sinks that do nothing but keep the compiler from discarding the work */
+
+static void bench_cb_sdt(uint8_t *provider, uint32_t *provider_len, uint8_t *name, uint32_t *name_len)
+{
+    (void)provider; (void)name;
+    bench_sink += *provider_len + *name_len;
+}
+
+static void bench_cb_pmt(uint32_t *index, uint32_t *pid, uint32_t *type)
+{
+    /* Times the first two streams of a capture, the video and audio of the synthetic TS */
+    if (*index == 0) pcrpts_set_pids(*pid, pcrpts_get_audio_pid());
+    if (*index == 1) pcrpts_set_pids(pcrpts_get_video_pid(), *pid);
+    bench_sink += *type;
+}
+
+static void bench_cb_stats(uint32_t *total, uint32_t *null_percentage)
+{
+    bench_sink += *total + *null_percentage;
+}
+
+static uint8_t bench_null_write(uint8_t message, uint32_t data, bool *output_ready)
+{
+    (void)output_ready;
+    bench_sink += message + data;
+    return ERROR_NONE;
+}
+
+static uint8_t bench_null_string_write(uint8_t message, char *data, bool *output_ready)
+{
+    (void)output_ready;
+    bench_sink += message + data[0];
+    return ERROR_NONE;
+}
+
+static void *bench_pipe_drain(void *arg)
+{
+    static uint8_t buffer[65536];
+    int fd = *(int *)arg;
+
+    while (read(fd, buffer, sizeof(buffer)) > 0) ;
+    return NULL;
+}
+
+/* The kernels, each one pass over the input */
+
+static void pass_ts_parse(bench_count_t *count)
+{
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        ts_parse(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2,
+                 bench_cb_sdt, bench_cb_pmt, bench_cb_stats, false);
+        count->ops++;
+        count->bytes += bench_read_lens[i];
+    }
+}
+
+static void pass_ts_align(bench_count_t *count)
+{
+    static uint8_t aligned[TS_FRAME_SIZE + TS_PACKET_SIZE];
+
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        bench_sink += ts_align(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2, aligned);
+        count->ops++;
+        count->bytes += bench_read_lens[i];
+    }
+}
+
+static void pass_udp_ts_write(bench_count_t *count)
+{
+    bool ready = true;
+
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        udp_ts_write(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2, &ready);
+        count->ops++;
+        count->bytes += bench_read_lens[i];
+    }
+}
+
+static void pass_fifo_ts_write(bench_count_t *count)
+{
+    bool ready = true;
+
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        fifo_ts_write(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2, &ready);
+        count->ops++;
+        count->bytes += bench_read_lens[i];
+    }
+}
+
+static void pass_crc32_mpeg2(bench_count_t *count)
+{
+    for (uint32_t i = 0; i < bench_packet_count; i++) {
+        bench_sink += crc32_mpeg2(&bench_packets[(size_t)i * TS_PACKET_SIZE], TS_PACKET_SIZE);
+        count->ops++;
+        count->bytes += TS_PACKET_SIZE;
+    }
+}
+
+static void pass_bbframe_crc8(bench_count_t *count)
+{
+    /* Over a BBHEADER's worth at the start of each packet, as the header hunt does at each offset */
+    for (uint32_t i = 0; i < bench_packet_count; i++) {
+        bench_sink += bbframe_crc8(&bench_packets[(size_t)i * TS_PACKET_SIZE], 9);
+        count->ops++;
+        count->bytes += 9;
+    }
+}
+
+static void pass_pcr(bench_count_t *count)
+{
+    for (uint32_t i = 0; i < bench_packet_count; i++) {
+        uint8_t *packet = &bench_packets[(size_t)i * TS_PACKET_SIZE];
+
+        if (PCRAvailable((char *)packet)) bench_sink += GetPCRFromPacket(packet);
+        count->ops++;
+        count->bytes += TS_PACKET_SIZE;
+    }
+}
+
+static void pass_pts(bench_count_t *count)
+{
+    unsigned long long pts, dts;
+    int pts_offset, dts_offset;
+
+    for (uint32_t i = 0; i < bench_packet_count; i++) {
+        uint8_t *packet = &bench_packets[(size_t)i * TS_PACKET_SIZE];
+
+        /* Only PES starts, as GetPTSFromPacket complains about packets without a payload */
+        if ((packet[1] & 0x40) && (packet[3] & 0x10)) {
+            bench_sink += GetPTSFromPacket(packet, &pts, &dts, &pts_offset, &dts_offset) + pts;
+        }
+        count->ops++;
+        count->bytes += TS_PACKET_SIZE;
+    }
+}
+
+static void pass_process_ts_timing(bench_count_t *count)
+{
+    size_t video_delay, audio_delay;
+    long transmission_delay;
+
+    /* In the blocks of 7 packets that udp_send_normalize() hands it */
+    for (uint32_t i = 0; i + 7 <= bench_packet_count; i += 7) {
+        ProcessTSTiming(&bench_packets[(size_t)i * TS_PACKET_SIZE], 7 * TS_PACKET_SIZE,
+                        &video_delay, &audio_delay, &transmission_delay);
+        count->ops++;
+        count->bytes += 7 * TS_PACKET_SIZE;
+    }
+}
+
+static void pass_json(json_format_t format, bench_count_t *count)
+{
+    static char buffer[JSON_BUFFER_SIZE_FULL];
+    status_fmt_t fmt;
+
+    for (uint32_t i = 0; i < BENCH_CYCLES; i++) {
+        status_fmt_init(&fmt, buffer, sizeof(buffer));
+        status_format_json(&fmt, format, 1, &bench_status, 1700000000000ULL + i, true);
+        count->ops++;
+        count->bytes += fmt.len;
+    }
+}
+
+static void pass_json_full(bench_count_t *count) { pass_json(JSON_FORMAT_FULL, count); }
+static void pass_json_compact(bench_count_t *count) { pass_json(JSON_FORMAT_COMPACT, count); }
+
+static void pass_mqtt_snapshot(bench_count_t *count)
+{
+    bool ready = true;
+
+    for (uint32_t i = 0; i < BENCH_CYCLES; i++) {
+        mqtt_status_snapshot(&bench_status, &ready);
+        count->ops++;
+    }
+}
+
+static void pass_mqtt_topics(bench_count_t *count)
+{
+    bool ready = true;
+
+    for (uint32_t i = 0; i < BENCH_CYCLES; i++) {
+        status_all_write(&bench_status, mqtt_status_write, mqtt_status_string_write, &ready);
+        count->ops++;
+    }
+}
+
+static void pass_status_all_write(bench_count_t *count)
+{
+    bool ready = true;
+
+    for (uint32_t i = 0; i < BENCH_CYCLES; i++) {
+        status_all_write(&bench_status, bench_null_write, bench_null_string_write, &ready);
+        count->ops++;
+    }
+}
+
+static void bench_run(const char *name, const char *unit, void (*pass)(bench_count_t *))
+{
+    bench_count_t count = { 0, 0 };
+    bench_result_t *result = &bench_results[bench_result_count++];
+    uint64_t start, elapsed;
+
+    /* One pass to warm the caches and let any first-time set up happen */
+    pass(&count);
+    count.ops = 0;
+    count.bytes = 0;
+
+    start = bench_now_ns();
+    do {
+        pass(&count);
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    result->name = name;
+    result->unit = unit;
+    result->ops = count.ops;
+    result->ns_per_op = (double)elapsed / count.ops;
+    result->mbytes_per_s = (count.bytes > 0) ? (double)count.bytes * 1000.0 / elapsed : 0;
+    if (result->mbytes_per_s > 0) {
+        printf("  %-28s %10.1f ns/%-7s %9.1f MB/s\n", name, result->ns_per_op, unit, result->mbytes_per_s);
+    } else {
+        printf("  %-28s %10.1f ns/%-7s\n", name, result->ns_per_op, unit);
+    }
+}
+
+static void bench_fill_status(longmynd_status_t *status)
+{
+    memset(status, 0, sizeof(longmynd_status_t));
+    status->state = STATE_DEMOD_S2;
+    status->demod_state = 2;
+    status->lna_ok = true;
+    status->lna_gain = 37;
+    status->agc1_gain = 4660;
+    status->agc2_gain = 1234;
+    status->power_i = 92;
+    status->power_q = 87;
+    status->frequency_requested = 741500;
+    status->frequency_offset = -12345;
+    status->symbolrate = 1500000;
+    status->modulation_error_rate = 90;
+    status->modcod = 7;
+    status->pilots = true;
+    status->matype1 = 0xf2;
+    status->ts_null_percentage = 20;
+    for (int count = 0; count < NUM_CONSTELLATIONS; count++) {
+        status->constellation[count][0] = (int8_t)((count * 37) % 256 - 128);
+        status->constellation[count][1] = (int8_t)((count * 91) % 256 - 128);
+    }
+    status->ts_elementary_streams[0][0] = TSGEN_PID_ES;
+    status->ts_elementary_streams[0][1] = 0x1b;
+    status->ts_elementary_streams[1][0] = TSGEN_PID_ES + 1;
+    status->ts_elementary_streams[1][1] = 0x0f;
+    strcpy(status->service_name, "A71A");
+    strcpy(status->service_provider_name, "QARS");
+}
+
+static void bench_write_results(const char *path, const char *input)
+{
+    FILE *file = fopen(path, "w");
+    struct utsname machine;
+
+    if (file == NULL) {
+        printf("ERROR: cannot write %s\n", path);
+        return;
+    }
+    uname(&machine);
+    fprintf(file, "kernel,unit,ops,ns_per_op,mbytes_per_s,input,machine,compiler\n");
+    for (uint32_t i = 0; i < bench_result_count; i++) {
+        fprintf(file, "%s,%s,%llu,%.2f,%.2f,%s,%s,\"%s\"\n", bench_results[i].name, bench_results[i].unit,
+                (unsigned long long)bench_results[i].ops, bench_results[i].ns_per_op, bench_results[i].mbytes_per_s,
+                input, machine.machine, __VERSION__);
+    }
+    fclose(file);
+    printf("Results written to %s\n", path);
+}
+
+int main(int argc, char *argv[])
+{
+    char *results_path = NULL;
+    char *input = NULL;
+    uint8_t *ts;
+    int pipe_fds[2];
+    int udp_fd;
+    struct sockaddr_in udp_addr;
+    socklen_t udp_addr_len = sizeof(udp_addr);
+    pthread_t drain;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        if (opt == 'o') results_path = optarg;
+        else {
+            printf("Usage: %s [-o results.csv] [capture or TS file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) input = argv[optind];
+
+    bench_reads = (uint8_t *)malloc((size_t)BENCH_READS * 4 * TS_FRAME_SIZE);
+    bench_read_lens = (uint16_t *)malloc(BENCH_READS * 4 * sizeof(uint16_t));
+    if (input == NULL) {
+        /* The TS generator's stream: a video PID carrying the PCR, an audio PID and 20% nulls at 2 Mbit/s */
+        if (tsgen_init((char *)"rate=2,pids=2,null=20,seconds=0") != ERROR_NONE) return 1;
+        ts = (uint8_t *)malloc((size_t)BENCH_READS * TSGEN_READ_TS_BYTES);
+        tsgen_ts(ts, (size_t)BENCH_READS * TSGEN_READ_TS_BYTES);
+        bench_frame_reads(ts, (size_t)BENCH_READS * TSGEN_READ_TS_BYTES);
+        free(ts);
+    } else if (bench_load_ts(input) != ERROR_NONE) {
+        return 1;
+    }
+    if (bench_read_count == 0) {
+        printf("ERROR: no TS in %s\n", input);
+        return 1;
+    }
+
+    bench_packets = (uint8_t *)malloc((size_t)bench_read_count * TS_FRAME_SIZE + TS_PACKET_SIZE);
+    bench_packet_count = 0;
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        bench_packet_count += ts_align(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2,
+                                       &bench_packets[(size_t)bench_packet_count * TS_PACKET_SIZE]) / TS_PACKET_SIZE;
+    }
+    printf("Input: %s, %u reads, %u packets\n", input != NULL ? input : "synthetic", bench_read_count,
+           bench_packet_count);
+
+    /* The UDP output goes to a socket of our own that is never read, the FIFO output to a drained pipe */
+    udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&udp_addr, 0, sizeof(udp_addr));
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(udp_fd, (struct sockaddr *)&udp_addr, sizeof(udp_addr));
+    getsockname(udp_fd, (struct sockaddr *)&udp_addr, &udp_addr_len);
+    udp_ts_init((char *)"127.0.0.1", ntohs(udp_addr.sin_port));
+    if (pipe(pipe_fds) != 0) return 1;
+    fd_ts_fifo = pipe_fds[1];
+    pthread_create(&drain, NULL, bench_pipe_drain, &pipe_fds[0]);
+
+    /* Learn the PIDs for the PCR/PTS timing, as the TS parse thread does */
+    for (uint32_t i = 0; i < bench_read_count; i++) {
+        ts_parse(&bench_reads[(size_t)i * TS_FRAME_SIZE + 2], bench_read_lens[i] - 2,
+                 bench_cb_sdt, bench_cb_pmt, bench_cb_stats, false);
+    }
+    bench_fill_status(&bench_status);
+    mqtt_status_configure(MQTT_SNAPSHOT_JSON);
+
+    printf("TS path:\n");
+    bench_run("ts_parse", "read", pass_ts_parse);
+    bench_run("ts_align (FTDI de-frame)", "read", pass_ts_align);
+    bench_run("udp_ts_write (normalize)", "read", pass_udp_ts_write);
+    bench_run("fifo_ts_write (pipe)", "read", pass_fifo_ts_write);
+    bench_run("crc32_mpeg2", "packet", pass_crc32_mpeg2);
+    bench_run("bbframe_crc8", "header", pass_bbframe_crc8);
+    bench_run("GetPCRFromPacket", "packet", pass_pcr);
+    bench_run("GetPTSFromPacket", "packet", pass_pts);
+    bench_run("ProcessTSTiming", "7 pkts", pass_process_ts_timing);
+
+    printf("Status path:\n");
+    bench_run("status_format_json full", "cycle", pass_json_full);
+    bench_run("status_format_json compact", "cycle", pass_json_compact);
+    bench_run("mqtt_status_snapshot", "cycle", pass_mqtt_snapshot);
+    status_delta_init(0);
+    bench_run("mqtt_status_write (topics)", "cycle", pass_mqtt_topics);
+    bench_run("status_all_write keyframe", "cycle", pass_status_all_write);
+    status_delta_init(STATUS_DEFAULT_KEYFRAME_SECONDS);
+    bench_run("status_all_write delta", "cycle", pass_status_all_write);
+
+    close(pipe_fds[1]);
+    pthread_join(drain, NULL);
+    close(udp_fd);
+
+    if (results_path != NULL) bench_write_results(results_path, input != NULL ? input : "synthetic");
+
+    return 0;
+}
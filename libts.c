@@ -64,7 +64,7 @@ static const uint32_t crc32_mpeg2_table[256] = {
     0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-static uint32_t crc32_mpeg2(uint8_t *data_ptr, size_t length)
+uint32_t crc32_mpeg2(uint8_t *data_ptr, size_t length)
 {
     uint32_t crc;
 
@@ -35,6 +35,8 @@
 
 #define TS_MAX_PID  8192
 
+uint32_t crc32_mpeg2(uint8_t *data_ptr, size_t length);
+
 void ts_parse(
     uint8_t *ts_buffer, uint32_t ts_buffer_length,
     void (*callback_sdt_service)(uint8_t *, uint32_t *, uint8_t *, uint32_t *),
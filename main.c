@@ -48,8 +48,23 @@
 #include "beep.h"
 #include "ts.h"
 #include "register_logging.h"
+#include "register_trace.h"
 #include "json_output.h"
 #include "mymqtt.h"
+#include "recorder.h"
+#include "timeshift.h"
+#include "web.h"
+#include "hls.h"
+#include "bbframe.h"
+#include "tsring.h"
+#include "status_shm.h"
+#include "status.h"
+#include "status_sink.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "capture.h"
+#include "nim_sim.h"
+#include "tsgen.h"
 
 /* -------------------------------------------------------------------------------------------------- */
 /* ----------------- DEFINES ------------------------------------------------------------------------ */
@@ -58,6 +73,12 @@
 /* Milliseconds between each i2c control loop */
 #define I2C_LOOP_MS 500
 
+/* A config change is held until nothing more has arrived for this long, so that a burst of commands */
+/* is applied with a single hardware reinit                                                          */
+#define CONFIG_COALESCE_MS 200
+/* ...but a steady stream of them, eg. from a slider, is not held up for longer than this */
+#define CONFIG_COALESCE_MAX_MS 1000
+
 /* -------------------------------------------------------------------------------------------------- */
 /* ----------------- GLOBALS ------------------------------------------------------------------------ */
 /* -------------------------------------------------------------------------------------------------- */
@@ -90,19 +111,72 @@ static pthread_t thread_beep;
 /* ----------------- ROUTINES ----------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------------------------------- */
 
+uint64_t monotonic_ms(void);
+
+/* -------------------------------------------------------------------------------------------------- */
+static void config_changed(void)
+/* -------------------------------------------------------------------------------------------------- */
+/* marks the config changed, with the config mutex held. loop_i2c only applies it once nothing more  */
+/* has arrived for CONFIG_COALESCE_MS, so that eg. a frequency then a symbol rate cost one reinit     */
+/* -------------------------------------------------------------------------------------------------- */
+{
+    uint64_t now = monotonic_ms();
+
+    if (!longmynd_config.new_config || longmynd_config.new_config_changes == 0)
+    {
+        longmynd_config.new_config_first_monotonic = now;
+        longmynd_config.new_config_changes = 0;
+    }
+    longmynd_config.new_config_last_monotonic = now;
+    longmynd_config.new_config_changes++;
+    longmynd_config.new_config = true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool config_frequency_valid(uint32_t frequency)
+/* -------------------------------------------------------------------------------------------------- */
+{
+    return (frequency <= 2450000 && frequency >= 144000);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool config_symbolrate_valid(uint32_t symbolrate)
+/* -------------------------------------------------------------------------------------------------- */
+{
+    return (symbolrate <= 27500 && symbolrate >= 33);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void config_frequency_locked(uint32_t frequency)
+/* -------------------------------------------------------------------------------------------------- */
+{
+    longmynd_config.freq_requested[0] = frequency;
+    longmynd_config.freq_requested[1] = 0;
+    longmynd_config.freq_requested[2] = 0;
+    longmynd_config.freq_requested[3] = 0;
+    longmynd_config.freq_index = 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void config_symbolrate_locked(uint32_t symbolrate)
+/* -------------------------------------------------------------------------------------------------- */
+{
+    longmynd_config.sr_requested[0] = symbolrate;
+    longmynd_config.sr_requested[1] = 0;
+    longmynd_config.sr_requested[2] = 0;
+    longmynd_config.sr_requested[3] = 0;
+    longmynd_config.sr_index = 0;
+}
+
 /* NB: This overwrites any multiple-frequency config */
 void config_set_frequency(uint32_t frequency)
 {
-    if (frequency <= 2450000 && frequency >= 144000)
+    if (config_frequency_valid(frequency))
     {
         pthread_mutex_lock(&longmynd_config.mutex);
 
-        longmynd_config.freq_requested[0] = frequency;
-        longmynd_config.freq_requested[1] = 0;
-        longmynd_config.freq_requested[2] = 0;
-        longmynd_config.freq_requested[3] = 0;
-        longmynd_config.freq_index = 0;
-        longmynd_config.new_config = true;
+        config_frequency_locked(frequency);
+        config_changed();
 
         pthread_mutex_unlock(&longmynd_config.mutex);
     }
@@ -111,16 +185,12 @@ void config_set_frequency(uint32_t frequency)
 /* NB: This overwrites any multiple-symbolrate config */
 void config_set_symbolrate(uint32_t symbolrate)
 {
-    if (symbolrate <= 27500 && symbolrate >= 33)
+    if (config_symbolrate_valid(symbolrate))
     {
         pthread_mutex_lock(&longmynd_config.mutex);
 
-        longmynd_config.sr_requested[0] = symbolrate;
-        longmynd_config.sr_requested[1] = 0;
-        longmynd_config.sr_requested[2] = 0;
-        longmynd_config.sr_requested[3] = 0;
-        longmynd_config.sr_index = 0;
-        longmynd_config.new_config = true;
+        config_symbolrate_locked(symbolrate);
+        config_changed();
 
         pthread_mutex_unlock(&longmynd_config.mutex);
     }
@@ -129,26 +199,34 @@ void config_set_symbolrate(uint32_t symbolrate)
 /* NB: This overwrites any multiple-frequency or multiple-symbolrate config */
 void config_set_frequency_and_symbolrate(uint32_t frequency, uint32_t symbolrate)
 {
-    if (frequency <= 2450000 && frequency >= 144000 && symbolrate <= 27500 && symbolrate >= 33)
-    {
-        pthread_mutex_lock(&longmynd_config.mutex);
-
-        longmynd_config.freq_requested[0] = frequency;
-        longmynd_config.freq_requested[1] = 0;
-        longmynd_config.freq_requested[2] = 0;
-        longmynd_config.freq_requested[3] = 0;
-        longmynd_config.freq_index = 0;
+    config_set_tune(frequency, symbolrate, false, false, false);
+}
 
-        longmynd_config.sr_requested[0] = symbolrate;
-        longmynd_config.sr_requested[1] = 0;
-        longmynd_config.sr_requested[2] = 0;
-        longmynd_config.sr_requested[3] = 0;
-        longmynd_config.sr_index = 0;
+/* NB: This overwrites any multiple-frequency or multiple-symbolrate config */
+bool config_set_tune(uint32_t frequency, uint32_t symbolrate, bool set_lnbv, bool enabled, bool horizontal)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* sets the frequency, symbol rate and optionally the LNB supply as one change; nothing is changed   */
+    /* unless all of it is valid                                                                         */
+    /* return: true if the change was accepted                                                           */
+    /* -------------------------------------------------------------------------------------------------- */
+    if (!config_frequency_valid(frequency) || !config_symbolrate_valid(symbolrate))
+        return false;
 
-        longmynd_config.new_config = true;
+    pthread_mutex_lock(&longmynd_config.mutex);
 
-        pthread_mutex_unlock(&longmynd_config.mutex);
+    config_frequency_locked(frequency);
+    config_symbolrate_locked(symbolrate);
+    if (set_lnbv)
+    {
+        longmynd_config.polarisation_supply = enabled;
+        longmynd_config.polarisation_horizontal = horizontal;
     }
+    config_changed();
+
+    pthread_mutex_unlock(&longmynd_config.mutex);
+
+    return true;
 }
 
 void config_set_lnbv(bool enabled, bool horizontal)
@@ -157,7 +235,7 @@ void config_set_lnbv(bool enabled, bool horizontal)
 
     longmynd_config.polarisation_supply = enabled;
     longmynd_config.polarisation_horizontal = horizontal;
-    longmynd_config.new_config = true;
+    config_changed();
 
     pthread_mutex_unlock(&longmynd_config.mutex);
 }
@@ -168,7 +246,7 @@ void config_set_swport(bool sport)
 
     printf("swport: %d\n",sport);
     longmynd_config.port_swap = sport;
-    longmynd_config.new_config = true;
+    config_changed();
 
     pthread_mutex_unlock(&longmynd_config.mutex);
 }
@@ -179,7 +257,7 @@ void config_set_tsip(char *tsip)
 
     strcpy(longmynd_config.ts_ip_addr, tsip);
     udp_ts_init(tsip,1234);
-    longmynd_config.new_config = true;
+    config_changed();
 
     pthread_mutex_unlock(&longmynd_config.mutex);
 }
@@ -264,17 +342,55 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
     config->status_use_mqtt = false;
     strcpy(config->ts_fifo_path, "longmynd_main_ts");
     config->status_use_ip = false;
+    config->status_use_fifo = false;
     strcpy(config->status_fifo_path, "longmynd_main_status");
+    config->status_fifo_max_rate = 0;
+    config->status_udp_max_rate = 0;
     config->polarisation_supply = false;
     char polarisation_str[8];
     config->ts_timeout = 50 * 1000;
+    config->capture_enabled = false;
+    config->replay_enabled = false;
+    config->replay_realtime = true;
+    config->nim_sim_enabled = false;
+    config->tsgen_enabled = false;
     config->disable_demod_suppression = false;
+    strcpy(config->register_trace_path, REGISTER_TRACE_DEFAULT_PATH);
+    config->register_trace_dump_on_exit = false;
+    config->timeline_enabled = false;
+    strcpy(config->timeline_path, TIMELINE_DEFAULT_PATH);
+    config->recorder_enabled = false;
+    config->recorder_segment_seconds = RECORDER_DEFAULT_SEGMENT_SECONDS;
+    config->recorder_segment_mbytes = RECORDER_DEFAULT_SEGMENT_MBYTES;
+    config->tsring_enabled = false;
+    config->tsring_mbytes = TSRING_DEFAULT_MBYTES;
+    config->timeshift_enabled = false;
+    config->timeshift_seconds = TIMESHIFT_DEFAULT_SECONDS;
+    config->timeshift_mbps = TIMESHIFT_DEFAULT_MBPS;
+    strcpy(config->timeshift_backing, TIMESHIFT_BACKING_MEMORY);
+    strcpy(config->timeshift_control_addr, TIMESHIFT_CONTROL_ADDR);
+    config->timeshift_control_port = 0;
+    config->timeshift_export_dir[0] = '\0';
+    config->timeshift_stream_allow[0] = '\0';
+    config->gse_enabled = false;
+    config->hls_enabled = false;
+    config->hls_segment_seconds = HLS_DEFAULT_SEGMENT_SECONDS;
+    config->hls_playlist_length = HLS_DEFAULT_PLAYLIST_LENGTH;
+    config->web_enabled = false;
+    config->web_port = 0;
+    config->status_keyframe_seconds = STATUS_DEFAULT_KEYFRAME_SECONDS;
+    config->status_binary = false;
+    config->status_shm_enabled = false;
+    config->status_mqtt_snapshot = MQTT_SNAPSHOT_NONE;
+    config->status_mqtt_max_rate = 0;
 
     /* JSON output defaults */
     config->json_output_enabled = false;
     config->json_output_interval_ms = 1000;
     config->json_output_format = 0;  /* 0=full, 1=compact, 2=minimal */
     config->json_include_constellation = false;
+    strcpy(config->json_output_target, "stdout");
+    config->json_output_rotate_mbytes = JSON_OUTPUT_DEFAULT_ROTATE_MBYTES;
 
     param = 1;
     while (param < argc - 2)
@@ -305,8 +421,8 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
                 status_ip_set = true;
                 break;
             case 'M':
-                strncpy(config->status_ip_addr, argv[param++], (16 - 1));
-                config->status_ip_port = (uint16_t)strtol(argv[param], NULL, 10);
+                strncpy(config->status_mqtt_addr, argv[param++], (16 - 1));
+                config->status_mqtt_port = (uint16_t)strtol(argv[param], NULL, 10);
                 config->status_use_mqtt = true;
                 status_mqtt_set = true;
                 break;
@@ -336,6 +452,34 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
                 config->disable_demod_suppression = true;
                 param--; /* there is no data for this so go back */
                 break;
+            case 'T':
+                strncpy(config->register_trace_path, argv[param], (128 - 1));
+                config->register_trace_dump_on_exit = true;
+                break;
+            case 'E':
+                strncpy(config->timeline_path, argv[param], (128 - 1));
+                config->timeline_enabled = true;
+                break;
+            case 'c':
+                strncpy(config->capture_path, argv[param], (128 - 1));
+                config->capture_enabled = true;
+                break;
+            case 'P':
+                strncpy(config->replay_path, argv[param], (128 - 1));
+                config->replay_enabled = true;
+                break;
+            case 'a':
+                config->replay_realtime = false;
+                param--; /* there is no data for this so go back */
+                break;
+            case 'N':
+                strncpy(config->nim_sim_settings, argv[param], (128 - 1));
+                config->nim_sim_enabled = true;
+                break;
+            case 'g':
+                strncpy(config->tsgen_settings, argv[param], (128 - 1));
+                config->tsgen_enabled = true;
+                break;
             case 'j':
                 config->json_output_enabled = true;
                 param--; /* there is no data for this so go back */
@@ -361,11 +505,148 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
                 config->json_include_constellation = true;
                 param--; /* there is no data for this so go back */
                 break;
+            case 'O':
+                strncpy(config->json_output_target, argv[param], (128 - 1));
+                config->json_output_enabled = true;
+                break;
+            case 'o':
+                config->json_output_rotate_mbytes = (uint32_t)strtol(argv[param], NULL, 10);
+                break;
+            case 'R':
+                strncpy(config->recorder_path, argv[param++], (128 - 1));
+                if (sscanf(argv[param], "%u,%u", &config->recorder_segment_seconds, &config->recorder_segment_mbytes) != 2)
+                {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: Recorder rotation must be given as <seconds>,<megabytes>\n");
+                }
+                config->recorder_enabled = true;
+                break;
+            case 'Z':
+                strncpy(config->tsring_name, argv[param++], (128 - 1));
+                config->tsring_mbytes = (uint32_t)strtol(argv[param], NULL, 10);
+                config->tsring_enabled = true;
+                break;
+            case 'x':
+                if (sscanf(argv[param++], "%u,%u", &config->timeshift_seconds, &config->timeshift_mbps) != 2)
+                {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: Timeshift size must be given as <seconds>,<Mbit/s>\n");
+                }
+                strncpy(config->timeshift_backing, argv[param], (128 - 1));
+                config->timeshift_enabled = true;
+                break;
+            case 'X':
+                /* [address:]port, listening on loopback only unless an address is given */
+                if (strchr(argv[param], ':') != NULL)
+                {
+                    if (sscanf(argv[param], "%15[^:]:%i", config->timeshift_control_addr, &config->timeshift_control_port) != 2)
+                    {
+                        err = ERROR_ARGS_INPUT;
+                        printf("ERROR: Timeshift control must be given as [<address>:]<port>\n");
+                    }
+                }
+                else
+                {
+                    config->timeshift_control_port = (int)strtol(argv[param], NULL, 10);
+                }
+                break;
+            case 'e':
+                strncpy(config->timeshift_export_dir, argv[param], (128 - 1));
+                break;
+            case 'A':
+                strncpy(config->timeshift_stream_allow, argv[param], (128 - 1));
+                break;
+            case 'G':
+                strncpy(config->gse_output, argv[param], (128 - 1));
+                config->gse_enabled = true;
+                break;
+            case 'L':
+                if (sscanf(argv[param], "%u,%u", &config->hls_segment_seconds, &config->hls_playlist_length) != 2)
+                {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: HLS segmenting must be given as <seconds>,<segments>\n");
+                }
+                config->hls_enabled = true;
+                break;
+            case 'H':
+                config->web_port = (int)strtol(argv[param], NULL, 10);
+                config->web_enabled = true;
+                break;
+            case 'k':
+                config->status_keyframe_seconds = (uint32_t)strtol(argv[param], NULL, 10);
+                break;
+            case 'B':
+                config->status_binary = true;
+                param--; /* there is no data for this so go back */
+                break;
+            case 'Q':
+                if (strcmp(argv[param], "json") == 0) {
+                    config->status_mqtt_snapshot = MQTT_SNAPSHOT_JSON;
+                } else if (strcmp(argv[param], "binary") == 0) {
+                    config->status_mqtt_snapshot = MQTT_SNAPSHOT_BINARY;
+                } else {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: MQTT snapshot format must be 'json' or 'binary'\n");
+                }
+                break;
+            case 'q':
+                config->status_mqtt_max_rate = (uint32_t)strtol(argv[param], NULL, 10);
+                break;
+            case 'U':
+            {
+                char sink[8];
+                uint32_t max_rate;
+                if (sscanf(argv[param], "%7[a-z],%u", sink, &max_rate) != 2)
+                {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: Status sink rate must be given as fifo|udp|mqtt,<updates per second>\n");
+                }
+                else if (strcmp(sink, "fifo") == 0)
+                    config->status_fifo_max_rate = max_rate;
+                else if (strcmp(sink, "udp") == 0)
+                    config->status_udp_max_rate = max_rate;
+                else if (strcmp(sink, "mqtt") == 0)
+                    config->status_mqtt_max_rate = max_rate;
+                else
+                {
+                    err = ERROR_ARGS_INPUT;
+                    printf("ERROR: Status sink must be fifo, udp or mqtt\n");
+                }
+                break;
+            }
+            case 'Y':
+                strncpy(config->status_shm_name, argv[param], (128 - 1));
+                config->status_shm_enabled = true;
+                break;
             }
         }
         param++;
     }
 
+    if (config->hls_enabled && !config->web_enabled)
+    {
+        err = ERROR_ARGS_INPUT;
+        printf("ERROR: HLS output needs the HTTP server (-H).\n");
+    }
+
+    if (!config->replay_enabled && !config->replay_realtime)
+    {
+        err = ERROR_ARGS_INPUT;
+        printf("ERROR: Replaying as fast as possible (-a) needs a capture to replay (-P).\n");
+    }
+
+    if (config->capture_enabled && config->replay_enabled && 0 == strcmp(config->capture_path, config->replay_path))
+    {
+        err = ERROR_ARGS_INPUT;
+        printf("ERROR: Cannot capture to the capture being replayed.\n");
+    }
+
+    if (config->tsgen_enabled && (config->replay_enabled || config->nim_sim_enabled))
+    {
+        err = ERROR_ARGS_INPUT;
+        printf("ERROR: The TS generator (-g) cannot be used with a replay (-P) or the simulated NIM (-N).\n");
+    }
+
     if ((argc - param) < 2)
     {
         err = ERROR_ARGS_INPUT;
@@ -558,6 +839,9 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
             }
         }
     }
+    /* The status FIFO is there by default, and alongside UDP or MQTT if it is named with -s */
+    config->status_use_fifo = status_fifo_set || (!status_ip_set && !status_mqtt_set);
+
     if (err == ERROR_NONE)
     {
         if (ts_ip_set && ts_fifo_set)
@@ -565,11 +849,6 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
             err = ERROR_ARGS_INPUT;
             printf("ERROR: Cannot set TS FIFO and TS IP address\n");
         }
-        else if (status_ip_set && status_fifo_set)
-        {
-            err = ERROR_ARGS_INPUT;
-            printf("ERROR: Cannot set Status FIFO and Status IP address\n");
-        }
         else if (config->ts_use_ip && config->status_use_ip && (config->ts_ip_port == config->status_ip_port) && (0 == strcmp(config->ts_ip_addr, config->status_ip_addr)))
         {
             err = ERROR_ARGS_INPUT;
@@ -592,7 +871,16 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
             {
                 printf("              Alternative Symbol Rate=%i KSymbols/s\n", config->sr_requested[i]);
             }
-            if (!main_usb_set)
+            if (config->replay_enabled)
+                printf("              Replaying TS reads from %s %s\n", config->replay_path,
+                       config->replay_realtime ? "in real time" : "as fast as possible");
+            if (config->tsgen_enabled)
+                printf("              TS generator (%s) in place of the TS endpoint\n", config->tsgen_settings);
+            if (config->nim_sim_enabled)
+                printf("              Simulated NIM (%s), no Minitiouner used\n", config->nim_sim_settings);
+            else if (config->replay_enabled || config->tsgen_enabled)
+                printf("              No Minitiouner used, the receiver is not run\n");
+            else if (!main_usb_set)
                 printf("              Using First Minitiouner detected on USB\n");
             else
                 printf("              USB bus/device=%i,%i\n", config->device_usb_bus, config->device_usb_addr);
@@ -600,10 +888,16 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
                 printf("              Main TS output to FIFO=%s\n", config->ts_fifo_path);
             else
                 printf("              Main TS output to IP=%s:%i\n", config->ts_ip_addr, config->ts_ip_port);
-            if (!config->status_use_ip)
+            if (config->status_use_fifo)
                 printf("              Main Status output to FIFO=%s\n", config->status_fifo_path);
-            else
+            if (config->status_use_ip)
                 printf("              Main Status output to IP=%s:%i\n", config->status_ip_addr, config->status_ip_port);
+            if (config->status_use_mqtt)
+                printf("              Main Status output to MQTT broker=%s\n", config->status_mqtt_addr);
+            if (config->status_fifo_max_rate != 0)
+                printf("              Status FIFO updated at most %u times a second\n", config->status_fifo_max_rate);
+            if (config->status_udp_max_rate != 0)
+                printf("              Status UDP sent at most %u times a second\n", config->status_udp_max_rate);
             if (config->port_swap)
                 printf("              NIM inputs are swapped (Main now refers to BOTTOM F-Type\n");
             else
@@ -618,12 +912,56 @@ uint8_t process_command_line(int argc, char *argv[], longmynd_config_t *config)
                 printf("              TS Timeout Disabled.\n");
             if (config->disable_demod_suppression)
                 printf("              Demod Suppression Disabled\n");
+            printf("              Register trace dumped to %s on SIGUSR1%s\n", config->register_trace_path,
+                   config->register_trace_dump_on_exit ? " and on exit" : "");
+            if (config->timeline_enabled)
+                printf("              Timeline dumped to %s on SIGUSR2 and on exit\n", config->timeline_path);
+            if (config->capture_enabled)
+                printf("              Capturing TS reads to %s\n", config->capture_path);
+            if (config->recorder_enabled)
+                printf("              Recording TS to %s, rotating every %u seconds or %u MB\n",
+                       config->recorder_path, config->recorder_segment_seconds, config->recorder_segment_mbytes);
+            if (config->tsring_enabled)
+                printf("              TS shared memory ring %s of %u MB\n", config->tsring_name, config->tsring_mbytes);
+            if (config->timeshift_enabled)
+                printf("              Timeshift ring of %u seconds at up to %u Mbit/s in %s\n",
+                       config->timeshift_seconds, config->timeshift_mbps, config->timeshift_backing);
+            if (config->timeshift_control_port != 0)
+                printf("              Timeshift control on UDP %s:%i\n", config->timeshift_control_addr, config->timeshift_control_port);
+            if (config->timeshift_export_dir[0] != '\0')
+                printf("              Timeshift exports written to %s\n", config->timeshift_export_dir);
+            if (config->timeshift_stream_allow[0] != '\0')
+                printf("              Timeshift streams allowed to loopback and %s\n", config->timeshift_stream_allow);
+            if (config->web_enabled)
+                printf("              HTTP server on port %i\n", config->web_port);
+            if (config->gse_enabled)
+                printf("              GSE decapsulated to %s\n", config->gse_output);
+            if (config->status_keyframe_seconds == 0)
+                printf("              Status sent in full on every update\n");
+            else
+                printf("              Status sent as changes, in full every %u seconds\n", config->status_keyframe_seconds);
+            if (config->status_binary)
+                printf("              Status sent in binary frames\n");
+            if (config->status_shm_enabled)
+                printf("              Status shared memory mailbox %s\n", config->status_shm_name);
+            if (config->status_mqtt_snapshot != MQTT_SNAPSHOT_NONE)
+                printf("              MQTT status as one %s snapshot per update on %s\n",
+                       (config->status_mqtt_snapshot == MQTT_SNAPSHOT_JSON) ? "JSON" : "binary", MQTT_SNAPSHOT_TOPIC);
+            if (config->status_mqtt_max_rate != 0)
+                printf("              MQTT status published at most %u times a second\n", config->status_mqtt_max_rate);
+            if (config->hls_enabled)
+                printf("              HLS playlist of %u x %u second segments\n",
+                       config->hls_playlist_length, config->hls_segment_seconds);
             if (config->json_output_enabled) {
                 const char *format_names[] = {"full", "compact", "minimal"};
                 printf("              JSON Output Enabled: format=%s, interval=%ums\n",
                        format_names[config->json_output_format], config->json_output_interval_ms);
                 if (config->json_include_constellation)
                     printf("              JSON includes constellation data\n");
+                printf("              JSON written to %s", config->json_output_target);
+                if (strncmp(config->json_output_target, "file:", 5) == 0 && config->json_output_rotate_mbytes != 0)
+                    printf(", rotated every %u MB", config->json_output_rotate_mbytes);
+                printf("\n");
             }
         }
     }
@@ -862,11 +1200,16 @@ static uint8_t handle_configuration_change(thread_vars_t *thread_vars, longmynd_
 
     fprintf(stderr,"New Config !!!!!!!!!\n");
     /* Lock config struct - PRESERVE EXACT MUTEX USAGE */
+    timeline_begin(TIMELINE_CONFIG_MUTEX_WAIT);
     pthread_mutex_lock(&thread_vars->config->mutex);
+    timeline_end(TIMELINE_CONFIG_MUTEX_WAIT);
     /* Clone status struct locally */
     memcpy(config_cpy, thread_vars->config, sizeof(longmynd_config_t));
-    /* Clear new config flag */
+    /* Clear new config flag, the copy keeps the changes it carries */
     thread_vars->config->new_config = false;
+    thread_vars->config->new_config_changes = 0;
+    if (config_cpy->new_config_changes > 0)
+        config_cpy->config_transaction = ++thread_vars->config->config_transaction;
     /* Set flag to clear ts buffer */
     thread_vars->config->ts_reset = true;
     pthread_mutex_unlock(&thread_vars->config->mutex);
@@ -894,9 +1237,43 @@ static uint8_t handle_configuration_change(thread_vars_t *thread_vars, longmynd_
 
     status_cpy->last_ts_or_reinit_monotonic = monotonic_ms();
 
+    /* Report commanded changes once the hardware has them */
+    if (config_cpy->new_config_changes > 0)
+    {
+        uint32_t elapsed_ms = (uint32_t)(monotonic_ms() - config_cpy->new_config_first_monotonic);
+
+        printf("Flow: Config %u applied, %u changes, %u KHz %u KSymbols/s, in %u ms\n",
+               config_cpy->config_transaction, config_cpy->new_config_changes,
+               config_cpy->freq_requested[config_cpy->freq_index], config_cpy->sr_requested[config_cpy->sr_index],
+               elapsed_ms);
+        if (config_cpy->status_use_mqtt)
+            mqtt_config_applied(config_cpy, local_err, elapsed_ms);
+    }
+
     return local_err;
 }
 
+/* -------------------------------------------------------------------------------------------------- */
+static bool config_change_settled(longmynd_config_t *config)
+/* -------------------------------------------------------------------------------------------------- */
+/* whether a pending config change has had CONFIG_COALESCE_MS without anything more arriving, or has */
+/* been pending for CONFIG_COALESCE_MAX_MS                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+{
+    uint64_t now = monotonic_ms();
+    bool settled;
+
+    timeline_begin(TIMELINE_CONFIG_MUTEX_WAIT);
+    pthread_mutex_lock(&config->mutex);
+    timeline_end(TIMELINE_CONFIG_MUTEX_WAIT);
+    settled = config->new_config
+           && (now - config->new_config_last_monotonic >= CONFIG_COALESCE_MS
+               || (config->new_config_changes > 0 && now - config->new_config_first_monotonic >= CONFIG_COALESCE_MAX_MS));
+    pthread_mutex_unlock(&config->mutex);
+
+    return settled;
+}
+
 /* -------------------------------------------------------------------------------------------------- */
 /* STATUS SYNCHRONIZATION FUNCTIONS                                                                   */
 /* -------------------------------------------------------------------------------------------------- */
@@ -906,62 +1283,23 @@ static void update_status_synchronization(longmynd_status_t *status, longmynd_st
                                          uint32_t *last_ts_packet_count)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* Updates TS packet tracking and synchronizes local status with global status                     */
-    /* Preserves exact mutex usage and pthread signaling                                               */
+    /* Updates TS packet tracking and publishes the local status to the global status                  */
     /* status: global status structure                                                                  */
     /* status_cpy: local status copy                                                                    */
     /* last_ts_packet_count: last TS packet count for tracking                                         */
     /* -------------------------------------------------------------------------------------------------- */
 
-    /* Update TS packet tracking - PRESERVE EXACT LOGIC */
-    if (status->ts_packet_count_nolock > 0 && *last_ts_packet_count != status->ts_packet_count_nolock)
-    {
-        status_cpy->last_ts_or_reinit_monotonic = monotonic_ms();
-        *last_ts_packet_count = status->ts_packet_count_nolock;
-    }
+    uint32_t ts_packet_count = status_get_ts_bytes(status);
 
-    /* Copy local status data over global object - PRESERVE EXACT MUTEX USAGE */
-    pthread_mutex_lock(&status->mutex);
-
-    /* Copy out other vars - PRESERVE EXACT FIELD ASSIGNMENTS */
-    status->state = status_cpy->state;
-    status->demod_state = status_cpy->demod_state;
-    status->lna_ok = status_cpy->lna_ok;
-    status->lna_gain = status_cpy->lna_gain;
-    status->agc1_gain = status_cpy->agc1_gain;
-    status->agc2_gain = status_cpy->agc2_gain;
-    status->power_i = status_cpy->power_i;
-    status->power_q = status_cpy->power_q;
-    status->frequency_requested = status_cpy->frequency_requested;
-    status->frequency_offset = status_cpy->frequency_offset;
-    status->polarisation_supply = status_cpy->polarisation_supply;
-    status->polarisation_horizontal = status_cpy->polarisation_horizontal;
-    status->symbolrate_requested = status_cpy->symbolrate_requested;
-    status->symbolrate = status_cpy->symbolrate;
-    status->viterbi_error_rate = status_cpy->viterbi_error_rate;
-    status->bit_error_rate = status_cpy->bit_error_rate;
-    status->modulation_error_rate = status_cpy->modulation_error_rate;
-    status->errors_bch_uncorrected = status_cpy->errors_bch_uncorrected;
-    status->errors_bch_count = status_cpy->errors_bch_count;
-    status->errors_ldpc_count = status_cpy->errors_ldpc_count;
-    memcpy(status->constellation, status_cpy->constellation, (sizeof(uint8_t) * NUM_CONSTELLATIONS * 2));
-    status->puncture_rate = status_cpy->puncture_rate;
-    status->modcod = status_cpy->modcod;
-    status->matype1 = status_cpy->matype1;
-    status->matype2 = status_cpy->matype2;
-    status->short_frame = status_cpy->short_frame;
-    status->pilots = status_cpy->pilots;
-    status->rolloff = status_cpy->rolloff;
-    if (status_cpy->last_ts_or_reinit_monotonic != 0)
+    /* Any TS since the last loop counts as activity for the no-data timeout */
+    if (ts_packet_count > 0 && *last_ts_packet_count != ts_packet_count)
     {
-        status->last_ts_or_reinit_monotonic = status_cpy->last_ts_or_reinit_monotonic;
+        status_cpy->last_ts_or_reinit_monotonic = monotonic_ms();
+        *last_ts_packet_count = ts_packet_count;
     }
 
-    /* Set monotonic value to signal new data - PRESERVE EXACT SIGNALING */
-    status->last_updated_monotonic = monotonic_ms();
-    /* Trigger pthread signal */
-    pthread_cond_signal(&status->signal);
-    pthread_mutex_unlock(&status->mutex);
+    /* Publish the demodulator block; readers never wait on this, nor it on them */
+    status_demod_publish(status, status_cpy);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1095,6 +1433,8 @@ void *loop_i2c(void *arg)
     longmynd_status_t status_cpy;
 
     uint32_t last_ts_packet_count = 0;
+    uint64_t cycle_start_ns, json_start_ns;
+    uint8_t last_state;
 
     uint64_t last_i2c_loop = monotonic_ms();
     while (*err == ERROR_NONE && *thread_vars->main_err_ptr == ERROR_NONE)
@@ -1106,13 +1446,19 @@ void *loop_i2c(void *arg)
             usleep(100 * 1000);
         } while (monotonic_ms() < (last_i2c_loop + I2C_LOOP_MS));
 
+        cycle_start_ns = metrics_now_ns();
+        timeline_begin(TIMELINE_I2C_CYCLE);
         status_cpy.last_ts_or_reinit_monotonic = 0;
 
         /* Check if there's a new config */
-        if (thread_vars->config->new_config)
+        if (thread_vars->config->new_config && config_change_settled(thread_vars->config))
         {
+            timeline_begin(TIMELINE_CONFIG_CHANGE);
             handle_configuration_change(thread_vars, &config_cpy, &status_cpy, err);
+            timeline_end(TIMELINE_CONFIG_CHANGE);
+            metric_add(METRIC_REINITS, 1);
         }
+        last_state = status_cpy.state;
 
         /* Main receiver state machine - PRESERVE EXACT BEHAVIOR */
         /* Update status from hardware */
@@ -1123,129 +1469,34 @@ void *loop_i2c(void *arg)
         if (*err == ERROR_NONE)
             process_demodulator_state_transition(&status_cpy, err);
 
+        if (status_cpy.state != last_state && status_cpy.state >= STATE_DEMOD_HUNTING
+            && status_cpy.state <= STATE_DEMOD_S2)
+            metric_add((metric_counter_t)(METRIC_DEMOD_TO_HUNTING + status_cpy.state - STATE_DEMOD_HUNTING), 1);
+        metric_set(METRIC_RECEIVER_STATE, status_cpy.state);
+
         /* Update TS packet tracking and synchronize status */
         update_status_synchronization(status, &status_cpy, &last_ts_packet_count);
 
         /* Output JSON demodulator cycle data if enabled */
+        json_start_ns = metrics_now_ns();
         JSON_OUTPUT_DEMOD_CYCLE(1, &status_cpy);
+        metric_latency(METRIC_LATENCY_JSON, json_start_ns);
 
+        metric_add(METRIC_STATUS_CYCLES, 1);
+        metric_set(METRIC_STATUS_CYCLE_NANOSECONDS, metric_latency(METRIC_LATENCY_I2C_CYCLE, cycle_start_ns)
+                                                    - cycle_start_ns);
+        timeline_end(TIMELINE_I2C_CYCLE);
         last_i2c_loop = monotonic_ms();
     }
+
+    /* Let the main loop see thread_err straight away */
+    status_notify(status);
+
     return NULL;
 }
 
 
 
-/* -------------------------------------------------------------------------------------------------- */
-uint8_t status_all_write(longmynd_status_t *status, uint8_t (*status_write)(uint8_t, uint32_t, bool *), uint8_t (*status_string_write)(uint8_t, char *, bool *), bool *output_ready_ptr)
-{
-    /* -------------------------------------------------------------------------------------------------- */
-    /* Reads the past status struct out to the passed write function                                      */
-    /*  Returns: error code                                                                               */
-    /* -------------------------------------------------------------------------------------------------- */
-    uint8_t err = ERROR_NONE;
-
-    /* Main status */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_STATE, status->state, output_ready_ptr);
-    /* LNAs if present */
-    if (status->lna_ok)
-    {
-        if (err == ERROR_NONE && *output_ready_ptr)
-            err = status_write(STATUS_LNA_GAIN, status->lna_gain, output_ready_ptr);
-    }
-    /* AGC1 Gain */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_AGC1_GAIN, status->agc1_gain, output_ready_ptr);
-    /* AGC2 Gain */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_AGC2_GAIN, status->agc2_gain, output_ready_ptr);
-    /* I,Q powers */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_POWER_I, status->power_i, output_ready_ptr);
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_POWER_Q, status->power_q, output_ready_ptr);
-    /* constellations */
-    for (uint8_t count = 0; count < NUM_CONSTELLATIONS; count++)
-    {
-        if (err == ERROR_NONE && *output_ready_ptr)
-            err = status_write(STATUS_CONSTELLATION_I, status->constellation[count][0], output_ready_ptr);
-        if (err == ERROR_NONE && *output_ready_ptr)
-            err = status_write(STATUS_CONSTELLATION_Q, status->constellation[count][1], output_ready_ptr);
-    }
-    /* puncture rate */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_PUNCTURE_RATE, status->puncture_rate, output_ready_ptr);
-    /* carrier frequency offset we are trying */
-    /* note we now have the offset, so we need to add in the freq we tried to set it to */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_CARRIER_FREQUENCY, (uint32_t)(status->frequency_requested + (status->frequency_offset / 1000)), output_ready_ptr);
-    /* LNB Voltage Supply Enabled: true / false */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_LNB_SUPPLY, status->polarisation_supply, output_ready_ptr);
-    /* LNB Voltage Supply is Horizontal Polarisation: true / false */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_LNB_POLARISATION_H, status->polarisation_horizontal, output_ready_ptr);
-    /* symbol rate we are trying */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_SYMBOL_RATE, status->symbolrate, output_ready_ptr);
-    /* viterbi error rate */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_VITERBI_ERROR_RATE, status->viterbi_error_rate, output_ready_ptr);
-    /* BER */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_BER, status->bit_error_rate, output_ready_ptr);
-    /* MER */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_MER, status->modulation_error_rate, output_ready_ptr);
-    /* BCH Uncorrected Errors Flag */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_ERRORS_BCH_UNCORRECTED, status->errors_bch_uncorrected, output_ready_ptr);
-    /* BCH Corrected Errors Count */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_ERRORS_BCH_COUNT, status->errors_bch_count, output_ready_ptr);
-    /* LDPC Corrected Errors Count */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_ERRORS_LDPC_COUNT, status->errors_ldpc_count, output_ready_ptr);
-    /* Service Name */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_string_write(STATUS_SERVICE_NAME, status->service_name, output_ready_ptr);
-    /* Service Provider Name */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_string_write(STATUS_SERVICE_PROVIDER_NAME, status->service_provider_name, output_ready_ptr);
-    /* TS Null Percentage */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_TS_NULL_PERCENTAGE, status->ts_null_percentage, output_ready_ptr);
-    /* TS Elementary Stream PIDs */
-    for (uint8_t count = 0; count < NUM_ELEMENT_STREAMS; count++)
-    {
-        if (status->ts_elementary_streams[count][0] > 0)
-        {
-            if (err == ERROR_NONE && *output_ready_ptr)
-                err = status_write(STATUS_ES_PID, status->ts_elementary_streams[count][0], output_ready_ptr);
-            if (err == ERROR_NONE && *output_ready_ptr)
-                err = status_write(STATUS_ES_TYPE, status->ts_elementary_streams[count][1], output_ready_ptr);
-        }
-    }
-    /* MODCOD */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_MODCOD, status->modcod, output_ready_ptr);
-    /* Short Frames */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_SHORT_FRAME, status->short_frame, output_ready_ptr);
-    /* Pilots */
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_PILOTS, status->pilots, output_ready_ptr);
-    // MATYPE    
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_MATYPE1, status->matype1, output_ready_ptr);    
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_MATYPE2, status->matype2, output_ready_ptr);
-    if (err == ERROR_NONE && *output_ready_ptr)
-        err = status_write(STATUS_ROLLOFF, status->rolloff, output_ready_ptr);        
-    return err;
-}
-
 /* -------------------------------------------------------------------------------------------------- */
 static uint8_t *sigterm_handler_err_ptr;
 void sigterm_handler(int sig)
@@ -1257,12 +1508,36 @@ void sigterm_handler(int sig)
     (void)sig;
     /* There are some internally handled errors, so we blindly set here to ensure we exit */
     *sigterm_handler_err_ptr = ERROR_SIGNAL_TERMINATE;
+    /* Wake the status loop so that it notices */
+    status_notify(&longmynd_status);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void sigusr2_handler(int sig)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /*    Runs on SIGUSR2, when the timeline is being recorded.                                           */
+    /*    Asks the main loop to dump it                                                                   */
+    /* -------------------------------------------------------------------------------------------------- */
+    (void)sig;
+    timeline_request_dump();
+    status_notify(&longmynd_status);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
 /* MAIN FUNCTION INITIALIZATION HELPERS                                                               */
 /* -------------------------------------------------------------------------------------------------- */
 
+/* -------------------------------------------------------------------------------------------------- */
+static bool receiver_enabled(const longmynd_config_t *config)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* whether there is a NIM for the receiver thread to drive: a replay or the TS generator stands in    */
+    /* for the TS endpoint and needs none, unless the NIM is simulated                                    */
+    /* -------------------------------------------------------------------------------------------------- */
+    return (!config->replay_enabled && !config->tsgen_enabled) || config->nim_sim_enabled;
+}
+
 /* -------------------------------------------------------------------------------------------------- */
 static uint8_t initialize_signal_handlers(uint8_t *err_ptr)
 {
@@ -1283,47 +1558,161 @@ static uint8_t initialize_signal_handlers(uint8_t *err_ptr)
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-static uint8_t initialize_status_output(uint8_t (**status_write)(uint8_t, uint32_t, bool *),
-                                       uint8_t (**status_string_write)(uint8_t, char *, bool *),
-                                       bool *status_output_ready)
+static uint8_t status_fifo_reopen(bool *ready)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* Initializes status output interface (FIFO, UDP, or MQTT)                                        */
-    /* Preserves exact initialization logic and function pointer assignments                           */
-    /* status_write: pointer to status write function pointer                                          */
-    /* status_string_write: pointer to status string write function pointer                           */
-    /* status_output_ready: status output ready flag                                                   */
-    /* return: error code                                                                              */
+    /* Tries opening the status fifo again, for when the last reader went away                            */
+    /* -------------------------------------------------------------------------------------------------- */
+    return fifo_status_init(longmynd_config.status_fifo_path, ready);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t initialize_status_output(void)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Opens each status output asked for (FIFO, UDP and/or MQTT) and attaches it as a status sink        */
+    /* return: error code                                                                                 */
     /* -------------------------------------------------------------------------------------------------- */
     uint8_t err = ERROR_NONE;
+    status_sink_ops_t ops;
+    bool ready;
 
-    /* first setup the fifos, udp socket, ftdi and usb - PRESERVE EXACT LOGIC */
-    if (longmynd_config.status_use_ip)
+    status_sinks_init(status_all_write);
+
+    if (err == ERROR_NONE && longmynd_config.status_use_fifo)
     {
+        ready = true;
+        err = fifo_status_init(longmynd_config.status_fifo_path, &ready);
+        memset(&ops, 0, sizeof(ops));
+        ops.name = "fifo";
+        ops.kind = STATUS_SINK_FRAME;
+        ops.send = fifo_status_send;
+        ops.reopen = status_fifo_reopen;
         if (err == ERROR_NONE)
-            err = udp_status_init(longmynd_config.status_ip_addr, longmynd_config.status_ip_port);
-        *status_write = udp_status_write;
-        *status_string_write = udp_status_string_write;
+            err = status_sink_add(&ops, longmynd_config.status_fifo_max_rate, ready);
     }
-    else if (longmynd_config.status_use_mqtt)
+
+    if (err == ERROR_NONE && longmynd_config.status_use_ip)
     {
+        err = udp_status_init(longmynd_config.status_ip_addr, longmynd_config.status_ip_port);
+        memset(&ops, 0, sizeof(ops));
+        ops.name = "udp";
+        ops.kind = STATUS_SINK_FRAME;
+        ops.send = udp_status_send;
         if (err == ERROR_NONE)
-            err = mqttinit(longmynd_config.status_ip_addr);
-        if(err>0) fprintf(stderr,"MQTT Broker not reachable\n");
-        *status_write = mqtt_status_write;
-        *status_string_write = mqtt_status_string_write;
+            err = status_sink_add(&ops, longmynd_config.status_udp_max_rate, true);
     }
-    else
+
+    if (err == ERROR_NONE && longmynd_config.status_use_mqtt)
     {
+        mqtt_status_configure(longmynd_config.status_mqtt_snapshot);
+        err = mqttinit(longmynd_config.status_mqtt_addr);
+        if(err>0) fprintf(stderr,"MQTT Broker not reachable\n");
+        memset(&ops, 0, sizeof(ops));
+        ops.name = "mqtt";
+        if (longmynd_config.status_mqtt_snapshot != MQTT_SNAPSHOT_NONE)
+        {
+            ops.kind = STATUS_SINK_SNAPSHOT;
+            ops.snapshot = mqtt_status_snapshot;
+        }
+        else
+        {
+            ops.kind = STATUS_SINK_VALUES;
+            ops.write = mqtt_status_write;
+            ops.string_write = mqtt_status_string_write;
+        }
+        ops.cycle = mqtt_status_cycle;
+        ops.held_back = mqtt_status_held_back;
         if (err == ERROR_NONE)
-            err = fifo_status_init(longmynd_config.status_fifo_path, status_output_ready);
-        *status_write = fifo_status_write;
-        *status_string_write = fifo_status_string_write;
+            err = status_sink_add(&ops, longmynd_config.status_mqtt_max_rate, true);
     }
 
     return err;
 }
 
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_collect_status_sinks(metrics_out_t *out)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Writes the counts each status sink keeps, for /metrics                                             */
+    /* -------------------------------------------------------------------------------------------------- */
+    static const char *names[] = { "fifo", "udp", "mqtt" };
+    static const char *labels[] = { "sink=\"fifo\"", "sink=\"udp\"", "sink=\"mqtt\"" };
+    status_sink_stats_t stats[3];
+    bool present[3];
+    uint8_t i;
+
+    for (i = 0; i < 3; i++)
+        present[i] = status_sink_get_stats(names[i], &stats[i]);
+
+    /* Each metric for every sink in turn, as the exposition format wants them together */
+    for (i = 0; i < 3; i++)
+        if (present[i])
+            metrics_write(out, "longmynd_status_updates_total", labels[i], "counter",
+                          "Status updates sent, by sink", stats[i].updates, 0);
+    for (i = 0; i < 3; i++)
+        if (present[i])
+            metrics_write(out, "longmynd_status_held_back_total", labels[i], "counter",
+                          "Status updates delayed by the sink's maximum rate", stats[i].held_back, 0);
+    for (i = 0; i < 3; i++)
+        if (present[i])
+            metrics_write(out, "longmynd_status_not_ready_total", labels[i], "counter",
+                          "Status updates missed while the sink was not ready", stats[i].not_ready, 0);
+    for (i = 0; i < 3; i++)
+        if (present[i])
+            metrics_write(out, "longmynd_status_dropped_total", labels[i], "counter",
+                          "Status updates that did not all get out, so the next was sent in full", stats[i].dropped, 0);
+    for (i = 0; i < 2; i++)
+        if (present[i])
+            metrics_write(out, "longmynd_status_bytes_total", labels[i], "counter",
+                          "Status bytes sent, by sink", stats[i].bytes, 0);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_collect_json_output(metrics_out_t *out)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Writes the JSON output writer's counts, for /metrics                                               */
+    /* -------------------------------------------------------------------------------------------------- */
+    json_output_stats_t stats;
+
+    json_output_get_stats(&stats);
+    metrics_write(out, "longmynd_json_lines_total", "result=\"written\"", "counter",
+                  "JSON telemetry lines, by what became of them", stats.written, 0);
+    metrics_write(out, "longmynd_json_lines_total", "result=\"dropped\"", "counter",
+                  "JSON telemetry lines, by what became of them", stats.dropped, 0);
+    metrics_write(out, "longmynd_json_lines_total", "result=\"write_error\"", "counter",
+                  "JSON telemetry lines, by what became of them", stats.write_errors, 0);
+    metrics_write(out, "longmynd_json_rotations_total", NULL, "counter",
+                  "JSON output file rotations", stats.rotations, 0);
+    metrics_write(out, "longmynd_json_queue_high_water", NULL, "gauge",
+                  "Most JSON lines ever waiting for the writer thread", stats.queue_high_water, 0);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_collect_mqtt(metrics_out_t *out)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Writes the MQTT publisher's counts, for /metrics                                                   */
+    /* -------------------------------------------------------------------------------------------------- */
+    static const char *tiers[MQTT_TIERS] = { "tier=\"telemetry\"", "tier=\"state\"" };
+    mqtt_stats_t stats;
+    uint8_t tier;
+
+    mqtt_get_stats(&stats);
+    for (tier = 0; tier < MQTT_TIERS; tier++)
+        metrics_write(out, "longmynd_mqtt_published_total", tiers[tier], "counter",
+                      "MQTT messages published, by tier", stats.published[tier], 0);
+    metrics_write(out, "longmynd_mqtt_suppressed_total", NULL, "counter",
+                  "Unchanged MQTT values not published again", stats.suppressed, 0);
+    for (tier = 0; tier < MQTT_TIERS; tier++)
+        metrics_write(out, "longmynd_mqtt_publish_seconds_total", tiers[tier], "counter",
+                      "Time from publish to PUBACK at QoS 1, or to the socket at QoS 0", stats.latency_total_us[tier], 6);
+    for (tier = 0; tier < MQTT_TIERS; tier++)
+        metrics_write(out, "longmynd_mqtt_publish_timed_total", tiers[tier], "counter",
+                      "MQTT publishes timed in longmynd_mqtt_publish_seconds_total", stats.latency_count[tier], 0);
+}
+
 /* -------------------------------------------------------------------------------------------------- */
 static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread_vars_ts,
                                         thread_vars_t *thread_vars_ts_parse, thread_vars_t *thread_vars_i2c,
@@ -1364,7 +1753,7 @@ static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread
     {
         if (0 == pthread_create(&thread_ts, NULL, loop_ts, (void *)thread_vars_ts))
         {
-            //pthread_setname_np(thread_ts, "TS Transport");
+            pthread_setname_np(thread_ts, "TS Transport");
         }
         else
         {
@@ -1377,7 +1766,7 @@ static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread
     {
         if (0 == pthread_create(&thread_ts_parse, NULL, loop_ts_parse, (void *)thread_vars_ts_parse))
         {
-            //pthread_setname_np(thread_ts_parse, "TS Parse");
+            pthread_setname_np(thread_ts_parse, "TS Parse");
         }
         else
         {
@@ -1386,11 +1775,12 @@ static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread
         }
     }
 
-    if (err == ERROR_NONE)
+    /* The receiver thread drives the NIM, when there is one */
+    if (err == ERROR_NONE && receiver_enabled(&longmynd_config))
     {
         if (0 == pthread_create(&thread_i2c, NULL, loop_i2c, (void *)thread_vars_i2c))
         {
-            //pthread_setname_np(thread_i2c, "Receiver");
+            pthread_setname_np(thread_i2c, "Receiver");
         }
         else
         {
@@ -1403,7 +1793,7 @@ static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread
     {
         if (0 == pthread_create(&thread_beep, NULL, loop_beep, (void *)thread_vars_beep))
         {
-            // pthread_setname_np(thread_beep, "Beep Audio");
+            pthread_setname_np(thread_beep, "Beep Audio");
         }
         else
         {
@@ -1416,60 +1806,75 @@ static uint8_t initialize_worker_threads(uint8_t *err_ptr, thread_vars_t *thread
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-static uint8_t run_main_status_loop(uint8_t (*status_write)(uint8_t, uint32_t, bool *),
-                                   uint8_t (*status_string_write)(uint8_t, char *, bool *),
-                                   bool *status_output_ready,
-                                   thread_vars_t *thread_vars_ts, thread_vars_t *thread_vars_ts_parse,
+static uint8_t run_main_status_loop(thread_vars_t *thread_vars_ts, thread_vars_t *thread_vars_ts_parse,
                                    thread_vars_t *thread_vars_i2c, thread_vars_t *thread_vars_beep)
 {
     /* -------------------------------------------------------------------------------------------------- */
     /* Runs the main status output loop and monitors thread health                                      */
-    /* Preserves exact timing, mutex usage, and error handling                                         */
-    /* status_write: status write function pointer                                                     */
-    /* status_string_write: status string write function pointer                                       */
-    /* status_output_ready: status output ready flag                                                   */
+    /* Sleeps on the status eventfd, so status goes out as soon as it is published                     */
     /* thread_vars_*: thread variable structures                                                       */
     /* return: error code                                                                              */
     /* -------------------------------------------------------------------------------------------------- */
     uint8_t err = ERROR_NONE;
-    uint64_t last_status_sent_monotonic = 0;
     longmynd_status_t longmynd_status_cpy;
+    uint32_t holdoff_ms = 0;
+    uint64_t output_start_ns;
+
+    memset(&longmynd_status_cpy, 0, sizeof(longmynd_status_cpy));
 
     /* Initialise TS data re-init timer to prevent immediate reset - PRESERVE EXACT LOGIC */
-    pthread_mutex_lock(&longmynd_status.mutex);
-    longmynd_status.last_ts_or_reinit_monotonic = monotonic_ms();
-    pthread_mutex_unlock(&longmynd_status.mutex);
+    status_set_last_ts_or_reinit(&longmynd_status, monotonic_ms());
 
-    while (err == ERROR_NONE)
+    while (err == ERROR_NONE && *thread_vars_ts->main_err_ptr == ERROR_NONE)
     {
         /* Test if new status data is available - PRESERVE EXACT LOGIC */
-        if (longmynd_status.last_updated_monotonic != last_status_sent_monotonic)
+        if (status_get_last_updated(&longmynd_status) != longmynd_status_cpy.last_updated_monotonic)
         {
-            /* Acquire lock on global status struct */
-            pthread_mutex_lock(&longmynd_status.mutex);
-            /* Clone status struct locally */
-            memcpy(&longmynd_status_cpy, &longmynd_status, sizeof(longmynd_status_t));
-            /* Release lock on global status struct */
-            pthread_mutex_unlock(&longmynd_status.mutex);
-
-            if (longmynd_config.status_use_ip || *status_output_ready)
-            {
-                /* Send all status via configured output interface from local copy */
-                err = status_all_write(&longmynd_status_cpy, status_write, status_string_write, status_output_ready);
-            }
-            else if (!longmynd_config.status_use_ip && !*status_output_ready)
+            /* Take a consistent copy without holding up the threads that write it */
+            timeline_begin(TIMELINE_STATUS_OUTPUT);
+            output_start_ns = metrics_now_ns();
+            status_snapshot(&longmynd_status, &longmynd_status_cpy);
+
+            /* The mailbox always holds a full keyframe, whatever the other sinks are doing */
+            if (longmynd_config.status_shm_enabled)
+                status_shm_publish(&longmynd_status_cpy);
+
+            /* Every sink that can take it now; one held back by its rate limit gets whatever is newest */
+            err = status_sinks_update(&longmynd_status_cpy, &holdoff_ms);
+            metric_latency(METRIC_LATENCY_STATUS_OUTPUT, output_start_ns);
+            timeline_end(TIMELINE_STATUS_OUTPUT);
+        }
+        else if (holdoff_ms > 0)
+        {
+            /* A held back sink may be due by now; if not this only works out how much longer to wait */
+            err = status_sinks_update(&longmynd_status_cpy, &holdoff_ms);
+        }
+
+        if (err == ERROR_NONE && status_get_last_updated(&longmynd_status) == longmynd_status_cpy.last_updated_monotonic)
+        {
+            /* Sleep until new status is published, a thread stops, we are signalled, or the TS */
+            /* timeout below or a held back sink falls due                                      */
+            int timeout_ms = -1;
+            if (longmynd_config.ts_timeout != -1)
             {
-                /* Try opening the fifo again */
-                err = fifo_status_init(longmynd_config.status_fifo_path, status_output_ready);
+                uint64_t deadline = status_get_last_ts_or_reinit(&longmynd_status) + longmynd_config.ts_timeout;
+                uint64_t now = monotonic_ms();
+                timeout_ms = (deadline >= now) ? (int)(deadline - now) + 1 : 0;
             }
-
-            /* Update monotonic timestamp last sent */
-            last_status_sent_monotonic = longmynd_status_cpy.last_updated_monotonic;
+            if (holdoff_ms > 0 && (timeout_ms < 0 || (int)holdoff_ms < timeout_ms))
+                timeout_ms = (int)holdoff_ms;
+            timeline_begin(TIMELINE_STATUS_WAIT);
+            status_wait(&longmynd_status, timeout_ms);
+            timeline_end(TIMELINE_STATUS_WAIT);
         }
-        else
+
+        /* Written here rather than in the SIGUSR2 handler that asks for it, as it takes a while */
+        if (longmynd_config.timeline_enabled && timeline_dump_requested())
         {
-            /* Sleep 10ms - PRESERVE EXACT TIMING */
-            usleep(100 * 1000);
+            if (timeline_dump(longmynd_config.timeline_path) == 0)
+                printf("Flow: timeline dumped to %s\n", longmynd_config.timeline_path);
+            else
+                printf("ERROR: timeline dump to %s failed\n", longmynd_config.timeline_path);
         }
 
         /* Check for errors on threads - PRESERVE EXACT ERROR CHECKING */
@@ -1482,7 +1887,7 @@ static uint8_t run_main_status_loop(uint8_t (*status_write)(uint8_t, uint32_t, b
 
         /* TS timeout handling - PRESERVE EXACT TIMEOUT LOGIC */
         if (longmynd_config.ts_timeout != -1 &&
-            monotonic_ms() > (longmynd_status.last_ts_or_reinit_monotonic + longmynd_config.ts_timeout))
+            monotonic_ms() > (status_get_last_ts_or_reinit(&longmynd_status) + longmynd_config.ts_timeout))
         {
             /* Had a while with no TS data, reinit config to pull NIM search loops back in, or fix -S fascination */
 
@@ -1490,12 +1895,14 @@ static uint8_t run_main_status_loop(uint8_t (*status_write)(uint8_t, uint32_t, b
             //config_reinit(true); // !!!!!!!!!!!! FIXME IF DONT WORK
 
             /* We've queued up a reinit so reset the timer */
-            pthread_mutex_lock(&longmynd_status.mutex);
-            longmynd_status.last_ts_or_reinit_monotonic = monotonic_ms();
-            pthread_mutex_unlock(&longmynd_status.mutex);
+            status_set_last_ts_or_reinit(&longmynd_status, monotonic_ms());
         }
     }
 
+    /* Stopped by a signal rather than an error of our own: report that */
+    if (err == ERROR_NONE)
+        err = *thread_vars_ts->main_err_ptr;
+
     return err;
 }
 
@@ -1508,9 +1915,6 @@ int main(int argc, char *argv[])
     /*    Print out of status information to requested interface, triggered by pthread condition variable */
     /* -------------------------------------------------------------------------------------------------- */
     uint8_t err = ERROR_NONE;
-    uint8_t (*status_write)(uint8_t, uint32_t, bool *);
-    uint8_t (*status_string_write)(uint8_t, char *, bool *);
-    bool status_output_ready = true;
 
     printf("Flow: main\n");
 
@@ -1520,6 +1924,10 @@ int main(int argc, char *argv[])
     /* Initialize JSON output system */
     JSON_OUTPUT_INIT();
 
+    /* Create the status wakeup before anything (including the signal handlers) can post to it */
+    if (err == ERROR_NONE)
+        err = status_init(&longmynd_status);
+
     /* Initialize signal handlers */
     if (err == ERROR_NONE)
         err = initialize_signal_handlers(&err);
@@ -1529,8 +1937,21 @@ int main(int argc, char *argv[])
         err = process_command_line(argc, argv, &longmynd_config);
 
     /* Configure register logging based on command line options */
-    if (err == ERROR_NONE)
+    if (err == ERROR_NONE) {
         register_logging_set_demod_suppression_disabled(longmynd_config.disable_demod_suppression);
+        register_trace_init(longmynd_config.register_trace_path);
+    }
+
+    /* After the register trace, so that SIGUSR1 prints the latencies and then dumps the trace */
+    if (err == ERROR_NONE)
+        metrics_latency_init();
+
+    /* Record the timeline from before the threads start, dumping it on SIGUSR2 */
+    if (err == ERROR_NONE && longmynd_config.timeline_enabled)
+    {
+        timeline_init();
+        signal(SIGUSR2, sigusr2_handler);
+    }
 
     /* Configure JSON output based on command line options */
     if (err == ERROR_NONE) {
@@ -1544,12 +1965,73 @@ int main(int argc, char *argv[])
         json_output_set_config(&json_config);
     }
 
+    /* The writer thread takes JSON off the i2c thread, so a slow consumer can never stall the tuner */
+    if (err == ERROR_NONE && longmynd_config.json_output_enabled)
+        err = json_output_start(longmynd_config.json_output_target, longmynd_config.json_output_rotate_mbytes);
+
+    /* Set how often the status goes out in full between changes */
+    if (err == ERROR_NONE)
+        status_delta_init(longmynd_config.status_keyframe_seconds);
+
+    /* Choose the framing before any status sink is opened */
+    if (err == ERROR_NONE && longmynd_config.status_binary)
+        status_frame_set_format(STATUS_FORMAT_BINARY);
+
+    if (err == ERROR_NONE && longmynd_config.status_shm_enabled)
+        err = status_shm_init(longmynd_config.status_shm_name);
+
     /* Initialize status output interface */
     if (err == ERROR_NONE)
-        err = initialize_status_output(&status_write, &status_string_write, &status_output_ready);
+        err = initialize_status_output();
+
+    /* Start the HTTP server before anything that registers handlers on it */
+    if (err == ERROR_NONE && longmynd_config.web_enabled)
+        err = web_init(longmynd_config.web_port);
+
+    /* Serve the pipeline metrics alongside, with what the status outputs keep themselves */
+    if (err == ERROR_NONE && longmynd_config.web_enabled)
+    {
+        metrics_add_collector(metrics_collect_status_sinks);
+        if (longmynd_config.json_output_enabled)
+            metrics_add_collector(metrics_collect_json_output);
+        if (longmynd_config.status_use_mqtt)
+            metrics_add_collector(metrics_collect_mqtt);
+        metrics_init();
+    }
+
+    /* Map the time-shift ring so that it is ready before the TS thread starts filling it */
+    if (err == ERROR_NONE && longmynd_config.timeshift_enabled)
+        err = timeshift_init(longmynd_config.timeshift_seconds, longmynd_config.timeshift_mbps,
+                             longmynd_config.timeshift_backing, longmynd_config.timeshift_control_addr,
+                             longmynd_config.timeshift_control_port, longmynd_config.timeshift_export_dir,
+                             longmynd_config.timeshift_stream_allow);
+
+    /* Allocate the HLS segments so that the TS thread can start cutting straight away */
+    if (err == ERROR_NONE && longmynd_config.hls_enabled)
+        err = hls_init(longmynd_config.hls_segment_seconds, longmynd_config.hls_playlist_length);
+
+    /* Open the GSE output before any generic stream can arrive */
+    if (err == ERROR_NONE && longmynd_config.gse_enabled)
+        err = bbframe_init(longmynd_config.gse_output);
+
+    /* Open the capture before the TS thread starts reading */
+    if (err == ERROR_NONE && longmynd_config.capture_enabled)
+        err = capture_init(longmynd_config.capture_path, TS_FRAME_SIZE);
+
+    /* A replay stands in for the TS endpoint, so there is no Minitiouner to open */
+    if (err == ERROR_NONE && longmynd_config.replay_enabled)
+        err = capture_replay_init(longmynd_config.replay_path, longmynd_config.replay_realtime);
+
+    /* The TS generator stands in for the TS endpoint too, to measure the pipeline behind it */
+    if (err == ERROR_NONE && longmynd_config.tsgen_enabled)
+        err = tsgen_init(longmynd_config.tsgen_settings);
+
+    /* The simulated NIM takes the Minitiouner's place under ftdi.c, so has to be there before ftdi_init() */
+    if (err == ERROR_NONE && longmynd_config.nim_sim_enabled)
+        err = nim_sim_init(longmynd_config.nim_sim_settings);
 
     /* Initialize FTDI USB interface */
-    if (err == ERROR_NONE)
+    if (err == ERROR_NONE && receiver_enabled(&longmynd_config))
         err = ftdi_init(longmynd_config.device_usb_bus, longmynd_config.device_usb_addr);
 
     /* Initialize and start worker threads */
@@ -1560,17 +2042,55 @@ int main(int argc, char *argv[])
 
     /* Run main status output loop */
     if (err == ERROR_NONE)
-        err = run_main_status_loop(status_write, status_string_write, &status_output_ready,
-                                  &thread_vars_ts, &thread_vars_ts_parse, &thread_vars_i2c, &thread_vars_beep);
+        err = run_main_status_loop(&thread_vars_ts, &thread_vars_ts_parse, &thread_vars_i2c, &thread_vars_beep);
 
     printf("Flow: Main loop aborted, waiting for threads.\n");
 
     /* No fatal errors are currently possible here, so don't currently check return values */
     pthread_join(thread_ts_parse, NULL);
     pthread_join(thread_ts, NULL);
-    pthread_join(thread_i2c, NULL);
+    if (receiver_enabled(&longmynd_config))
+        pthread_join(thread_i2c, NULL);
     pthread_join(thread_beep, NULL);
 
+    /* Coming to the end of a replay is how a replay run finishes, once the threads have seen err set */
+    if (err == ERROR_THREAD_ERROR && longmynd_config.replay_enabled && thread_vars_ts.thread_err == ERROR_CAPTURE_END)
+        err = ERROR_NONE;
+    /* and likewise the TS generator's time running out, after which it reports */
+    if (err == ERROR_THREAD_ERROR && longmynd_config.tsgen_enabled && thread_vars_ts.thread_err == ERROR_TSGEN_END)
+        err = ERROR_NONE;
+    if (longmynd_config.tsgen_enabled)
+        tsgen_report();
+
+    /* The i2c thread has stopped queueing, so whatever is left can be written out */
+    json_output_stop();
+
+    /* Every thread that touched a register has stopped, so the rings are complete */
+    if (longmynd_config.register_trace_dump_on_exit) {
+        if (register_trace_dump(longmynd_config.register_trace_path) == 0)
+            printf("Flow: register trace dumped to %s\n", longmynd_config.register_trace_path);
+        else
+            printf("ERROR: register trace dump to %s failed\n", longmynd_config.register_trace_path);
+    }
+
+    /* Likewise the timeline, which then ends with how the threads stopped */
+    if (longmynd_config.timeline_enabled) {
+        if (timeline_dump(longmynd_config.timeline_path) == 0)
+            printf("Flow: timeline dumped to %s\n", longmynd_config.timeline_path);
+        else
+            printf("ERROR: timeline dump to %s failed\n", longmynd_config.timeline_path);
+    }
+
+    /* Stop serving before the buffers behind the handlers go away */
+    web_close();
+    timeshift_close();
+    hls_close();
+    bbframe_close();
+    capture_close();
+    capture_replay_close();
+    status_shm_close();
+    status_close(&longmynd_status);
+
     printf("Flow: All threads accounted for. Exiting cleanly.\n");
 
     return err;
@@ -65,6 +65,7 @@
 #define STATUS_MATYPE1            28
 #define STATUS_MATYPE2            29
 #define STATUS_ROLLOFF            30
+#define STATUS_SEQUENCE           31 /* first in each batched FIFO/UDP frame, counts the frames sent */
 
 /* The number of constellation peeks we do for each background loop */
 #define NUM_CONSTELLATIONS 16
@@ -92,22 +93,80 @@ typedef struct {
 
     bool status_use_ip;
     bool status_use_mqtt;
+    bool status_use_fifo;
     char status_fifo_path[128];
     char status_ip_addr[16];
     int status_ip_port;
+    char status_mqtt_addr[16];
+    int status_mqtt_port;
+    uint32_t status_fifo_max_rate;
+    uint32_t status_udp_max_rate;
 
     bool polarisation_supply;
     bool polarisation_horizontal; // false -> 13V, true -> 18V
 
     int ts_timeout;
 
+    bool capture_enabled;
+    char capture_path[128];
+    bool replay_enabled;
+    char replay_path[128];
+    bool replay_realtime;
+
+    bool nim_sim_enabled;
+    char nim_sim_settings[128];
+
+    bool tsgen_enabled;
+    char tsgen_settings[128];
+
+    bool recorder_enabled;
+    char recorder_path[128];
+    uint32_t recorder_segment_seconds;
+    uint32_t recorder_segment_mbytes;
+
+    bool tsring_enabled;
+    char tsring_name[128];
+    uint32_t tsring_mbytes;
+
+    bool timeshift_enabled;
+    uint32_t timeshift_seconds;
+    uint32_t timeshift_mbps;
+    char timeshift_backing[128];
+    char timeshift_control_addr[16];
+    int timeshift_control_port;
+    char timeshift_export_dir[128];
+    char timeshift_stream_allow[128];
+
+    bool gse_enabled;
+    char gse_output[128];
+
+    bool hls_enabled;
+    uint32_t hls_segment_seconds;
+    uint32_t hls_playlist_length;
+
+    bool web_enabled;
+    int web_port;
+
+    uint32_t status_keyframe_seconds;
+    bool status_binary;
+    bool status_shm_enabled;
+    char status_shm_name[128];
+    uint8_t status_mqtt_snapshot;
+    uint32_t status_mqtt_max_rate;
+
     bool disable_demod_suppression;
+    char register_trace_path[128];
+    bool register_trace_dump_on_exit;
+    bool timeline_enabled;
+    char timeline_path[128];
 
     // JSON output configuration
     bool json_output_enabled;
     uint32_t json_output_interval_ms;
     uint8_t json_output_format;  // 0=full, 1=compact, 2=minimal
     bool json_include_constellation;
+    char json_output_target[128];  // "stdout", file:PATH, unix:PATH or udp:HOST:PORT
+    uint32_t json_output_rotate_mbytes;
 
     // Tuner 2 configuration
     bool tuner2_enabled;
@@ -136,10 +195,18 @@ typedef struct {
     bool tuner2_polarisation_horizontal;
 
     bool new_config;
+    /* Changes arriving close together are applied as one, see config_changed() */
+    uint64_t new_config_first_monotonic;
+    uint64_t new_config_last_monotonic;
+    uint32_t new_config_changes;
+    uint32_t config_transaction;
     pthread_mutex_t mutex;
 } longmynd_config_t;
 
 typedef struct {
+    /* Demodulator block: written only by the I2C thread, published as a whole under demod_seq       */
+    /* Readers take consistent copies with status_snapshot() / status_demod_snapshot(), see status.c   */
+    uint32_t demod_seq;
     uint8_t state;
     uint8_t demod_state;
     bool lna_ok;
@@ -162,23 +229,29 @@ typedef struct {
     uint32_t errors_ldpc_count;
     int8_t constellation[NUM_CONSTELLATIONS][2]; // { i, q }
     uint8_t puncture_rate;
-    char service_name[255];
-    char service_provider_name[255];
-    uint8_t ts_null_percentage;
-    uint16_t ts_elementary_streams[NUM_ELEMENT_STREAMS][2]; // { pid, type }
     uint32_t modcod;
     uint32_t matype1;
     uint32_t matype2;
     bool short_frame;
     bool pilots;
     uint8_t rolloff;
-    uint64_t last_ts_or_reinit_monotonic;
 
+    /* TS block: written by the TS and TS parse threads between status_ts_write_begin/end, under ts_seq */
+    uint32_t ts_seq __attribute__((aligned(64)));
+    char service_name[255];
+    char service_provider_name[255];
+    uint8_t ts_null_percentage;
+    uint16_t ts_elementary_streams[NUM_ELEMENT_STREAMS][2]; // { pid, type }
+
+    /* Standalone values, only ever accessed atomically */
+    uint64_t last_ts_or_reinit_monotonic __attribute__((aligned(64)));
     uint64_t last_updated_monotonic;
-    pthread_mutex_t mutex;
-    pthread_cond_t signal;
+    uint32_t ts_packet_count_nolock __attribute__((aligned(64)));
 
-    uint32_t ts_packet_count_nolock;
+    /* Serialises the TS block writers; readers never take it */
+    pthread_mutex_t mutex;
+    /* eventfd that status_notify() posts to and the main loop sleeps on */
+    int event_fd;
 } longmynd_status_t;
 
 typedef struct {
@@ -194,6 +267,7 @@ void config_set_frequency(uint32_t frequency);
 void config_set_symbolrate(uint32_t symbolrate);
 void config_set_frequency_and_symbolrate(uint32_t frequency, uint32_t symbolrate);
 void config_set_lnbv(bool enabled, bool horizontal);
+bool config_set_tune(uint32_t frequency, uint32_t symbolrate, bool set_lnbv, bool enabled, bool horizontal);
 void config_reinit(bool increment_frsr);
 void config_set_swport(bool sport);
 void config_set_tsip(char *tsip);
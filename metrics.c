@@ -0,0 +1,582 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: metrics.c                                                                   */
+/*    - pipeline counters, gauges and histograms, served as Prometheus text at /metrics               */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Each thread that counts something gets its own shard the first time it does, so counting is a      */
+/* plain add to memory no other thread writes. A scrape sums the shards as they stand, which is never */
+/* more than a few counts behind. Numbers other modules already keep (the status sinks, JSON output,  */
+/* MQTT) are not counted twice: they are read at scrape time by the collectors main.c registers.      */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "web.h"
+#include "metrics.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    const char *labels;  /* NULL for none */
+    const char *help;
+    uint8_t decimals;    /* the value is in units of 10^-decimals */
+} metrics_info_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    uint8_t buckets;     /* including +Inf */
+    uint64_t bounds[METRICS_BUCKETS_MAX - 1];
+} metrics_histogram_info_t;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+__thread metrics_shard_t *metrics_shard = NULL;
+metrics_shard_t metrics_shared_shard;
+uint64_t metrics_gauges[METRIC_GAUGES];
+
+static metrics_shard_t *metrics_shards[METRICS_SHARDS];
+static uint32_t metrics_shard_count = 0;
+
+static metrics_collector_t metrics_collectors[METRICS_COLLECTORS];
+static uint32_t metrics_collector_count = 0;
+
+/* In metric_counter_t order. Metrics of the same name are listed together, so HELP is written once */
+static const metrics_info_t metrics_counter_info[METRIC_COUNTERS] = {
+    { "longmynd_usb_ts_reads_total", NULL, "Bulk reads of the transport stream endpoint", 0 },
+    { "longmynd_usb_ts_bytes_total", NULL, "Transport stream bytes read from USB, status bytes removed", 0 },
+    { "longmynd_usb_ts_read_errors_total", NULL, "Transport stream bulk reads that failed", 0 },
+    { "longmynd_ts_parse_handoffs_total", NULL, "TS buffers handed to the parse thread", 0 },
+    { "longmynd_ts_parse_skipped_total", NULL, "TS buffers not parsed because the parse thread was busy", 0 },
+    { "longmynd_ts_output_bytes_total", NULL, "TS bytes written to the FIFO or UDP output", 0 },
+    { "longmynd_ts_output_dropped_bytes_total", NULL, "TS bytes dropped because the FIFO had no reader", 0 },
+    { "longmynd_i2c_ops_total", "op=\"read\"", "I2C register accesses through the FTDI", 0 },
+    { "longmynd_i2c_ops_total", "op=\"write\"", "I2C register accesses through the FTDI", 0 },
+    { "longmynd_i2c_retries_total", NULL, "I2C transfers retried, including FTDI_RDWR_TIMEOUT retries", 0 },
+    { "longmynd_i2c_errors_total", NULL, "I2C register accesses that failed after every retry", 0 },
+    { "longmynd_i2c_op_seconds_total", NULL, "Time spent in I2C register accesses", 9 },
+    { "longmynd_reinits_total", NULL, "Tuner and demodulator reinitialisations for a new configuration", 0 },
+    { "longmynd_lock_transitions_total", "to=\"hunting\"", "Demodulator state changes, by new state", 0 },
+    { "longmynd_lock_transitions_total", "to=\"found_header\"", "Demodulator state changes, by new state", 0 },
+    { "longmynd_lock_transitions_total", "to=\"dvbs\"", "Demodulator state changes, by new state", 0 },
+    { "longmynd_lock_transitions_total", "to=\"dvbs2\"", "Demodulator state changes, by new state", 0 },
+    { "longmynd_status_cycles_total", NULL, "Passes of the status polling loop", 0 },
+    { "longmynd_ftdi_packets_total", NULL, "512 byte USB packets read from the FTDI TS endpoint", 0 },
+    { "longmynd_ftdi_empty_reads_total", NULL, "TS reads that returned only the status bytes, nothing buffered", 0 },
+    { "longmynd_ftdi_line_errors_total", "flag=\"overrun\"", "TS packets with a line status error flag set", 0 },
+    { "longmynd_ftdi_line_errors_total", "flag=\"parity\"", "TS packets with a line status error flag set", 0 },
+    { "longmynd_ftdi_line_errors_total", "flag=\"framing\"", "TS packets with a line status error flag set", 0 },
+    { "longmynd_ftdi_line_errors_total", "flag=\"break\"", "TS packets with a line status error flag set", 0 },
+    { "longmynd_ftdi_line_errors_total", "flag=\"fifo\"", "TS packets with a line status error flag set", 0 }
+};
+
+/* In metric_gauge_t order */
+static const metrics_info_t metrics_gauge_info[METRIC_GAUGES] = {
+    { "longmynd_receiver_state", NULL, "Receiver state as in the status, 1 hunting to 4 DVB-S2", 0 },
+    { "longmynd_status_cycle_seconds", NULL, "Duration of the last pass of the status polling loop", 9 },
+    { "longmynd_ftdi_last_overrun_timestamp_seconds", NULL, "When the FTDI last reported a receive overrun", 9 },
+    { "longmynd_ftdi_last_overrun_read_seconds", NULL, "How long the read that found the last overrun took", 9 },
+    { "longmynd_ftdi_last_overrun_gap_seconds", NULL, "How long nothing was reading before the last overrun", 9 }
+};
+
+/* In metric_histogram_t order. A TS read is up to TS_FRAME_SIZE, 2 bytes is a status-only packet */
+static const metrics_histogram_info_t metrics_histogram_info[METRIC_HISTOGRAMS] = {
+    { "longmynd_usb_ts_read_bytes", "Size of each transport stream bulk read, status bytes included",
+      7, { 2, 512, 1024, 2048, 4096, 8192 } }
+};
+
+/* In metric_latency_t order */
+static const char *metrics_latency_stages[METRIC_LATENCIES] = {
+    "usb_read", "usb_read_gap", "deframe", "output_write", "parse", "i2c_cycle", "json", "status_output"
+};
+
+/* The percentiles reported */
+typedef struct {
+    uint16_t per_mille;
+    const char *quantile; /* as Prometheus labels it */
+    const char *name;     /* as the SIGUSR1 report labels it */
+} metrics_quantile_t;
+
+#define METRICS_LATENCY_QUANTILES 3
+static const metrics_quantile_t metrics_latency_quantiles[METRICS_LATENCY_QUANTILES] = {
+    { 500, "0.5", "p50" }, { 990, "0.99", "p99" }, { 999, "0.999", "p999" }
+};
+
+/* Whoever had SIGUSR1 before, called after the latency report */
+static struct sigaction metrics_previous_sigusr1;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+metrics_shard_t *metrics_shard_create(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gives the calling thread its shard, on the first thing it counts                                   */
+/* return: the shard, or NULL if every shard is taken and the thread is to share metrics_shared_shard */
+/* -------------------------------------------------------------------------------------------------- */
+    metrics_shard_t *shard;
+    uint32_t slot;
+
+    if (__atomic_load_n(&metrics_shard_count, __ATOMIC_RELAXED) >= METRICS_SHARDS) return NULL;
+
+    shard = (metrics_shard_t *)calloc(1, sizeof(metrics_shard_t));
+    if (shard == NULL) return NULL;
+
+    slot = __atomic_fetch_add(&metrics_shard_count, 1, __ATOMIC_RELAXED);
+    if (slot >= METRICS_SHARDS) {
+        free(shard);
+        return NULL;
+    }
+    /* A scrape walks the table without a lock, and skips a slot that has been claimed but not yet set */
+    __atomic_store_n(&metrics_shards[slot], shard, __ATOMIC_RELEASE);
+
+    metrics_shard = shard;
+    return shard;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint64_t metrics_histogram_bound(metric_histogram_t histogram, uint8_t bucket) {
+/* -------------------------------------------------------------------------------------------------- */
+    return metrics_histogram_info[histogram].bounds[bucket];
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t metrics_histogram_buckets(metric_histogram_t histogram) {
+/* -------------------------------------------------------------------------------------------------- */
+    return metrics_histogram_info[histogram].buckets;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void metrics_add_collector(metrics_collector_t collect) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds a function that writes metrics another module keeps, called on each scrape                    */
+/* -------------------------------------------------------------------------------------------------- */
+    if (metrics_collector_count < METRICS_COLLECTORS) {
+        metrics_collectors[metrics_collector_count++] = collect;
+    } else {
+        printf("ERROR: no metrics collector left\n");
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void metrics_write(metrics_out_t *out, const char *name, const char *labels, const char *type, const char *help,
+                   uint64_t value, uint8_t decimals) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes one sample, with the HELP and TYPE lines before the first sample of each name               */
+/*   labels: the label pairs without braces, NULL for none                                            */
+/*     type: "counter" or "gauge"                                                                     */
+/* decimals: the value is in units of 10^-decimals                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    if (out->family == NULL || strcmp(out->family, name) != 0) {
+        status_fmt_str(&out->fmt, "# HELP ");
+        status_fmt_str(&out->fmt, name);
+        status_fmt_char(&out->fmt, ' ');
+        status_fmt_str(&out->fmt, help);
+        status_fmt_str(&out->fmt, "\n# TYPE ");
+        status_fmt_str(&out->fmt, name);
+        status_fmt_char(&out->fmt, ' ');
+        status_fmt_str(&out->fmt, type);
+        status_fmt_char(&out->fmt, '\n');
+        out->family = name;
+    }
+
+    status_fmt_str(&out->fmt, name);
+    if (labels != NULL) {
+        status_fmt_char(&out->fmt, '{');
+        status_fmt_str(&out->fmt, labels);
+        status_fmt_char(&out->fmt, '}');
+    }
+    status_fmt_char(&out->fmt, ' ');
+    if (decimals == 0) {
+        status_fmt_u64(&out->fmt, value);
+    } else {
+        status_fmt_fixed(&out->fmt, (int64_t)value, decimals);
+    }
+    status_fmt_char(&out->fmt, '\n');
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t metrics_sum(const uint64_t *value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds up one counter across every shard, given where it is in the shared shard                      */
+/* -------------------------------------------------------------------------------------------------- */
+    size_t offset = (const uint8_t *)value - (const uint8_t *)&metrics_shared_shard;
+    uint32_t count = __atomic_load_n(&metrics_shard_count, __ATOMIC_ACQUIRE);
+    uint64_t total = __atomic_load_n(value, __ATOMIC_RELAXED);
+    metrics_shard_t *shard;
+    uint32_t i;
+
+    if (count > METRICS_SHARDS) count = METRICS_SHARDS;
+    for (i = 0; i < count; i++) {
+        shard = __atomic_load_n(&metrics_shards[i], __ATOMIC_ACQUIRE);
+        if (shard != NULL) total += __atomic_load_n((uint64_t *)((uint8_t *)shard + offset), __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t metrics_max(const uint64_t *value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the largest of one value across every shard, given where it is in the shared shard                 */
+/* -------------------------------------------------------------------------------------------------- */
+    size_t offset = (const uint8_t *)value - (const uint8_t *)&metrics_shared_shard;
+    uint32_t count = __atomic_load_n(&metrics_shard_count, __ATOMIC_ACQUIRE);
+    uint64_t max = __atomic_load_n(value, __ATOMIC_RELAXED);
+    metrics_shard_t *shard;
+    uint64_t shard_max;
+    uint32_t i;
+
+    if (count > METRICS_SHARDS) count = METRICS_SHARDS;
+    for (i = 0; i < count; i++) {
+        shard = __atomic_load_n(&metrics_shards[i], __ATOMIC_ACQUIRE);
+        if (shard == NULL) continue;
+        shard_max = __atomic_load_n((uint64_t *)((uint8_t *)shard + offset), __ATOMIC_RELAXED);
+        if (shard_max > max) max = shard_max;
+    }
+
+    return max;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t metrics_latency_bucket_top(uint32_t bucket) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the largest latency counted in a bucket, the inverse of metrics_latency_bucket()                   */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t shift;
+
+    if (bucket < METRICS_LATENCY_SUB_BUCKETS) return bucket;
+    shift = bucket / METRICS_LATENCY_SUB_BUCKETS - 1;
+
+    return ((uint64_t)(METRICS_LATENCY_SUB_BUCKETS + bucket % METRICS_LATENCY_SUB_BUCKETS) << shift)
+           + ((1ULL << shift) - 1);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_latency_summary(metric_latency_t stage, uint64_t *count, uint64_t *sum_ns, uint64_t *max_ns,
+                                    uint64_t quantiles_ns[METRICS_LATENCY_QUANTILES]) {
+/* -------------------------------------------------------------------------------------------------- */
+/* merges a stage's buckets across the shards and finds its percentiles. Async-signal-safe            */
+/* -------------------------------------------------------------------------------------------------- */
+    const metrics_latency_t *latency = &metrics_shared_shard.latencies[stage];
+    uint64_t buckets[METRICS_LATENCY_BUCKETS];
+    uint64_t total = 0, seen = 0, rank;
+    uint32_t bucket = 0, q;
+
+    for (bucket = 0; bucket < METRICS_LATENCY_BUCKETS; bucket++) {
+        buckets[bucket] = metrics_sum(&latency->buckets[bucket]);
+        total += buckets[bucket];
+    }
+    /* Counted from the buckets rather than the count, which may be a record ahead or behind them */
+    *count = total;
+    *sum_ns = metrics_sum(&latency->sum_ns);
+    *max_ns = metrics_max(&latency->max_ns);
+
+    bucket = 0;
+    for (q = 0; q < METRICS_LATENCY_QUANTILES; q++) {
+        rank = (total * metrics_latency_quantiles[q].per_mille + 999) / 1000;
+        if (rank == 0) rank = 1;
+        while (bucket < METRICS_LATENCY_BUCKETS - 1 && seen + buckets[bucket] < rank) seen += buckets[bucket++];
+        quantiles_ns[q] = (total == 0) ? 0 : metrics_latency_bucket_top(bucket);
+        /* The top of the bucket can be more than anything actually seen */
+        if (quantiles_ns[q] > *max_ns) quantiles_ns[q] = *max_ns;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint64_t metrics_counter_total(metric_counter_t counter) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a counter summed across the shards, for a report made in process rather than over HTTP             */
+/* -------------------------------------------------------------------------------------------------- */
+    return metrics_sum(&metrics_shared_shard.counters[counter]);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint64_t metrics_latency_total_ns(metric_latency_t stage) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the time spent in a stage so far, summed across the shards                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    return metrics_sum(&metrics_shared_shard.latencies[stage].sum_ns);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+const char *metrics_latency_stage_name(metric_latency_t stage) {
+/* -------------------------------------------------------------------------------------------------- */
+    return metrics_latency_stages[stage];
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_write_latencies(metrics_out_t *out) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes the stage latencies as a summary, and their maximum as a gauge                              */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t count[METRIC_LATENCIES], sum_ns[METRIC_LATENCIES], max_ns[METRIC_LATENCIES];
+    uint64_t quantiles_ns[METRIC_LATENCIES][METRICS_LATENCY_QUANTILES];
+    const char *name = "longmynd_stage_latency_seconds";
+    uint32_t stage, q;
+
+    for (stage = 0; stage < METRIC_LATENCIES; stage++) {
+        metrics_latency_summary((metric_latency_t)stage, &count[stage], &sum_ns[stage], &max_ns[stage],
+                                quantiles_ns[stage]);
+    }
+
+    status_fmt_str(&out->fmt, "# HELP longmynd_stage_latency_seconds Time taken by each stage of the pipeline\n"
+                              "# TYPE longmynd_stage_latency_seconds summary\n");
+    for (stage = 0; stage < METRIC_LATENCIES; stage++) {
+        for (q = 0; q < METRICS_LATENCY_QUANTILES; q++) {
+            status_fmt_str(&out->fmt, name);
+            status_fmt_str(&out->fmt, "{stage=\"");
+            status_fmt_str(&out->fmt, metrics_latency_stages[stage]);
+            status_fmt_str(&out->fmt, "\",quantile=\"");
+            status_fmt_str(&out->fmt, metrics_latency_quantiles[q].quantile);
+            status_fmt_str(&out->fmt, "\"} ");
+            status_fmt_fixed(&out->fmt, (int64_t)quantiles_ns[stage][q], 9);
+            status_fmt_char(&out->fmt, '\n');
+        }
+        status_fmt_str(&out->fmt, name);
+        status_fmt_str(&out->fmt, "_sum{stage=\"");
+        status_fmt_str(&out->fmt, metrics_latency_stages[stage]);
+        status_fmt_str(&out->fmt, "\"} ");
+        status_fmt_fixed(&out->fmt, (int64_t)sum_ns[stage], 9);
+        status_fmt_char(&out->fmt, '\n');
+        status_fmt_str(&out->fmt, name);
+        status_fmt_str(&out->fmt, "_count{stage=\"");
+        status_fmt_str(&out->fmt, metrics_latency_stages[stage]);
+        status_fmt_str(&out->fmt, "\"} ");
+        status_fmt_u64(&out->fmt, count[stage]);
+        status_fmt_char(&out->fmt, '\n');
+    }
+    out->family = name;
+
+    status_fmt_str(&out->fmt, "# HELP longmynd_stage_latency_max_seconds Longest time taken by each stage\n"
+                              "# TYPE longmynd_stage_latency_max_seconds gauge\n");
+    for (stage = 0; stage < METRIC_LATENCIES; stage++) {
+        status_fmt_str(&out->fmt, "longmynd_stage_latency_max_seconds{stage=\"");
+        status_fmt_str(&out->fmt, metrics_latency_stages[stage]);
+        status_fmt_str(&out->fmt, "\"} ");
+        status_fmt_fixed(&out->fmt, (int64_t)max_ns[stage], 9);
+        status_fmt_char(&out->fmt, '\n');
+    }
+    out->family = "longmynd_stage_latency_max_seconds";
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void metrics_write_histogram(metrics_out_t *out, metric_histogram_t histogram) {
+/* -------------------------------------------------------------------------------------------------- */
+    const metrics_histogram_info_t *info = &metrics_histogram_info[histogram];
+    uint64_t *slots = metrics_shared_shard.histograms[histogram];
+    uint64_t cumulative = 0;
+    uint8_t bucket;
+
+    status_fmt_str(&out->fmt, "# HELP ");
+    status_fmt_str(&out->fmt, info->name);
+    status_fmt_char(&out->fmt, ' ');
+    status_fmt_str(&out->fmt, info->help);
+    status_fmt_str(&out->fmt, "\n# TYPE ");
+    status_fmt_str(&out->fmt, info->name);
+    status_fmt_str(&out->fmt, " histogram\n");
+
+    for (bucket = 0; bucket < info->buckets; bucket++) {
+        /* Prometheus buckets count every value up to the bound, not just those above the one before */
+        cumulative += metrics_sum(&slots[bucket]);
+        status_fmt_str(&out->fmt, info->name);
+        status_fmt_str(&out->fmt, "_bucket{le=\"");
+        if (bucket < info->buckets - 1) {
+            status_fmt_u64(&out->fmt, info->bounds[bucket]);
+        } else {
+            status_fmt_str(&out->fmt, "+Inf");
+        }
+        status_fmt_str(&out->fmt, "\"} ");
+        status_fmt_u64(&out->fmt, cumulative);
+        status_fmt_char(&out->fmt, '\n');
+    }
+
+    status_fmt_str(&out->fmt, info->name);
+    status_fmt_str(&out->fmt, "_sum ");
+    status_fmt_u64(&out->fmt, metrics_sum(&slots[METRICS_BUCKETS_MAX]));
+    status_fmt_char(&out->fmt, '\n');
+    status_fmt_str(&out->fmt, info->name);
+    status_fmt_str(&out->fmt, "_count ");
+    status_fmt_u64(&out->fmt, metrics_sum(&slots[METRICS_BUCKETS_MAX + 1]));
+    status_fmt_char(&out->fmt, '\n');
+    out->family = info->name;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t metrics_format(char *buffer, uint32_t size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes every metric in the Prometheus text exposition format                                       */
+/* return: the length written, NUL terminated                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    metrics_out_t out;
+    uint32_t i;
+
+    status_fmt_init(&out.fmt, buffer, size);
+    out.family = NULL;
+
+    for (i = 0; i < METRIC_COUNTERS; i++) {
+        metrics_write(&out, metrics_counter_info[i].name, metrics_counter_info[i].labels, "counter",
+                      metrics_counter_info[i].help, metrics_sum(&metrics_shared_shard.counters[i]),
+                      metrics_counter_info[i].decimals);
+    }
+    for (i = 0; i < METRIC_GAUGES; i++) {
+        metrics_write(&out, metrics_gauge_info[i].name, metrics_gauge_info[i].labels, "gauge",
+                      metrics_gauge_info[i].help, __atomic_load_n(&metrics_gauges[i], __ATOMIC_RELAXED),
+                      metrics_gauge_info[i].decimals);
+    }
+    for (i = 0; i < METRIC_HISTOGRAMS; i++) metrics_write_histogram(&out, (metric_histogram_t)i);
+    metrics_write_latencies(&out);
+    for (i = 0; i < metrics_collector_count; i++) metrics_collectors[i](&out);
+
+    if (out.fmt.truncated) printf("ERROR: metrics do not fit in %u bytes\n", size);
+
+    return out.fmt.len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+class MetricsHandler : public CivetHandler
+{
+public:
+    bool handleGet(CivetServer *server, struct mg_connection *conn)
+    {
+        (void)server;
+        char *buffer = (char *)malloc(METRICS_BUFFER_SIZE);
+        uint32_t len;
+
+        if (buffer == NULL) {
+            mg_printf(conn, "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\n"
+                            "Cache-Control: no-cache\r\nConnection: close\r\n\r\nOut of memory\n");
+            return true;
+        }
+
+        len = metrics_format(buffer, METRICS_BUFFER_SIZE);
+        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        "Cache-Control: no-cache\r\nContent-Length: %u\r\n\r\n", len);
+        mg_write(conn, buffer, len);
+
+        free(buffer);
+        return true;
+    }
+};
+
+static MetricsHandler metrics_http_handler;
+
+/* -------------------------------------------------------------------------------------------------- */
+void metrics_init(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* serves the metrics at /metrics, if the web server is running                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    if (web_is_enabled()) {
+        web_add_handler("/metrics", &metrics_http_handler);
+        printf("Flow: metrics at /metrics\n");
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t metrics_latency_report(char *buffer, uint32_t size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes a line for each stage of the pipeline with its percentiles, in microseconds.                */
+/* Async-signal-safe                                                                                  */
+/* return: the length written, NUL terminated                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t count, sum_ns, max_ns, quantiles_ns[METRICS_LATENCY_QUANTILES];
+    status_fmt_t fmt;
+    uint32_t stage, q;
+
+    status_fmt_init(&fmt, buffer, size);
+
+    for (stage = 0; stage < METRIC_LATENCIES; stage++) {
+        metrics_latency_summary((metric_latency_t)stage, &count, &sum_ns, &max_ns, quantiles_ns);
+        status_fmt_str(&fmt, "Latency: ");
+        status_fmt_str(&fmt, metrics_latency_stages[stage]);
+        status_fmt_str(&fmt, " count ");
+        status_fmt_u64(&fmt, count);
+        for (q = 0; q < METRICS_LATENCY_QUANTILES; q++) {
+            status_fmt_str(&fmt, ", ");
+            status_fmt_str(&fmt, metrics_latency_quantiles[q].name);
+            status_fmt_char(&fmt, ' ');
+            status_fmt_fixed(&fmt, (int64_t)quantiles_ns[q], 3);
+        }
+        status_fmt_str(&fmt, ", max ");
+        status_fmt_fixed(&fmt, (int64_t)max_ns, 3);
+        status_fmt_str(&fmt, " us\n");
+    }
+
+    return fmt.len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void metrics_latency_report_signal(int sig) {
+/* -------------------------------------------------------------------------------------------------- */
+/* SIGUSR1 handler: prints the latency report, then passes the signal on to the handler it replaced   */
+/* -------------------------------------------------------------------------------------------------- */
+    char buffer[2048];
+    const char *next = buffer;
+    uint32_t len;
+    ssize_t written;
+    int saved_errno = errno;
+
+    len = metrics_latency_report(buffer, sizeof(buffer));
+    while (len > 0) {
+        written = write(STDOUT_FILENO, next, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        next += written;
+        len -= written;
+    }
+
+    errno = saved_errno;
+
+    if (metrics_previous_sigusr1.sa_handler != SIG_DFL && metrics_previous_sigusr1.sa_handler != SIG_IGN
+        && !(metrics_previous_sigusr1.sa_flags & SA_SIGINFO)) {
+        metrics_previous_sigusr1.sa_handler(sig);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void metrics_latency_init(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* prints the latency report on SIGUSR1 from now on, ahead of whatever else SIGUSR1 already does      */
+/* -------------------------------------------------------------------------------------------------- */
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = metrics_latency_report_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, &metrics_previous_sigusr1);
+}
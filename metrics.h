@@ -0,0 +1,248 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: metrics.h                                                                   */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "status_format.h"
+
+#define METRICS_SHARDS          32
+#define METRICS_BUCKETS_MAX     12
+#define METRICS_COLLECTORS       8
+#define METRICS_BUFFER_SIZE 65536
+
+/* Latencies are kept in nanoseconds in log buckets, 2^SUB_BITS of them for each power of 2, so that  */
+/* any percentile is within 1/2^SUB_BITS (6%) of the true value, up to 2^MAX_BITS ns (18 minutes)     */
+#define METRICS_LATENCY_SUB_BITS    4
+#define METRICS_LATENCY_SUB_BUCKETS (1 << METRICS_LATENCY_SUB_BITS)
+#define METRICS_LATENCY_MAX_BITS    40
+#define METRICS_LATENCY_BUCKETS     ((METRICS_LATENCY_MAX_BITS - METRICS_LATENCY_SUB_BITS + 1) * METRICS_LATENCY_SUB_BUCKETS)
+
+/* Counters only ever go up, and each thread adds to its own copy, summed when they are read */
+typedef enum {
+    METRIC_USB_TS_READS,
+    METRIC_USB_TS_BYTES,
+    METRIC_USB_TS_READ_ERRORS,
+    METRIC_TS_PARSE_HANDOFFS,
+    METRIC_TS_PARSE_SKIPPED,
+    METRIC_TS_OUTPUT_BYTES,
+    METRIC_TS_OUTPUT_DROPPED_BYTES,
+    METRIC_I2C_READS,
+    METRIC_I2C_WRITES,
+    METRIC_I2C_RETRIES,
+    METRIC_I2C_ERRORS,
+    METRIC_I2C_NANOSECONDS,
+    METRIC_REINITS,
+    METRIC_DEMOD_TO_HUNTING,          /* in STATE_DEMOD_* order */
+    METRIC_DEMOD_TO_FOUND_HEADER,
+    METRIC_DEMOD_TO_DVBS,
+    METRIC_DEMOD_TO_DVBS2,
+    METRIC_STATUS_CYCLES,
+    METRIC_FTDI_PACKETS,
+    METRIC_FTDI_EMPTY_READS,
+    METRIC_FTDI_OVERRUNS,             /* in the order of the line status bits */
+    METRIC_FTDI_PARITY_ERRORS,
+    METRIC_FTDI_FRAMING_ERRORS,
+    METRIC_FTDI_BREAKS,
+    METRIC_FTDI_FIFO_ERRORS,
+    METRIC_COUNTERS
+} metric_counter_t;
+
+/* Gauges are each set by one thread, the last value set is the one read */
+typedef enum {
+    METRIC_RECEIVER_STATE,
+    METRIC_STATUS_CYCLE_NANOSECONDS,
+    METRIC_FTDI_LAST_OVERRUN_NANOSECONDS,      /* CLOCK_REALTIME */
+    METRIC_FTDI_LAST_OVERRUN_READ_NANOSECONDS, /* how long the read it was found in took */
+    METRIC_FTDI_LAST_OVERRUN_GAP_NANOSECONDS,  /* how long before that read nothing was reading */
+    METRIC_GAUGES
+} metric_gauge_t;
+
+/* Histograms count each value into the first bucket whose bound it does not exceed */
+typedef enum {
+    METRIC_USB_TS_READ_SIZE,
+    METRIC_HISTOGRAMS
+} metric_histogram_t;
+
+/* The stages of the receive pipeline that are timed */
+typedef enum {
+    METRIC_LATENCY_USB_READ,      /* a bulk read of the TS endpoint, loop_ts */
+    METRIC_LATENCY_USB_READ_GAP,  /* from the end of one bulk read to the start of the next, loop_ts */
+    METRIC_LATENCY_DEFRAME,       /* lining the TS up on packet boundaries, loop_ts */
+    METRIC_LATENCY_OUTPUT_WRITE,  /* the FIFO or UDP write, loop_ts */
+    METRIC_LATENCY_PARSE,         /* parsing a handed off buffer, loop_ts_parse */
+    METRIC_LATENCY_I2C_CYCLE,     /* a pass of the status polling loop, loop_i2c */
+    METRIC_LATENCY_JSON,          /* formatting and queueing the JSON telemetry, loop_i2c */
+    METRIC_LATENCY_STATUS_OUTPUT, /* sending a status update to the sinks, run_main_status_loop */
+    METRIC_LATENCIES
+} metric_latency_t;
+
+typedef struct {
+    uint64_t buckets[METRICS_LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} metrics_latency_t;
+
+typedef struct {
+    uint64_t counters[METRIC_COUNTERS];
+    /* the buckets, then the sum and count of the values */
+    uint64_t histograms[METRIC_HISTOGRAMS][METRICS_BUCKETS_MAX + 2];
+    metrics_latency_t latencies[METRIC_LATENCIES];
+} metrics_shard_t;
+
+/* What a collector writes to, see metrics_add_collector() */
+typedef struct {
+    status_fmt_t fmt;
+    const char *family; /* the last metric a HELP and TYPE were written for */
+} metrics_out_t;
+
+typedef void (*metrics_collector_t)(metrics_out_t *out);
+
+extern __thread metrics_shard_t *metrics_shard;
+extern metrics_shard_t metrics_shared_shard;
+extern uint64_t metrics_gauges[METRIC_GAUGES];
+
+metrics_shard_t *metrics_shard_create(void);
+void metrics_add_collector(metrics_collector_t collect);
+void metrics_write(metrics_out_t *out, const char *name, const char *labels, const char *type, const char *help,
+                   uint64_t value, uint8_t decimals);
+uint32_t metrics_format(char *buffer, uint32_t size);
+void metrics_init(void);
+uint64_t metrics_counter_total(metric_counter_t counter);
+uint64_t metrics_latency_total_ns(metric_latency_t stage);
+const char *metrics_latency_stage_name(metric_latency_t stage);
+uint32_t metrics_latency_report(char *buffer, uint32_t size);
+void metrics_latency_report_signal(int sig);
+void metrics_latency_init(void);
+
+uint64_t metrics_histogram_bound(metric_histogram_t histogram, uint8_t bucket);
+uint8_t metrics_histogram_buckets(metric_histogram_t histogram);
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline uint64_t metrics_now_ns(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline metrics_shard_t *metrics_get_shard(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the calling thread's shard, made on first use, or NULL if there are none left                      */
+/* -------------------------------------------------------------------------------------------------- */
+    return (metrics_shard != NULL) ? metrics_shard : metrics_shard_create();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void metrics_add(metrics_shard_t *shard, uint64_t *value, uint64_t n) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (shard != NULL) {
+        /* Only this thread writes it, so no locked add is needed, just a store readers see whole */
+        __atomic_store_n(value, *value + n, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(value, n, __ATOMIC_RELAXED);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void metric_add(metric_counter_t counter, uint64_t n) {
+/* -------------------------------------------------------------------------------------------------- */
+    metrics_shard_t *shard = metrics_get_shard();
+
+    metrics_add(shard, &((shard != NULL) ? shard : &metrics_shared_shard)->counters[counter], n);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void metric_set(metric_gauge_t gauge, uint64_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_store_n(&metrics_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void metric_observe(metric_histogram_t histogram, uint64_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    metrics_shard_t *shard = metrics_get_shard();
+    uint64_t *slots = ((shard != NULL) ? shard : &metrics_shared_shard)->histograms[histogram];
+    uint8_t buckets = metrics_histogram_buckets(histogram);
+    uint8_t bucket = 0;
+
+    /* The last bucket has no bound (+Inf) */
+    while (bucket < buckets - 1 && value > metrics_histogram_bound(histogram, bucket)) bucket++;
+
+    metrics_add(shard, &slots[bucket], 1);
+    metrics_add(shard, &slots[METRICS_BUCKETS_MAX], value);
+    metrics_add(shard, &slots[METRICS_BUCKETS_MAX + 1], 1);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline uint32_t metrics_latency_bucket(uint64_t ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the bucket a latency is counted in: the power of 2 it falls in, then the next SUB_BITS bits        */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t exponent;
+
+    if (ns < METRICS_LATENCY_SUB_BUCKETS) return (uint32_t)ns;
+    exponent = 63 - __builtin_clzll(ns);
+    if (exponent >= METRICS_LATENCY_MAX_BITS) return METRICS_LATENCY_BUCKETS - 1;
+
+    return (exponent - METRICS_LATENCY_SUB_BITS + 1) * METRICS_LATENCY_SUB_BUCKETS
+           + (uint32_t)((ns >> (exponent - METRICS_LATENCY_SUB_BITS)) & (METRICS_LATENCY_SUB_BUCKETS - 1));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void metric_latency_add(metric_latency_t stage, uint64_t ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* records a time against a stage                                                                     */
+/* -------------------------------------------------------------------------------------------------- */
+    metrics_shard_t *shard = metrics_get_shard();
+    metrics_latency_t *latency = &((shard != NULL) ? shard : &metrics_shared_shard)->latencies[stage];
+
+    metrics_add(shard, &latency->buckets[metrics_latency_bucket(ns)], 1);
+    metrics_add(shard, &latency->sum_ns, ns);
+    metrics_add(shard, &latency->count, 1);
+    if (shard != NULL) {
+        if (ns > latency->max_ns) __atomic_store_n(&latency->max_ns, ns, __ATOMIC_RELAXED);
+    } else {
+        uint64_t max = __atomic_load_n(&latency->max_ns, __ATOMIC_RELAXED);
+        while (ns > max && !__atomic_compare_exchange_n(&latency->max_ns, &max, ns, true,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline uint64_t metric_latency(metric_latency_t stage, uint64_t start_ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* records the time since start_ns against a stage                                                    */
+/* return: now, to start timing the next stage from                                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t now = metrics_now_ns();
+
+    metric_latency_add(stage, now - start_ns);
+    return now;
+}
+
+#endif
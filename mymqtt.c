@@ -3,8 +3,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include "errors.h"
 #include "main.h"
+#include "timeshift.h"
+#include "status.h"
+#include "mymqtt.h"
+#include "status_format.h"
+
+/* Topics whose last payload is remembered, so that an unchanged value is not published again */
+#define MQTT_TOPIC_CACHE_SIZE 64
+/* Publishes whose send time is kept until the broker acknowledges them */
+#define MQTT_LATENCY_SLOTS 64
+#define MQTT_STATS_INTERVAL_MS 10000
+#define MQTT_SNAPSHOT_MAX 4096
+
+typedef struct {
+	bool used;
+	char topic[48];
+	uint32_t hash;
+} mqtt_topic_cache_t;
+
+typedef struct {
+	int mid;
+	uint8_t tier;
+	bool acked;  /* on_publish ran before mosquitto_publish returned */
+	uint64_t sent_ns;
+	uint64_t acked_ns;
+} mqtt_latency_slot_t;
+
+extern uint64_t monotonic_ms(void);
+
+static uint8_t mqtt_snapshot = MQTT_SNAPSHOT_NONE;
+static uint64_t mqtt_last_stats_monotonic = 0;
+static mqtt_topic_cache_t mqtt_topic_cache[MQTT_TOPIC_CACHE_SIZE];
+static mqtt_latency_slot_t mqtt_latency_slots[MQTT_LATENCY_SLOTS];
+static mqtt_stats_t mqtt_stats;
+static pthread_mutex_t mqtt_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* A publish failed since the status sink last looked, so it has to send everything again */
+static bool mqtt_publish_failed = false;
 
 /* Callback called when the client receives a CONNACK message from the broker. */
 void on_connect(struct mosquitto *mosq, void *obj, int reason_code)
@@ -27,6 +65,9 @@ void on_connect(struct mosquitto *mosq, void *obj, int reason_code)
 	 * connection drops and is automatically resumed by the client, then the
 	 * subscriptions will be recreated when the client reconnects. */
 
+	/* Whatever is listening has missed any status that did not change since */
+	status_delta_request_full();
+
 	rc = mosquitto_subscribe(mosq, NULL, "cmd/longmynd/#", 1);
 	if (rc != MOSQ_ERR_SUCCESS)
 	{
@@ -83,6 +124,27 @@ void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_messag
 		Frequency = atol(svalue);
 		config_set_frequency(Frequency);
 	}
+	if (strcmp(key, "cmd/longmynd/tune") == 0)
+	{
+		/* <frequency>,<symbolrate>[,h|v|n] applied as one change */
+		uint32_t frequency, symbolrate;
+		char polar = '\0';
+		char extra;
+		int fields = sscanf(svalue, "%u,%u,%c%c", &frequency, &symbolrate, &polar, &extra);
+
+		/* Anything but h, v or n after the symbol rate is a mistake, not a request to turn the supply off */
+		if ((fields == 2 || (fields == 3 && (polar == 'h' || polar == 'v' || polar == 'n')))
+			&& config_set_tune(frequency, symbolrate, polar != '\0', polar == 'h' || polar == 'v', polar == 'h'))
+		{
+			Frequency = frequency;
+			Symbolrate = symbolrate;
+		}
+		else
+		{
+			const char *error = "{\"error\":\"invalid tune command\"}";
+			mosquitto_publish(mosq, NULL, MQTT_TUNE_ACK_TOPIC, strlen(error), error, 1, false);
+		}
+	}
 	if (strcmp(key, "cmd/longmynd/swport") == 0)
 	{
 		sport = atoi(svalue);
@@ -104,6 +166,24 @@ void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_messag
 		if (strcmp(svalue, "n") == 0)
 			config_set_lnbv(false, false);
 	}
+
+	if (strcmp(key, "cmd/longmynd/status") == 0)
+	{
+		/* A new subscriber asking for every status value, not just those that change */
+		status_delta_request_full();
+	}
+
+	if (strcmp(key, "cmd/longmynd/timeshift") == 0)
+	{
+		char command[256];
+		char reply[256];
+		int len = (msg->payloadlen < (int)sizeof(command) - 1) ? msg->payloadlen : (int)sizeof(command) - 1;
+
+		memcpy(command, msg->payload, len);
+		command[len] = '\0';
+		timeshift_command(command, reply, sizeof(reply));
+		mosquitto_publish(mosq, NULL, "dt/longmynd/timeshift", strlen(reply), reply, 2, false);
+	}
 }
 
 /* Callback called when the client receives a message. */
@@ -111,6 +191,220 @@ void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_messag
 
 static struct mosquitto *mosq;
 
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t mqtt_now_ns(void)
+/* -------------------------------------------------------------------------------------------------- */
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void mqtt_latency_record(uint8_t tier, uint64_t latency_ns)
+/* -------------------------------------------------------------------------------------------------- */
+/* called with mqtt_stats_mutex held                                                                  */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	uint32_t latency_us = (uint32_t)(latency_ns / 1000);
+
+	mqtt_stats.latency_count[tier]++;
+	mqtt_stats.latency_total_us[tier] += latency_us;
+	if (latency_us > mqtt_stats.latency_max_us[tier])
+		mqtt_stats.latency_max_us[tier] = latency_us;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void on_publish(struct mosquitto *mosq, void *obj, int mid)
+/* -------------------------------------------------------------------------------------------------- */
+/* runs on the mosquitto thread once a publish is sent (QoS 0) or acknowledged (QoS 1); this can be   */
+/* before mosquitto_publish has returned the mid to mqtt_publish, so either side may fill the slot    */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	mqtt_latency_slot_t *slot = &mqtt_latency_slots[mid % MQTT_LATENCY_SLOTS];
+	uint64_t now = mqtt_now_ns();
+
+	pthread_mutex_lock(&mqtt_stats_mutex);
+	if (slot->mid == mid && !slot->acked)
+	{
+		mqtt_latency_record(slot->tier, now - slot->sent_ns);
+		slot->mid = 0;
+	}
+	else
+	{
+		slot->mid = mid;
+		slot->acked = true;
+		slot->acked_ns = now;
+	}
+	pthread_mutex_unlock(&mqtt_stats_mutex);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void mqtt_publish(const char *topic, const char *payload, int len, uint8_t tier)
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes with the QoS and retain flag of the tier, and starts timing it                           */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	mqtt_latency_slot_t *slot;
+	uint64_t sent = mqtt_now_ns();
+	int mid = 0;
+
+	if (mosquitto_publish(mosq, &mid, topic, len, payload, (tier == MQTT_TIER_STATE) ? 1 : 0,
+						  tier == MQTT_TIER_STATE) != MOSQ_ERR_SUCCESS)
+	{
+		__atomic_store_n(&mqtt_publish_failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+
+	slot = &mqtt_latency_slots[mid % MQTT_LATENCY_SLOTS];
+	pthread_mutex_lock(&mqtt_stats_mutex);
+	mqtt_stats.published[tier]++;
+	if (slot->mid == mid && slot->acked)
+	{
+		mqtt_latency_record(tier, slot->acked_ns - sent);
+		slot->mid = 0;
+	}
+	else
+	{
+		slot->mid = mid;
+		slot->tier = tier;
+		slot->acked = false;
+		slot->sent_ns = sent;
+	}
+	pthread_mutex_unlock(&mqtt_stats_mutex);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool mqtt_topic_changed(const char *topic, const char *payload, int len)
+/* -------------------------------------------------------------------------------------------------- */
+/* remembers the payload last published on a topic; everything counts as changed on a keyframe        */
+/*  return: true if the payload differs from last time                                                */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	uint32_t topic_hash = 2166136261u, hash = 2166136261u;
+	uint32_t index, probe;
+	mqtt_topic_cache_t *entry;
+	int i;
+
+	for (i = 0; topic[i] != '\0'; i++)
+		topic_hash = (topic_hash ^ (uint8_t)topic[i]) * 16777619u;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (uint8_t)payload[i]) * 16777619u;
+
+	index = topic_hash % MQTT_TOPIC_CACHE_SIZE;
+	for (probe = 0; probe < MQTT_TOPIC_CACHE_SIZE; probe++)
+	{
+		entry = &mqtt_topic_cache[(index + probe) % MQTT_TOPIC_CACHE_SIZE];
+		if (!entry->used)
+		{
+			if (strlen(topic) >= sizeof(entry->topic))
+				return true;
+			strcpy(entry->topic, topic);
+			entry->used = true;
+			entry->hash = hash;
+			return true;
+		}
+		if (strcmp(entry->topic, topic) == 0)
+		{
+			if (entry->hash == hash && !status_delta_keyframe())
+			{
+				__atomic_add_fetch(&mqtt_stats.suppressed, 1, __ATOMIC_RELAXED);
+				return false;
+			}
+			entry->hash = hash;
+			return true;
+		}
+	}
+
+	/* Table full, so just publish */
+	return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void mqtt_publish_changed(const char *topic, const char *payload, int len, uint8_t tier)
+/* -------------------------------------------------------------------------------------------------- */
+{
+	if (mqtt_topic_changed(topic, payload, len))
+		mqtt_publish(topic, payload, len, tier);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void mqtt_publish_number(const char *topic, int64_t value, uint8_t decimals, uint8_t tier)
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes a number, eg. value 123 with 1 decimal as 12.3, if it has changed                        */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	char message[24];
+	status_fmt_t fmt;
+
+	status_fmt_init(&fmt, message, sizeof(message));
+	status_fmt_fixed(&fmt, value, decimals);
+	mqtt_publish_changed(topic, message, fmt.len, tier);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void mqtt_stats_publish(void)
+/* -------------------------------------------------------------------------------------------------- */
+{
+	mqtt_stats_t stats;
+	char message[512];
+	int len;
+
+	mqtt_get_stats(&stats);
+	len = snprintf(message, sizeof(message),
+				   "{\"published\":[%u,%u],\"suppressed\":%u,\"held_back\":%u,"
+				   "\"latency_avg_us\":[%llu,%llu],\"latency_max_us\":[%u,%u]}",
+				   stats.published[MQTT_TIER_TELEMETRY], stats.published[MQTT_TIER_STATE],
+				   stats.suppressed, stats.held_back,
+				   (unsigned long long)(stats.latency_count[MQTT_TIER_TELEMETRY] ? stats.latency_total_us[MQTT_TIER_TELEMETRY] / stats.latency_count[MQTT_TIER_TELEMETRY] : 0),
+				   (unsigned long long)(stats.latency_count[MQTT_TIER_STATE] ? stats.latency_total_us[MQTT_TIER_STATE] / stats.latency_count[MQTT_TIER_STATE] : 0),
+				   stats.latency_max_us[MQTT_TIER_TELEMETRY], stats.latency_max_us[MQTT_TIER_STATE]);
+	mqtt_publish(MQTT_STATS_TOPIC, message, len, MQTT_TIER_TELEMETRY);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void mqtt_status_configure(uint8_t snapshot)
+/* -------------------------------------------------------------------------------------------------- */
+/* snapshot: MQTT_SNAPSHOT_NONE for a topic per value, or the snapshot format                         */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	mqtt_snapshot = snapshot;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void mqtt_status_cycle(void)
+/* -------------------------------------------------------------------------------------------------- */
+/* called before each status update is published, once the sink's maximum rate allows it              */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	uint64_t now = monotonic_ms();
+
+	if (now - mqtt_last_stats_monotonic >= MQTT_STATS_INTERVAL_MS)
+	{
+		mqtt_last_stats_monotonic = now;
+		mqtt_stats_publish();
+	}
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void mqtt_status_held_back(void)
+/* -------------------------------------------------------------------------------------------------- */
+/* counts a status update delayed by the maximum rate; it goes out with whatever follows it           */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	__atomic_add_fetch(&mqtt_stats.held_back, 1, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void mqtt_get_stats(mqtt_stats_t *stats)
+/* -------------------------------------------------------------------------------------------------- */
+{
+	pthread_mutex_lock(&mqtt_stats_mutex);
+	memcpy(stats, &mqtt_stats, sizeof(mqtt_stats_t));
+	pthread_mutex_unlock(&mqtt_stats_mutex);
+}
+
 int mqttinit(char *MqttBroker)
 {
 
@@ -135,6 +429,7 @@ int mqttinit(char *MqttBroker)
 	mosquitto_connect_callback_set(mosq, on_connect);
 	mosquitto_subscribe_callback_set(mosq, on_subscribe);
 	mosquitto_message_callback_set(mosq, on_message);
+	mosquitto_publish_callback_set(mosq, on_publish);
 
 	/* Connect to test.mosquitto.org on port 1883, with a keepalive of 60 seconds.
 	 * This call makes the socket connection only, it does not complete the MQTT
@@ -170,8 +465,28 @@ const char StatusString[30][255] = {"", "rx_state", "lna_gain", "puncrate", "pow
 									"symbolrate", "viterbi_error", "ber", "mer", "service_name", "provider_name", "ts_null", "es_pid", "es_type", "modcod", "short_frame", "pilots",
 									"ldpc_errors", "bch_errors", "bch_uncorect", "lnb_supply", "polarisation", "agc1", "agc2", "matype1", "matype2"};
 
+/* Values that describe what is being received rather than how well */
+const uint8_t StatusTier[30] = {MQTT_TIER_TELEMETRY, MQTT_TIER_STATE, MQTT_TIER_TELEMETRY, MQTT_TIER_STATE, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY,
+								MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY,
+								MQTT_TIER_TELEMETRY, MQTT_TIER_STATE, MQTT_TIER_STATE, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY,
+								MQTT_TIER_STATE, MQTT_TIER_STATE, MQTT_TIER_STATE, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY,
+								MQTT_TIER_STATE, MQTT_TIER_STATE, MQTT_TIER_TELEMETRY, MQTT_TIER_TELEMETRY, MQTT_TIER_STATE, MQTT_TIER_STATE};
+
 const char StateString[5][255] = {"Init", "Hunting", "found header", "demod_s", "demod_s2"};
 
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t mqtt_status_result(uint8_t err)
+/* -------------------------------------------------------------------------------------------------- */
+/* what a status write returns: ERROR_STATUS_DROPPED if a publish has failed since the last one, so   */
+/* that the sink sends everything with the next update                                                */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	if (err == ERROR_NONE && __atomic_exchange_n(&mqtt_publish_failed, false, __ATOMIC_RELAXED))
+		err = ERROR_STATUS_DROPPED;
+
+	return err;
+}
+
 uint8_t mqtt_status_write(uint8_t message, uint32_t data, bool *output_ready)
 {
 	/* -------------------------------------------------------------------------------------------------- */
@@ -182,56 +497,38 @@ uint8_t mqtt_status_write(uint8_t message, uint32_t data, bool *output_ready)
 	/* -------------------------------------------------------------------------------------------------- */
 	(void)output_ready;
 	uint8_t err = ERROR_NONE;
-	char status_topic[255];
-	char status_message[255];
+	char status_topic[64];
+	status_fmt_t topic;
 	static int latest_modcod = 0;
 	/* WARNING: This currently prints as signed integer (int32_t), even though function appears to expect unsigned (uint32_t) */
-	sprintf(status_topic, "dt/longmynd/%s", StatusString[message]);
+	status_fmt_init(&topic, status_topic, sizeof(status_topic));
+	status_fmt_str(&topic, "dt/longmynd/");
+	status_fmt_str(&topic, StatusString[message]);
 	if (message == STATUS_STATE) // state machine
 	{
-		sprintf(status_message, "%s", StateString[data]);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
-
-		sprintf(status_topic, "dt/longmynd/set/sr");
-		sprintf(status_message, "%d", Symbolrate);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
-
-		sprintf(status_topic, "dt/longmynd/set/frequency");
-		sprintf(status_message, "%d", Frequency);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_changed(status_topic, StateString[data], strlen(StateString[data]), MQTT_TIER_STATE);
 
-		sprintf(status_topic, "dt/longmynd/set/swport");
-		sprintf(status_message, "%d", sport);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
-
-		sprintf(status_topic, "dt/longmynd/set/tsip");
-		sprintf(status_message, "%s", stsip);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_number("dt/longmynd/set/sr", (int32_t)Symbolrate, 0, MQTT_TIER_STATE);
+		mqtt_publish_number("dt/longmynd/set/frequency", (int32_t)Frequency, 0, MQTT_TIER_STATE);
+		mqtt_publish_number("dt/longmynd/set/swport", sport, 0, MQTT_TIER_STATE);
+		mqtt_publish_changed("dt/longmynd/set/tsip", stsip, strlen(stsip), MQTT_TIER_STATE);
 
 		extern size_t video_pcrpts;
 		extern size_t audio_pcrpts;
 		extern long transmission_delay;
 
-		sprintf(status_topic, "dt/longmynd/videobuffer");
-		sprintf(status_message, "%zu", video_pcrpts);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
-
-		sprintf(status_topic, "dt/longmynd/audiobuffer");
-		sprintf(status_message, "%zu", audio_pcrpts);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_number("dt/longmynd/videobuffer", video_pcrpts, 0, MQTT_TIER_TELEMETRY);
+		mqtt_publish_number("dt/longmynd/audiobuffer", audio_pcrpts, 0, MQTT_TIER_TELEMETRY);
 
 		if(transmission_delay!=0)
 		{
-		sprintf(status_topic, "dt/longmynd/transdelay");
-		sprintf(status_message, "%ld", transmission_delay);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_number("dt/longmynd/transdelay", transmission_delay, 0, MQTT_TIER_TELEMETRY);
 		}
 	}
 	else if (message == STATUS_SYMBOL_RATE)
 	{
 		data = (data + 500) / 1000; // SR EN KS
-		sprintf(status_message, "%i", data);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_number(status_topic, (int32_t)data, 0, MQTT_TIER_TELEMETRY);
 	}
 	else if (message == STATUS_MODCOD)
 	{
@@ -254,23 +551,27 @@ uint8_t mqtt_status_write(uint8_t message, uint32_t data, bool *output_ready)
 			strcpy(modulation, "32APSK");
 
 		strcpy(fec, TabFec[modcod]);
-		mosquitto_publish(mosq, NULL, "dt/longmynd/modulation", strlen(modulation), modulation, 2, false);
-		mosquitto_publish(mosq, NULL, "dt/longmynd/fec", strlen(fec), fec, 2, false);
+		mqtt_publish_changed("dt/longmynd/modulation", modulation, strlen(modulation), MQTT_TIER_STATE);
+		mqtt_publish_changed("dt/longmynd/fec", fec, strlen(fec), MQTT_TIER_STATE);
 		
 	}
 	else if (message == STATUS_MATYPE2)
 	{
-		sprintf(status_message, "%x", data);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		char status_message[16];
+		status_fmt_t value;
+
+		status_fmt_init(&value, status_message, sizeof(status_message));
+		status_fmt_hex(&value, data);
+		mqtt_publish_changed(status_topic, status_message, value.len, MQTT_TIER_STATE);
 	}
 	else if (message == STATUS_ROLLOFF)
 	{
-		sprintf(status_topic, "dt/longmynd/rolloff");
-		if(data==0)	sprintf(status_message, "0.35");
-		if(data==1)	sprintf(status_message, "0.25");
-		if(data==2)	sprintf(status_message, "0.20");
-		if(data==3)	sprintf(status_message, "0.15");
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		const char *rolloff = "";
+		if(data==0)	rolloff = "0.35";
+		if(data==1)	rolloff = "0.25";
+		if(data==2)	rolloff = "0.20";
+		if(data==3)	rolloff = "0.15";
+		mqtt_publish_changed("dt/longmynd/rolloff", rolloff, strlen(rolloff), MQTT_TIER_STATE);
 	}
 	else if (message == STATUS_MATYPE1)
 	{
@@ -291,42 +592,41 @@ uint8_t mqtt_status_write(uint8_t message, uint32_t data, bool *output_ready)
 			break;
 		}
 
-		mosquitto_publish(mosq, NULL, status_topic, strlen(matype), matype, 2, false);
+		mqtt_publish_changed(status_topic, matype, strlen(matype), MQTT_TIER_STATE);
 	}
 	else if (message == STATUS_MER)
 	{
 		int TheoricMER[] = {0, -24, -12, 0, 10, 22, 32, 40, 46, 52, 62, 65, 55, 66, 79, 94, 106, 110, 90, 102, 110, 116, 129, 131, 126, 136, 143, 157, 161};
-		sprintf(status_message, "%0.1f", ((int)data) / 10.0);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
-		char smargin[50];
+		/* Tenths of a dB, so shown with one decimal place */
+		mqtt_publish_number(status_topic, (int32_t)data, 1, MQTT_TIER_TELEMETRY);
 		if (latest_modcod != 0)
 		{
 
 			int Margin = (int)data - TheoricMER[latest_modcod];
-			sprintf(smargin, "%d", Margin / 10);
-			mosquitto_publish(mosq, NULL, "dt/longmynd/margin_db", strlen(smargin), smargin, 2, false);
+			mqtt_publish_number("dt/longmynd/margin_db", Margin / 10, 0, MQTT_TIER_TELEMETRY);
 		}
 		else
 		{
-			sprintf(smargin, "%d", 0);
-			mosquitto_publish(mosq, NULL, "dt/longmynd/margin_db", strlen(smargin), smargin, 2, false);
+			mqtt_publish_number("dt/longmynd/margin_db", 0, 0, MQTT_TIER_TELEMETRY);
 		}
 	}
-	else if ((message == STATUS_CONSTELLATION_I) || (message == STATUS_CONSTELLATION_Q))
+	else if ((message == STATUS_CONSTELLATION_I) || (message == STATUS_CONSTELLATION_Q) ||
+			 (message == STATUS_ES_PID) || (message == STATUS_ES_TYPE))
 	{
-		int8_t signed_data;
-		signed_data = (int8_t)data;
-		sprintf(status_message, "%d", data);
+		char status_message[16];
+		status_fmt_t value;
 
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		/* One message per point or stream, so never suppressed as a repeat */
+		status_fmt_init(&value, status_message, sizeof(status_message));
+		status_fmt_i32(&value, (int32_t)data);
+		mqtt_publish(status_topic, status_message, value.len, MQTT_TIER_TELEMETRY);
 	}
 	else
 	{
-		sprintf(status_message, "%i", data);
-		mosquitto_publish(mosq, NULL, status_topic, strlen(status_message), status_message, 2, false);
+		mqtt_publish_number(status_topic, (int32_t)data, 0, StatusTier[message]);
 	}
 
-	return err;
+	return mqtt_status_result(err);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -341,10 +641,167 @@ uint8_t mqtt_status_string_write(uint8_t message, char *data, bool *output_ready
 	(void)output_ready;
 	uint8_t err = ERROR_NONE;
 
-	char status_topic[255];
+	char status_topic[64];
+	status_fmt_t topic;
 
-	sprintf(status_topic, "dt/longmynd/%s", StatusString[message]);
-	mosquitto_publish(mosq, NULL, status_topic, strlen(data), data, 2, false);
+	status_fmt_init(&topic, status_topic, sizeof(status_topic));
+	status_fmt_str(&topic, "dt/longmynd/");
+	status_fmt_str(&topic, StatusString[message]);
+	mqtt_publish_changed(status_topic, data, strlen(data), MQTT_TIER_STATE);
 
-	return err;
+	return mqtt_status_result(err);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t mqtt_status_snapshot(const longmynd_status_t *status, bool *output_ready)
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes the whole status as one message on MQTT_SNAPSHOT_TOPIC; the state and set-points still   */
+/* go out on their own retained topics when they change                                               */
+/*  *status: a consistent snapshot, as taken by status_snapshot()                                     */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	(void)output_ready;
+	extern size_t video_pcrpts;
+	extern size_t audio_pcrpts;
+	extern long transmission_delay;
+	static status_frame_t frame;
+	static uint32_t sequence = 0;
+	static char message[MQTT_SNAPSHOT_MAX];
+	const char *state = StateString[status->state < 5 ? status->state : 0];
+	status_fmt_t fmt;
+	int count;
+
+	/* Keeps the retained topics on the status keyframe cadence */
+	status_delta_begin();
+
+	if (mqtt_snapshot == MQTT_SNAPSHOT_BINARY)
+	{
+		status_frame_encode_full(status, &frame);
+		mqtt_publish(MQTT_SNAPSHOT_TOPIC, frame.buffer, frame.len, MQTT_TIER_TELEMETRY);
+		status_frame_sent(&frame);
+	}
+	else
+	{
+		status_fmt_init(&fmt, message, sizeof(message));
+		status_fmt_str(&fmt, "{\"seq\":");
+		status_fmt_u32(&fmt, sequence++);
+		status_fmt_str(&fmt, ",\"rx_state\":");
+		status_fmt_json_string(&fmt, state);
+		status_fmt_str(&fmt, ",\"state\":");
+		status_fmt_u32(&fmt, status->state);
+		status_fmt_str(&fmt, ",\"lna_gain\":");
+		status_fmt_u32(&fmt, status->lna_ok ? status->lna_gain : 0);
+		status_fmt_str(&fmt, ",\"puncrate\":");
+		status_fmt_u32(&fmt, status->puncture_rate);
+		status_fmt_str(&fmt, ",\"poweri\":");
+		status_fmt_u32(&fmt, status->power_i);
+		status_fmt_str(&fmt, ",\"powerq\":");
+		status_fmt_u32(&fmt, status->power_q);
+		status_fmt_str(&fmt, ",\"carrier_frequency\":");
+		status_fmt_u32(&fmt, (uint32_t)(status->frequency_requested + (status->frequency_offset / 1000)));
+		status_fmt_str(&fmt, ",\"symbolrate\":");
+		status_fmt_u32(&fmt, status->symbolrate);
+		status_fmt_str(&fmt, ",\"viterbi_error\":");
+		status_fmt_u32(&fmt, status->viterbi_error_rate);
+		status_fmt_str(&fmt, ",\"ber\":");
+		status_fmt_u32(&fmt, status->bit_error_rate);
+		status_fmt_str(&fmt, ",\"mer\":");
+		status_fmt_fixed(&fmt, status->modulation_error_rate, 1);
+		status_fmt_str(&fmt, ",\"ts_null\":");
+		status_fmt_u32(&fmt, status->ts_null_percentage);
+		status_fmt_str(&fmt, ",\"modcod\":");
+		status_fmt_u32(&fmt, status->modcod);
+		status_fmt_str(&fmt, ",\"short_frame\":");
+		status_fmt_u32(&fmt, status->short_frame);
+		status_fmt_str(&fmt, ",\"pilots\":");
+		status_fmt_u32(&fmt, status->pilots);
+		status_fmt_str(&fmt, ",\"ldpc_errors\":");
+		status_fmt_u32(&fmt, status->errors_ldpc_count);
+		status_fmt_str(&fmt, ",\"bch_errors\":");
+		status_fmt_u32(&fmt, status->errors_bch_count);
+		status_fmt_str(&fmt, ",\"bch_uncorect\":");
+		status_fmt_u32(&fmt, status->errors_bch_uncorrected);
+		status_fmt_str(&fmt, ",\"lnb_supply\":");
+		status_fmt_u32(&fmt, status->polarisation_supply);
+		status_fmt_str(&fmt, ",\"polarisation\":");
+		status_fmt_u32(&fmt, status->polarisation_horizontal);
+		status_fmt_str(&fmt, ",\"agc1\":");
+		status_fmt_u32(&fmt, status->agc1_gain);
+		status_fmt_str(&fmt, ",\"agc2\":");
+		status_fmt_u32(&fmt, status->agc2_gain);
+		status_fmt_str(&fmt, ",\"matype1\":");
+		status_fmt_u32(&fmt, status->matype1);
+		status_fmt_str(&fmt, ",\"matype2\":");
+		status_fmt_u32(&fmt, status->matype2);
+		status_fmt_str(&fmt, ",\"rolloff\":");
+		status_fmt_u32(&fmt, status->rolloff);
+		status_fmt_str(&fmt, ",\"videobuffer\":");
+		status_fmt_u64(&fmt, video_pcrpts);
+		status_fmt_str(&fmt, ",\"audiobuffer\":");
+		status_fmt_u64(&fmt, audio_pcrpts);
+		status_fmt_str(&fmt, ",\"transdelay\":");
+		status_fmt_fixed(&fmt, transmission_delay, 0);
+		status_fmt_str(&fmt, ",\"service_name\":");
+		status_fmt_json_string(&fmt, status->service_name);
+		status_fmt_str(&fmt, ",\"provider_name\":");
+		status_fmt_json_string(&fmt, status->service_provider_name);
+
+		status_fmt_str(&fmt, ",\"constellation\":[");
+		for (count = 0; count < NUM_CONSTELLATIONS; count++)
+		{
+			status_fmt_str(&fmt, count ? ",[" : "[");
+			status_fmt_i32(&fmt, status->constellation[count][0]);
+			status_fmt_char(&fmt, ',');
+			status_fmt_i32(&fmt, status->constellation[count][1]);
+			status_fmt_char(&fmt, ']');
+		}
+		status_fmt_str(&fmt, "],\"es\":[");
+		for (count = 0; count < NUM_ELEMENT_STREAMS; count++)
+		{
+			if (status->ts_elementary_streams[count][0] > 0)
+			{
+				status_fmt_str(&fmt, (message[fmt.len - 1] == '[') ? "[" : ",[");
+				status_fmt_u32(&fmt, status->ts_elementary_streams[count][0]);
+				status_fmt_char(&fmt, ',');
+				status_fmt_u32(&fmt, status->ts_elementary_streams[count][1]);
+				status_fmt_char(&fmt, ']');
+			}
+		}
+		status_fmt_str(&fmt, "]}");
+
+		if (!fmt.truncated)
+			mqtt_publish(MQTT_SNAPSHOT_TOPIC, message, fmt.len, MQTT_TIER_TELEMETRY);
+	}
+
+	/* Late subscribers get these from the broker */
+	mqtt_publish_changed("dt/longmynd/rx_state", state, strlen(state), MQTT_TIER_STATE);
+	mqtt_publish_number("dt/longmynd/set/sr", (int32_t)Symbolrate, 0, MQTT_TIER_STATE);
+	mqtt_publish_number("dt/longmynd/set/frequency", (int32_t)Frequency, 0, MQTT_TIER_STATE);
+	mqtt_publish_number("dt/longmynd/set/swport", sport, 0, MQTT_TIER_STATE);
+	mqtt_publish_changed("dt/longmynd/set/tsip", stsip, strlen(stsip), MQTT_TIER_STATE);
+
+	return mqtt_status_result(ERROR_NONE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void mqtt_config_applied(const longmynd_config_t *config, uint8_t err, uint32_t elapsed_ms)
+/* -------------------------------------------------------------------------------------------------- */
+/* acknowledges a config change once loop_i2c has put it into the hardware                            */
+/*     *config: the config as applied                                                                 */
+/*         err: the error code from applying it                                                       */
+/*  elapsed_ms: from the first command in the change to the hardware being set up                     */
+/* -------------------------------------------------------------------------------------------------- */
+{
+	char message[256];
+	int len;
+
+	len = snprintf(message, sizeof(message),
+				   "{\"transaction\":%u,\"changes\":%u,\"frequency\":%u,\"sr\":%u,\"polar\":\"%c\","
+				   "\"swport\":%u,\"err\":%u,\"elapsed_ms\":%u}",
+				   config->config_transaction, config->new_config_changes,
+				   config->freq_requested[config->freq_index], config->sr_requested[config->sr_index],
+				   config->polarisation_supply ? (config->polarisation_horizontal ? 'h' : 'v') : 'n',
+				   config->port_swap, err, elapsed_ms);
+	mosquitto_publish(mosq, NULL, MQTT_TUNE_ACK_TOPIC, len, message, 1, false);
 }
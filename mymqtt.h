@@ -3,8 +3,39 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "main.h"
+
+/* How the status goes out: one topic per value as ever, or one snapshot per update on MQTT_SNAPSHOT_TOPIC */
+#define MQTT_SNAPSHOT_NONE   0
+#define MQTT_SNAPSHOT_JSON   1
+#define MQTT_SNAPSHOT_BINARY 2 /* a keyframe as described in status_binary.h */
+
+#define MQTT_SNAPSHOT_TOPIC "dt/longmynd/status"
+#define MQTT_STATS_TOPIC    "dt/longmynd/mqtt_stats"
+#define MQTT_TUNE_ACK_TOPIC "dt/longmynd/tune_ack"
+
+/* Telemetry is superseded by the next update so goes at QoS 0; the state and set-points go at QoS 1 */
+/* and are retained so that a new subscriber sees them straight away                                 */
+#define MQTT_TIER_TELEMETRY 0
+#define MQTT_TIER_STATE     1
+#define MQTT_TIERS          2
+
+typedef struct {
+	uint32_t published[MQTT_TIERS];
+	uint32_t suppressed;   /* unchanged values not published again */
+	uint32_t held_back;    /* status updates delayed by the maximum publish rate */
+	uint32_t latency_count[MQTT_TIERS];
+	uint64_t latency_total_us[MQTT_TIERS];
+	uint32_t latency_max_us[MQTT_TIERS]; /* publish to PUBACK at QoS 1, to the socket at QoS 0 */
+} mqtt_stats_t;
 
 int mqttinit(char *MqttBroker);
+void mqtt_status_configure(uint8_t snapshot);
+void mqtt_status_cycle(void);
+void mqtt_status_held_back(void);
 uint8_t mqtt_status_write(uint8_t message, uint32_t data, bool *output_ready);
 uint8_t mqtt_status_string_write(uint8_t message, char *data, bool *output_ready);
+uint8_t mqtt_status_snapshot(const longmynd_status_t *status, bool *output_ready);
+void mqtt_get_stats(mqtt_stats_t *stats);
+void mqtt_config_applied(const longmynd_config_t *config, uint8_t err, uint32_t elapsed_ms);
 #endif
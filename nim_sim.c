@@ -0,0 +1,715 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: nim_sim.c                                                                   */
+/*    - a behavioural model of the Serit NIM, standing in for the Minitiouner as the FTDI transport   */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* The model sits below ftdi.c, so everything from nim.c up runs unchanged and is counted and traced  */
+/* as it would be on the hardware. Each chip is a register file: the STV0910 seeded from its default  */
+/* table, the STV6120 from zero, both overlaid with any values read in register logs until the host   */
+/* writes them. The few registers the driver waits on are computed from when they were last kicked:   */
+/* the demodulator PLL, the tuner calibrations and PLL, the LNA AGC, the scan state, symbols, symbol  */
+/* rate, MER and the BER counters. Every access sleeps out its bus time with the bus (the mutex) held */
+/* and can be NAKed, and the tuner and LNAs only answer through the demodulator's I2C repeater.       */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "errors.h"
+#include "ftdi.h"
+#include "nim.h"
+#include "stv0910.h"
+#include "stv0910_regs.h"
+#include "stv0910_regs_init.h"
+#include "stv6120_regs.h"
+#include "stvvglna_regs.h"
+#include "metrics.h"
+#include "nim_sim.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* As many attempts as ftdi.c makes before giving up: FTDI_NUM_TRIES * FTDI_RDWR_TIMEOUT */
+#define NIM_SIM_TRIES 1000
+
+#define NIM_SIM_DEMOD_BASE 0xf000
+#define NIM_SIM_DEMOD_REGS 0x1000
+#define NIM_SIM_TUNER_REGS 0x20
+#define NIM_SIM_LNA_REGS   4
+
+/* The P1 (bottom) demodulator's registers are the P2 (top) ones moved up by 0x200 */
+#define NIM_SIM_PATH_P2     0
+#define NIM_SIM_PATH_P1     1
+#define NIM_SIM_PATH_OFFSET 0x200
+
+#define NIM_SIM_SIGNAL_NONE 0
+#define NIM_SIM_SIGNAL_S2   1
+#define NIM_SIM_SIGNAL_S    2
+
+/* What a locked signal reads back as */
+#define NIM_SIM_S2_MODCOD  7    /* QPSK 3/4 */
+#define NIM_SIM_MER        90   /* 9.0dB */
+#define NIM_SIM_SYMBOL     0x28 /* constellation point amplitude */
+#define NIM_SIM_BER_BITS   1000 /* one bit in error in this many */
+#define NIM_SIM_LNA_GAIN   STVVGLNA_REG3_SWLNAGAIN_INTERMEDIATE_HIGH
+#define NIM_SIM_LNA_VGO    0x0c
+
+/* Register bits the model drives */
+#define NIM_SIM_STANDBY         0x80 /* SYNTCTRL */
+#define NIM_SIM_PLLLOCK         0x01 /* PLLSTAT */
+#define NIM_SIM_REPEATER_ON     0x80 /* I2CRPT */
+#define NIM_SIM_CAR_LOCK        0x80 /* DSTATUS */
+#define NIM_SIM_LOCK_DEFINITIF  0x08 /* DSTATUS */
+#define NIM_SIM_HEADER_MODE     0x60 /* DMDSTATE */
+#define NIM_SIM_NOSRAM_VALIDE   0x04 /* NOSRAMPOS */
+#define NIM_SIM_DMDISTATE_MASK  0x1f
+#define NIM_SIM_DMDISTATE_STOP  0x1c
+#define NIM_SIM_DMDISTATE_RESET 0x1f
+
+/* The FTDI latency timer: how often an idle TS endpoint hands back just its status bytes */
+#define NIM_SIM_TS_LATENCY_US 16000
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t latency_us;
+    uint32_t nak_ppm;
+    uint32_t seed;
+    uint32_t header_ms;
+    uint32_t lock_ms;
+    uint8_t signal;
+    bool lna;
+} nim_sim_settings_t;
+
+static nim_sim_settings_t nim_sim_settings;
+
+/* Held for the whole of an access, bus time included, as the NIM has the one I2C bus */
+static pthread_mutex_t nim_sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t nim_sim_prng;
+static bool nim_sim_in_reset = false;
+
+static uint8_t nim_sim_demod[NIM_SIM_DEMOD_REGS];
+static bool nim_sim_demod_written[NIM_SIM_DEMOD_REGS];
+static int16_t nim_sim_demod_observed[NIM_SIM_DEMOD_REGS]; /* from the register logs, -1 if never read */
+static uint64_t nim_sim_pll_lock_ns;                       /* 0 while the PLL is in standby */
+static uint64_t nim_sim_scan_start_ns[2];                  /* 0 while the demodulator is stopped */
+static uint64_t nim_sim_fber_bytes[2];                     /* latched by reading FBERCPT4 */
+
+static uint8_t nim_sim_tuner[NIM_SIM_TUNER_REGS];
+static bool nim_sim_tuner_written[NIM_SIM_TUNER_REGS];
+static int16_t nim_sim_tuner_observed[NIM_SIM_TUNER_REGS];
+static uint64_t nim_sim_tuner_rc_end_ns[2];
+static uint64_t nim_sim_tuner_vco_end_ns[2];
+static uint64_t nim_sim_tuner_lock_ns[2];
+
+static uint8_t nim_sim_lna[2][NIM_SIM_LNA_REGS];
+static uint64_t nim_sim_lna_agc_end_ns[2];
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t nim_sim_random(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* xorshift64: cheap, and the same run for the same seed                                              */
+/* -------------------------------------------------------------------------------------------------- */
+    nim_sim_prng ^= nim_sim_prng << 13;
+    nim_sim_prng ^= nim_sim_prng >> 7;
+    nim_sim_prng ^= nim_sim_prng << 17;
+    return (uint32_t)(nim_sim_prng >> 32);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void nim_sim_reset_state(uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* puts every chip back to how it comes out of the NIM reset                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint16_t i;
+
+    memset(nim_sim_demod, 0, sizeof(nim_sim_demod));
+    memset(nim_sim_demod_written, 0, sizeof(nim_sim_demod_written));
+    for (i=0; i<STV0910_NBREGS; i++) {
+        if (STV0910DefVal[i].reg>=NIM_SIM_DEMOD_BASE) {
+            nim_sim_demod[STV0910DefVal[i].reg-NIM_SIM_DEMOD_BASE]=STV0910DefVal[i].val;
+        }
+    }
+    nim_sim_demod[RSTV0910_MID-NIM_SIM_DEMOD_BASE]=0x51;
+    nim_sim_demod[RSTV0910_DID-NIM_SIM_DEMOD_BASE]=0x20;
+    nim_sim_pll_lock_ns=(nim_sim_demod[RSTV0910_SYNTCTRL-NIM_SIM_DEMOD_BASE] & NIM_SIM_STANDBY) ?
+                        0 : now+NIM_SIM_DEMOD_PLL_US*1000ULL;
+    memset(nim_sim_scan_start_ns, 0, sizeof(nim_sim_scan_start_ns));
+    memset(nim_sim_fber_bytes, 0, sizeof(nim_sim_fber_bytes));
+
+    /* The register logs have the tuner PLL locked from power up, before its first calibration */
+    memset(nim_sim_tuner, 0, sizeof(nim_sim_tuner));
+    memset(nim_sim_tuner_written, 0, sizeof(nim_sim_tuner_written));
+    memset(nim_sim_tuner_rc_end_ns, 0, sizeof(nim_sim_tuner_rc_end_ns));
+    memset(nim_sim_tuner_vco_end_ns, 0, sizeof(nim_sim_tuner_vco_end_ns));
+    nim_sim_tuner_lock_ns[0]=now;
+    nim_sim_tuner_lock_ns[1]=now;
+
+    memset(nim_sim_lna, 0, sizeof(nim_sim_lna));
+    memset(nim_sim_lna_agc_end_ns, 0, sizeof(nim_sim_lna_agc_end_ns));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_demod_value(uint16_t reg) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a demodulator register as stored: what was last written, else what the logs saw, else its default  */
+/* -------------------------------------------------------------------------------------------------- */
+    uint16_t i=reg-NIM_SIM_DEMOD_BASE;
+
+    if (!nim_sim_demod_written[i] && nim_sim_demod_observed[i]>=0) return (uint8_t)nim_sim_demod_observed[i];
+    return nim_sim_demod[i];
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool nim_sim_tuner_locked(uint8_t tuner, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+    return (nim_sim_tuner_lock_ns[tuner]!=0) && (now>=nim_sim_tuner_lock_ns[tuner]);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_scan_state(uint8_t path, uint64_t now, uint64_t *locked_ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* where a demodulator has got to in its scan. The scan makes no progress until its tuner is locked,  */
+/* so a retune that recalibrates the tuner after starting the scan also delays the lock               */
+/*      path: NIM_SIM_PATH_P2 | NIM_SIM_PATH_P1, which also picks its tuner                           */
+/* locked_ns: set to when it locked, if it has                                                        */
+/*    return: DEMOD_HUNTING | DEMOD_FOUND_HEADER | DEMOD_S2 | DEMOD_S                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t start;
+
+    if ((nim_sim_scan_start_ns[path]==0) || (nim_sim_settings.signal==NIM_SIM_SIGNAL_NONE)) return DEMOD_HUNTING;
+    if (!nim_sim_tuner_locked(path, now)) return DEMOD_HUNTING;
+
+    start=nim_sim_scan_start_ns[path];
+    if (nim_sim_tuner_lock_ns[path]>start) start=nim_sim_tuner_lock_ns[path];
+
+    if (now < start+nim_sim_settings.header_ms*1000000ULL) return DEMOD_HUNTING;
+    if (now < start+nim_sim_settings.lock_ms*1000000ULL) return DEMOD_FOUND_HEADER;
+
+    *locked_ns=start+nim_sim_settings.lock_ms*1000000ULL;
+    return (nim_sim_settings.signal==NIM_SIM_SIGNAL_S2) ? DEMOD_S2 : DEMOD_S;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_demod_read(uint16_t reg, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* reads a demodulator register, working out the ones the chip drives itself                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t val=nim_sim_demod_value(reg);
+    uint8_t path;
+    uint16_t p2_reg;
+    uint8_t state;
+    uint64_t locked_ns=0;
+    bool locked;
+    double symbol_rate;
+    uint64_t bytes;
+    int16_t symbol;
+
+    if (reg==RSTV0910_PLLSTAT) {
+        return (val & ~NIM_SIM_PLLLOCK) | (((nim_sim_pll_lock_ns!=0) && (now>=nim_sim_pll_lock_ns)) ? NIM_SIM_PLLLOCK : 0);
+    }
+
+    /* Everything else the model drives is per demodulator */
+    if ((reg<0xf200) || (reg>=0xf600)) return val;
+    path=(reg>=0xf400) ? NIM_SIM_PATH_P1 : NIM_SIM_PATH_P2;
+    p2_reg=(path==NIM_SIM_PATH_P1) ? reg-NIM_SIM_PATH_OFFSET : reg;
+
+    state=nim_sim_scan_state(path, now, &locked_ns);
+    locked=(state==DEMOD_S2) || (state==DEMOD_S);
+
+    switch (p2_reg) {
+        case RSTV0910_P2_DMDSTATE:
+            return (val & ~NIM_SIM_HEADER_MODE) | (state << 5);
+        case RSTV0910_P2_DSTATUS:
+            if (locked) return val | NIM_SIM_CAR_LOCK | NIM_SIM_LOCK_DEFINITIF;
+            return val & ~(NIM_SIM_CAR_LOCK | NIM_SIM_LOCK_DEFINITIF);
+        case RSTV0910_P2_DMDMODCOD:
+            if (state==DEMOD_S2) return NIM_SIM_S2_MODCOD << 2;
+            return val;
+        case RSTV0910_P2_ISYMB:
+        case RSTV0910_P2_QSYMB:
+            /* QPSK points with a little noise once locked, just noise before */
+            if (locked) {
+                symbol=((nim_sim_random() & 1) ? NIM_SIM_SYMBOL : -NIM_SIM_SYMBOL) + (int16_t)(nim_sim_random()%17) - 8;
+            } else {
+                symbol=(int16_t)(nim_sim_random()%129) - 64;
+            }
+            return (uint8_t)(int8_t)symbol;
+        /* The found symbol rate is where the scan was told to start */
+        case RSTV0910_P2_SFR3:
+            return nim_sim_demod_value(reg-RSTV0910_P2_SFR3+RSTV0910_P2_SFRINIT1);
+        case RSTV0910_P2_SFR2:
+            return nim_sim_demod_value(reg-RSTV0910_P2_SFR2+RSTV0910_P2_SFRINIT0);
+        case RSTV0910_P2_SFR1:
+        case RSTV0910_P2_SFR0:
+            return 0;
+        case RSTV0910_P2_FBERCPT4:
+            /* Reading the top byte latches the counters, the bytes through the FEC since lock */
+            bytes=0;
+            if (locked) {
+                symbol_rate=(double)NIM_DEMOD_MCLK*
+                            ((nim_sim_demod_value(reg-RSTV0910_P2_FBERCPT4+RSTV0910_P2_SFRINIT1) << 8) |
+                              nim_sim_demod_value(reg-RSTV0910_P2_FBERCPT4+RSTV0910_P2_SFRINIT0))/65536.0;
+                bytes=(uint64_t)(symbol_rate*2.0/8.0*(double)(now-locked_ns)/1e9);
+            }
+            nim_sim_fber_bytes[path]=bytes;
+            return (uint8_t)(bytes >> 32);
+        case RSTV0910_P2_FBERCPT3:
+            return (uint8_t)(nim_sim_fber_bytes[path] >> 24);
+        case RSTV0910_P2_FBERCPT2:
+            return (uint8_t)(nim_sim_fber_bytes[path] >> 16);
+        case RSTV0910_P2_FBERCPT1:
+            return (uint8_t)(nim_sim_fber_bytes[path] >> 8);
+        case RSTV0910_P2_FBERCPT0:
+            return (uint8_t)nim_sim_fber_bytes[path];
+        case RSTV0910_P2_FBERERR2:
+            return (uint8_t)((nim_sim_fber_bytes[path]*8/NIM_SIM_BER_BITS) >> 16);
+        case RSTV0910_P2_FBERERR1:
+            return (uint8_t)((nim_sim_fber_bytes[path]*8/NIM_SIM_BER_BITS) >> 8);
+        case RSTV0910_P2_FBERERR0:
+            return (uint8_t)(nim_sim_fber_bytes[path]*8/NIM_SIM_BER_BITS);
+        case RSTV0910_P2_NOSRAMPOS:
+            if (locked) return (val & ~0x07) | NIM_SIM_NOSRAM_VALIDE | ((NIM_SIM_MER >> 8) & 0x01);
+            return val & ~NIM_SIM_NOSRAM_VALIDE;
+        case RSTV0910_P2_NOSRAMVAL:
+            if (locked) return NIM_SIM_MER & 0xff;
+            return val;
+        default:
+            return val;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void nim_sim_demod_write(uint16_t reg, uint8_t val, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes a demodulator register, and starts whatever writing it starts                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t path;
+
+    nim_sim_demod[reg-NIM_SIM_DEMOD_BASE]=val;
+    nim_sim_demod_written[reg-NIM_SIM_DEMOD_BASE]=true;
+
+    if (reg==RSTV0910_SYNTCTRL) {
+        if (val & NIM_SIM_STANDBY) nim_sim_pll_lock_ns=0;
+        else if (nim_sim_pll_lock_ns==0) nim_sim_pll_lock_ns=now+NIM_SIM_DEMOD_PLL_US*1000ULL;
+    } else if ((reg==RSTV0910_P2_DMDISTATE) || (reg==RSTV0910_P1_DMDISTATE)) {
+        path=(reg==RSTV0910_P1_DMDISTATE) ? NIM_SIM_PATH_P1 : NIM_SIM_PATH_P2;
+        if (((val & NIM_SIM_DMDISTATE_MASK)==NIM_SIM_DMDISTATE_STOP) ||
+            ((val & NIM_SIM_DMDISTATE_MASK)==NIM_SIM_DMDISTATE_RESET)) {
+            nim_sim_scan_start_ns[path]=0;
+        } else {
+            /* any of the search modes (re)starts the scan */
+            nim_sim_scan_start_ns[path]=now;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_tuner_read(uint8_t reg, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* reads a tuner register, with the calibration and lock bits of STAT1/STAT2 worked out               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t val;
+    uint8_t tuner;
+
+    val=(!nim_sim_tuner_written[reg] && nim_sim_tuner_observed[reg]>=0) ?
+        (uint8_t)nim_sim_tuner_observed[reg] : nim_sim_tuner[reg];
+    if ((reg!=STV6120_STAT1) && (reg!=STV6120_STAT2)) return val;
+
+    tuner=(reg==STV6120_STAT1) ? 0 : 1;
+    val&=~((1<<STV6120_STAT1_CALVCOSTRT_SHIFT) | (1<<STV6120_STAT1_CALRCSTRT_SHIFT) | (1<<STV6120_STAT1_LOCK_SHIFT));
+    if (now<nim_sim_tuner_vco_end_ns[tuner]) val|=(1<<STV6120_STAT1_CALVCOSTRT_SHIFT);
+    if (now<nim_sim_tuner_rc_end_ns[tuner])  val|=(1<<STV6120_STAT1_CALRCSTRT_SHIFT);
+    if (nim_sim_tuner_locked(tuner, now))    val|=(1<<STV6120_STAT1_LOCK_SHIFT);
+
+    return val;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void nim_sim_tuner_write(uint8_t reg, uint8_t val, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes a tuner register; STAT1/STAT2 start the calibrations, and a VCO one loses the PLL lock      */
+/* until it is done and the PLL has settled                                                           */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t tuner;
+
+    nim_sim_tuner[reg]=val;
+    nim_sim_tuner_written[reg]=true;
+    if ((reg!=STV6120_STAT1) && (reg!=STV6120_STAT2)) return;
+
+    tuner=(reg==STV6120_STAT1) ? 0 : 1;
+    if (val & (1<<STV6120_STAT1_CALRCSTRT_SHIFT)) {
+        nim_sim_tuner_rc_end_ns[tuner]=now+NIM_SIM_TUNER_RC_US*1000ULL;
+    }
+    if (val & (1<<STV6120_STAT1_CALVCOSTRT_SHIFT)) {
+        nim_sim_tuner_vco_end_ns[tuner]=now+NIM_SIM_TUNER_VCO_US*1000ULL;
+        nim_sim_tuner_lock_ns[tuner]=nim_sim_tuner_vco_end_ns[tuner]+NIM_SIM_TUNER_PLL_US*1000ULL;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_lna_read(uint8_t lna, uint8_t reg, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+/* reads an LNA register: its ident, the AGC measurement in progress bit and the gains it measured    */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t val=nim_sim_lna[lna][reg];
+
+    switch (reg) {
+        case STVVGLNA_REG0:
+            return (val & ~STVVGLNA_REG0_IDENT_MASK) | STVVGLNA_REG0_IDENT_DEFAULT;
+        case STVVGLNA_REG1:
+            val&=~((1<<STVVGLNA_REG1_GETAGC_SHIFT) | STVVGLNA_REG1_VGO_MASK);
+            if (now<nim_sim_lna_agc_end_ns[lna]) val|=(STVVGLNA_REG1_GETAGC_START << STVVGLNA_REG1_GETAGC_SHIFT);
+            return val | (NIM_SIM_LNA_VGO << STVVGLNA_REG1_VGO_SHIFT);
+        case STVVGLNA_REG3:
+            return (val & ~STVVGLNA_REG3_SWLNAGAIN_MASK) | (NIM_SIM_LNA_GAIN << STVVGLNA_REG3_SWLNAGAIN_SHIFT);
+        default:
+            return val;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void nim_sim_lna_write(uint8_t lna, uint8_t reg, uint8_t val, uint64_t now) {
+/* -------------------------------------------------------------------------------------------------- */
+    nim_sim_lna[lna][reg]=val;
+    if ((reg==STVVGLNA_REG1) &&
+        (((val >> STVVGLNA_REG1_GETAGC_SHIFT) & 1)==STVVGLNA_REG1_GETAGC_START)) {
+        nim_sim_lna_agc_end_ns[lna]=now+NIM_SIM_LNA_AGC_US*1000ULL;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool nim_sim_acks(uint8_t addr, uint8_t reg) {
+/* -------------------------------------------------------------------------------------------------- */
+/* whether anything on the NIM answers at this address and register                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    bool repeater;
+
+    if (nim_sim_in_reset) return false;
+    if (addr==NIM_DEMOD_ADDR) return true;
+
+    /* Everything else hangs off the demodulator's I2C repeater */
+    repeater=(nim_sim_demod_value(RSTV0910_P1_I2CRPT) & NIM_SIM_REPEATER_ON)!=0;
+    if (addr==NIM_TUNER_ADDR) return repeater && (reg<NIM_SIM_TUNER_REGS);
+    if ((addr==NIM_LNA_0_ADDR) || (addr==NIM_LNA_1_ADDR)) {
+        return repeater && nim_sim_settings.lna && (reg<NIM_SIM_LNA_REGS);
+    }
+
+    return false;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_transfer(uint8_t addr, uint8_t reg, uint8_t transfers, uint32_t *failures) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes the bus time of an access, trying again as ftdi.c does until it is acked or we give up       */
+/*      addr: the i2c bus address to access                                                           */
+/*       reg: the 8 bit register, which the tuner and LNAs only ack if they have it                   */
+/* transfers: the I2C transactions in each attempt, 2 for a read                                      */
+/* *failures: incremented for each attempt that was NAKed                                             */
+/*    return: error code                                                                              */
+/* -------------------------------------------------------------------------------------------------- */
+    struct timespec delay;
+    uint64_t delay_ns=(uint64_t)nim_sim_settings.latency_us*1000ULL*transfers;
+    uint32_t tries;
+
+    for (tries=0; tries<NIM_SIM_TRIES; tries++) {
+        if (delay_ns>0) {
+            delay.tv_sec=delay_ns/1000000000ULL;
+            delay.tv_nsec=delay_ns%1000000000ULL;
+            while (nanosleep(&delay, &delay)==-1 && errno==EINTR);
+        }
+        if (nim_sim_acks(addr, reg) &&
+            ((nim_sim_settings.nak_ppm==0) || (nim_sim_random()%1000000 >= nim_sim_settings.nak_ppm))) {
+            return ERROR_NONE;
+        }
+        (*failures)++;
+    }
+
+    return ERROR_I2C_NO_ACK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_i2c_read_reg16(uint8_t addr, uint16_t reg, uint8_t *val, uint32_t *failures) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+
+    pthread_mutex_lock(&nim_sim_mutex);
+    err=nim_sim_transfer(addr, 0, 2, failures);
+    if (err==ERROR_NONE) *val=(reg>=NIM_SIM_DEMOD_BASE) ? nim_sim_demod_read(reg, metrics_now_ns()) : 0;
+    pthread_mutex_unlock(&nim_sim_mutex);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_i2c_write_reg16(uint8_t addr, uint16_t reg, uint8_t val, uint32_t *failures) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+
+    pthread_mutex_lock(&nim_sim_mutex);
+    err=nim_sim_transfer(addr, 0, 1, failures);
+    if ((err==ERROR_NONE) && (reg>=NIM_SIM_DEMOD_BASE)) nim_sim_demod_write(reg, val, metrics_now_ns());
+    pthread_mutex_unlock(&nim_sim_mutex);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_i2c_read_reg8(uint8_t addr, uint8_t reg, uint8_t *val, uint32_t *failures) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint64_t now;
+
+    pthread_mutex_lock(&nim_sim_mutex);
+    err=nim_sim_transfer(addr, reg, 2, failures);
+    if (err==ERROR_NONE) {
+        now=metrics_now_ns();
+        if (addr==NIM_TUNER_ADDR) *val=nim_sim_tuner_read(reg, now);
+        else *val=nim_sim_lna_read(addr==NIM_LNA_0_ADDR ? 0 : 1, reg, now);
+    }
+    pthread_mutex_unlock(&nim_sim_mutex);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_i2c_write_reg8(uint8_t addr, uint8_t reg, uint8_t val, uint32_t *failures) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+    uint64_t now;
+
+    pthread_mutex_lock(&nim_sim_mutex);
+    err=nim_sim_transfer(addr, reg, 1, failures);
+    if (err==ERROR_NONE) {
+        now=metrics_now_ns();
+        if (addr==NIM_TUNER_ADDR) nim_sim_tuner_write(reg, val, now);
+        else nim_sim_lna_write(addr==NIM_LNA_0_ADDR ? 0 : 1, reg, val, now);
+    }
+    pthread_mutex_unlock(&nim_sim_mutex);
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_gpio_write(uint8_t gpio_value, uint8_t gpio_direction) {
+/* -------------------------------------------------------------------------------------------------- */
+/* holds the NIM in reset while its reset pin is driven low, and resets it on the way out             */
+/* -------------------------------------------------------------------------------------------------- */
+    bool reset=((gpio_direction >> FTDI_GPIO_PINID_NIM_RESET) & 1) && !((gpio_value >> FTDI_GPIO_PINID_NIM_RESET) & 1);
+
+    pthread_mutex_lock(&nim_sim_mutex);
+    if (nim_sim_in_reset && !reset) nim_sim_reset_state(metrics_now_ns());
+    nim_sim_in_reset=reset;
+    pthread_mutex_unlock(&nim_sim_mutex);
+
+    return ERROR_NONE;
+}
+
+static const ftdi_transport_t nim_sim_transport = {
+    "nim_sim",
+    nim_sim_i2c_read_reg16,
+    nim_sim_i2c_write_reg16,
+    nim_sim_i2c_read_reg8,
+    nim_sim_i2c_write_reg8,
+    nim_sim_gpio_write
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t nim_sim_load_log(const char *path) {
+/* -------------------------------------------------------------------------------------------------- */
+/* seeds the registers from the register reads in a log written with register logging on, eg. those   */
+/* in register_analysis/log_output. A register keeps the last value read from it                      */
+/*   path: the log file                                                                               */
+/* return: error code                                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    FILE *file;
+    char line[512];
+    char *reading;
+    unsigned int reg, val;
+    uint32_t count=0;
+
+    file=fopen(path, "r");
+    if (file==NULL) {
+        printf("ERROR: NIM sim: cannot open register log %s (%s)\n", path, strerror(errno));
+        return ERROR_NIM_SIM_INIT;
+    }
+
+    while (fgets(line, sizeof(line), file)!=NULL) {
+        if ((reading=strstr(line, "STV0910: Reading "))!=NULL &&
+            sscanf(reading, "STV0910: Reading %*s (0x%x) = 0x%x", &reg, &val)==2 &&
+            reg>=NIM_SIM_DEMOD_BASE && reg<NIM_SIM_DEMOD_BASE+NIM_SIM_DEMOD_REGS) {
+            nim_sim_demod_observed[reg-NIM_SIM_DEMOD_BASE]=val & 0xff;
+            count++;
+        } else if ((reading=strstr(line, "STV6120: Reading "))!=NULL &&
+            sscanf(reading, "STV6120: Reading %*s (0x%x) = 0x%x", &reg, &val)==2 &&
+            reg<NIM_SIM_TUNER_REGS) {
+            nim_sim_tuner_observed[reg]=val & 0xff;
+            count++;
+        }
+    }
+    fclose(file);
+
+    printf("Flow: NIM sim: %u register reads from %s\n", count, path);
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool nim_sim_number(const char *value, uint32_t *number) {
+/* -------------------------------------------------------------------------------------------------- */
+    char *end;
+    unsigned long parsed;
+
+    errno=0;
+    parsed=strtoul(value, &end, 10);
+    if ((errno!=0) || (end==value) || (*end!='\0') || (parsed>UINT32_MAX)) return false;
+    *number=(uint32_t)parsed;
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t nim_sim_init(char *settings) {
+/* -------------------------------------------------------------------------------------------------- */
+/* puts the simulated NIM in place of the Minitiouner's. Before ftdi_init(), which resets it          */
+/* settings: comma separated key=value pairs, or "on" for the defaults:                               */
+/*             latency=US   bus time of each I2C transfer                                             */
+/*             nak=PPM      chance of each transfer being NAKed, per million                          */
+/*             seed=N       for the NAKs and the symbols                                              */
+/*             header=MS    scan start to headers found                                               */
+/*             lock=MS      scan start to lock                                                        */
+/*             signal=s2|s|none                                                                       */
+/*             lna=on|off   off for an older NIM without LNAs                                         */
+/*             log=PATH     a register log to seed the registers from, can be given more than once    */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    char copy[128];
+    char *token;
+    char *save;
+    char *value;
+    bool ok;
+    uint16_t i;
+
+    nim_sim_settings.latency_us=NIM_SIM_LATENCY_US;
+    nim_sim_settings.nak_ppm=NIM_SIM_NAK_PPM;
+    nim_sim_settings.seed=NIM_SIM_SEED;
+    nim_sim_settings.header_ms=NIM_SIM_HEADER_MS;
+    nim_sim_settings.lock_ms=NIM_SIM_LOCK_MS;
+    nim_sim_settings.signal=NIM_SIM_SIGNAL_S2;
+    nim_sim_settings.lna=true;
+
+    for (i=0; i<NIM_SIM_DEMOD_REGS; i++) nim_sim_demod_observed[i]=-1;
+    for (i=0; i<NIM_SIM_TUNER_REGS; i++) nim_sim_tuner_observed[i]=-1;
+
+    strncpy(copy, settings, sizeof(copy)-1);
+    copy[sizeof(copy)-1]='\0';
+
+    for (token=strtok_r(copy, ",", &save); (token!=NULL) && (err==ERROR_NONE); token=strtok_r(NULL, ",", &save)) {
+        if (0==strcmp(token, "on")) continue;
+
+        value=strchr(token, '=');
+        ok=(value!=NULL);
+        if (ok) {
+            *value++='\0';
+            if      (0==strcmp(token, "latency")) ok=nim_sim_number(value, &nim_sim_settings.latency_us);
+            else if (0==strcmp(token, "nak"))     ok=nim_sim_number(value, &nim_sim_settings.nak_ppm) &&
+                                                     (nim_sim_settings.nak_ppm<=1000000);
+            else if (0==strcmp(token, "seed"))    ok=nim_sim_number(value, &nim_sim_settings.seed);
+            else if (0==strcmp(token, "header"))  ok=nim_sim_number(value, &nim_sim_settings.header_ms);
+            else if (0==strcmp(token, "lock"))    ok=nim_sim_number(value, &nim_sim_settings.lock_ms);
+            else if (0==strcmp(token, "signal")) {
+                if      (0==strcmp(value, "s2"))   nim_sim_settings.signal=NIM_SIM_SIGNAL_S2;
+                else if (0==strcmp(value, "s"))    nim_sim_settings.signal=NIM_SIM_SIGNAL_S;
+                else if (0==strcmp(value, "none")) nim_sim_settings.signal=NIM_SIM_SIGNAL_NONE;
+                else ok=false;
+            }
+            else if (0==strcmp(token, "lna")) {
+                if      (0==strcmp(value, "on"))  nim_sim_settings.lna=true;
+                else if (0==strcmp(value, "off")) nim_sim_settings.lna=false;
+                else ok=false;
+            }
+            else if (0==strcmp(token, "log")) err=nim_sim_load_log(value);
+            else ok=false;
+        }
+        if (!ok) {
+            printf("ERROR: NIM sim: bad setting %s%s%s\n", token, value!=NULL ? "=" : "", value!=NULL ? value : "");
+            err=ERROR_NIM_SIM_INIT;
+        }
+    }
+
+    if ((err==ERROR_NONE) && (nim_sim_settings.lock_ms<nim_sim_settings.header_ms)) {
+        printf("ERROR: NIM sim: lock (%u ms) cannot come before header (%u ms)\n",
+               nim_sim_settings.lock_ms, nim_sim_settings.header_ms);
+        err=ERROR_NIM_SIM_INIT;
+    }
+
+    if (err==ERROR_NONE) {
+        nim_sim_prng=(nim_sim_settings.seed==0) ? 1 : nim_sim_settings.seed;
+        nim_sim_in_reset=false;
+        nim_sim_reset_state(metrics_now_ns());
+        ftdi_set_transport(&nim_sim_transport);
+        printf("Flow: NIM sim: %uus per transfer, %u ppm NAKs, signal %s locking after %u ms, %s\n",
+               nim_sim_settings.latency_us, nim_sim_settings.nak_ppm,
+               nim_sim_settings.signal==NIM_SIM_SIGNAL_S2 ? "S2" : nim_sim_settings.signal==NIM_SIM_SIGNAL_S ? "S" : "none",
+               nim_sim_settings.lock_ms, nim_sim_settings.lna ? "with LNAs" : "no LNAs");
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t nim_sim_ts_read(uint8_t *buffer, uint16_t *len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the simulated NIM's ftdi_usb_ts_read(): it has no TS to give, so like an idle endpoint it hands    */
+/* back the two FTDI status bytes each time the latency timer runs out                                */
+/*  *buffer: the buffer to collect the ts data into                                                   */
+/*     *len: how many bytes we put into the buffer                                                    */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    usleep(NIM_SIM_TS_LATENCY_US);
+
+    buffer[0]=0x32; /* modem status */
+    buffer[1]=0x60; /* line status: transmitter empty, no errors */
+    *len=2;
+
+    metric_observe(METRIC_USB_TS_READ_SIZE, *len);
+    metric_add(METRIC_USB_TS_READS, 1);
+
+    return ERROR_NONE;
+}
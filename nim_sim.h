@@ -0,0 +1,44 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: nim_sim.h                                                                   */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef NIM_SIM_H
+#define NIM_SIM_H
+
+#include <stdint.h>
+
+/* Defaults, each can be changed in the settings string                                               */
+#define NIM_SIM_LATENCY_US  500 /* per I2C transfer: the register logs show ~0.5ms writes, ~1ms reads  */
+#define NIM_SIM_NAK_PPM     0   /* chance of a transfer not being acked, per million                   */
+#define NIM_SIM_SEED        1
+#define NIM_SIM_HEADER_MS   150 /* from the start of a scan, with the tuner locked, to finding headers */
+#define NIM_SIM_LOCK_MS     400 /* from the start of a scan to lock                                    */
+
+/* Chip timings, from the STV6120 datasheet and the register logs                                     */
+#define NIM_SIM_DEMOD_PLL_US  100
+#define NIM_SIM_TUNER_RC_US   1000
+#define NIM_SIM_TUNER_VCO_US  1500
+#define NIM_SIM_TUNER_PLL_US  300
+#define NIM_SIM_LNA_AGC_US    1000
+
+uint8_t nim_sim_init(char *settings);
+uint8_t nim_sim_ts_read(uint8_t *buffer, uint16_t *len);
+
+#endif
@@ -78,6 +78,26 @@ unsigned long long int CalculatePCR = 0ll;
 int synctopcr = 0;
 bool discountinuity=false;
 
+/* Defaults until the PMT has been parsed, see pcrpts_set_pids() */
+static uint16_t pid_video = PID_PCR;
+static uint16_t pid_audio = PID_AUDIO;
+
+void pcrpts_set_pids(uint16_t video_pid, uint16_t audio_pid)
+{
+	__atomic_store_n(&pid_video, video_pid, __ATOMIC_RELAXED);
+	__atomic_store_n(&pid_audio, audio_pid, __ATOMIC_RELAXED);
+}
+
+uint16_t pcrpts_get_video_pid(void)
+{
+	return __atomic_load_n(&pid_video, __ATOMIC_RELAXED);
+}
+
+uint16_t pcrpts_get_audio_pid(void)
+{
+	return __atomic_load_n(&pid_audio, __ATOMIC_RELAXED);
+}
+
 void set_timedts_pts(unsigned long long ts, unsigned char *buff)
 {
 	ts = ts / 300ll;
@@ -254,7 +274,7 @@ char PCRAvailable(char *Packet)
 
 unsigned short GetPid(char *Packet)
 {
-	return (((Packet[1] << 8) | Packet[2]) & 0x1fff);
+	return ((((unsigned char)Packet[1] << 8) | (unsigned char)Packet[2]) & 0x1fff);
 }
 
 void fill_buffer(void)
@@ -448,9 +468,11 @@ void ProcessCorectPCR(uint8_t *Buffer, size_t BUFF_MAX_SIZE)
     int PacketOffsetDTS;
     char flag = 0;
     static unsigned long long offset_time_clk=4*27000000LL;
+    uint16_t video_pid = pcrpts_get_video_pid();
+    uint16_t audio_pid = pcrpts_get_audio_pid();
     for (size_t i = 0; i < BUFF_MAX_SIZE; i += 188)
     {
-        if (GetPid((char *)cur_packet) == 256) // video
+        if (GetPid((char *)cur_packet) == video_pid) // video
         {
 
             // if(PCRAvailable(cur_packet))
@@ -491,7 +513,7 @@ void ProcessCorectPCR(uint8_t *Buffer, size_t BUFF_MAX_SIZE)
                 }
             }
         }
-        else if (GetPid((char *)cur_packet) == 257) // audio
+        else if (GetPid((char *)cur_packet) == audio_pid) // audio
         {
             flag = GetPTSFromPacket(cur_packet, &pts, &dts, &PacketOffsetPTS, &PacketOffsetDTS);
             if (flag == 2) // PTS
@@ -529,6 +551,8 @@ void ProcessTSTiming(uint8_t *Buffer, size_t BUFF_MAX_SIZE,size_t *video_delay,s
 {
 
     uint8_t *cur_packet = Buffer;
+    uint16_t video_pid = pcrpts_get_video_pid();
+    uint16_t audio_pid = pcrpts_get_audio_pid();
 for (size_t i = 0; i < BUFF_MAX_SIZE; i += 188)
     {
        
@@ -539,7 +563,7 @@ for (size_t i = 0; i < BUFF_MAX_SIZE; i += 188)
         int PacketOffsetPTS;
         int PacketOffsetDTS;
         char flag = 0;
-        if (GetPid((char *)cur_packet) == 256) // video
+        if (GetPid((char *)cur_packet) == video_pid) // video
         {
 
             if (PCRAvailable((char *)cur_packet)) // Just take when PCR to low cpu
@@ -576,7 +600,7 @@ for (size_t i = 0; i < BUFF_MAX_SIZE; i += 188)
                 }
             }
         }
-        else if (GetPid((char *)cur_packet) == 257) // audio
+        else if (GetPid((char *)cur_packet) == audio_pid) // audio
         {
             flag = GetPTSFromPacket(cur_packet, (unsigned long long *)&pts, (unsigned long long *)&dts, &PacketOffsetPTS, &PacketOffsetDTS);
             if (flag == 2) // PTS
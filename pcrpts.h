@@ -1,5 +1,8 @@
 extern char PCRAvailable(char *Packet);
 extern unsigned short GetPid(char *Packet);
+extern void pcrpts_set_pids(uint16_t video_pid, uint16_t audio_pid);
+extern uint16_t pcrpts_get_video_pid(void);
+extern uint16_t pcrpts_get_audio_pid(void);
 extern char GetPTSFromPacket(unsigned char *Packet, unsigned long long *pts, unsigned long long *dts, int *PacketOffsetPTS, int *PacketOffsetDTS);
 extern unsigned long long GetPCRFromPacket(unsigned char *Packet);
 extern void set_timedts_pts(unsigned long long ts, unsigned char *buff);
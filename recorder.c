@@ -0,0 +1,718 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: recorder.c                                                                  */
+/*    - segmented recording of the TS to disk, with a sidecar PCR/PTS index per segment               */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#include "errors.h"
+#include "pcrpts.h"
+#include "recorder.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* Older kernel headers (eg. Debian buster) have neither io_uring nor its syscall numbers, and before */
+/* 5.4 lack the single mmap feature we rely on, so the recorder is then built with pwritev only       */
+#if defined(IORING_FEAT_SINGLE_MMAP) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define RECORDER_IO_URING 1
+#else
+#define RECORDER_IO_URING 0
+#endif
+
+#define RECORDER_PACKET_SIZE 188
+
+/* O_DIRECT needs the buffer address, file offset and length all aligned to the logical block size.  */
+/* 4096 covers every block device we are likely to record to.                                         */
+#define RECORDER_BLOCK_SIZE  4096
+#define RECORDER_BUFFER_SIZE (64 * RECORDER_BLOCK_SIZE)
+#define RECORDER_NUM_BUFFERS 8
+#define RECORDER_URING_ENTRIES RECORDER_NUM_BUFFERS
+
+/* Once a rotation is due we wait for a random access point, but never longer than this */
+#define RECORDER_ROTATE_GRACE_MS 2000
+/* After a write failure (eg. disk full) wait this long before trying a fresh segment */
+#define RECORDER_RETRY_MS 5000
+
+#define RECORDER_INDEX_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    uint8_t *data;
+    uint32_t used;
+    uint64_t offset;
+    bool in_flight;
+    struct iovec iov;
+} recorder_buffer_t;
+
+#if RECORDER_IO_URING
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} recorder_uring_t;
+#endif
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+extern uint64_t monotonic_ms(void);
+
+static char recorder_path_prefix[128];
+static uint32_t recorder_segment_ms;
+static uint64_t recorder_segment_bytes_max;
+
+#if RECORDER_IO_URING
+static recorder_uring_t recorder_uring = { .fd = -1 };
+#endif
+static bool recorder_uring_ok = false;
+
+static recorder_buffer_t recorder_buffers[RECORDER_NUM_BUFFERS];
+static int recorder_fill_index;
+static uint32_t recorder_in_flight;
+
+static int recorder_fd = -1;
+static bool recorder_direct = false;
+static FILE *recorder_index_file = NULL;
+static char *recorder_index_buffer = NULL;
+static uint64_t recorder_segment_offset;
+static uint64_t recorder_segment_start_ms;
+static uint32_t recorder_segment_number;
+
+static bool recorder_rotate_pending;
+static uint64_t recorder_rotate_pending_ms;
+static bool recorder_failed;
+static uint64_t recorder_failed_ms;
+
+static recorder_stats_t recorder_stats;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool recorder_uring_setup(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sets up a small io_uring instance with the raw syscalls, so there is no dependency on liburing     */
+/*  return: true if io_uring is usable, false to fall back to writev                                  */
+/* -------------------------------------------------------------------------------------------------- */
+#if RECORDER_IO_URING
+    struct io_uring_params params;
+    recorder_uring_t *ring = &recorder_uring;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, RECORDER_URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        printf("Flow: Recorder io_uring not available (%s), using writev\n", strerror(errno));
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        ring->fd = -1;
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            ring->fd = -1;
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        ring->fd = -1;
+        return false;
+    }
+
+    ring->sq_head  = (unsigned *)((uint8_t *)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail  = (unsigned *)((uint8_t *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)((uint8_t *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((uint8_t *)ring->sq_ring + params.sq_off.array);
+    ring->cq_head  = (unsigned *)((uint8_t *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)((uint8_t *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)((uint8_t *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)((uint8_t *)ring->cq_ring + params.cq_off.cqes);
+
+    return true;
+#else
+    printf("Flow: Recorder built without io_uring, using writev\n");
+    return false;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_uring_teardown(void) {
+/* -------------------------------------------------------------------------------------------------- */
+#if RECORDER_IO_URING
+    recorder_uring_t *ring = &recorder_uring;
+
+    if (ring->fd < 0) return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_write_failed(int error) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a write to the current segment has failed, stop recording until the retry period has passed       */
+/* -------------------------------------------------------------------------------------------------- */
+    if (!recorder_failed) {
+        printf("ERROR: recorder write (error: %s)\n", strerror(error));
+    }
+    recorder_stats.write_errors++;
+    recorder_failed = true;
+    recorder_failed_ms = monotonic_ms();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool recorder_write_sync(uint8_t *data, uint32_t len, uint64_t offset) {
+/* -------------------------------------------------------------------------------------------------- */
+/* synchronous write of a buffer at a given offset, used by the writev fallback and for tails/retries */
+/*  return: true if all bytes were written                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    struct iovec iov;
+    ssize_t ret;
+
+    while (len > 0) {
+        iov.iov_base = data;
+        iov.iov_len = len;
+        ret = pwritev(recorder_fd, &iov, 1, (off_t)offset);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && errno == EINVAL && recorder_direct) {
+            /* The filesystem accepted O_DIRECT at open but not for this write, so drop it */
+            fcntl(recorder_fd, F_SETFL, fcntl(recorder_fd, F_GETFL) & ~O_DIRECT);
+            recorder_direct = false;
+            continue;
+        }
+        if (ret <= 0) {
+            recorder_write_failed(ret < 0 ? errno : ENOSPC);
+            return false;
+        }
+        data += ret;
+        offset += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_uring_submit(int index) {
+/* -------------------------------------------------------------------------------------------------- */
+/* queues a single writev of one of the staging buffers                                               */
+/* -------------------------------------------------------------------------------------------------- */
+#if RECORDER_IO_URING
+    recorder_uring_t *ring = &recorder_uring;
+    recorder_buffer_t *buf = &recorder_buffers[index];
+    struct io_uring_sqe *sqe;
+    unsigned tail, slot;
+
+    buf->iov.iov_base = buf->data;
+    buf->iov.iov_len = buf->used;
+
+    tail = *ring->sq_tail;
+    slot = tail & *ring->sq_mask;
+    sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = recorder_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&buf->iov;
+    sqe->len = 1;
+    sqe->off = buf->offset;
+    sqe->user_data = (uint64_t)index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    buf->in_flight = true;
+    recorder_in_flight++;
+
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR);
+#else
+    (void)index;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_uring_reap(bool wait_all) {
+/* -------------------------------------------------------------------------------------------------- */
+/* collects completed writes and frees their buffers                                                  */
+/* wait_all: block until nothing is left in flight                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+#if RECORDER_IO_URING
+    recorder_uring_t *ring = &recorder_uring;
+    struct io_uring_cqe *cqe;
+    recorder_buffer_t *buf;
+    unsigned head, tail;
+
+    while (recorder_in_flight > 0) {
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            if (!wait_all) break;
+            syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        buf = &recorder_buffers[cqe->user_data];
+
+        if (cqe->res < 0) {
+            /* Retry synchronously, this also copes with O_DIRECT being refused at write time */
+            if (!recorder_failed) recorder_write_sync(buf->data, buf->used, buf->offset);
+        } else if ((uint32_t)cqe->res < buf->used && !recorder_failed) {
+            /* Short write, finish it off */
+            recorder_write_sync(buf->data + cqe->res, buf->used - cqe->res, buf->offset + cqe->res);
+        }
+
+        buf->in_flight = false;
+        buf->used = 0;
+        recorder_in_flight--;
+
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+#else
+    (void)wait_all;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_flush_buffer(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* hands the full staging buffer to the disk and moves on to the next free one                        */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_buffer_t *buf = &recorder_buffers[recorder_fill_index];
+
+    if (recorder_uring_ok) {
+        recorder_uring_submit(recorder_fill_index);
+    } else {
+        recorder_write_sync(buf->data, buf->used, buf->offset);
+        buf->used = 0;
+    }
+
+    recorder_fill_index = (recorder_fill_index + 1) % RECORDER_NUM_BUFFERS;
+
+    /* If the disk has stalled for long enough that the next buffer is still in flight, */
+    /* we mark that there is no buffer, and drop packets until one comes back           */
+    if (recorder_buffers[recorder_fill_index].in_flight) {
+        recorder_uring_reap(false);
+        if (recorder_buffers[recorder_fill_index].in_flight) recorder_fill_index = -1;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_segment_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* drains any outstanding writes, writes out the unaligned tail and closes the segment and index      */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_buffer_t *buf;
+
+    if (recorder_fd < 0) return;
+
+    if (recorder_uring_ok) recorder_uring_reap(true);
+
+    if (recorder_fill_index >= 0) {
+        buf = &recorder_buffers[recorder_fill_index];
+        if (buf->used > 0 && !recorder_failed) {
+            /* The tail will not be a multiple of the block size, so it has to go without O_DIRECT */
+            if (recorder_direct) {
+                fcntl(recorder_fd, F_SETFL, fcntl(recorder_fd, F_GETFL) & ~O_DIRECT);
+                recorder_direct = false;
+            }
+            recorder_write_sync(buf->data, buf->used, buf->offset);
+        }
+        buf->used = 0;
+    }
+
+    close(recorder_fd);
+    recorder_fd = -1;
+
+    if (recorder_index_file != NULL) {
+        fclose(recorder_index_file);
+        recorder_index_file = NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t recorder_segment_open(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* opens a new TS segment and its sidecar index, named from the prefix, UTC start time and number     */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    char path[192];
+    char timestamp[32];
+    time_t now;
+    struct tm tm_utc;
+    recorder_index_header_t header;
+
+    now = time(NULL);
+    gmtime_r(&now, &tm_utc);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", &tm_utc);
+
+    snprintf(path, sizeof(path), "%s-%s-%05u.ts", recorder_path_prefix, timestamp, recorder_segment_number);
+
+    recorder_direct = true;
+    recorder_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (recorder_fd < 0 && errno == EINVAL) {
+        /* eg. tmpfs does not support O_DIRECT */
+        recorder_direct = false;
+        recorder_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (recorder_fd < 0) {
+        printf("ERROR: Failed to open recorder segment %s (error: %s)\n", path, strerror(errno));
+        err=ERROR_RECORDER_OPEN;
+    }
+
+    if (err==ERROR_NONE) {
+        snprintf(path, sizeof(path), "%s-%s-%05u.idx", recorder_path_prefix, timestamp, recorder_segment_number);
+        recorder_index_file = fopen(path, "wb");
+        if (recorder_index_file == NULL) {
+            printf("ERROR: Failed to open recorder index %s (error: %s)\n", path, strerror(errno));
+            close(recorder_fd);
+            recorder_fd = -1;
+            err=ERROR_RECORDER_OPEN;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        setvbuf(recorder_index_file, recorder_index_buffer, _IOFBF, RECORDER_INDEX_BUFFER_SIZE);
+
+        header.magic = RECORDER_INDEX_MAGIC;
+        header.version = RECORDER_INDEX_VERSION;
+        header.entry_size = sizeof(recorder_index_entry_t);
+        header.packet_size = RECORDER_PACKET_SIZE;
+        header.reserved = 0;
+        fwrite(&header, sizeof(header), 1, recorder_index_file);
+
+        recorder_segment_offset = 0;
+        recorder_segment_start_ms = monotonic_ms();
+        recorder_segment_number++;
+        recorder_rotate_pending = false;
+        recorder_failed = false;
+        recorder_fill_index = 0;
+        recorder_buffers[0].used = 0;
+        recorder_buffers[0].offset = 0;
+
+        recorder_stats.segments++;
+        recorder_stats.using_direct_io = recorder_direct;
+
+        printf("Flow: Recorder segment %s-%s-%05u.ts%s\n", recorder_path_prefix, timestamp,
+               recorder_segment_number - 1, recorder_direct ? " (O_DIRECT)" : "");
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_index_packet(uint8_t *packet) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds any PCR or PTS carried in this packet to the segment index                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_index_entry_t entry;
+    unsigned long long pts, dts;
+    int pts_offset, dts_offset;
+    uint8_t flags = 0;
+
+    /* Adaptation field present with a non-zero length */
+    if ((packet[3] & 0x20) && packet[4] != 0) {
+        if (packet[5] & 0x40) flags |= RECORDER_INDEX_FLAG_RANDOM_ACCESS;
+        if (packet[5] & 0x80) flags |= RECORDER_INDEX_FLAG_DISCONTINUITY;
+    }
+
+    entry.packet = (uint32_t)(recorder_segment_offset / RECORDER_PACKET_SIZE);
+    entry.pid = ((packet[1] & 0x1f) << 8) | packet[2];
+    entry.flags = flags;
+
+    if (PCRAvailable((char *)packet)) {
+        entry.type = RECORDER_INDEX_PCR;
+        entry.value = GetPCRFromPacket(packet);
+        fwrite(&entry, sizeof(entry), 1, recorder_index_file);
+    }
+
+    /* PES headers only start in packets with payload_unit_start_indicator set */
+    if ((packet[1] & 0x40) && (packet[3] & 0x10) && GetPTSFromPacket(packet, &pts, &dts, &pts_offset, &dts_offset) >= 2) {
+        entry.type = RECORDER_INDEX_PTS;
+        entry.value = pts;
+        fwrite(&entry, sizeof(entry), 1, recorder_index_file);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void recorder_packet(uint8_t *packet) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes one sync-aligned TS packet, rotates the segment if due, indexes it and stages it for disk    */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_buffer_t *buf;
+    bool random_access;
+
+    /* A failed segment is abandoned, a new one is tried once the retry period is up */
+    if (recorder_failed && recorder_fd >= 0) recorder_segment_close();
+
+    if (recorder_rotate_pending && recorder_fd >= 0) {
+        /* Prefer to start the next segment on a random access point so that it plays from the start */
+        random_access = (packet[3] & 0x20) && packet[4] != 0 && (packet[5] & 0x40);
+        if (random_access || monotonic_ms() > recorder_rotate_pending_ms + RECORDER_ROTATE_GRACE_MS) {
+            recorder_segment_close();
+        }
+    }
+
+    if (recorder_fd < 0) {
+        if (recorder_failed && monotonic_ms() < recorder_failed_ms + RECORDER_RETRY_MS) {
+            recorder_stats.packets_dropped++;
+            return;
+        }
+        if (recorder_segment_open() != ERROR_NONE) {
+            recorder_failed = true;
+            recorder_failed_ms = monotonic_ms();
+            recorder_stats.packets_dropped++;
+            return;
+        }
+    }
+
+    if (recorder_fill_index < 0) {
+        /* Still waiting on the disk, see if a buffer has come back */
+        recorder_uring_reap(false);
+        for (int i = 0; i < RECORDER_NUM_BUFFERS; i++) {
+            if (!recorder_buffers[i].in_flight) {
+                recorder_fill_index = i;
+                recorder_buffers[i].used = 0;
+                recorder_buffers[i].offset = recorder_segment_offset;
+                break;
+            }
+        }
+        if (recorder_fill_index < 0) {
+            recorder_stats.packets_dropped++;
+            return;
+        }
+    }
+
+    buf = &recorder_buffers[recorder_fill_index];
+    if (buf->used == 0) buf->offset = recorder_segment_offset;
+
+    /* Packets straddle buffer boundaries so that every buffer stays a whole number of blocks, */
+    /* so only take a straddling packet if there is a buffer ready for the rest of it          */
+    uint32_t copy_len = RECORDER_PACKET_SIZE;
+    uint32_t space = RECORDER_BUFFER_SIZE - buf->used;
+    if (copy_len > space) {
+        copy_len = space;
+        int next = (recorder_fill_index + 1) % RECORDER_NUM_BUFFERS;
+        if (recorder_buffers[next].in_flight) recorder_uring_reap(false);
+        if (recorder_buffers[next].in_flight) {
+            recorder_stats.packets_dropped++;
+            return;
+        }
+    }
+
+    recorder_index_packet(packet);
+
+    memcpy(buf->data + buf->used, packet, copy_len);
+    buf->used += copy_len;
+    recorder_segment_offset += copy_len;
+
+    if (buf->used == RECORDER_BUFFER_SIZE) {
+        recorder_flush_buffer();
+        if (copy_len < RECORDER_PACKET_SIZE) {
+            /* recorder_flush_buffer() found the next buffer free, as checked above */
+            buf = &recorder_buffers[recorder_fill_index];
+            buf->offset = recorder_segment_offset;
+            memcpy(buf->data, packet + copy_len, RECORDER_PACKET_SIZE - copy_len);
+            buf->used = RECORDER_PACKET_SIZE - copy_len;
+            recorder_segment_offset += buf->used;
+        }
+    }
+
+    recorder_stats.bytes_written += RECORDER_PACKET_SIZE;
+
+    if (recorder_segment_bytes_max != 0 && recorder_segment_offset >= recorder_segment_bytes_max && !recorder_rotate_pending) {
+        recorder_rotate_pending = true;
+        recorder_rotate_pending_ms = monotonic_ms();
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t recorder_ts_write(uint8_t *packets, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* records a run of sync-aligned TS packets                                                           */
+/* Write failures are reported and retried on a new segment rather than stopping the receiver        */
+/* *packets: the aligned TS packets, as produced by ts_align()                                       */
+/*      len: the length (number of bytes) of the packets, a multiple of 188                           */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    /* Time based rotation is checked once per USB transfer rather than per packet */
+    if (recorder_segment_ms != 0 && recorder_fd >= 0 && !recorder_rotate_pending
+        && monotonic_ms() >= recorder_segment_start_ms + recorder_segment_ms) {
+        recorder_rotate_pending = true;
+        recorder_rotate_pending_ms = monotonic_ms();
+    }
+
+    for (uint32_t offset = 0; offset + RECORDER_PACKET_SIZE <= len; offset += RECORDER_PACKET_SIZE) {
+        recorder_packet(&packets[offset]);
+    }
+
+    /* Pick up completions so that buffers are ready before we need them */
+    if (recorder_uring_ok) recorder_uring_reap(false);
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void recorder_reset(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* called when the TS is reset (eg. a new frequency), starts a new segment with the next packet       */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_segment_close();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void recorder_get_stats(recorder_stats_t *stats) {
+/* -------------------------------------------------------------------------------------------------- */
+    memcpy(stats, &recorder_stats, sizeof(recorder_stats_t));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t recorder_init(char *path_prefix, uint32_t segment_seconds, uint32_t segment_mbytes) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sets up the recorder buffers and io_uring, and opens the first segment                             */
+/* *path_prefix: directory and file name prefix for the segments, eg. /data/rec/gb3hv                 */
+/* segment_seconds: rotate the segment after this many seconds, 0 to disable                          */
+/* segment_mbytes: rotate the segment after this many megabytes, 0 to disable                         */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+
+    strncpy(recorder_path_prefix, path_prefix, sizeof(recorder_path_prefix) - 1);
+    recorder_segment_ms = segment_seconds * 1000;
+    recorder_segment_bytes_max = (uint64_t)segment_mbytes * 1024 * 1024;
+    memset(&recorder_stats, 0, sizeof(recorder_stats));
+
+    for (int i = 0; (i < RECORDER_NUM_BUFFERS) && (err==ERROR_NONE); i++) {
+        if (posix_memalign((void **)&recorder_buffers[i].data, RECORDER_BLOCK_SIZE, RECORDER_BUFFER_SIZE) != 0) {
+            printf("ERROR: recorder buffer malloc\n");
+            err=ERROR_RECORDER_MALLOC;
+        }
+        recorder_buffers[i].used = 0;
+        recorder_buffers[i].in_flight = false;
+    }
+
+    if (err==ERROR_NONE) {
+        recorder_index_buffer = (char *)malloc(RECORDER_INDEX_BUFFER_SIZE);
+        if (recorder_index_buffer == NULL) {
+            printf("ERROR: recorder index buffer malloc\n");
+            err=ERROR_RECORDER_MALLOC;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        recorder_uring_ok = recorder_uring_setup();
+        recorder_stats.using_io_uring = recorder_uring_ok;
+        recorder_in_flight = 0;
+        recorder_segment_number = 0;
+        err=recorder_segment_open();
+    }
+
+    if (err!=ERROR_NONE) printf("ERROR: recorder init\n");
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t recorder_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* flushes and closes the current segment and releases the recorder resources                         */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    recorder_segment_close();
+    recorder_uring_teardown();
+    recorder_uring_ok = false;
+
+    for (int i = 0; i < RECORDER_NUM_BUFFERS; i++) {
+        free(recorder_buffers[i].data);
+        recorder_buffers[i].data = NULL;
+    }
+    free(recorder_index_buffer);
+    recorder_index_buffer = NULL;
+
+    printf("Flow: Recorder closed, %llu bytes in %u segments, %llu packets dropped\n",
+           (unsigned long long)recorder_stats.bytes_written, recorder_stats.segments,
+           (unsigned long long)recorder_stats.packets_dropped);
+
+    return ERROR_NONE;
+}
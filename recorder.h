@@ -0,0 +1,74 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: recorder.h                                                                  */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Segments are rotated on whichever limit is reached first, 0 disables a limit */
+#define RECORDER_DEFAULT_SEGMENT_SECONDS 600
+#define RECORDER_DEFAULT_SEGMENT_MBYTES  1024
+
+/* Sidecar index file (<segment>.idx) layout, all fields little-endian:                               */
+/*   recorder_index_header_t once, then one recorder_index_entry_t per PCR or PTS seen in the segment */
+#define RECORDER_INDEX_MAGIC   0x49544d4c /* "LMTI" */
+#define RECORDER_INDEX_VERSION 1
+
+#define RECORDER_INDEX_PCR 0
+#define RECORDER_INDEX_PTS 1
+
+#define RECORDER_INDEX_FLAG_RANDOM_ACCESS 0x01
+#define RECORDER_INDEX_FLAG_DISCONTINUITY 0x02
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t packet_size;
+    uint32_t reserved;
+} recorder_index_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t packet;   /* packet number within the segment, byte offset = packet * 188 */
+    uint16_t pid;
+    uint8_t type;      /* RECORDER_INDEX_PCR or RECORDER_INDEX_PTS */
+    uint8_t flags;     /* RECORDER_INDEX_FLAG_* from the adaptation field */
+    uint64_t value;    /* PCR or PTS in 27MHz ticks */
+} recorder_index_entry_t;
+
+typedef struct {
+    uint64_t bytes_written;
+    uint64_t packets_dropped;
+    uint32_t segments;
+    uint32_t write_errors;
+    bool using_io_uring;
+    bool using_direct_io;
+} recorder_stats_t;
+
+uint8_t recorder_init(char *path_prefix, uint32_t segment_seconds, uint32_t segment_mbytes);
+uint8_t recorder_ts_write(uint8_t *buffer, uint32_t len);
+void recorder_reset(void);
+void recorder_get_stats(recorder_stats_t *stats);
+uint8_t recorder_close(void);
+
+#endif
@@ -0,0 +1,189 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: register_decode.c                                                           */
+/*    - prints a register trace dump as the REGISTER_LOG lines longmynd used to print as it went      */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "register_logging.h"
+#include "register_trace.h"
+
+typedef struct {
+    register_trace_record_t record;
+    uint64_t number; /* within its thread, to keep the order of records with the same time */
+    uint32_t ring;
+} decode_entry_t;
+
+static char (*sequence_names)[REGISTER_TRACE_NAME_LEN];
+static uint32_t sequence_count;
+static bool show_thread = false;
+static bool show_fields = false;
+
+static int compare_entries(const void *a, const void *b)
+{
+    const decode_entry_t *x = (const decode_entry_t *)a;
+    const decode_entry_t *y = (const decode_entry_t *)b;
+
+    if (x->record.timestamp_ns != y->record.timestamp_ns)
+        return (x->record.timestamp_ns < y->record.timestamp_ns) ? -1 : 1;
+    if (x->ring != y->ring) return (x->ring < y->ring) ? -1 : 1;
+    return (x->number < y->number) ? -1 : (x->number > y->number);
+}
+
+static void print_fields(uint16_t reg, uint8_t value)
+{
+    const stv0910_field_info_t *fields;
+    uint8_t count = get_stv0910_register_fields(reg, &fields);
+    uint8_t i;
+
+    /* As stv0910_read_reg_field() takes them apart */
+    for (i = 0; i < count; i++) {
+        printf("    %s = %u\n", fields[i].name,
+               (value & (fields[i].field & 0xff)) >> ((fields[i].field >> 12) & 0x0f));
+    }
+}
+
+static void print_entry(const decode_entry_t *entry, int64_t realtime_offset_ns,
+                        const register_trace_ring_header_t *rings)
+{
+    const register_trace_record_t *record = &entry->record;
+    unsigned long long ms = (unsigned long long)(((int64_t)record->timestamp_ns + realtime_offset_ns) / 1000000);
+    const char *context = register_logging_context_to_string((register_context_t)record->context);
+    const char *action = (record->direction == REGISTER_TRACE_WRITE) ? "Writing" : "Reading";
+
+    printf("[%llu] ", ms);
+    if (show_thread) printf("{%s} ", rings[entry->ring].thread_name);
+
+    switch (record->chip) {
+        case REGISTER_TRACE_STV6120:
+            printf("STV6120: %s %s (0x%02x) = 0x%02x (%d) - %s [%s]\n", action,
+                   get_stv6120_register_name((uint8_t)record->reg), record->reg, record->value, record->value,
+                   get_stv6120_register_description((uint8_t)record->reg), context);
+            break;
+        case REGISTER_TRACE_STV0910:
+            printf("STV0910: %s %s (0x%04x) = 0x%02x (%d) - %s [%s]\n", action,
+                   get_stv0910_register_name(record->reg), record->reg, record->value, record->value,
+                   get_stv0910_register_description(record->reg), context);
+            if (show_fields) print_fields(record->reg, record->value);
+            break;
+        case REGISTER_TRACE_SEQUENCE:
+            printf("%s: %s\n", (record->direction == REGISTER_TRACE_START) ? "SEQUENCE_START" : "SEQUENCE_END",
+                   (record->reg < sequence_count) ? sequence_names[record->reg] : "UNKNOWN");
+            break;
+        default:
+            printf("UNKNOWN record\n");
+            break;
+    }
+}
+
+static int decode(const char *path)
+{
+    register_trace_file_header_t header;
+    register_trace_ring_header_t *rings = NULL;
+    register_trace_record_t *records = NULL;
+    decode_entry_t *entries = NULL;
+    uint64_t head_after, first, n;
+    size_t entry_count = 0;
+    uint32_t i;
+    int result = 1;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != REGISTER_TRACE_MAGIC) {
+        fprintf(stderr, "%s is not a register trace\n", path);
+        goto done;
+    }
+    if (header.version != REGISTER_TRACE_VERSION || header.record_size != sizeof(register_trace_record_t)
+        || header.records == 0 || (header.records & (header.records - 1)) != 0) {
+        fprintf(stderr, "%s is a register trace version %u this decoder does not read\n", path, header.version);
+        goto done;
+    }
+
+    sequence_count = header.sequence_count;
+    sequence_names = (char (*)[REGISTER_TRACE_NAME_LEN])calloc(sequence_count + 1, REGISTER_TRACE_NAME_LEN);
+    rings = (register_trace_ring_header_t *)calloc(header.ring_count + 1, sizeof(register_trace_ring_header_t));
+    records = (register_trace_record_t *)malloc((size_t)header.records * sizeof(register_trace_record_t));
+    entries = (decode_entry_t *)malloc((size_t)header.ring_count * header.records * sizeof(decode_entry_t) + 1);
+    if (sequence_names == NULL || rings == NULL || records == NULL || entries == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+    if (sequence_count > 0 && fread(sequence_names, REGISTER_TRACE_NAME_LEN, sequence_count, file) != sequence_count) {
+        fprintf(stderr, "%s is truncated\n", path);
+        goto done;
+    }
+    for (i = 0; i < sequence_count; i++) sequence_names[i][REGISTER_TRACE_NAME_LEN - 1] = '\0';
+
+    for (i = 0; i < header.ring_count; i++) {
+        if (fread(&rings[i], sizeof(rings[i]), 1, file) != 1
+            || fread(records, sizeof(register_trace_record_t), header.records, file) != header.records
+            || fread(&head_after, sizeof(head_after), 1, file) != 1) {
+            fprintf(stderr, "%s is truncated\n", path);
+            goto done;
+        }
+        rings[i].thread_name[sizeof(rings[i].thread_name) - 1] = '\0';
+
+        /* Whatever the thread wrote while it was being dumped may have overwritten the oldest records */
+        first = (head_after + 1 > header.records) ? head_after + 1 - header.records : 0;
+        for (n = first; n < rings[i].head; n++) {
+            entries[entry_count].record = records[n & (header.records - 1)];
+            entries[entry_count].number = n;
+            entries[entry_count].ring = i;
+            entry_count++;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(decode_entry_t), compare_entries);
+    for (n = 0; n < entry_count; n++) print_entry(&entries[n], header.realtime_offset_ns, rings);
+    result = 0;
+
+done:
+    fclose(file);
+    free(sequence_names);
+    free(rings);
+    free(records);
+    free(entries);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int param;
+
+    for (param = 1; param < argc - 1; param++) {
+        if (strcmp(argv[param], "-t") == 0) show_thread = true;
+        else if (strcmp(argv[param], "-f") == 0) show_fields = true;
+        else break;
+    }
+    if (param == argc - 1 && argv[param][0] != '-') return decode(argv[param]);
+
+    fprintf(stderr, "Usage: %s [-t] [-f] <dump>\n", argv[0]);
+    fprintf(stderr, "  -t  show the thread each record came from\n");
+    fprintf(stderr, "  -f  show the value of each field of an STV0910 register\n");
+    return 1;
+}
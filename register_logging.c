@@ -28,8 +28,10 @@
 #include <sys/time.h>
 #endif
 #include "register_logging.h"
+#include "register_trace.h"
 #include "stv6120_regs.h"
 #include "stv0910_regs.h"
+#include "stv0910_regs_info.h"
 
 /* -------------------------------------------------------------------------------------------------- */
 /* GLOBAL VARIABLES                                                                                   */
@@ -39,15 +41,11 @@ bool register_logging_enabled = true;  /* Runtime enable/disable flag */
 static bool demod_suppression_disabled = false;  /* Flag to disable demod suppression */
 static register_context_t current_context = REG_CONTEXT_UNKNOWN;
 
-/* Rate limiting for demod sequence logging */
-static uint64_t last_demod_sequence_log_time = 0;
-static bool demod_sequence_suppressed = false;
-
 /* -------------------------------------------------------------------------------------------------- */
 /* STV6120 REGISTER NAME LOOKUP TABLE                                                                */
 /* -------------------------------------------------------------------------------------------------- */
 
-static const stv6120_register_info_t stv6120_register_table[] = {
+static constexpr stv6120_register_info_t stv6120_register_table[] = {
     { STV6120_CTRL1,  "STV6120_CTRL1",  "K divider, RDIV, output shape, MCLK divider" },
     { STV6120_CTRL2,  "STV6120_CTRL2",  "DC loop, shutdown, synthesizer, reference, baseband gain" },
     { STV6120_CTRL3,  "STV6120_CTRL3",  "N divider LSB (tuner 1)" },
@@ -80,7 +78,7 @@ static const stv6120_register_info_t stv6120_register_table[] = {
 /* STV0910 REGISTER NAME LOOKUP TABLE (PARTIAL - KEY REGISTERS)                                     */
 /* -------------------------------------------------------------------------------------------------- */
 
-static const stv0910_register_info_t stv0910_register_table[] = {
+static constexpr stv0910_register_info_t stv0910_register_table[] = {
     /* System registers */
     { RSTV0910_MID,           "RSTV0910_MID",           "Chip identification" },
     { RSTV0910_DID,           "RSTV0910_DID",           "Device identification" },
@@ -1086,6 +1084,64 @@ static const stv0910_register_info_t stv0910_register_table[] = {
     { 0xFFFF, NULL, NULL }  /* End marker */
 };
 
+/* -------------------------------------------------------------------------------------------------- */
+/* REGISTER LOOKUP INDEXES                                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+/* Built by the compiler from the tables above and stv0910_regs_info.h, so that every lookup is one   */
+/* array access by address. Entries hold table positions + 1, with 0 for none.                        */
+
+typedef struct {
+    uint16_t name;         /* in stv0910_register_names */
+    uint16_t description;  /* in stv0910_register_table */
+    uint16_t first_field;  /* in stv0910_field_table */
+    uint8_t field_count;
+} stv0910_register_slot_t;
+
+typedef struct {
+    stv0910_register_slot_t slot[STV0910_REGISTER_SPAN];
+} stv0910_register_index_t;
+
+typedef struct {
+    uint8_t slot[256];
+} stv6120_register_index_t;
+
+static constexpr stv0910_register_index_t stv0910_register_index_build(void)
+{
+    stv0910_register_index_t index = {};
+    uint16_t slot = 0;
+
+    for (uint16_t i = 0; i < STV0910_REGS_INFO_REGISTERS; i++) {
+        index.slot[stv0910_register_names[i].address - STV0910_REGISTER_BASE].name = i + 1;
+    }
+    /* The first entry for an address wins, as it did for the linear search */
+    for (uint16_t i = 0; stv0910_register_table[i].name != NULL; i++) {
+        slot = stv0910_register_table[i].address - STV0910_REGISTER_BASE;
+        if (index.slot[slot].description == 0) index.slot[slot].description = i + 1;
+    }
+    /* stv0910_regs.h lists each register's fields together */
+    for (uint16_t i = 0; i < STV0910_REGS_INFO_FIELDS; i++) {
+        slot = (uint16_t)(stv0910_field_table[i].field >> 16) - STV0910_REGISTER_BASE;
+        if (index.slot[slot].field_count == 0) index.slot[slot].first_field = i;
+        index.slot[slot].field_count++;
+    }
+
+    return index;
+}
+
+static constexpr stv6120_register_index_t stv6120_register_index_build(void)
+{
+    stv6120_register_index_t index = {};
+
+    for (uint8_t i = 0; stv6120_register_table[i].name != NULL; i++) {
+        if (index.slot[stv6120_register_table[i].address] == 0) index.slot[stv6120_register_table[i].address] = i + 1;
+    }
+
+    return index;
+}
+
+static constexpr stv0910_register_index_t stv0910_register_index = stv0910_register_index_build();
+static constexpr stv6120_register_index_t stv6120_register_index = stv6120_register_index_build();
+
 /* -------------------------------------------------------------------------------------------------- */
 /* CONTEXT STRING LOOKUP TABLE                                                                        */
 /* -------------------------------------------------------------------------------------------------- */
@@ -1114,40 +1170,6 @@ static const char *context_strings[] = {
 /* UTILITY FUNCTIONS                                                                                  */
 /* -------------------------------------------------------------------------------------------------- */
 
-/* -------------------------------------------------------------------------------------------------- */
-static bool should_log_demod_sequence(void)
-{
-    /* -------------------------------------------------------------------------------------------------- */
-    /* Checks if enough time has passed to log demod sequence again                                    */
-    /* return: true if demod sequence should be logged                                                 */
-    /* -------------------------------------------------------------------------------------------------- */
-
-    /* If demod suppression is disabled, always log */
-    if (demod_suppression_disabled) {
-        return true;
-    }
-
-    uint64_t current_time = get_timestamp_ms();
-
-    if (current_time - last_demod_sequence_log_time >= DEMOD_SEQUENCE_LOG_INTERVAL_MS) {
-        last_demod_sequence_log_time = current_time;
-
-        /* Reset suppression flag if we were suppressing logs */
-        if (demod_sequence_suppressed) {
-            demod_sequence_suppressed = false;
-        }
-
-        return true;
-    }
-
-    /* Mark that we're suppressing logs (without verbose output) */
-    if (!demod_sequence_suppressed) {
-        demod_sequence_suppressed = true;
-    }
-
-    return false;
-}
-
 /* -------------------------------------------------------------------------------------------------- */
 uint64_t get_timestamp_ms(void)
 {
@@ -1209,6 +1231,7 @@ void register_logging_set_demod_suppression_disabled(bool disabled)
     /* disabled: true to disable suppression (always log), false to enable suppression               */
     /* -------------------------------------------------------------------------------------------------- */
     demod_suppression_disabled = disabled;
+    register_trace_demod_suppression = !disabled;
 
     if (register_logging_enabled) {
         printf("[%llu] REGISTER_LOG: Demod suppression %s\n",
@@ -1273,12 +1296,9 @@ const char *get_stv6120_register_name(uint8_t reg)
     /* reg: register address                                                                           */
     /* return: register name string or "UNKNOWN_REG" if not found                                      */
     /* -------------------------------------------------------------------------------------------------- */
-    for (int i = 0; stv6120_register_table[i].name != NULL; i++) {
-        if (stv6120_register_table[i].address == reg) {
-            return stv6120_register_table[i].name;
-        }
-    }
-    return "UNKNOWN_REG";
+    uint8_t entry = stv6120_register_index.slot[reg];
+
+    return (entry != 0) ? stv6120_register_table[entry - 1].name : "UNKNOWN_REG";
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1289,12 +1309,9 @@ const char *get_stv6120_register_description(uint8_t reg)
     /* reg: register address                                                                           */
     /* return: register description string or "Unknown register" if not found                         */
     /* -------------------------------------------------------------------------------------------------- */
-    for (int i = 0; stv6120_register_table[i].name != NULL; i++) {
-        if (stv6120_register_table[i].address == reg) {
-            return stv6120_register_table[i].description;
-        }
-    }
-    return "Unknown register";
+    uint8_t entry = stv6120_register_index.slot[reg];
+
+    return (entry != 0) ? stv6120_register_table[entry - 1].description : "Unknown register";
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1305,12 +1322,12 @@ const char *get_stv0910_register_name(uint16_t reg)
     /* reg: register address                                                                           */
     /* return: register name string or "UNKNOWN_REG" if not found                                      */
     /* -------------------------------------------------------------------------------------------------- */
-    for (int i = 0; stv0910_register_table[i].name != NULL; i++) {
-        if (stv0910_register_table[i].address == reg) {
-            return stv0910_register_table[i].name;
-        }
-    }
-    return "UNKNOWN_REG";
+    uint16_t entry;
+
+    if (reg < STV0910_REGISTER_BASE) return "UNKNOWN_REG";
+    entry = stv0910_register_index.slot[reg - STV0910_REGISTER_BASE].name;
+
+    return (entry != 0) ? stv0910_register_names[entry - 1].name : "UNKNOWN_REG";
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1321,17 +1338,39 @@ const char *get_stv0910_register_description(uint16_t reg)
     /* reg: register address                                                                           */
     /* return: register description string or "Unknown register" if not found                         */
     /* -------------------------------------------------------------------------------------------------- */
-    for (int i = 0; stv0910_register_table[i].name != NULL; i++) {
-        if (stv0910_register_table[i].address == reg) {
-            return stv0910_register_table[i].description;
-        }
-    }
-    return "Unknown register";
+    uint16_t entry;
+
+    if (reg < STV0910_REGISTER_BASE) return "Unknown register";
+    entry = stv0910_register_index.slot[reg - STV0910_REGISTER_BASE].description;
+
+    return (entry != 0) ? stv0910_register_table[entry - 1].description : "Unknown register";
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t get_stv0910_register_fields(uint16_t reg, const stv0910_field_info_t **fields)
+{
+    /* -------------------------------------------------------------------------------------------------- */
+    /* Gets the fields of an STV0910 register, as defined in stv0910_regs.h                            */
+    /* reg: register address                                                                           */
+    /* fields: set to the first of them                                                                */
+    /* return: how many there are, 0 for an unknown register                                           */
+    /* -------------------------------------------------------------------------------------------------- */
+    const stv0910_register_slot_t *slot;
+
+    *fields = NULL;
+    if (reg < STV0910_REGISTER_BASE) return 0;
+    slot = &stv0910_register_index.slot[reg - STV0910_REGISTER_BASE];
+    if (slot->field_count > 0) *fields = &stv0910_field_table[slot->first_field];
+
+    return slot->field_count;
 }
 
 /* -------------------------------------------------------------------------------------------------- */
 /* REGISTER LOGGING FUNCTIONS                                                                         */
 /* -------------------------------------------------------------------------------------------------- */
+/* These only add a record to the calling thread's trace ring (register_trace.c). register_decode     */
+/* prints a dump of the rings as the lines these used to print:                                       */
+/*   [ms] STV0910: Writing NAME (0xreg) = 0xval (val) - description [CONTEXT]                         */
 
 /* -------------------------------------------------------------------------------------------------- */
 void log_stv6120_register_write(uint8_t reg, uint8_t val, register_context_t context)
@@ -1344,14 +1383,7 @@ void log_stv6120_register_write(uint8_t reg, uint8_t val, register_context_t con
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    printf("[%llu] STV6120: Writing %s (0x%02x) = 0x%02x (%d) - %s [%s]\n",
-           (unsigned long long)get_timestamp_ms(),
-           get_stv6120_register_name(reg),
-           reg,
-           val,
-           val,
-           get_stv6120_register_description(reg),
-           register_logging_context_to_string(context));
+    register_trace_record(REGISTER_TRACE_STV6120, REGISTER_TRACE_WRITE, reg, val, context);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1365,14 +1397,7 @@ void log_stv6120_register_read(uint8_t reg, uint8_t val, register_context_t cont
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    printf("[%llu] STV6120: Reading %s (0x%02x) = 0x%02x (%d) - %s [%s]\n",
-           (unsigned long long)get_timestamp_ms(),
-           get_stv6120_register_name(reg),
-           reg,
-           val,
-           val,
-           get_stv6120_register_description(reg),
-           register_logging_context_to_string(context));
+    register_trace_record(REGISTER_TRACE_STV6120, REGISTER_TRACE_READ, reg, val, context);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1386,42 +1411,21 @@ void log_stv0910_register_write(uint16_t reg, uint8_t val, register_context_t co
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    printf("[%llu] STV0910: Writing %s (0x%04x) = 0x%02x (%d) - %s [%s]\n",
-           (unsigned long long)get_timestamp_ms(),
-           get_stv0910_register_name(reg),
-           reg,
-           val,
-           val,
-           get_stv0910_register_description(reg),
-           register_logging_context_to_string(context));
+    register_trace_record(REGISTER_TRACE_STV0910, REGISTER_TRACE_WRITE, reg, val, context);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
 void log_stv0910_register_read(uint16_t reg, uint8_t val, register_context_t context)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* Logs an STV0910 register read operation with rate limiting for demod sequences                  */
+    /* Logs an STV0910 register read operation, rate limited for demod sequences by the trace ring     */
     /* reg: register address                                                                           */
     /* val: value that was read                                                                        */
     /* context: operation context                                                                      */
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    /* Apply rate limiting for demod control context */
-    if (context == REG_CONTEXT_DEMOD_CONTROL) {
-        if (!should_log_demod_sequence()) {
-            return;  /* Skip logging this register read */
-        }
-    }
-
-    printf("[%llu] STV0910: Reading %s (0x%04x) = 0x%02x (%d) - %s [%s]\n",
-           (unsigned long long)get_timestamp_ms(),
-           get_stv0910_register_name(reg),
-           reg,
-           val,
-           val,
-           get_stv0910_register_description(reg),
-           register_logging_context_to_string(context));
+    register_trace_record(REGISTER_TRACE_STV0910, REGISTER_TRACE_READ, reg, val, context);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1433,9 +1437,8 @@ void log_register_sequence_start(const char *sequence_name)
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    printf("[%llu] SEQUENCE_START: %s\n",
-           (unsigned long long)get_timestamp_ms(),
-           sequence_name);
+    register_trace_record(REGISTER_TRACE_SEQUENCE, REGISTER_TRACE_START, register_trace_sequence(sequence_name), 0,
+                          current_context);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -1447,7 +1450,6 @@ void log_register_sequence_end(const char *sequence_name)
     /* -------------------------------------------------------------------------------------------------- */
     if (!register_logging_enabled) return;
 
-    printf("[%llu] SEQUENCE_END: %s\n",
-           (unsigned long long)get_timestamp_ms(),
-           sequence_name);
+    register_trace_record(REGISTER_TRACE_SEQUENCE, REGISTER_TRACE_END, register_trace_sequence(sequence_name), 0,
+                          current_context);
 }
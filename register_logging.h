@@ -39,6 +39,11 @@
 #define DEMOD_SEQUENCE_LOG_INTERVAL_MS 5000  /* Log demod sequence once every 5 seconds */
 #endif
 
+/* How long a demod sequence runs for, ie. what is kept of it each interval */
+#ifndef DEMOD_SEQUENCE_LOG_PASS_MS
+#define DEMOD_SEQUENCE_LOG_PASS_MS 50
+#endif
+
 /* Runtime enable/disable register logging */
 extern bool register_logging_enabled;
 
@@ -86,6 +91,20 @@ typedef struct {
     const char *description;
 } stv0910_register_info_t;
 
+/* The STV0910 registers all sit in one 4K window, so every lookup is a direct index into it */
+#define STV0910_REGISTER_BASE 0xf000
+#define STV0910_REGISTER_SPAN 0x1000
+
+typedef struct {
+    uint16_t address;
+    const char *name;
+} stv0910_register_name_t;
+
+typedef struct {
+    uint32_t field;  /* as the FSTV0910_ defines: register << 16 | position << 12 | mask */
+    const char *name;
+} stv0910_field_info_t;
+
 /* -------------------------------------------------------------------------------------------------- */
 /* FUNCTION PROTOTYPES                                                                                */
 /* -------------------------------------------------------------------------------------------------- */
@@ -114,6 +133,7 @@ const char *get_stv6120_register_name(uint8_t reg);
 const char *get_stv6120_register_description(uint8_t reg);
 const char *get_stv0910_register_name(uint16_t reg);
 const char *get_stv0910_register_description(uint16_t reg);
+uint8_t get_stv0910_register_fields(uint16_t reg, const stv0910_field_info_t **fields);
 
 /* Utility functions */
 uint64_t get_timestamp_ms(void);
@@ -0,0 +1,244 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: register_trace.c                                                            */
+/*    - per thread binary rings of register reads and writes, dumped on demand or on SIGUSR1          */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Each thread that touches a register gets its own ring the first time it does, so recording takes   */
+/* no lock and the hot path is a clock read and a 16 byte store. Nothing is formatted here: a dump is */
+/* the rings as they stand, and register_decode turns it back into the REGISTER_LOG text lines.       */
+/* The dump only uses async-signal-safe calls so that it can be taken from the signal handler.        */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include "register_trace.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+__thread register_trace_ring_t *register_trace_ring = NULL;
+bool register_trace_demod_suppression = true;
+
+static register_trace_ring_t *register_trace_rings[REGISTER_TRACE_THREADS];
+static uint32_t register_trace_ring_count = 0;
+
+static const char *register_trace_sequences[REGISTER_TRACE_SEQUENCES];
+static uint32_t register_trace_sequence_count = 0;
+static pthread_mutex_t register_trace_sequence_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char register_trace_dump_path[256] = REGISTER_TRACE_DEFAULT_PATH;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+void register_trace_init(const char *dump_path) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sets where a dump goes and dumps on SIGUSR1 from now on                                            */
+/* dump_path: the file to dump to, NULL for REGISTER_TRACE_DEFAULT_PATH                               */
+/* -------------------------------------------------------------------------------------------------- */
+    struct sigaction action;
+
+    if (dump_path != NULL && dump_path[0] != '\0') {
+        strncpy(register_trace_dump_path, dump_path, sizeof(register_trace_dump_path) - 1);
+        register_trace_dump_path[sizeof(register_trace_dump_path) - 1] = '\0';
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = register_trace_dump_signal;
+    sigemptyset(&action.sa_mask);
+    /* So that the reads and waits of the other threads carry on rather than fail with EINTR */
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+register_trace_ring_t *register_trace_ring_create(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gives the calling thread its ring, on its first register access                                    */
+/* return: the ring, or NULL if every ring is taken                                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    register_trace_ring_t *ring;
+    uint32_t slot;
+
+    if (__atomic_load_n(&register_trace_ring_count, __ATOMIC_RELAXED) >= REGISTER_TRACE_THREADS) return NULL;
+
+    ring = (register_trace_ring_t *)calloc(1, sizeof(register_trace_ring_t));
+    if (ring == NULL) return NULL;
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+
+    slot = __atomic_fetch_add(&register_trace_ring_count, 1, __ATOMIC_RELAXED);
+    if (slot >= REGISTER_TRACE_THREADS) {
+        printf("ERROR: no register trace ring left for thread %s\n", ring->thread_name);
+        free(ring);
+        return NULL;
+    }
+    /* A dump walks the table without a lock, and skips a slot that has been claimed but not yet set */
+    __atomic_store_n(&register_trace_rings[slot], ring, __ATOMIC_RELEASE);
+
+    register_trace_ring = ring;
+    return ring;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint16_t register_trace_sequence(const char *name) {
+/* -------------------------------------------------------------------------------------------------- */
+/* finds the index recorded for a sequence name, adding it the first time it is seen                  */
+/*   name: the sequence name, a string that lives for the whole run                                   */
+/* return: its index, or REGISTER_TRACE_SEQUENCES if the table is full                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t count = __atomic_load_n(&register_trace_sequence_count, __ATOMIC_ACQUIRE);
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (register_trace_sequences[i] == name || strcmp(register_trace_sequences[i], name) == 0) return i;
+    }
+
+    pthread_mutex_lock(&register_trace_sequence_mutex);
+    count = register_trace_sequence_count;
+    for (i = 0; i < count; i++) {
+        if (strcmp(register_trace_sequences[i], name) == 0) break;
+    }
+    if (i == count && count < REGISTER_TRACE_SEQUENCES) {
+        register_trace_sequences[count] = name;
+        __atomic_store_n(&register_trace_sequence_count, count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&register_trace_sequence_mutex);
+
+    return (i < REGISTER_TRACE_SEQUENCES) ? i : REGISTER_TRACE_SEQUENCES;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool register_trace_write_all(int fd, const void *data, size_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+    const uint8_t *next = (const uint8_t *)data;
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(fd, next, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        next += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int register_trace_dump(const char *path) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes every ring to a file, see register_trace.h for its layout. Async-signal-safe, and safe to   */
+/* call while the rings are being written to                                                          */
+/*   path: the file to write, replaced if it exists                                                   */
+/* return: 0, or -1 with errno set                                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    register_trace_file_header_t header;
+    register_trace_ring_header_t ring_header;
+    register_trace_ring_t *rings[REGISTER_TRACE_THREADS];
+    register_trace_ring_t *ring;
+    char name[REGISTER_TRACE_NAME_LEN];
+    struct timespec realtime, monotonic;
+    uint64_t head;
+    uint32_t count, i;
+    bool ok;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = REGISTER_TRACE_MAGIC;
+    header.version = REGISTER_TRACE_VERSION;
+    header.record_size = sizeof(register_trace_record_t);
+    header.records = REGISTER_TRACE_RECORDS;
+    header.realtime_offset_ns = ((int64_t)realtime.tv_sec - monotonic.tv_sec) * 1000000000LL
+                                + (realtime.tv_nsec - monotonic.tv_nsec);
+    /* Only the rings filled in so far: a thread that has claimed a slot may not have set it yet */
+    count = __atomic_load_n(&register_trace_ring_count, __ATOMIC_ACQUIRE);
+    if (count > REGISTER_TRACE_THREADS) count = REGISTER_TRACE_THREADS;
+    header.ring_count = 0;
+    for (i = 0; i < count; i++) {
+        ring = __atomic_load_n(&register_trace_rings[i], __ATOMIC_ACQUIRE);
+        if (ring != NULL) rings[header.ring_count++] = ring;
+    }
+    header.sequence_count = __atomic_load_n(&register_trace_sequence_count, __ATOMIC_ACQUIRE);
+    ok = register_trace_write_all(fd, &header, sizeof(header));
+
+    for (i = 0; ok && i < header.sequence_count; i++) {
+        memset(name, 0, sizeof(name));
+        strncpy(name, register_trace_sequences[i], sizeof(name) - 1);
+        ok = register_trace_write_all(fd, name, sizeof(name));
+    }
+
+    for (i = 0; ok && i < header.ring_count; i++) {
+        ring = rings[i];
+        memset(&ring_header, 0, sizeof(ring_header));
+        memcpy(ring_header.thread_name, ring->thread_name, sizeof(ring_header.thread_name));
+        ring_header.head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        ok = register_trace_write_all(fd, &ring_header, sizeof(ring_header))
+             && register_trace_write_all(fd, ring->records, sizeof(ring->records));
+        /* The reader uses this to drop whatever was overwritten while the records were written */
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        ok = ok && register_trace_write_all(fd, &head, sizeof(head));
+    }
+
+    if (close(fd) != 0) ok = false;
+
+    return ok ? 0 : -1;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void register_trace_dump_signal(int sig) {
+/* -------------------------------------------------------------------------------------------------- */
+/* SIGUSR1 handler: dumps to the path given to register_trace_init()                                  */
+/* -------------------------------------------------------------------------------------------------- */
+    static const char done[] = "Flow: register trace dumped\n";
+    static const char failed[] = "ERROR: register trace dump failed\n";
+    int saved_errno = errno;
+
+    (void)sig;
+    if (register_trace_dump(register_trace_dump_path) == 0) {
+        register_trace_write_all(STDOUT_FILENO, done, sizeof(done) - 1);
+    } else {
+        register_trace_write_all(STDOUT_FILENO, failed, sizeof(failed) - 1);
+    }
+
+    errno = saved_errno;
+}
@@ -0,0 +1,146 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: register_trace.h                                                            */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef REGISTER_TRACE_H
+#define REGISTER_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "register_logging.h"
+
+/* Records kept per thread, a power of 2. At 16 bytes each this is 1MB a thread */
+#ifndef REGISTER_TRACE_RECORDS
+#define REGISTER_TRACE_RECORDS 65536
+#endif
+#define REGISTER_TRACE_THREADS   16
+#define REGISTER_TRACE_SEQUENCES 64
+#define REGISTER_TRACE_NAME_LEN  48
+
+#define REGISTER_TRACE_DEFAULT_PATH "longmynd_register_trace.bin"
+
+/* register_trace_record_t.chip */
+#define REGISTER_TRACE_STV6120  0
+#define REGISTER_TRACE_STV0910  1
+#define REGISTER_TRACE_SEQUENCE 2 /* reg is the index of the sequence name */
+
+/* register_trace_record_t.direction */
+#define REGISTER_TRACE_WRITE 0
+#define REGISTER_TRACE_READ  1
+#define REGISTER_TRACE_START 2
+#define REGISTER_TRACE_END   3
+
+typedef struct {
+    uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+    uint16_t reg;
+    uint8_t value;
+    uint8_t chip;
+    uint8_t context;       /* register_context_t */
+    uint8_t direction;
+    uint16_t reserved;
+} register_trace_record_t;
+
+/* The dump file, all little endian as written by the host:                                           */
+/*   register_trace_file_header_t                                                                     */
+/*   sequence_count names of REGISTER_TRACE_NAME_LEN bytes                                            */
+/*   ring_count times: register_trace_ring_header_t, then REGISTER_TRACE_RECORDS records in ring      */
+/*                     order, then the ring's head again as a uint64_t, taken after the records       */
+/* A record numbered n (counting from 0 since the thread started) is in slot n % records. It is       */
+/* intact if it is below the first head and no less than the second head + 1 - records, since the     */
+/* thread may have carried on writing while it was dumped.                                            */
+#define REGISTER_TRACE_MAGIC   0x54524d4c /* "LMRT" */
+#define REGISTER_TRACE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t records;            /* per ring */
+    int64_t realtime_offset_ns;  /* add to a timestamp_ns for the time of day */
+    uint32_t ring_count;
+    uint32_t sequence_count;
+} register_trace_file_header_t;
+
+typedef struct {
+    char thread_name[16];
+    uint64_t head;               /* records written by the thread so far */
+} register_trace_ring_header_t;
+
+typedef struct {
+    register_trace_record_t records[REGISTER_TRACE_RECORDS];
+    uint64_t head;
+    uint64_t demod_window_ns;    /* start of the current window of DEMOD_CTRL reads kept */
+    char thread_name[16];
+} register_trace_ring_t;
+
+extern __thread register_trace_ring_t *register_trace_ring;
+extern bool register_trace_demod_suppression;
+
+void register_trace_init(const char *dump_path);
+register_trace_ring_t *register_trace_ring_create(void);
+uint16_t register_trace_sequence(const char *name);
+int register_trace_dump(const char *path);
+void register_trace_dump_signal(int sig);
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline uint64_t register_trace_now_ns(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void register_trace_record(uint8_t chip, uint8_t direction, uint16_t reg, uint8_t value,
+                                         uint8_t context) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds a record to the calling thread's ring: no locks, no formatting, no system calls               */
+/* -------------------------------------------------------------------------------------------------- */
+    register_trace_ring_t *ring = register_trace_ring;
+    register_trace_record_t *record;
+    uint64_t now = register_trace_now_ns();
+
+    if (ring == NULL) {
+        ring = register_trace_ring_create();
+        if (ring == NULL) return;
+    }
+
+    /* The demod status poll would fill the ring in seconds: keep one pass of it every interval */
+    if (register_trace_demod_suppression && context == REG_CONTEXT_DEMOD_CONTROL
+        && direction == REGISTER_TRACE_READ) {
+        if (now - ring->demod_window_ns >= DEMOD_SEQUENCE_LOG_INTERVAL_MS * 1000000ULL)
+            ring->demod_window_ns = now;
+        else if (now - ring->demod_window_ns >= DEMOD_SEQUENCE_LOG_PASS_MS * 1000000ULL) return;
+    }
+
+    record = &ring->records[ring->head & (REGISTER_TRACE_RECORDS - 1)];
+    record->timestamp_ns = now;
+    record->reg = reg;
+    record->value = value;
+    record->chip = chip;
+    record->context = context;
+    record->direction = direction;
+    /* Publish after the record, for a dump from another thread or a signal handler */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
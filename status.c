@@ -0,0 +1,780 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status.c                                                                    */
+/*    - lock-free publication of the shared status struct, see status.h                               */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* The status struct is split into two blocks, each protected by its own sequence counter (a seqlock).   */
+/* A writer makes the counter odd, writes the block, then makes it even again. A reader copies the block */
+/* and retries if the counter was odd or changed underneath it, so readers never block writers and       */
+/* never see a half written block. The demodulator block is rewritten every I2C loop by one thread; the  */
+/* TS block changes rarely but has two writers (TS and TS parse), which serialise on status->mutex.      */
+/* Publication is announced through an eventfd, so the main loop can sleep in poll() until there is      */
+/* something to send and a signal handler can wake it too.                                               */
+/*                                                                                                       */
+/* On the way out, status_all_write() asks the delta functions here whether each value has changed since */
+/* it was last sent, so steady values are not re-sent every cycle. Everything goes out periodically, and */
+/* on request (a status FIFO being reopened, an MQTT client asking), so a late joiner can catch up.      */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "main.h"
+#include "errors.h"
+#include "status.h"
+#include "status_binary.h"
+#include "status_format.h"
+#include "timeline.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define STATUS_DEMOD_START offsetof(longmynd_status_t, state)
+#define STATUS_DEMOD_END   offsetof(longmynd_status_t, ts_seq)
+#define STATUS_TS_START    offsetof(longmynd_status_t, service_name)
+#define STATUS_TS_END      offsetof(longmynd_status_t, last_ts_or_reinit_monotonic)
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+extern uint64_t monotonic_ms(void);
+
+/* Only used from the main status loop, apart from status_delta_full_generation */
+static status_delta_t status_delta_default;
+static status_delta_t *status_delta = &status_delta_default;
+static uint64_t status_delta_keyframe_ms;
+static uint32_t status_delta_full_generation = 1;
+
+static uint8_t status_frame_format = STATUS_FORMAT_TEXT;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_seq_write(uint32_t *seq, void *dest, const void *source, size_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes one block under its sequence counter, the caller must be the only writer of that block      */
+/*      *seq: the block's sequence counter                                                            */
+/*     *dest: where the block lives in the shared struct                                              */
+/*   *source: the new contents                                                                        */
+/*       len: size of the block                                                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(dest, source, len);
+    __atomic_store_n(seq, s + 2, __ATOMIC_RELEASE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_seq_read(const uint32_t *seq, void *dest, const void *source, size_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* copies one block out, retrying until the copy was not overlapped by a write                        */
+/*      *seq: the block's sequence counter                                                            */
+/*     *dest: where to put the copy                                                                   */
+/*   *source: the block in the shared struct                                                          */
+/*       len: size of the block                                                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t before, after;
+
+    while (true) {
+        before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            /* A writer is part way through, it will be done within a few hundred ns unless preempted */
+            sched_yield();
+            continue;
+        }
+        memcpy(dest, source, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(seq, __ATOMIC_RELAXED);
+        if (before == after) break;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_demod_publish(longmynd_status_t *status, const longmynd_status_t *source) {
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes the demodulator block of the I2C thread's local copy and tells the main loop             */
+/*  *status: the shared status struct                                                                 */
+/*  *source: the local copy to take the demodulator block (and a non-zero                             */
+/*           last_ts_or_reinit_monotonic) from                                                        */
+/* -------------------------------------------------------------------------------------------------- */
+    status_seq_write(&status->demod_seq, (uint8_t *)status + STATUS_DEMOD_START,
+                     (const uint8_t *)source + STATUS_DEMOD_START, STATUS_DEMOD_END - STATUS_DEMOD_START);
+
+    if (source->last_ts_or_reinit_monotonic != 0) {
+        status_set_last_ts_or_reinit(status, source->last_ts_or_reinit_monotonic);
+    }
+
+    __atomic_store_n(&status->last_updated_monotonic, monotonic_ms(), __ATOMIC_RELEASE);
+    status_notify(status);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_ts_write_begin(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* starts an in-place update of the TS block, readers will retry until status_ts_write_end            */
+/*  *status: the shared status struct                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_begin(TIMELINE_STATUS_MUTEX_WAIT);
+    pthread_mutex_lock(&status->mutex);
+    timeline_end(TIMELINE_STATUS_MUTEX_WAIT);
+    __atomic_store_n(&status->ts_seq, status->ts_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_ts_write_end(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* finishes an update started with status_ts_write_begin                                              */
+/*  *status: the shared status struct                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_store_n(&status->ts_seq, status->ts_seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&status->mutex);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_snapshot(const longmynd_status_t *status, longmynd_status_t *copy) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes a consistent copy of everything a status output needs, without blocking any writer           */
+/*  *status: the shared status struct                                                                 */
+/*    *copy: filled in; its mutex and signal are not usable                                           */
+/* -------------------------------------------------------------------------------------------------- */
+    status_demod_snapshot(status, copy);
+    status_seq_read(&status->ts_seq, (uint8_t *)copy + STATUS_TS_START,
+                    (const uint8_t *)status + STATUS_TS_START, STATUS_TS_END - STATUS_TS_START);
+
+    copy->last_ts_or_reinit_monotonic = status_get_last_ts_or_reinit(status);
+    copy->last_updated_monotonic = status_get_last_updated(status);
+    copy->ts_packet_count_nolock = status_get_ts_bytes(status);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_demod_snapshot(const longmynd_status_t *status, longmynd_status_t *copy) {
+/* -------------------------------------------------------------------------------------------------- */
+/* takes a consistent copy of just the demodulator block, for readers that need nothing else          */
+/*  *status: the shared status struct                                                                 */
+/*    *copy: the demodulator block is filled in, everything else is left alone                        */
+/* -------------------------------------------------------------------------------------------------- */
+    status_seq_read(&status->demod_seq, (uint8_t *)copy + STATUS_DEMOD_START,
+                    (const uint8_t *)status + STATUS_DEMOD_START, STATUS_DEMOD_END - STATUS_DEMOD_START);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_init(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* creates the eventfd behind status_notify/status_wait, before any thread or signal can use it       */
+/*  *status: the shared status struct                                                                 */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+
+    status->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (status->event_fd < 0) {
+        printf("ERROR: status eventfd (error: %s)\n", strerror(errno));
+        err=ERROR_STATUS_INIT;
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_notify(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* wakes the main loop; async-signal-safe, and never blocks as the eventfd only counts up             */
+/*  *status: the shared status struct                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t one = 1;
+
+    if (status->event_fd < 0) return;
+    if (write(status->event_fd, &one, sizeof(one)) < 0) {
+        /* Only fails if the counter would overflow, in which case the main loop is already due to wake */
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_wait(longmynd_status_t *status, int timeout_ms) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sleeps until status_notify has been called since the last wait, or the timeout runs out. Notifies  */
+/* that arrive while the caller is busy are kept, so none are lost between checking and waiting       */
+/*    *status: the shared status struct                                                               */
+/* timeout_ms: how long to wait, -1 for ever                                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = status->event_fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN)) {
+        if (read(status->event_fd, &count, sizeof(count)) < 0) {
+            /* EAGAIN, someone else drained it */
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_close(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (status->event_fd >= 0) close(status->event_fd);
+    status->event_fd = -1;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint64_t status_get_last_ts_or_reinit(const longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+    return __atomic_load_n(&status->last_ts_or_reinit_monotonic, __ATOMIC_ACQUIRE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_set_last_ts_or_reinit(longmynd_status_t *status, uint64_t monotonic) {
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_store_n(&status->last_ts_or_reinit_monotonic, monotonic, __ATOMIC_RELEASE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint64_t status_get_last_updated(const longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+    return __atomic_load_n(&status->last_updated_monotonic, __ATOMIC_ACQUIRE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_add_ts_bytes(longmynd_status_t *status, uint32_t bytes) {
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_add_fetch(&status->ts_packet_count_nolock, bytes, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t status_get_ts_bytes(const longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+    return __atomic_load_n(&status->ts_packet_count_nolock, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_clear_ts_bytes(longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_store_n(&status->ts_packet_count_nolock, 0, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_delta_init(uint32_t keyframe_seconds) {
+/* -------------------------------------------------------------------------------------------------- */
+/* keyframe_seconds: how often to send everything regardless, 0 to always send everything             */
+/* -------------------------------------------------------------------------------------------------- */
+    status_delta_keyframe_ms = (uint64_t)keyframe_seconds * 1000;
+    status_delta_request_full();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_delta_request_full(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* makes the next status update on every stream a keyframe, callable from any thread                  */
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_add_fetch(&status_delta_full_generation, 1, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_delta_select(status_delta_t *delta) {
+/* -------------------------------------------------------------------------------------------------- */
+/* chooses the stream that the other status_delta_ functions and the frame builders work on; until    */
+/* this is called there is a single stream, as used by the status tools                               */
+/*  *delta: the stream's state, zeroed before its first use                                           */
+/* -------------------------------------------------------------------------------------------------- */
+    status_delta = delta;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool status_delta_begin(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* starts a status update, deciding whether it is a keyframe                                          */
+/*  return: true if everything is to be sent                                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t now = monotonic_ms();
+    uint32_t generation = __atomic_load_n(&status_delta_full_generation, __ATOMIC_RELAXED);
+
+    status_delta->full = status_delta->full_requested
+                      || status_delta->full_generation != generation
+                      || status_delta_keyframe_ms == 0
+                      || now - status_delta->last_keyframe_monotonic >= status_delta_keyframe_ms;
+    status_delta->full_requested = false;
+    status_delta->full_generation = generation;
+    if (status_delta->full) status_delta->last_keyframe_monotonic = now;
+
+    return status_delta->full;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool status_delta_keyframe(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* whether the update started by the last status_delta_begin() is a keyframe                          */
+/* -------------------------------------------------------------------------------------------------- */
+    return status_delta->full;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool status_delta_changed(uint8_t id, uint32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* records a value as sent, and says whether it needs sending                                         */
+/*     id: the STATUS_ message number                                                                 */
+/*  value: the value about to be sent                                                                 */
+/* return: true if it differs from the last one sent, or this is a keyframe                           */
+/* -------------------------------------------------------------------------------------------------- */
+    status_delta_field_t *field;
+    bool changed;
+
+    if (id >= STATUS_DELTA_IDS) return true;
+
+    field = &status_delta->fields[id];
+    changed = status_delta->full || !field->sent || field->value != value;
+    field->sent = true;
+    field->value = value;
+
+    return changed;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool status_delta_block_changed(uint8_t id, const void *data, size_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* as status_delta_changed, for strings and for lists that are sent as a group under one number       */
+/*     id: the STATUS_ message number the block is tracked under                                      */
+/*  *data: the block                                                                                  */
+/*    len: its length                                                                                 */
+/* return: true if it differs from the last one sent, or this is a keyframe                           */
+/* -------------------------------------------------------------------------------------------------- */
+    const uint8_t *bytes = (const uint8_t *)data;
+    status_delta_field_t *field;
+    uint64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+    bool changed;
+
+    if (id >= STATUS_DELTA_IDS) return true;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    field = &status_delta->fields[id];
+    changed = status_delta->full || !field->sent || field->value != hash;
+    field->sent = true;
+    field->value = hash;
+
+    return changed;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_all_write(longmynd_status_t *status, uint8_t (*status_write)(uint8_t, uint32_t, bool *), uint8_t (*status_string_write)(uint8_t, char *, bool *), bool *output_ready_ptr) {
+/* -------------------------------------------------------------------------------------------------- */
+/* Reads the past status struct out to the passed write function                                      */
+/*  Only values that changed since they were last sent go out, apart from on keyframes (see           */
+/*  status_delta_begin). The state is always sent, as consumers use it to mark each update.           */
+/*  Returns: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err = ERROR_NONE;
+    uint32_t carrier_frequency;
+
+    status_delta_begin();
+
+    /* Main status */
+    if (err == ERROR_NONE && *output_ready_ptr)
+        err = status_write(STATUS_STATE, status->state, output_ready_ptr);
+    /* LNAs if present */
+    if (status->lna_ok)
+    {
+        if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_LNA_GAIN, status->lna_gain))
+            err = status_write(STATUS_LNA_GAIN, status->lna_gain, output_ready_ptr);
+    }
+    /* AGC1 Gain */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_AGC1_GAIN, status->agc1_gain))
+        err = status_write(STATUS_AGC1_GAIN, status->agc1_gain, output_ready_ptr);
+    /* AGC2 Gain */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_AGC2_GAIN, status->agc2_gain))
+        err = status_write(STATUS_AGC2_GAIN, status->agc2_gain, output_ready_ptr);
+    /* I,Q powers */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_POWER_I, status->power_i))
+        err = status_write(STATUS_POWER_I, status->power_i, output_ready_ptr);
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_POWER_Q, status->power_q))
+        err = status_write(STATUS_POWER_Q, status->power_q, output_ready_ptr);
+    /* constellations, always sent as a whole set of points */
+    if (status_delta_block_changed(STATUS_CONSTELLATION_I, status->constellation, sizeof(status->constellation)))
+    {
+        for (uint8_t count = 0; count < NUM_CONSTELLATIONS; count++)
+        {
+            if (err == ERROR_NONE && *output_ready_ptr)
+                err = status_write(STATUS_CONSTELLATION_I, status->constellation[count][0], output_ready_ptr);
+            if (err == ERROR_NONE && *output_ready_ptr)
+                err = status_write(STATUS_CONSTELLATION_Q, status->constellation[count][1], output_ready_ptr);
+        }
+    }
+    /* puncture rate */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_PUNCTURE_RATE, status->puncture_rate))
+        err = status_write(STATUS_PUNCTURE_RATE, status->puncture_rate, output_ready_ptr);
+    /* carrier frequency offset we are trying */
+    /* note we now have the offset, so we need to add in the freq we tried to set it to */
+    carrier_frequency = (uint32_t)(status->frequency_requested + (status->frequency_offset / 1000));
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_CARRIER_FREQUENCY, carrier_frequency))
+        err = status_write(STATUS_CARRIER_FREQUENCY, carrier_frequency, output_ready_ptr);
+    /* LNB Voltage Supply Enabled: true / false */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_LNB_SUPPLY, status->polarisation_supply))
+        err = status_write(STATUS_LNB_SUPPLY, status->polarisation_supply, output_ready_ptr);
+    /* LNB Voltage Supply is Horizontal Polarisation: true / false */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_LNB_POLARISATION_H, status->polarisation_horizontal))
+        err = status_write(STATUS_LNB_POLARISATION_H, status->polarisation_horizontal, output_ready_ptr);
+    /* symbol rate we are trying */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_SYMBOL_RATE, status->symbolrate))
+        err = status_write(STATUS_SYMBOL_RATE, status->symbolrate, output_ready_ptr);
+    /* viterbi error rate */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_VITERBI_ERROR_RATE, status->viterbi_error_rate))
+        err = status_write(STATUS_VITERBI_ERROR_RATE, status->viterbi_error_rate, output_ready_ptr);
+    /* BER */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_BER, status->bit_error_rate))
+        err = status_write(STATUS_BER, status->bit_error_rate, output_ready_ptr);
+    /* MER */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_MER, status->modulation_error_rate))
+        err = status_write(STATUS_MER, status->modulation_error_rate, output_ready_ptr);
+    /* BCH Uncorrected Errors Flag */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_ERRORS_BCH_UNCORRECTED, status->errors_bch_uncorrected))
+        err = status_write(STATUS_ERRORS_BCH_UNCORRECTED, status->errors_bch_uncorrected, output_ready_ptr);
+    /* BCH Corrected Errors Count */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_ERRORS_BCH_COUNT, status->errors_bch_count))
+        err = status_write(STATUS_ERRORS_BCH_COUNT, status->errors_bch_count, output_ready_ptr);
+    /* LDPC Corrected Errors Count */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_ERRORS_LDPC_COUNT, status->errors_ldpc_count))
+        err = status_write(STATUS_ERRORS_LDPC_COUNT, status->errors_ldpc_count, output_ready_ptr);
+    /* Service Name */
+    if (err == ERROR_NONE && *output_ready_ptr
+        && status_delta_block_changed(STATUS_SERVICE_NAME, status->service_name, strlen(status->service_name)))
+        err = status_string_write(STATUS_SERVICE_NAME, status->service_name, output_ready_ptr);
+    /* Service Provider Name */
+    if (err == ERROR_NONE && *output_ready_ptr
+        && status_delta_block_changed(STATUS_SERVICE_PROVIDER_NAME, status->service_provider_name, strlen(status->service_provider_name)))
+        err = status_string_write(STATUS_SERVICE_PROVIDER_NAME, status->service_provider_name, output_ready_ptr);
+    /* TS Null Percentage */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_TS_NULL_PERCENTAGE, status->ts_null_percentage))
+        err = status_write(STATUS_TS_NULL_PERCENTAGE, status->ts_null_percentage, output_ready_ptr);
+    /* TS Elementary Stream PIDs, always sent as a whole list */
+    if (status_delta_block_changed(STATUS_ES_PID, status->ts_elementary_streams, sizeof(status->ts_elementary_streams)))
+    {
+        for (uint8_t count = 0; count < NUM_ELEMENT_STREAMS; count++)
+        {
+            if (status->ts_elementary_streams[count][0] > 0)
+            {
+                if (err == ERROR_NONE && *output_ready_ptr)
+                    err = status_write(STATUS_ES_PID, status->ts_elementary_streams[count][0], output_ready_ptr);
+                if (err == ERROR_NONE && *output_ready_ptr)
+                    err = status_write(STATUS_ES_TYPE, status->ts_elementary_streams[count][1], output_ready_ptr);
+            }
+        }
+    }
+    /* MODCOD */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_MODCOD, status->modcod))
+        err = status_write(STATUS_MODCOD, status->modcod, output_ready_ptr);
+    /* Short Frames */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_SHORT_FRAME, status->short_frame))
+        err = status_write(STATUS_SHORT_FRAME, status->short_frame, output_ready_ptr);
+    /* Pilots */
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_PILOTS, status->pilots))
+        err = status_write(STATUS_PILOTS, status->pilots, output_ready_ptr);
+    // MATYPE    
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_MATYPE1, status->matype1))
+        err = status_write(STATUS_MATYPE1, status->matype1, output_ready_ptr);    
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_MATYPE2, status->matype2))
+        err = status_write(STATUS_MATYPE2, status->matype2, output_ready_ptr);
+    if (err == ERROR_NONE && *output_ready_ptr && status_delta_changed(STATUS_ROLLOFF, status->rolloff))
+        err = status_write(STATUS_ROLLOFF, status->rolloff, output_ready_ptr);        
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_frame_text_begin(status_frame_t *frame, status_fmt_t *fmt) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sets fmt up to append one line to the frame, starting the frame with its sequence number if it is  */
+/* empty                                                                                              */
+/* -------------------------------------------------------------------------------------------------- */
+    if (frame->len == 0) {
+        status_fmt_init(fmt, frame->buffer, STATUS_FRAME_MAX);
+        status_format_line(fmt, STATUS_SEQUENCE, (int32_t)frame->sequence);
+        frame->len = fmt->len;
+    }
+    status_fmt_init(fmt, &frame->buffer[frame->len], STATUS_FRAME_MAX - frame->len);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_frame_text_end(status_frame_t *frame, status_fmt_t *fmt) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a line that did not fit is dropped whole, so the frame never carries a truncated value             */
+/* -------------------------------------------------------------------------------------------------- */
+    if (!fmt->truncated) frame->len += fmt->len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_frame_put_le16(uint8_t *p, uint16_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_frame_put_le32(uint8_t *p, uint32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = value >> 24;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t *status_frame_binary_reserve(status_frame_t *frame, uint32_t len, bool keyframe) {
+/* -------------------------------------------------------------------------------------------------- */
+/* makes room for len more bytes, starting the frame with its header if it is empty                   */
+/*    *frame: the frame being built                                                                   */
+/*       len: bytes wanted                                                                            */
+/*  keyframe: whether a frame started here carries everything                                         */
+/*    return: where to write them, or NULL if they will not fit                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t *buffer = (uint8_t *)frame->buffer;
+
+    if (frame->len == 0) {
+        status_frame_put_le32(&buffer[0], STATUS_BINARY_MAGIC);
+        buffer[4] = STATUS_BINARY_VERSION;
+        buffer[5] = sizeof(status_binary_header_t);
+        status_frame_put_le32(&buffer[8], frame->sequence);
+        status_frame_put_le32(&buffer[12], keyframe ? STATUS_BINARY_FLAG_KEYFRAME : 0);
+        frame->len = sizeof(status_binary_header_t);
+        frame->group_id = 0;
+    }
+    if (frame->len + len > STATUS_FRAME_MAX) return NULL;
+
+    frame->len += len;
+    status_frame_put_le16(&buffer[6], frame->len);
+
+    return &buffer[frame->len - len];
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool status_frame_binary_field(status_frame_t *frame, uint8_t id, const uint8_t *value, uint32_t len,
+                                      bool keyframe) {
+/* -------------------------------------------------------------------------------------------------- */
+/* appends one TLV; a value too long for the length byte is cut short, which only a name could be     */
+/*  return: false if the frame is full                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t *p;
+
+    if (len > 255) len = 255;
+    p = status_frame_binary_reserve(frame, 2 + len, keyframe);
+    if (p == NULL) return false;
+
+    p[0] = id;
+    p[1] = len;
+    memcpy(&p[2], value, len);
+    frame->group_id = 0;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_frame_binary_add(status_frame_t *frame, uint8_t message, uint32_t data, bool keyframe) {
+/* -------------------------------------------------------------------------------------------------- */
+/* appends one value; constellation points and ES entries are packed into a single TLV per frame      */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t value[4];
+    uint8_t group_id = 0;
+    uint32_t size = 4;
+    uint8_t *p;
+
+    if (message == STATUS_CONSTELLATION_I || message == STATUS_CONSTELLATION_Q) {
+        group_id = STATUS_CONSTELLATION_I;
+        size = 1;
+    } else if (message == STATUS_ES_PID || message == STATUS_ES_TYPE) {
+        group_id = STATUS_ES_PID;
+        size = 2;
+    }
+
+    if (size == 4) status_frame_put_le32(value, data);
+    else if (size == 2) status_frame_put_le16(value, (uint16_t)data);
+    else value[0] = (uint8_t)data;
+
+    if (group_id == 0) {
+        status_frame_binary_field(frame, message, value, size, keyframe);
+        return;
+    }
+
+    /* Extend the group's TLV if it is the last thing in the frame and has room, else start one */
+    if (frame->len != 0 && frame->group_id == group_id
+        && (uint8_t)frame->buffer[frame->group_offset + 1] + size <= 255) {
+        p = status_frame_binary_reserve(frame, size, keyframe);
+        if (p == NULL) return;
+        memcpy(p, value, size);
+        frame->buffer[frame->group_offset + 1] += size;
+    } else if (status_frame_binary_field(frame, group_id, value, size, keyframe)) {
+        frame->group_id = group_id;
+        frame->group_offset = frame->len - 2 - size;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_frame_set_format(uint8_t format) {
+/* -------------------------------------------------------------------------------------------------- */
+/* chooses how the FIFO and UDP sinks build their frames, before any status is sent                   */
+/*  format: STATUS_FORMAT_TEXT or STATUS_FORMAT_BINARY                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    status_frame_format = format;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_frame_add(status_frame_t *frame, uint8_t message, uint32_t data) {
+/* -------------------------------------------------------------------------------------------------- */
+/*   *frame: the sink's frame being built                                                             */
+/*  message: the STATUS_ message number                                                               */
+/*     data: the value                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_t fmt;
+
+    if (status_frame_format == STATUS_FORMAT_BINARY) {
+        status_frame_binary_add(frame, message, data, status_delta->full);
+        return;
+    }
+
+    /* WARNING: This currently prints as signed integer (int32_t), even though function appears to expect unsigned (uint32_t) */
+    status_frame_text_begin(frame, &fmt);
+    status_format_line(&fmt, message, (int32_t)data);
+    status_frame_text_end(frame, &fmt);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_frame_add_string(status_frame_t *frame, uint8_t message, const char *data) {
+/* -------------------------------------------------------------------------------------------------- */
+/*   *frame: the sink's frame being built                                                             */
+/*  message: the STATUS_ message number                                                               */
+/*    *data: the string value                                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_t fmt;
+
+    if (status_frame_format == STATUS_FORMAT_BINARY) {
+        status_frame_binary_field(frame, message, (const uint8_t *)data, strlen(data), status_delta->full);
+        return;
+    }
+
+    status_frame_text_begin(frame, &fmt);
+    status_format_line_string(&fmt, message, data);
+    status_frame_text_end(frame, &fmt);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_frame_sent(status_frame_t *frame) {
+/* -------------------------------------------------------------------------------------------------- */
+/* empties the frame once the sink has sent it (or given up on it), ready for the next cycle          */
+/*   *frame: the sink's frame                                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    frame->len = 0;
+    frame->sequence++;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t status_frame_header(const status_frame_t *frame, uint32_t sequence, char *header, uint32_t *body_offset) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gives one sink its own header for a frame that is shared with other sinks, so that each sink's      */
+/* sequence still counts only the frames it sent                                                      */
+/*       *frame: a frame built by status_frame_add                                                    */
+/*     sequence: the sink's sequence number for it                                                    */
+/*      *header: at least STATUS_FRAME_HEADER_MAX bytes, filled in with the sink's header             */
+/* *body_offset: set to where the rest of the frame starts, to be sent after the header               */
+/*       return: length of the header                                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_t fmt;
+    const char *end;
+
+    if (status_frame_format == STATUS_FORMAT_BINARY) {
+        *body_offset = sizeof(status_binary_header_t);
+        memcpy(header, frame->buffer, sizeof(status_binary_header_t));
+        status_frame_put_le32((uint8_t *)&header[8], sequence);
+        return sizeof(status_binary_header_t);
+    }
+
+    /* The text frame starts with its own sequence line */
+    end = (const char *)memchr(frame->buffer, '\n', frame->len);
+    *body_offset = (end == NULL) ? 0 : (uint32_t)(end - frame->buffer) + 1;
+    status_fmt_init(&fmt, header, STATUS_FRAME_HEADER_MAX);
+    status_format_line(&fmt, STATUS_SEQUENCE, (int32_t)sequence);
+
+    return fmt.len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_frame_encode_full(const longmynd_status_t *status, status_frame_t *frame) {
+/* -------------------------------------------------------------------------------------------------- */
+/* builds a binary keyframe of a whole status snapshot, for the shared memory mailbox. Carries the    */
+/* same fields as status_all_write() above                                                            */
+/*  *status: a snapshot, see status_snapshot()                                                        */
+/*   *frame: emptied, then filled in                                                                  */
+/* -------------------------------------------------------------------------------------------------- */
+    frame->len = 0;
+
+    status_frame_binary_add(frame, STATUS_STATE, status->state, true);
+    if (status->lna_ok) status_frame_binary_add(frame, STATUS_LNA_GAIN, status->lna_gain, true);
+    status_frame_binary_add(frame, STATUS_AGC1_GAIN, status->agc1_gain, true);
+    status_frame_binary_add(frame, STATUS_AGC2_GAIN, status->agc2_gain, true);
+    status_frame_binary_add(frame, STATUS_POWER_I, status->power_i, true);
+    status_frame_binary_add(frame, STATUS_POWER_Q, status->power_q, true);
+    for (int i = 0; i < NUM_CONSTELLATIONS; i++) {
+        status_frame_binary_add(frame, STATUS_CONSTELLATION_I, status->constellation[i][0], true);
+        status_frame_binary_add(frame, STATUS_CONSTELLATION_Q, status->constellation[i][1], true);
+    }
+    status_frame_binary_add(frame, STATUS_PUNCTURE_RATE, status->puncture_rate, true);
+    status_frame_binary_add(frame, STATUS_CARRIER_FREQUENCY,
+                            (uint32_t)(status->frequency_requested + (status->frequency_offset / 1000)), true);
+    status_frame_binary_add(frame, STATUS_LNB_SUPPLY, status->polarisation_supply, true);
+    status_frame_binary_add(frame, STATUS_LNB_POLARISATION_H, status->polarisation_horizontal, true);
+    status_frame_binary_add(frame, STATUS_SYMBOL_RATE, status->symbolrate, true);
+    status_frame_binary_add(frame, STATUS_VITERBI_ERROR_RATE, status->viterbi_error_rate, true);
+    status_frame_binary_add(frame, STATUS_BER, status->bit_error_rate, true);
+    status_frame_binary_add(frame, STATUS_MER, status->modulation_error_rate, true);
+    status_frame_binary_add(frame, STATUS_ERRORS_BCH_UNCORRECTED, status->errors_bch_uncorrected, true);
+    status_frame_binary_add(frame, STATUS_ERRORS_BCH_COUNT, status->errors_bch_count, true);
+    status_frame_binary_add(frame, STATUS_ERRORS_LDPC_COUNT, status->errors_ldpc_count, true);
+    status_frame_binary_field(frame, STATUS_SERVICE_NAME, (const uint8_t *)status->service_name,
+                              strlen(status->service_name), true);
+    status_frame_binary_field(frame, STATUS_SERVICE_PROVIDER_NAME, (const uint8_t *)status->service_provider_name,
+                              strlen(status->service_provider_name), true);
+    status_frame_binary_add(frame, STATUS_TS_NULL_PERCENTAGE, status->ts_null_percentage, true);
+    for (int i = 0; i < NUM_ELEMENT_STREAMS; i++) {
+        if (status->ts_elementary_streams[i][0] == 0) continue;
+        status_frame_binary_add(frame, STATUS_ES_PID, status->ts_elementary_streams[i][0], true);
+        status_frame_binary_add(frame, STATUS_ES_TYPE, status->ts_elementary_streams[i][1], true);
+    }
+    status_frame_binary_add(frame, STATUS_MODCOD, status->modcod, true);
+    status_frame_binary_add(frame, STATUS_SHORT_FRAME, status->short_frame, true);
+    status_frame_binary_add(frame, STATUS_PILOTS, status->pilots, true);
+    status_frame_binary_add(frame, STATUS_MATYPE1, status->matype1, true);
+    status_frame_binary_add(frame, STATUS_MATYPE2, status->matype2, true);
+    status_frame_binary_add(frame, STATUS_ROLLOFF, status->rolloff, true);
+}
@@ -0,0 +1,103 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status.h                                                                    */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "main.h"
+
+/* Every status value goes out in full this often even if unchanged, 0 sends everything every update */
+#define STATUS_DEFAULT_KEYFRAME_SECONDS 10
+
+/* A whole cycle of $n,m lines, or one binary frame (see status_binary.h), is sent in one datagram or */
+/* one FIFO write. Keeping to PIPE_BUF means a FIFO reader always gets a cycle in one piece; a text   */
+/* keyframe with both names at full length is ~1.5 KB                                                */
+#define STATUS_FRAME_MAX 4096
+
+/* Room for the sequence line, or the binary header, that status_frame_header() gives each sink */
+#define STATUS_FRAME_HEADER_MAX 32
+
+#define STATUS_FORMAT_TEXT   0
+#define STATUS_FORMAT_BINARY 1
+
+/* One slot per STATUS_ message number */
+#define STATUS_DELTA_IDS 32
+
+typedef struct {
+    bool sent;
+    uint64_t value; /* the value itself, or a hash of a block */
+} status_delta_field_t;
+
+/* What one stream of updates last sent; each sink that keeps its own pace has its own */
+typedef struct {
+    status_delta_field_t fields[STATUS_DELTA_IDS];
+    uint64_t last_keyframe_monotonic;
+    uint32_t full_generation; /* the status_delta_request_full() calls already acted on */
+    bool full;
+    bool full_requested;
+} status_delta_t;
+
+typedef struct {
+    char buffer[STATUS_FRAME_MAX];
+    uint32_t len;
+    uint32_t sequence;
+    uint32_t group_offset; /* binary only: the TLV that grouped values are being appended to */
+    uint8_t group_id;
+} status_frame_t;
+
+void status_demod_publish(longmynd_status_t *status, const longmynd_status_t *source);
+void status_ts_write_begin(longmynd_status_t *status);
+void status_ts_write_end(longmynd_status_t *status);
+void status_snapshot(const longmynd_status_t *status, longmynd_status_t *copy);
+void status_demod_snapshot(const longmynd_status_t *status, longmynd_status_t *copy);
+
+uint8_t status_init(longmynd_status_t *status);
+void status_notify(longmynd_status_t *status);
+void status_wait(longmynd_status_t *status, int timeout_ms);
+void status_close(longmynd_status_t *status);
+
+uint64_t status_get_last_ts_or_reinit(const longmynd_status_t *status);
+void status_set_last_ts_or_reinit(longmynd_status_t *status, uint64_t monotonic);
+uint64_t status_get_last_updated(const longmynd_status_t *status);
+void status_add_ts_bytes(longmynd_status_t *status, uint32_t bytes);
+uint32_t status_get_ts_bytes(const longmynd_status_t *status);
+void status_clear_ts_bytes(longmynd_status_t *status);
+
+void status_delta_init(uint32_t keyframe_seconds);
+void status_delta_request_full(void);
+void status_delta_select(status_delta_t *delta);
+bool status_delta_begin(void);
+bool status_delta_keyframe(void);
+bool status_delta_changed(uint8_t id, uint32_t value);
+bool status_delta_block_changed(uint8_t id, const void *data, size_t len);
+uint8_t status_all_write(longmynd_status_t *status, uint8_t (*status_write)(uint8_t, uint32_t, bool *),
+                         uint8_t (*status_string_write)(uint8_t, char *, bool *), bool *output_ready_ptr);
+
+void status_frame_set_format(uint8_t format);
+void status_frame_add(status_frame_t *frame, uint8_t message, uint32_t data);
+void status_frame_add_string(status_frame_t *frame, uint8_t message, const char *data);
+void status_frame_sent(status_frame_t *frame);
+uint32_t status_frame_header(const status_frame_t *frame, uint32_t sequence, char *header, uint32_t *body_offset);
+void status_frame_encode_full(const longmynd_status_t *status, status_frame_t *frame);
+
+#endif
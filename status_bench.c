@@ -0,0 +1,263 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_bench.c                                                              */
+/*    - measures the cost per cycle of formatting the status, against the snprintf it replaced        */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "main.h"
+#include "json_output.h"
+#include "status.h"
+#include "status_format.h"
+
+#define BENCH_ITERATIONS 200000
+
+static char bench_buffer[JSON_BUFFER_SIZE_FULL];
+static char reference_buffer[JSON_BUFFER_SIZE_FULL];
+static volatile uint32_t bench_sink;
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The formats as they were built before status_format.c, for timing and to check the output matches */
+static int reference_full(char *buffer, size_t size, const longmynd_status_t *status, uint64_t timestamp)
+{
+    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
+
+    return snprintf(buffer, size,
+        "{\n  \"timestamp\": %llu,\n  \"tuner\": %u,\n"
+        "  \"signal\": {\n    \"power_i\": %u,\n    \"power_q\": %u,\n    \"agc1_gain\": %u,\n"
+        "    \"agc2_gain\": %u,\n    \"lna_gain\": %u\n  },\n"
+        "  \"lock\": {\n    \"demod_state\": %u,\n    \"state_name\": \"%s\",\n    \"locked\": %s\n  },\n"
+        "  \"errors\": {\n    \"viterbi_rate\": %u,\n    \"ber\": %u,\n    \"mer\": %d,\n"
+        "    \"bch_uncorrected\": %s,\n    \"bch_count\": %u,\n    \"ldpc_count\": %u\n  },\n"
+        "  \"frequency\": {\n    \"requested\": %u,\n    \"offset\": %d,\n    \"actual\": %.1f\n  },\n"
+        "  \"modulation\": {\n    \"symbol_rate\": %u,\n    \"modcod\": %u,\n    \"short_frame\": %s,\n"
+        "    \"pilots\": %s,\n    \"rolloff\": %u\n  }\n}",
+        (unsigned long long)timestamp, 1, status->power_i, status->power_q, status->agc1_gain, status->agc2_gain,
+        status->lna_gain, status->demod_state, json_get_demod_state_name(status->demod_state),
+        is_locked ? "true" : "false", status->viterbi_error_rate, status->bit_error_rate,
+        status->modulation_error_rate, status->errors_bch_uncorrected ? "true" : "false", status->errors_bch_count,
+        status->errors_ldpc_count, status->frequency_requested, status->frequency_offset,
+        status->frequency_requested + (status->frequency_offset / 1000.0), status->symbolrate, status->modcod,
+        status->short_frame ? "true" : "false", status->pilots ? "true" : "false", status->rolloff);
+}
+
+static int reference_compact(char *buffer, size_t size, const longmynd_status_t *status, uint64_t timestamp)
+{
+    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
+
+    return snprintf(buffer, size,
+        "{\"ts\":%llu,\"t\":%u,\"pi\":%u,\"pq\":%u,\"a1\":%u,\"a2\":%u,\"lna\":%u,"
+        "\"ds\":%u,\"lck\":%s,\"vit\":%u,\"ber\":%u,\"mer\":%d,\"freq\":%.1f,\"sr\":%u,\"mc\":%u}",
+        (unsigned long long)timestamp, 1, status->power_i, status->power_q, status->agc1_gain, status->agc2_gain,
+        status->lna_gain, status->demod_state, is_locked ? "true" : "false", status->viterbi_error_rate,
+        status->bit_error_rate, status->modulation_error_rate,
+        status->frequency_requested + (status->frequency_offset / 1000.0), status->symbolrate, status->modcod);
+}
+
+static int reference_minimal(char *buffer, size_t size, const longmynd_status_t *status, uint64_t timestamp)
+{
+    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
+
+    return snprintf(buffer, size, "{\"ts\":%llu,\"t\":%u,\"lck\":%s,\"mer\":%d,\"freq\":%u,\"sr\":%u}",
+                    (unsigned long long)timestamp, 1, is_locked ? "true" : "false", status->modulation_error_rate,
+                    status->frequency_requested, status->symbolrate);
+}
+
+static void reference_text_cycle(char *buffer, size_t size, const longmynd_status_t *status)
+{
+    int len = 0;
+    int count;
+
+    len += snprintf(&buffer[len], size - len, "$%i,%u\n", STATUS_SEQUENCE, 0);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_STATE, status->state);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_AGC1_GAIN, status->agc1_gain);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_AGC2_GAIN, status->agc2_gain);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_POWER_I, status->power_i);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_POWER_Q, status->power_q);
+    for (count = 0; count < NUM_CONSTELLATIONS; count++) {
+        len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_CONSTELLATION_I, status->constellation[count][0]);
+        len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_CONSTELLATION_Q, status->constellation[count][1]);
+    }
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_SYMBOL_RATE, status->symbolrate);
+    len += snprintf(&buffer[len], size - len, "$%i,%i\n", STATUS_MER, status->modulation_error_rate);
+    len += snprintf(&buffer[len], size - len, "$%i,%s\n", STATUS_SERVICE_NAME, status->service_name);
+    len += snprintf(&buffer[len], size - len, "$%i,%s\n", STATUS_SERVICE_PROVIDER_NAME, status->service_provider_name);
+    bench_sink += len;
+}
+
+static void text_cycle(status_frame_t *frame, const longmynd_status_t *status)
+{
+    int count;
+
+    status_frame_add(frame, STATUS_STATE, status->state);
+    status_frame_add(frame, STATUS_AGC1_GAIN, status->agc1_gain);
+    status_frame_add(frame, STATUS_AGC2_GAIN, status->agc2_gain);
+    status_frame_add(frame, STATUS_POWER_I, status->power_i);
+    status_frame_add(frame, STATUS_POWER_Q, status->power_q);
+    for (count = 0; count < NUM_CONSTELLATIONS; count++) {
+        status_frame_add(frame, STATUS_CONSTELLATION_I, status->constellation[count][0]);
+        status_frame_add(frame, STATUS_CONSTELLATION_Q, status->constellation[count][1]);
+    }
+    status_frame_add(frame, STATUS_SYMBOL_RATE, status->symbolrate);
+    status_frame_add(frame, STATUS_MER, status->modulation_error_rate);
+    status_frame_add_string(frame, STATUS_SERVICE_NAME, status->service_name);
+    status_frame_add_string(frame, STATUS_SERVICE_PROVIDER_NAME, status->service_provider_name);
+    bench_sink += frame->len;
+    frame->len = 0;
+}
+
+static void bench_status(longmynd_status_t *status, uint32_t seed)
+{
+    int count;
+
+    srand(seed);
+    memset(status, 0, sizeof(longmynd_status_t));
+    status->state = 4;
+    status->demod_state = 2;
+    status->lna_ok = true;
+    status->lna_gain = rand() % 64;
+    status->agc1_gain = rand() % 65536;
+    status->agc2_gain = rand() % 65536;
+    status->power_i = rand() % 256;
+    status->power_q = rand() % 256;
+    status->frequency_requested = 741500 + rand() % 1000000;
+    status->frequency_offset = (rand() % 2000000) - 1000000;
+    status->symbolrate = 333000 + rand() % 27000000;
+    status->viterbi_error_rate = rand();
+    status->bit_error_rate = rand();
+    status->modulation_error_rate = (rand() % 400) - 100;
+    status->modcod = rand() % 29;
+    status->errors_ldpc_count = rand();
+    status->errors_bch_count = rand();
+    status->errors_bch_uncorrected = rand() % 2;
+    status->short_frame = rand() % 2;
+    status->pilots = rand() % 2;
+    status->rolloff = rand() % 4;
+    for (count = 0; count < NUM_CONSTELLATIONS; count++) {
+        status->constellation[count][0] = (int8_t)(rand() % 256 - 128);
+        status->constellation[count][1] = (int8_t)(rand() % 256 - 128);
+    }
+    strcpy(status->service_name, "A71A");
+    strcpy(status->service_provider_name, "QARS");
+}
+
+static double bench_json(json_format_t format, const longmynd_status_t *status)
+{
+    status_fmt_t fmt;
+    uint64_t start = bench_now_ns();
+    int count;
+
+    for (count = 0; count < BENCH_ITERATIONS; count++) {
+        status_fmt_init(&fmt, bench_buffer, sizeof(bench_buffer));
+        status_format_json(&fmt, format, 1, status, 1700000000000ULL + count, false);
+        bench_sink += fmt.len;
+    }
+
+    return (double)(bench_now_ns() - start) / BENCH_ITERATIONS;
+}
+
+static double bench_reference(int (*reference)(char *, size_t, const longmynd_status_t *, uint64_t),
+                              const longmynd_status_t *status)
+{
+    uint64_t start = bench_now_ns();
+    int count;
+
+    for (count = 0; count < BENCH_ITERATIONS; count++) {
+        bench_sink += reference(reference_buffer, sizeof(reference_buffer), status, 1700000000000ULL + count);
+    }
+
+    return (double)(bench_now_ns() - start) / BENCH_ITERATIONS;
+}
+
+int main(void)
+{
+    static longmynd_status_t status;
+    static status_frame_t frame;
+    status_fmt_t fmt;
+    uint64_t start;
+    double text_ns, text_reference_ns, binary_ns;
+    uint32_t seed, mismatches = 0;
+    int count;
+
+    /* Same output as before, over a spread of values */
+    for (seed = 1; seed <= 10000; seed++) {
+        bench_status(&status, seed);
+        status_fmt_init(&fmt, bench_buffer, sizeof(bench_buffer));
+        status_format_json(&fmt, JSON_FORMAT_FULL, 1, &status, seed, false);
+        reference_full(reference_buffer, sizeof(reference_buffer), &status, seed);
+        if (strcmp(bench_buffer, reference_buffer) != 0) mismatches++;
+        status_fmt_init(&fmt, bench_buffer, sizeof(bench_buffer));
+        status_format_json(&fmt, JSON_FORMAT_COMPACT, 1, &status, seed, false);
+        reference_compact(reference_buffer, sizeof(reference_buffer), &status, seed);
+        if (strcmp(bench_buffer, reference_buffer) != 0) mismatches++;
+        status_fmt_init(&fmt, bench_buffer, sizeof(bench_buffer));
+        status_format_json(&fmt, JSON_FORMAT_MINIMAL, 1, &status, seed, false);
+        reference_minimal(reference_buffer, sizeof(reference_buffer), &status, seed);
+        if (strcmp(bench_buffer, reference_buffer) != 0) mismatches++;
+    }
+    printf("Output check: %u mismatches in 30000\n", mismatches);
+
+    bench_status(&status, 1);
+    printf("Per status cycle, %d iterations:\n", BENCH_ITERATIONS);
+    printf("  JSON full       %7.1f ns   (snprintf %7.1f ns)\n", bench_json(JSON_FORMAT_FULL, &status),
+           bench_reference(reference_full, &status));
+    printf("  JSON compact    %7.1f ns   (snprintf %7.1f ns)\n", bench_json(JSON_FORMAT_COMPACT, &status),
+           bench_reference(reference_compact, &status));
+    printf("  JSON minimal    %7.1f ns   (snprintf %7.1f ns)\n", bench_json(JSON_FORMAT_MINIMAL, &status),
+           bench_reference(reference_minimal, &status));
+
+    start = bench_now_ns();
+    for (count = 0; count < BENCH_ITERATIONS; count++) text_cycle(&frame, &status);
+    text_ns = (double)(bench_now_ns() - start) / BENCH_ITERATIONS;
+    start = bench_now_ns();
+    for (count = 0; count < BENCH_ITERATIONS; count++) {
+        reference_text_cycle(reference_buffer, sizeof(reference_buffer), &status);
+    }
+    text_reference_ns = (double)(bench_now_ns() - start) / BENCH_ITERATIONS;
+    printf("  text frame      %7.1f ns   (snprintf %7.1f ns)\n", text_ns, text_reference_ns);
+
+    start = bench_now_ns();
+    for (count = 0; count < BENCH_ITERATIONS; count++) {
+        status_frame_encode_full(&status, &frame);
+        bench_sink += frame.len;
+    }
+    binary_ns = (double)(bench_now_ns() - start) / BENCH_ITERATIONS;
+    printf("  binary keyframe %7.1f ns\n", binary_ns);
+
+    return (mismatches > 0) ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_binary.c                                                             */
+/*    - reference decoder for the binary status format, see status_binary.h                           */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "status_binary.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint16_t status_binary_le16(const uint8_t *p) {
+/* -------------------------------------------------------------------------------------------------- */
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t status_binary_le32(const uint8_t *p) {
+/* -------------------------------------------------------------------------------------------------- */
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int status_binary_frame_length(const uint8_t *data, size_t len, size_t *frame_len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* finds the length of the frame at the start of a byte stream, eg. as read from the status FIFO      */
+/*      *data: the stream                                                                             */
+/*        len: bytes available                                                                        */
+/* *frame_len: set to the length of the first frame                                                   */
+/*     return: STATUS_BINARY_OK, STATUS_BINARY_SHORT if more bytes are needed, or                     */
+/*             STATUS_BINARY_INVALID if the stream is not positioned at a frame                       */
+/* -------------------------------------------------------------------------------------------------- */
+    if (len < 8) return STATUS_BINARY_SHORT;
+    if (status_binary_le32(&data[0]) != STATUS_BINARY_MAGIC) return STATUS_BINARY_INVALID;
+
+    *frame_len = status_binary_le16(&data[6]);
+    if (*frame_len < sizeof(status_binary_header_t) || *frame_len < data[5]) return STATUS_BINARY_INVALID;
+    if (len < *frame_len) return STATUS_BINARY_SHORT;
+
+    return STATUS_BINARY_OK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int status_binary_decode(const uint8_t *frame, size_t len, status_binary_header_t *header,
+                         void (*callback)(const status_binary_field_t *field, void *context), void *context) {
+/* -------------------------------------------------------------------------------------------------- */
+/* checks one frame and hands each of its fields to the callback, in order                            */
+/*    *frame: the frame                                                                               */
+/*       len: its length, eg. a datagram length or from status_binary_frame_length                    */
+/*   *header: filled in with the header, in host order                                                */
+/* *callback: called for each field; field->value points into frame                                   */
+/*  *context: passed to the callback                                                                  */
+/*    return: STATUS_BINARY_OK or STATUS_BINARY_INVALID                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    status_binary_field_t field;
+    size_t frame_len, offset;
+
+    if (status_binary_frame_length(frame, len, &frame_len) != STATUS_BINARY_OK || frame_len != len) {
+        return STATUS_BINARY_INVALID;
+    }
+
+    header->magic = status_binary_le32(&frame[0]);
+    header->version = frame[4];
+    header->header_size = frame[5];
+    header->length = status_binary_le16(&frame[6]);
+    header->sequence = status_binary_le32(&frame[8]);
+    header->flags = status_binary_le32(&frame[12]);
+    if (header->version != STATUS_BINARY_VERSION) return STATUS_BINARY_INVALID;
+
+    for (offset = header->header_size; offset < len; offset += 2 + field.length) {
+        if (offset + 2 > len) return STATUS_BINARY_INVALID;
+        field.id = frame[offset];
+        field.length = frame[offset + 1];
+        field.value = &frame[offset + 2];
+        if (offset + 2 + field.length > len) return STATUS_BINARY_INVALID;
+        callback(&field, context);
+    }
+
+    return STATUS_BINARY_OK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t status_binary_u32(const status_binary_field_t *field) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the value of a 4 byte unsigned field                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    return (field->length >= 4) ? status_binary_le32(field->value) : 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int32_t status_binary_i32(const status_binary_field_t *field) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the value of a 4 byte signed field, ie. STATUS_MER                                                 */
+/* -------------------------------------------------------------------------------------------------- */
+    return (int32_t)status_binary_u32(field);
+}
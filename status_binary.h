@@ -0,0 +1,93 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_binary.h                                                             */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUS_BINARY_H
+#define STATUS_BINARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Binary status format, as sent with longmynd -B and published with -Y. Plain C for clients.         */
+/*                                                                                                    */
+/* Each status update is one frame: a status_binary_header_t, then fields as TLVs of                  */
+/*   uint8_t id; uint8_t length; uint8_t value[length];                                               */
+/* all little-endian. id is the STATUS_ message number used by the text format (see main.h):          */
+/*   - most fields are 4 byte integers, unsigned apart from STATUS_MER which is signed (tenths of dB) */
+/*   - STATUS_SERVICE_NAME and STATUS_SERVICE_PROVIDER_NAME are the bytes of the name, no terminator  */
+/*   - STATUS_CONSTELLATION_I carries all the constellation points, as { int8_t i, q } pairs          */
+/*   - STATUS_ES_PID carries the elementary stream list, as { uint16_t pid, type } pairs              */
+/* Frames only carry the fields that changed, unless STATUS_BINARY_FLAG_KEYFRAME is set. Decoders     */
+/* must skip ids they do not know, and honour header_size so that the header can grow.                */
+/* On a FIFO, frames follow one another and length gives the start of the next; over UDP there is one */
+/* frame per datagram.                                                                                */
+
+#define STATUS_BINARY_MAGIC   0x54534d4c /* "LMST" */
+#define STATUS_BINARY_VERSION 1
+
+#define STATUS_BINARY_FLAG_KEYFRAME 0x0001
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t header_size;
+    uint16_t length;   /* of the whole frame, header included */
+    uint32_t sequence; /* counts the frames sent, so that a gap shows a lost frame */
+    uint32_t flags;
+} status_binary_header_t;
+
+/* Shared memory status mailbox (-Y): always holds the latest update, as a keyframe.                  */
+/* seq is odd while longmynd is writing; a reader copies frame[0..length) and uses the copy only if   */
+/* seq was even and unchanged across the copy. seq is also a futex that is woken on every update.     */
+
+#define STATUS_SHM_MAGIC      0x4d534d4c /* "LMSM" */
+#define STATUS_SHM_VERSION    1
+#define STATUS_SHM_FRAME_MAX  4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t writer_pid;
+    uint32_t seq;
+    uint32_t length;
+    uint32_t closed;
+    uint64_t updated_monotonic_ns;
+    uint8_t frame[STATUS_SHM_FRAME_MAX];
+} status_shm_t;
+
+/* Reference decoder, status_binary.c */
+
+#define STATUS_BINARY_OK       0
+#define STATUS_BINARY_SHORT    1 /* not a whole frame yet */
+#define STATUS_BINARY_INVALID -1
+
+typedef struct {
+    uint8_t id;
+    uint8_t length;
+    const uint8_t *value;
+} status_binary_field_t;
+
+int status_binary_frame_length(const uint8_t *data, size_t len, size_t *frame_len);
+int status_binary_decode(const uint8_t *frame, size_t len, status_binary_header_t *header,
+                         void (*callback)(const status_binary_field_t *field, void *context), void *context);
+uint32_t status_binary_u32(const status_binary_field_t *field);
+int32_t status_binary_i32(const status_binary_field_t *field);
+
+#endif
@@ -0,0 +1,291 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_check.c                                                              */
+/*    - checks binary status frames decode back to the status they were encoded from                  */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "main.h"
+#include "errors.h"
+#include "status.h"
+#include "status_binary.h"
+
+#define CHECK(cond) check_result((cond), #cond, __LINE__)
+
+/* What a frame decoded to, and which ids it carried */
+typedef struct {
+    longmynd_status_t status;
+    uint64_t seen;
+    uint32_t constellation_points;
+    uint32_t es_entries;
+} check_decoded_t;
+
+static longmynd_status_t check_status;
+static status_frame_t check_frame;
+static uint32_t check_failures;
+static uint32_t check_count;
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void check_result(bool ok, const char *what, int line)
+{
+    check_count++;
+    if (!ok) {
+        printf("FAIL: line %i: %s\n", line, what);
+        check_failures++;
+    }
+}
+
+/* status_all_write() targets, as the frame sinks in status_sink.c use them */
+static uint8_t check_frame_write(uint8_t message, uint32_t data, bool *ready)
+{
+    (void)ready;
+    status_frame_add(&check_frame, message, data);
+    return ERROR_NONE;
+}
+
+static uint8_t check_frame_string_write(uint8_t message, char *data, bool *ready)
+{
+    (void)ready;
+    status_frame_add_string(&check_frame, message, data);
+    return ERROR_NONE;
+}
+
+static void check_field(const status_binary_field_t *field, void *context)
+{
+    check_decoded_t *decoded = (check_decoded_t *)context;
+    longmynd_status_t *status = &decoded->status;
+    uint32_t value = status_binary_u32(field);
+
+    decoded->seen |= 1ULL << field->id;
+
+    switch (field->id) {
+        case STATUS_STATE:                  status->state = value; break;
+        case STATUS_LNA_GAIN:               status->lna_gain = value; break;
+        case STATUS_AGC1_GAIN:              status->agc1_gain = value; break;
+        case STATUS_AGC2_GAIN:              status->agc2_gain = value; break;
+        case STATUS_POWER_I:                status->power_i = value; break;
+        case STATUS_POWER_Q:                status->power_q = value; break;
+        case STATUS_PUNCTURE_RATE:          status->puncture_rate = value; break;
+        case STATUS_CARRIER_FREQUENCY:      status->frequency_requested = value; break;
+        case STATUS_LNB_SUPPLY:             status->polarisation_supply = value; break;
+        case STATUS_LNB_POLARISATION_H:     status->polarisation_horizontal = value; break;
+        case STATUS_SYMBOL_RATE:            status->symbolrate = value; break;
+        case STATUS_VITERBI_ERROR_RATE:     status->viterbi_error_rate = value; break;
+        case STATUS_BER:                    status->bit_error_rate = value; break;
+        case STATUS_MER:                    status->modulation_error_rate = status_binary_i32(field); break;
+        case STATUS_ERRORS_BCH_UNCORRECTED: status->errors_bch_uncorrected = value; break;
+        case STATUS_ERRORS_BCH_COUNT:       status->errors_bch_count = value; break;
+        case STATUS_ERRORS_LDPC_COUNT:      status->errors_ldpc_count = value; break;
+        case STATUS_TS_NULL_PERCENTAGE:     status->ts_null_percentage = value; break;
+        case STATUS_MODCOD:                 status->modcod = value; break;
+        case STATUS_SHORT_FRAME:            status->short_frame = value; break;
+        case STATUS_PILOTS:                 status->pilots = value; break;
+        case STATUS_MATYPE1:                status->matype1 = value; break;
+        case STATUS_MATYPE2:                status->matype2 = value; break;
+        case STATUS_ROLLOFF:                status->rolloff = value; break;
+        case STATUS_SERVICE_NAME:
+            memcpy(status->service_name, field->value, field->length);
+            status->service_name[field->length] = '\0';
+            break;
+        case STATUS_SERVICE_PROVIDER_NAME:
+            memcpy(status->service_provider_name, field->value, field->length);
+            status->service_provider_name[field->length] = '\0';
+            break;
+        case STATUS_CONSTELLATION_I:
+            for (uint32_t i = 0; i + 2 <= field->length && decoded->constellation_points < NUM_CONSTELLATIONS; i += 2) {
+                status->constellation[decoded->constellation_points][0] = (int8_t)field->value[i];
+                status->constellation[decoded->constellation_points][1] = (int8_t)field->value[i + 1];
+                decoded->constellation_points++;
+            }
+            break;
+        case STATUS_ES_PID:
+            for (uint32_t i = 0; i + 4 <= field->length && decoded->es_entries < NUM_ELEMENT_STREAMS; i += 4) {
+                status->ts_elementary_streams[decoded->es_entries][0] = field->value[i] | (field->value[i + 1] << 8);
+                status->ts_elementary_streams[decoded->es_entries][1] = field->value[i + 2] | (field->value[i + 3] << 8);
+                decoded->es_entries++;
+            }
+            break;
+    }
+}
+
+/* Decodes the frame, checking its header, and returns what it carried */
+static void check_decode(const uint8_t *frame, uint32_t len, uint32_t sequence, bool keyframe, check_decoded_t *decoded)
+{
+    status_binary_header_t header;
+
+    memset(decoded, 0, sizeof(check_decoded_t));
+    CHECK(len >= sizeof(status_binary_header_t));
+    CHECK(memcmp(frame, "LMST", 4) == 0);
+    CHECK(status_binary_decode(frame, len, &header, check_field, decoded) == STATUS_BINARY_OK);
+    CHECK(header.magic == STATUS_BINARY_MAGIC);
+    CHECK(header.version == STATUS_BINARY_VERSION);
+    CHECK(header.header_size == sizeof(status_binary_header_t));
+    CHECK(header.length == len);
+    CHECK(header.sequence == sequence);
+    CHECK(((header.flags & STATUS_BINARY_FLAG_KEYFRAME) != 0) == keyframe);
+}
+
+/* Every value a keyframe carries came back as it went in */
+static void check_full(const check_decoded_t *decoded)
+{
+    const longmynd_status_t *in = &check_status;
+    const longmynd_status_t *out = &decoded->status;
+
+    CHECK(out->state == in->state);
+    CHECK(out->lna_gain == in->lna_gain);
+    CHECK(out->agc1_gain == in->agc1_gain);
+    CHECK(out->agc2_gain == in->agc2_gain);
+    CHECK(out->power_i == in->power_i);
+    CHECK(out->power_q == in->power_q);
+    CHECK(out->puncture_rate == in->puncture_rate);
+    CHECK(out->frequency_requested == in->frequency_requested);
+    CHECK(out->polarisation_supply == in->polarisation_supply);
+    CHECK(out->polarisation_horizontal == in->polarisation_horizontal);
+    CHECK(out->symbolrate == in->symbolrate);
+    CHECK(out->viterbi_error_rate == in->viterbi_error_rate);
+    CHECK(out->bit_error_rate == in->bit_error_rate);
+    CHECK(out->modulation_error_rate == in->modulation_error_rate);
+    CHECK(out->errors_bch_uncorrected == in->errors_bch_uncorrected);
+    CHECK(out->errors_bch_count == in->errors_bch_count);
+    CHECK(out->errors_ldpc_count == in->errors_ldpc_count);
+    CHECK(out->ts_null_percentage == in->ts_null_percentage);
+    CHECK(out->modcod == in->modcod);
+    CHECK(out->short_frame == in->short_frame);
+    CHECK(out->pilots == in->pilots);
+    CHECK(out->matype1 == in->matype1);
+    CHECK(out->matype2 == in->matype2);
+    CHECK(out->rolloff == in->rolloff);
+    CHECK(strcmp(out->service_name, in->service_name) == 0);
+    CHECK(strcmp(out->service_provider_name, in->service_provider_name) == 0);
+    CHECK(decoded->constellation_points == NUM_CONSTELLATIONS);
+    CHECK(memcmp(out->constellation, in->constellation, sizeof(in->constellation)) == 0);
+    CHECK(decoded->es_entries == 3);
+    CHECK(memcmp(out->ts_elementary_streams, in->ts_elementary_streams, 3 * sizeof(in->ts_elementary_streams[0])) == 0);
+}
+
+static void check_fill_status(void)
+{
+    longmynd_status_t *status = &check_status;
+
+    memset(status, 0, sizeof(longmynd_status_t));
+    status->state = STATE_DEMOD_S2;
+    status->lna_ok = true;
+    status->lna_gain = 0x1234;
+    status->agc1_gain = 0x2345;
+    status->agc2_gain = 0x3456;
+    status->power_i = 101;
+    status->power_q = 102;
+    status->frequency_requested = 741500;
+    status->polarisation_supply = true;
+    status->polarisation_horizontal = true;
+    status->symbolrate = 1500000;
+    status->viterbi_error_rate = 7;
+    status->bit_error_rate = 1234567;
+    status->modulation_error_rate = -25;
+    status->errors_bch_uncorrected = true;
+    status->errors_bch_count = 99;
+    status->errors_ldpc_count = 100000;
+    for (int i = 0; i < NUM_CONSTELLATIONS; i++) {
+        status->constellation[i][0] = (int8_t)(i * 7 - 50);
+        status->constellation[i][1] = (int8_t)(60 - i * 9);
+    }
+    status->puncture_rate = 5;
+    status->modcod = 11;
+    status->matype1 = 0x72;
+    status->matype2 = 0x00;
+    status->short_frame = true;
+    status->pilots = true;
+    status->rolloff = 2;
+    strcpy(status->service_name, "GB3HV");
+    strcpy(status->service_provider_name, "BATC");
+    status->ts_null_percentage = 12;
+    status->ts_elementary_streams[0][0] = 0x100;
+    status->ts_elementary_streams[0][1] = 0x1b;
+    status->ts_elementary_streams[1][0] = 0x101;
+    status->ts_elementary_streams[1][1] = 0x0f;
+    status->ts_elementary_streams[2][0] = 0x1ffe;
+    status->ts_elementary_streams[2][1] = 0x24;
+}
+
+int main(void)
+{
+    static status_delta_t delta;
+    check_decoded_t decoded;
+    char header[STATUS_FRAME_HEADER_MAX];
+    uint8_t joined[STATUS_FRAME_MAX];
+    uint32_t header_len, body_offset;
+    bool ready = true;
+
+    check_fill_status();
+    status_frame_set_format(STATUS_FORMAT_BINARY);
+
+    /* A keyframe of the whole snapshot, as for the shared memory mailbox */
+    check_frame.sequence = 41;
+    status_frame_encode_full(&check_status, &check_frame);
+    check_decode((uint8_t *)check_frame.buffer, check_frame.len, 41, true, &decoded);
+    check_full(&decoded);
+    status_frame_sent(&check_frame);
+
+    /* The first update on a stream is a keyframe too, built value by value as the sinks build it */
+    status_delta_init(STATUS_DEFAULT_KEYFRAME_SECONDS);
+    status_delta_select(&delta);
+    status_all_write(&check_status, check_frame_write, check_frame_string_write, &ready);
+    check_decode((uint8_t *)check_frame.buffer, check_frame.len, 42, true, &decoded);
+    check_full(&decoded);
+    status_frame_sent(&check_frame);
+
+    /* A delta carries the state and what changed, and nothing else */
+    check_status.modulation_error_rate = 87;
+    strcpy(check_status.service_name, "GB3HV-2");
+    check_status.ts_elementary_streams[1][0] = 0x102;
+    status_all_write(&check_status, check_frame_write, check_frame_string_write, &ready);
+    check_decode((uint8_t *)check_frame.buffer, check_frame.len, 43, false, &decoded);
+    CHECK(decoded.seen == ((1ULL << STATUS_STATE) | (1ULL << STATUS_MER) | (1ULL << STATUS_SERVICE_NAME)
+                           | (1ULL << STATUS_ES_PID)));
+    CHECK(decoded.status.state == check_status.state);
+    CHECK(decoded.status.modulation_error_rate == 87);
+    CHECK(strcmp(decoded.status.service_name, "GB3HV-2") == 0);
+    CHECK(decoded.es_entries == 3);
+    CHECK(memcmp(decoded.status.ts_elementary_streams, check_status.ts_elementary_streams,
+                 3 * sizeof(check_status.ts_elementary_streams[0])) == 0);
+
+    /* Each sink puts its own sequence in the header it sends the shared body behind */
+    header_len = status_frame_header(&check_frame, 7, header, &body_offset);
+    CHECK(header_len == sizeof(status_binary_header_t) && body_offset == header_len);
+    memcpy(joined, header, header_len);
+    memcpy(&joined[header_len], &check_frame.buffer[body_offset], check_frame.len - body_offset);
+    check_decode(joined, check_frame.len, 7, false, &decoded);
+    CHECK(decoded.status.modulation_error_rate == 87);
+    status_frame_sent(&check_frame);
+
+    printf("status_check: %u of %u checks passed\n", check_count - check_failures, check_count);
+
+    return (check_failures == 0) ? 0 : 1;
+}
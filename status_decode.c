@@ -0,0 +1,200 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_decode.c                                                             */
+/*    - example binary status reader, prints each update as $n,m lines like the text format           */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/futex.h>
+#include "status_binary.h"
+
+/* The message numbers that need more than a plain integer, as in main.h */
+#define STATUS_CONSTELLATION_I        7
+#define STATUS_CONSTELLATION_Q        8
+#define STATUS_MER                   12
+#define STATUS_SERVICE_NAME          13
+#define STATUS_SERVICE_PROVIDER_NAME 14
+#define STATUS_ES_PID                16
+#define STATUS_ES_TYPE               17
+
+static void print_field(const status_binary_field_t *field, void *context)
+{
+    uint32_t i;
+
+    (void)context;
+    switch (field->id) {
+        case STATUS_CONSTELLATION_I:
+            for (i = 0; i + 1 < field->length; i += 2) {
+                printf("$%i,%i\n$%i,%i\n", STATUS_CONSTELLATION_I, (int8_t)field->value[i],
+                       STATUS_CONSTELLATION_Q, (int8_t)field->value[i + 1]);
+            }
+            break;
+        case STATUS_ES_PID:
+            for (i = 0; i + 3 < field->length; i += 4) {
+                printf("$%i,%u\n$%i,%u\n", STATUS_ES_PID, field->value[i] | (field->value[i + 1] << 8),
+                       STATUS_ES_TYPE, field->value[i + 2] | (field->value[i + 3] << 8));
+            }
+            break;
+        case STATUS_SERVICE_NAME:
+        case STATUS_SERVICE_PROVIDER_NAME:
+            printf("$%i,%.*s\n", field->id, field->length, (const char *)field->value);
+            break;
+        case STATUS_MER:
+            printf("$%i,%i\n", field->id, status_binary_i32(field));
+            break;
+        default:
+            if (field->length == 4) printf("$%i,%u\n", field->id, status_binary_u32(field));
+            break;
+    }
+}
+
+static int print_frame(const uint8_t *frame, size_t len)
+{
+    status_binary_header_t header;
+
+    if (status_binary_decode(frame, len, &header, print_field, NULL) != STATUS_BINARY_OK) {
+        fprintf(stderr, "Invalid status frame of %zu bytes\n", len);
+        return -1;
+    }
+    printf("# sequence %u%s\n", header.sequence, (header.flags & STATUS_BINARY_FLAG_KEYFRAME) ? " keyframe" : "");
+    fflush(stdout);
+
+    return 0;
+}
+
+static int read_fifo(const char *path)
+{
+    static uint8_t buffer[2 * 65536];
+    size_t used = 0, frame_len;
+    ssize_t got;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    for (;;) {
+        got = read(fd, &buffer[used], sizeof(buffer) - used);
+        if (got <= 0) break;
+        used += got;
+
+        while ((ret = status_binary_frame_length(buffer, used, &frame_len)) == STATUS_BINARY_OK) {
+            print_frame(buffer, frame_len);
+            memmove(buffer, &buffer[frame_len], used - frame_len);
+            used -= frame_len;
+        }
+        if (ret == STATUS_BINARY_INVALID) {
+            /* Lost our place, drop a byte at a time until a frame starts */
+            memmove(buffer, &buffer[1], used - 1);
+            used--;
+        }
+    }
+    close(fd);
+
+    return 0;
+}
+
+static int read_udp(int port)
+{
+    static uint8_t buffer[65536];
+    struct sockaddr_in addr;
+    ssize_t got;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Failed to listen on UDP port %i: %s\n", port, strerror(errno));
+        return 1;
+    }
+
+    for (;;) {
+        got = recv(sock, buffer, sizeof(buffer), 0);
+        if (got < 0) break;
+        print_frame(buffer, got);
+    }
+    close(sock);
+
+    return 0;
+}
+
+static int read_shm(const char *name)
+{
+    static uint8_t frame[STATUS_SHM_FRAME_MAX];
+    struct timespec timeout = { 1, 0 };
+    status_shm_t *shm;
+    uint32_t seq, last_seq = 0, length;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    shm = (fd < 0) ? MAP_FAILED : (status_shm_t *)mmap(NULL, sizeof(status_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (fd >= 0) close(fd);
+    if (shm == MAP_FAILED || __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATUS_SHM_MAGIC
+        || shm->version != STATUS_SHM_VERSION) {
+        fprintf(stderr, "Failed to attach to status mailbox %s\n", name);
+        return 1;
+    }
+
+    while (!__atomic_load_n(&shm->closed, __ATOMIC_ACQUIRE)) {
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq == last_seq || (seq & 1)) {
+            syscall(SYS_futex, &shm->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+            continue;
+        }
+
+        length = shm->length;
+        if (length > STATUS_SHM_FRAME_MAX) continue;
+        memcpy(frame, shm->frame, length);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        last_seq = seq;
+        print_frame(frame, length);
+    }
+    munmap(shm, sizeof(status_shm_t));
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "fifo") == 0) return read_fifo(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "udp") == 0) return read_udp(atoi(argv[2]));
+    if (argc == 3 && strcmp(argv[1], "shm") == 0) return read_shm(argv[2]);
+
+    fprintf(stderr, "Usage: %s fifo <path> | udp <port> | shm <name>\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,371 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_format.c                                                             */
+/*    - allocation free text and JSON formatting of the status, shared by the status sinks            */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "main.h"
+#include "json_output.h"
+#include "status_format.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static const char status_fmt_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_init(status_fmt_t *fmt, char *buffer, uint32_t size) {
+/* -------------------------------------------------------------------------------------------------- */
+/*    *fmt: the formatter                                                                             */
+/* *buffer: where the output goes, owned by the caller and normally static to the sink                */
+/*    size: the size of buffer, including space for the NUL                                           */
+/* -------------------------------------------------------------------------------------------------- */
+    fmt->buffer = buffer;
+    fmt->size = size;
+    fmt->len = 0;
+    fmt->truncated = (size == 0);
+    if (size > 0) buffer[0] = '\0';
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_mem(status_fmt_t *fmt, const char *data, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (fmt->truncated || fmt->size - fmt->len <= len) {
+        fmt->truncated = true;
+        return;
+    }
+    memcpy(&fmt->buffer[fmt->len], data, len);
+    fmt->len += len;
+    fmt->buffer[fmt->len] = '\0';
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_char(status_fmt_t *fmt, char c) {
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_mem(fmt, &c, 1);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_str(status_fmt_t *fmt, const char *str) {
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_mem(fmt, str, strlen(str));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_u64(status_fmt_t *fmt, uint64_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* decimal, two digits at a time from the right                                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    char digits[20];
+    char *p = &digits[sizeof(digits)];
+    uint32_t pair;
+
+    while (value >= 100) {
+        pair = (uint32_t)(value % 100) * 2;
+        value /= 100;
+        *--p = status_fmt_digit_pairs[pair + 1];
+        *--p = status_fmt_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        pair = (uint32_t)value * 2;
+        *--p = status_fmt_digit_pairs[pair + 1];
+        *--p = status_fmt_digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    status_fmt_mem(fmt, p, (uint32_t)(&digits[sizeof(digits)] - p));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_u32(status_fmt_t *fmt, uint32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_u64(fmt, value);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_i32(status_fmt_t *fmt, int32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (value < 0) {
+        status_fmt_char(fmt, '-');
+        status_fmt_u64(fmt, (uint64_t)(-(int64_t)value));
+    } else {
+        status_fmt_u64(fmt, (uint64_t)value);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_hex(status_fmt_t *fmt, uint32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* lower case, no leading zeros, as %x                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    char digits[8];
+    char *p = &digits[sizeof(digits)];
+
+    do {
+        *--p = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+
+    status_fmt_mem(fmt, p, (uint32_t)(&digits[sizeof(digits)] - p));
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_fixed(status_fmt_t *fmt, int64_t value, uint8_t decimals) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a fixed point number, eg. value -15 with 1 decimal is -1.5                                         */
+/*   value: the number in units of 10^-decimals                                                       */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t magnitude = (value < 0) ? (uint64_t)(-value) : (uint64_t)value;
+    uint64_t scale = 1;
+    uint64_t fraction;
+    char digits[20];
+    uint8_t count;
+
+    for (count = 0; count < decimals; count++) scale *= 10;
+
+    if (value < 0) status_fmt_char(fmt, '-');
+    status_fmt_u64(fmt, magnitude / scale);
+    if (decimals == 0) return;
+
+    status_fmt_char(fmt, '.');
+    fraction = magnitude % scale;
+    for (count = decimals; count > 0; count--) {
+        digits[count - 1] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    status_fmt_mem(fmt, digits, decimals);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_fmt_json_string(status_fmt_t *fmt, const char *str) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a quoted JSON string, escaped as needed                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    const char *run = str;
+    char escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+
+    status_fmt_char(fmt, '"');
+    for (; *str != '\0'; str++) {
+        if (*str != '"' && *str != '\\' && (uint8_t)*str >= 0x20) continue;
+
+        status_fmt_mem(fmt, run, (uint32_t)(str - run));
+        run = str + 1;
+        if ((uint8_t)*str >= 0x20) {
+            escape[1] = *str;
+            status_fmt_mem(fmt, escape, 2);
+            escape[1] = 'u';
+        } else {
+            escape[4] = "0123456789abcdef"[(uint8_t)*str >> 4];
+            escape[5] = "0123456789abcdef"[*str & 0xf];
+            status_fmt_mem(fmt, escape, 6);
+        }
+    }
+    status_fmt_mem(fmt, run, (uint32_t)(str - run));
+    status_fmt_char(fmt, '"');
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static int64_t status_format_actual_frequency(const longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the tuned frequency in tenths of KHz, rounded as %.1f of the double the JSON used to be printed    */
+/* from. Only an exact tie in Hz needs that double: %.1f rounds what the double holds, which is just  */
+/* above or below the tie, or on it and rounded to even                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    int64_t hz = (int64_t)status->frequency_requested * 1000 + status->frequency_offset;
+    int64_t tenths = (hz >= 0) ? hz / 100 : -((-hz + 99) / 100); /* rounded down */
+    double khz, above;
+
+    if (hz - tenths * 100 != 50) return (hz >= 0) ? (hz + 50) / 100 : (hz - 50) / 100;
+
+    khz = status->frequency_requested + (status->frequency_offset / 1000.0);
+    above = fma(khz, 1000.0, -(double)hz); /* exact, so its sign says which side of the tie khz is */
+    if (above > 0 || (above == 0 && (tenths & 1) != 0)) tenths++;
+
+    return tenths;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_format_json(status_fmt_t *fmt, json_format_t format, uint8_t tuner, const longmynd_status_t *status,
+                        uint64_t timestamp, bool include_constellation) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the demodulator status as one JSON object, in the layouts documented in json_output.h              */
+/*                  *fmt: where the JSON goes                                                         */
+/*                format: full, compact or minimal                                                    */
+/*                 tuner: tuner number                                                                */
+/*               *status: a consistent snapshot                                                       */
+/*             timestamp: milliseconds since the epoch                                                */
+/* include_constellation: full format only, adds the constellation points                             */
+/* -------------------------------------------------------------------------------------------------- */
+    bool is_locked = (status->demod_state == 2 || status->demod_state == 3);
+    uint8_t count;
+
+    switch (format) {
+        case JSON_FORMAT_FULL:
+            status_fmt_str(fmt, "{\n  \"timestamp\": ");
+            status_fmt_u64(fmt, timestamp);
+            status_fmt_str(fmt, ",\n  \"tuner\": ");
+            status_fmt_u32(fmt, tuner);
+            status_fmt_str(fmt, ",\n  \"signal\": {\n    \"power_i\": ");
+            status_fmt_u32(fmt, status->power_i);
+            status_fmt_str(fmt, ",\n    \"power_q\": ");
+            status_fmt_u32(fmt, status->power_q);
+            status_fmt_str(fmt, ",\n    \"agc1_gain\": ");
+            status_fmt_u32(fmt, status->agc1_gain);
+            status_fmt_str(fmt, ",\n    \"agc2_gain\": ");
+            status_fmt_u32(fmt, status->agc2_gain);
+            status_fmt_str(fmt, ",\n    \"lna_gain\": ");
+            status_fmt_u32(fmt, status->lna_gain);
+            status_fmt_str(fmt, "\n  },\n  \"lock\": {\n    \"demod_state\": ");
+            status_fmt_u32(fmt, status->demod_state);
+            status_fmt_str(fmt, ",\n    \"state_name\": ");
+            status_fmt_json_string(fmt, json_get_demod_state_name(status->demod_state));
+            status_fmt_str(fmt, ",\n    \"locked\": ");
+            status_fmt_str(fmt, is_locked ? "true" : "false");
+            status_fmt_str(fmt, "\n  },\n  \"errors\": {\n    \"viterbi_rate\": ");
+            status_fmt_u32(fmt, status->viterbi_error_rate);
+            status_fmt_str(fmt, ",\n    \"ber\": ");
+            status_fmt_u32(fmt, status->bit_error_rate);
+            status_fmt_str(fmt, ",\n    \"mer\": ");
+            status_fmt_i32(fmt, status->modulation_error_rate);
+            status_fmt_str(fmt, ",\n    \"bch_uncorrected\": ");
+            status_fmt_str(fmt, status->errors_bch_uncorrected ? "true" : "false");
+            status_fmt_str(fmt, ",\n    \"bch_count\": ");
+            status_fmt_u32(fmt, status->errors_bch_count);
+            status_fmt_str(fmt, ",\n    \"ldpc_count\": ");
+            status_fmt_u32(fmt, status->errors_ldpc_count);
+            status_fmt_str(fmt, "\n  },\n  \"frequency\": {\n    \"requested\": ");
+            status_fmt_u32(fmt, status->frequency_requested);
+            status_fmt_str(fmt, ",\n    \"offset\": ");
+            status_fmt_i32(fmt, status->frequency_offset);
+            status_fmt_str(fmt, ",\n    \"actual\": ");
+            status_fmt_fixed(fmt, status_format_actual_frequency(status), 1);
+            status_fmt_str(fmt, "\n  },\n  \"modulation\": {\n    \"symbol_rate\": ");
+            status_fmt_u32(fmt, status->symbolrate);
+            status_fmt_str(fmt, ",\n    \"modcod\": ");
+            status_fmt_u32(fmt, status->modcod);
+            status_fmt_str(fmt, ",\n    \"short_frame\": ");
+            status_fmt_str(fmt, status->short_frame ? "true" : "false");
+            status_fmt_str(fmt, ",\n    \"pilots\": ");
+            status_fmt_str(fmt, status->pilots ? "true" : "false");
+            status_fmt_str(fmt, ",\n    \"rolloff\": ");
+            status_fmt_u32(fmt, status->rolloff);
+            status_fmt_str(fmt, "\n  }");
+            if (include_constellation) {
+                status_fmt_str(fmt, ",\n  \"constellation\": [");
+                for (count = 0; count < NUM_CONSTELLATIONS; count++) {
+                    status_fmt_str(fmt, count ? ",[" : "[");
+                    status_fmt_i32(fmt, status->constellation[count][0]);
+                    status_fmt_char(fmt, ',');
+                    status_fmt_i32(fmt, status->constellation[count][1]);
+                    status_fmt_char(fmt, ']');
+                }
+                status_fmt_char(fmt, ']');
+            }
+            status_fmt_str(fmt, "\n}");
+            break;
+
+        case JSON_FORMAT_COMPACT:
+            status_fmt_str(fmt, "{\"ts\":");
+            status_fmt_u64(fmt, timestamp);
+            status_fmt_str(fmt, ",\"t\":");
+            status_fmt_u32(fmt, tuner);
+            status_fmt_str(fmt, ",\"pi\":");
+            status_fmt_u32(fmt, status->power_i);
+            status_fmt_str(fmt, ",\"pq\":");
+            status_fmt_u32(fmt, status->power_q);
+            status_fmt_str(fmt, ",\"a1\":");
+            status_fmt_u32(fmt, status->agc1_gain);
+            status_fmt_str(fmt, ",\"a2\":");
+            status_fmt_u32(fmt, status->agc2_gain);
+            status_fmt_str(fmt, ",\"lna\":");
+            status_fmt_u32(fmt, status->lna_gain);
+            status_fmt_str(fmt, ",\"ds\":");
+            status_fmt_u32(fmt, status->demod_state);
+            status_fmt_str(fmt, ",\"lck\":");
+            status_fmt_str(fmt, is_locked ? "true" : "false");
+            status_fmt_str(fmt, ",\"vit\":");
+            status_fmt_u32(fmt, status->viterbi_error_rate);
+            status_fmt_str(fmt, ",\"ber\":");
+            status_fmt_u32(fmt, status->bit_error_rate);
+            status_fmt_str(fmt, ",\"mer\":");
+            status_fmt_i32(fmt, status->modulation_error_rate);
+            status_fmt_str(fmt, ",\"freq\":");
+            status_fmt_fixed(fmt, status_format_actual_frequency(status), 1);
+            status_fmt_str(fmt, ",\"sr\":");
+            status_fmt_u32(fmt, status->symbolrate);
+            status_fmt_str(fmt, ",\"mc\":");
+            status_fmt_u32(fmt, status->modcod);
+            status_fmt_char(fmt, '}');
+            break;
+
+        case JSON_FORMAT_MINIMAL:
+            status_fmt_str(fmt, "{\"ts\":");
+            status_fmt_u64(fmt, timestamp);
+            status_fmt_str(fmt, ",\"t\":");
+            status_fmt_u32(fmt, tuner);
+            status_fmt_str(fmt, ",\"lck\":");
+            status_fmt_str(fmt, is_locked ? "true" : "false");
+            status_fmt_str(fmt, ",\"mer\":");
+            status_fmt_i32(fmt, status->modulation_error_rate);
+            status_fmt_str(fmt, ",\"freq\":");
+            status_fmt_u32(fmt, status->frequency_requested);
+            status_fmt_str(fmt, ",\"sr\":");
+            status_fmt_u32(fmt, status->symbolrate);
+            status_fmt_char(fmt, '}');
+            break;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_format_line(status_fmt_t *fmt, uint8_t message, int32_t value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* one $n,m status line                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_char(fmt, '$');
+    status_fmt_u32(fmt, message);
+    status_fmt_char(fmt, ',');
+    status_fmt_i32(fmt, value);
+    status_fmt_char(fmt, '\n');
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_format_line_string(status_fmt_t *fmt, uint8_t message, const char *value) {
+/* -------------------------------------------------------------------------------------------------- */
+    status_fmt_char(fmt, '$');
+    status_fmt_u32(fmt, message);
+    status_fmt_char(fmt, ',');
+    status_fmt_str(fmt, value);
+    status_fmt_char(fmt, '\n');
+}
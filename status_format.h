@@ -0,0 +1,57 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_format.h                                                             */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUS_FORMAT_H
+#define STATUS_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+#include "json_output.h"
+
+/* Appends text to a caller's buffer without allocating, and formats numbers without printf or the    */
+/* locale. Writes past the end are dropped and mark the output truncated; the buffer is always left   */
+/* NUL terminated.                                                                                    */
+typedef struct {
+    char *buffer;
+    uint32_t size;
+    uint32_t len;
+    bool truncated;
+} status_fmt_t;
+
+void status_fmt_init(status_fmt_t *fmt, char *buffer, uint32_t size);
+void status_fmt_char(status_fmt_t *fmt, char c);
+void status_fmt_mem(status_fmt_t *fmt, const char *data, uint32_t len);
+void status_fmt_str(status_fmt_t *fmt, const char *str);
+void status_fmt_u64(status_fmt_t *fmt, uint64_t value);
+void status_fmt_u32(status_fmt_t *fmt, uint32_t value);
+void status_fmt_i32(status_fmt_t *fmt, int32_t value);
+void status_fmt_hex(status_fmt_t *fmt, uint32_t value);
+void status_fmt_fixed(status_fmt_t *fmt, int64_t value, uint8_t decimals);
+void status_fmt_json_string(status_fmt_t *fmt, const char *str);
+
+/* The status formats built from a snapshot */
+void status_format_json(status_fmt_t *fmt, json_format_t format, uint8_t tuner, const longmynd_status_t *status,
+                        uint64_t timestamp, bool include_constellation);
+void status_format_line(status_fmt_t *fmt, uint8_t message, int32_t value);
+void status_format_line_string(status_fmt_t *fmt, uint8_t message, const char *value);
+
+#endif
@@ -0,0 +1,153 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_shm.c                                                                */
+/*    - keeps the latest binary status keyframe in a POSIX shared memory mailbox, see status_binary.h */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "errors.h"
+#include "status.h"
+#include "status_binary.h"
+#include "status_shm.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static status_shm_t *status_shm = NULL;
+static status_frame_t status_shm_frame;
+static char status_shm_name[128];
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void status_shm_wake(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    syscall(SYS_futex, &status_shm->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_shm_publish(const longmynd_status_t *status) {
+/* -------------------------------------------------------------------------------------------------- */
+/* replaces the mailbox contents with a full binary keyframe of the status                            */
+/*  *status: a consistent snapshot, as taken by status_snapshot()                                     */
+/* -------------------------------------------------------------------------------------------------- */
+    struct timespec now;
+    uint32_t seq;
+
+    if (status_shm == NULL) return;
+
+    status_frame_encode_full(status, &status_shm_frame);
+    if (status_shm_frame.len == 0 || status_shm_frame.len > STATUS_SHM_FRAME_MAX) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    seq = status_shm->seq;
+    __atomic_store_n(&status_shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(status_shm->frame, status_shm_frame.buffer, status_shm_frame.len);
+    status_shm->length = status_shm_frame.len;
+    status_shm->updated_monotonic_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    __atomic_store_n(&status_shm->seq, seq + 2, __ATOMIC_RELEASE);
+    status_frame_sent(&status_shm_frame);
+
+    status_shm_wake();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_shm_init(char *name) {
+/* -------------------------------------------------------------------------------------------------- */
+/* creates (or recreates) the shared memory status mailbox                                            */
+/*   *name: POSIX shared memory name, eg. /longmynd_status                                            */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    int fd;
+
+    strncpy(status_shm_name, name, sizeof(status_shm_name) - 1);
+
+    /* Start from a fresh object, readers still attached to an old one will see it closed */
+    shm_unlink(status_shm_name);
+    fd = shm_open(status_shm_name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0 || ftruncate(fd, sizeof(status_shm_t)) != 0) {
+        printf("ERROR: status shm_open %s (error: %s)\n", status_shm_name, strerror(errno));
+        err=ERROR_STATUS_SHM_INIT;
+    }
+
+    if (err==ERROR_NONE) {
+        status_shm = (status_shm_t *)mmap(NULL, sizeof(status_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (status_shm == MAP_FAILED) {
+            printf("ERROR: status shm mmap (error: %s)\n", strerror(errno));
+            status_shm = NULL;
+            err=ERROR_STATUS_SHM_INIT;
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    if (err==ERROR_NONE) {
+        /* ftruncate has zeroed everything else */
+        status_shm->version = STATUS_SHM_VERSION;
+        status_shm->writer_pid = getpid();
+        /* Readers check the magic last */
+        __atomic_store_n(&status_shm->magic, STATUS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+        printf("Flow: Status mailbox %s\n", status_shm_name);
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_shm_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* marks the mailbox closed, wakes any readers so they notice, and removes the name                   */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (status_shm == NULL) return ERROR_NONE;
+
+    __atomic_store_n(&status_shm->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&status_shm->seq, 2, __ATOMIC_RELEASE);
+    status_shm_wake();
+
+    munmap(status_shm, sizeof(status_shm_t));
+    status_shm = NULL;
+    shm_unlink(status_shm_name);
+
+    return ERROR_NONE;
+}
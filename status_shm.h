@@ -0,0 +1,34 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_shm.h                                                                */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUS_SHM_H
+#define STATUS_SHM_H
+
+#include <stdint.h>
+#include "main.h"
+
+#define STATUS_SHM_DEFAULT_NAME "/longmynd_status"
+
+uint8_t status_shm_init(char *name);
+void status_shm_publish(const longmynd_status_t *status);
+uint8_t status_shm_close(void);
+
+#endif
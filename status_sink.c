@@ -0,0 +1,299 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_sink.c                                                               */
+/*    - fans each status update out to every attached sink: FIFO, UDP, MQTT in any combination        */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Each sink keeps its own rate limit, ready state and sequence numbers, and sinks that keep their    */
+/* own pace keep their own record of what they were last sent (status_delta_t), so a slow sink still  */
+/* gets every change. Frame sinks with no rate limit always take the same updates, so they share one  */
+/* stream: the frame is built once per update and each sink sends it behind its own header.          */
+/* Only used from the main status loop, apart from the counters.                                      */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+#include "errors.h"
+#include "status.h"
+#include "status_sink.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+    status_delta_t delta;
+    status_frame_t frame;
+    bool shared; /* the stream of the frame sinks with no rate limit */
+} status_stream_t;
+
+typedef struct {
+    status_sink_ops_t ops;
+    status_stream_t *stream;
+    uint32_t min_interval_ms;
+    bool ready;
+    bool due;
+    uint64_t last_update;         /* the snapshot last sent, or missed while not ready */
+    uint64_t last_sent_monotonic;
+    uint64_t held_update;         /* the snapshot last counted as held back */
+    uint32_t sequence;
+    status_sink_stats_t stats;
+} status_sink_t;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+extern uint64_t monotonic_ms(void);
+
+static status_sink_t status_sinks[STATUS_SINK_MAX];
+static status_stream_t status_streams[STATUS_SINK_MAX];
+static uint8_t status_sink_count = 0;
+static uint8_t status_stream_count = 0;
+static status_sink_all_write_t status_sink_all_write = NULL;
+static status_frame_t *status_sink_building = NULL;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t status_sink_frame_write(uint8_t message, uint32_t data, bool *ready) {
+/* -------------------------------------------------------------------------------------------------- */
+    (void)ready;
+    status_frame_add(status_sink_building, message, data);
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t status_sink_frame_string_write(uint8_t message, char *data, bool *ready) {
+/* -------------------------------------------------------------------------------------------------- */
+    (void)ready;
+    status_frame_add_string(status_sink_building, message, data);
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void status_sinks_init(status_sink_all_write_t all_write) {
+/* -------------------------------------------------------------------------------------------------- */
+/* all_write: walks a snapshot calling a sink's write functions for each changed value, ie.           */
+/*            status_all_write() in status.c                                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    status_sink_all_write = all_write;
+    status_sink_count = 0;
+    status_stream_count = 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_sink_add(const status_sink_ops_t *ops, uint32_t max_rate, bool ready) {
+/* -------------------------------------------------------------------------------------------------- */
+/* attaches a sink, to be sent every status update from now on                                        */
+/*     *ops: how to send to it, copied                                                                */
+/* max_rate: updates a second at most, 0 for every update                                             */
+/*    ready: whether it can be sent to yet, eg. false for a FIFO with no reader                       */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    status_sink_t *sink;
+    status_stream_t *stream = NULL;
+    bool shared = (ops->kind == STATUS_SINK_FRAME && max_rate == 0);
+
+    if (status_sink_count == STATUS_SINK_MAX) {
+        printf("ERROR: too many status sinks, %s not added\n", ops->name);
+        return ERROR_STATUS_INIT;
+    }
+
+    if (shared) {
+        for (uint8_t i = 0; i < status_stream_count; i++) {
+            if (status_streams[i].shared) stream = &status_streams[i];
+        }
+    }
+    if (stream == NULL) {
+        stream = &status_streams[status_stream_count++];
+        memset(stream, 0, sizeof(status_stream_t));
+        stream->shared = shared;
+    }
+
+    sink = &status_sinks[status_sink_count++];
+    memset(sink, 0, sizeof(status_sink_t));
+    sink->ops = *ops;
+    sink->stream = stream;
+    sink->min_interval_ms = (max_rate > 0) ? 1000 / max_rate : 0;
+    sink->ready = ready;
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool status_sink_due(status_sink_t *sink, uint64_t update, uint64_t now, uint32_t *holdoff_ms) {
+/* -------------------------------------------------------------------------------------------------- */
+/* decides whether a sink takes this update now: it has not had it, its rate limit allows, and it is  */
+/* ready or can be made so                                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t wait_ms;
+
+    if (sink->last_update == update) return false;
+
+    if (sink->min_interval_ms > 0 && sink->last_sent_monotonic != 0
+        && now - sink->last_sent_monotonic < sink->min_interval_ms) {
+        /* Left pending, so whatever follows goes out with it when the limit allows */
+        wait_ms = (uint32_t)(sink->last_sent_monotonic + sink->min_interval_ms - now);
+        if (*holdoff_ms == 0 || wait_ms < *holdoff_ms) *holdoff_ms = wait_ms;
+        if (sink->held_update != update) {
+            sink->held_update = update;
+            __atomic_add_fetch(&sink->stats.held_back, 1, __ATOMIC_RELAXED);
+            if (sink->ops.held_back != NULL) sink->ops.held_back();
+        }
+        return false;
+    }
+
+    if (!sink->ready && sink->ops.reopen != NULL) {
+        sink->ops.reopen(&sink->ready);
+        /* Whoever has opened the other end needs everything */
+        if (sink->ready) sink->stream->delta.full_requested = true;
+    }
+    if (!sink->ready) {
+        sink->last_update = update;
+        __atomic_add_fetch(&sink->stats.not_ready, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t status_sink_send_frame(status_sink_t *sink) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sends the stream's frame behind the sink's own header                                              */
+/* -------------------------------------------------------------------------------------------------- */
+    status_frame_t *frame = &sink->stream->frame;
+    char header[STATUS_FRAME_HEADER_MAX];
+    uint32_t body_offset;
+    struct iovec iov[2];
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = status_frame_header(frame, sink->sequence++, header, &body_offset);
+    iov[1].iov_base = &frame->buffer[body_offset];
+    iov[1].iov_len = frame->len - body_offset;
+    __atomic_add_fetch(&sink->stats.bytes, iov[0].iov_len + iov[1].iov_len, __ATOMIC_RELAXED);
+
+    return sink->ops.send(iov, 2, &sink->ready);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t status_sinks_update(const longmynd_status_t *status, uint32_t *holdoff_ms) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sends a snapshot to every sink that has not had it yet and may take it now                         */
+/*     *status: a consistent snapshot, as taken by status_snapshot()                                  */
+/* *holdoff_ms: set to how long until a sink held back by its rate limit may be sent it, 0 if none is */
+/*      return: error code                                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err = ERROR_NONE;
+    uint64_t update = status->last_updated_monotonic;
+    uint64_t now = monotonic_ms();
+    status_stream_t *stream;
+    status_sink_t *sink;
+    bool any, built;
+
+    *holdoff_ms = 0;
+
+    for (uint8_t s = 0; s < status_stream_count && err == ERROR_NONE; s++) {
+        stream = &status_streams[s];
+
+        any = false;
+        for (uint8_t i = 0; i < status_sink_count; i++) {
+            sink = &status_sinks[i];
+            sink->due = (sink->stream == stream) && status_sink_due(sink, update, now, holdoff_ms);
+            any = any || sink->due;
+        }
+        if (!any) continue;
+
+        status_delta_select(&stream->delta);
+        built = false;
+
+        for (uint8_t i = 0; i < status_sink_count && err == ERROR_NONE; i++) {
+            sink = &status_sinks[i];
+            if (!sink->due) continue;
+
+            if (sink->ops.cycle != NULL) sink->ops.cycle();
+
+            switch (sink->ops.kind) {
+                case STATUS_SINK_FRAME:
+                    if (!built) {
+                        /* Once for every sink on the stream */
+                        bool building = true;
+                        status_sink_building = &stream->frame;
+                        stream->frame.len = 0;
+                        err = status_sink_all_write((longmynd_status_t *)status, status_sink_frame_write,
+                                                    status_sink_frame_string_write, &building);
+                        built = true;
+                    }
+                    if (err == ERROR_NONE && stream->frame.len > 0) err = status_sink_send_frame(sink);
+                    break;
+                case STATUS_SINK_VALUES:
+                    err = status_sink_all_write((longmynd_status_t *)status, sink->ops.write, sink->ops.string_write,
+                                                &sink->ready);
+                    break;
+                case STATUS_SINK_SNAPSHOT:
+                    err = sink->ops.snapshot(status, &sink->ready);
+                    break;
+            }
+
+            if (err == ERROR_STATUS_DROPPED) {
+                stream->delta.full_requested = true;
+                __atomic_add_fetch(&sink->stats.dropped, 1, __ATOMIC_RELAXED);
+                err = ERROR_NONE;
+            }
+
+            sink->last_update = update;
+            sink->last_sent_monotonic = now;
+            __atomic_add_fetch(&sink->stats.updates, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool status_sink_get_stats(const char *name, status_sink_stats_t *stats) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gets a sink's counters, from any thread                                                            */
+/*   *name: the name it was added under                                                               */
+/*  *stats: filled in with its counters                                                               */
+/*  return: false if there is no such sink                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    for (uint8_t i = 0; i < status_sink_count; i++) {
+        if (strcmp(status_sinks[i].ops.name, name) != 0) continue;
+        stats->updates = __atomic_load_n(&status_sinks[i].stats.updates, __ATOMIC_RELAXED);
+        stats->held_back = __atomic_load_n(&status_sinks[i].stats.held_back, __ATOMIC_RELAXED);
+        stats->not_ready = __atomic_load_n(&status_sinks[i].stats.not_ready, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&status_sinks[i].stats.dropped, __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&status_sinks[i].stats.bytes, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    return false;
+}
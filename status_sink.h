@@ -0,0 +1,78 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: status_sink.h                                                               */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATUS_SINK_H
+#define STATUS_SINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "main.h"
+
+#define STATUS_SINK_MAX 8
+
+/* How a sink takes each status update:                                                               */
+/*   FRAME    - one frame of the changed values (text or binary, see status_frame_set_format). Sinks  */
+/*              with no rate limit share one stream, so the frame is built once and sent to each      */
+/*   VALUES   - one call per changed value, eg. a topic each                                          */
+/*   SNAPSHOT - the whole snapshot, which the sink serialises itself                                  */
+#define STATUS_SINK_FRAME    0
+#define STATUS_SINK_VALUES   1
+#define STATUS_SINK_SNAPSHOT 2
+
+typedef struct {
+    const char *name;
+    uint8_t kind;
+    /* STATUS_SINK_FRAME: sends the frame as given, a header then the shared body */
+    uint8_t (*send)(const struct iovec *iov, int iovcnt, bool *ready);
+    /* STATUS_SINK_VALUES */
+    uint8_t (*write)(uint8_t message, uint32_t data, bool *ready);
+    uint8_t (*string_write)(uint8_t message, char *data, bool *ready);
+    /* STATUS_SINK_SNAPSHOT */
+    uint8_t (*snapshot)(const longmynd_status_t *status, bool *ready);
+    /* Optional: tries to make a sink that is not ready ready again, eg. reopening a FIFO */
+    uint8_t (*reopen)(bool *ready);
+    /* Optional: called before each update the sink is sent, and each time the rate limit holds one */
+    void (*cycle)(void);
+    void (*held_back)(void);
+} status_sink_ops_t;
+
+/* send, write and snapshot return ERROR_STATUS_DROPPED when an update did not all get out but the    */
+/* sink carries on, eg. a full FIFO. The sink's stream then sends everything with the next update, as */
+/* what was lost has already been recorded as sent                                                    */
+
+typedef struct {
+    uint64_t updates;   /* updates sent */
+    uint64_t held_back; /* updates delayed by the sink's rate limit */
+    uint64_t not_ready; /* updates missed while the sink was not ready */
+    uint64_t dropped;   /* updates that did not all get out, see ERROR_STATUS_DROPPED */
+    uint64_t bytes;     /* frame sinks only */
+} status_sink_stats_t;
+
+typedef uint8_t (*status_sink_all_write_t)(longmynd_status_t *status, uint8_t (*status_write)(uint8_t, uint32_t, bool *),
+                                           uint8_t (*status_string_write)(uint8_t, char *, bool *), bool *ready);
+
+void status_sinks_init(status_sink_all_write_t all_write);
+uint8_t status_sink_add(const status_sink_ops_t *ops, uint32_t max_rate, bool ready);
+uint8_t status_sinks_update(const longmynd_status_t *status, uint32_t *holdoff_ms);
+bool status_sink_get_stats(const char *name, status_sink_stats_t *stats);
+
+#endif
@@ -0,0 +1,36 @@
+# The LongMynd receiver: stv0910_regs_info.awk
+# Copyright 2024 Heather Lomond
+#
+# This file is part of longmynd, distributed under the GNU General Public License version 3 or later.
+#
+# Generates stv0910_regs_info.h from stv0910_regs.h (see the Makefile): every register and field it
+# defines, by name, for the direct index built in register_logging.c. Fields are listed after the
+# register they belong to, as they are in stv0910_regs.h.
+
+BEGIN {
+    registers = 0
+    fields = 0
+}
+
+/^#define RSTV0910_/ { register_names[registers++] = $2 }
+/^#define FSTV0910_/ { field_names[fields++] = $2 }
+
+END {
+    print "/* Generated from stv0910_regs.h by stv0910_regs_info.awk, do not edit */"
+    print ""
+    print "#ifndef STV0910_REGS_INFO_H"
+    print "#define STV0910_REGS_INFO_H"
+    print ""
+    print "#define STV0910_REGS_INFO_REGISTERS " registers
+    print "#define STV0910_REGS_INFO_FIELDS " fields
+    print ""
+    print "static constexpr stv0910_register_name_t stv0910_register_names[] = {"
+    for (i = 0; i < registers; i++) printf "    { %s, \"%s\" },\n", register_names[i], register_names[i]
+    print "};"
+    print ""
+    print "static constexpr stv0910_field_info_t stv0910_field_table[] = {"
+    for (i = 0; i < fields; i++) printf "    { %s, \"%s\" },\n", field_names[i], field_names[i]
+    print "};"
+    print ""
+    print "#endif"
+}
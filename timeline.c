@@ -0,0 +1,225 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: timeline.c                                                                  */
+/*    - per thread rings of begin, end and instant events, dumped as Chrome trace event JSON          */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Laid out like the register trace: each thread gets its own ring on its first event, so recording   */
+/* takes no lock. When tracing is off each event costs a load and a branch. A dump is written by the  */
+/* main loop rather than the signal handler that asks for it, so it can take its time over the JSON;  */
+/* the file loads straight into chrome://tracing or ui.perfetto.dev, one track per thread.            */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "timeline.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+bool timeline_enabled = false;
+__thread timeline_ring_t *timeline_ring = NULL;
+
+static timeline_ring_t *timeline_rings[TIMELINE_THREADS];
+static uint32_t timeline_ring_count = 0;
+
+static volatile sig_atomic_t timeline_dump_pending = 0;
+
+/* In timeline_event_t order */
+static const char *timeline_event_names[TIMELINE_EVENT_TYPES] = {
+    "usb_ts_read",
+    "ts_output",
+    "ts_parse",
+    "ts_parse_wait",
+    "i2c_read",
+    "i2c_write",
+    "i2c_cycle",
+    "config_change",
+    "config_mutex_wait",
+    "status_mutex_wait",
+    "status_output",
+    "status_wait",
+    "beep_period",
+    "ftdi_overrun"
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+void timeline_init(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* starts recording, before the threads are started                                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_enabled = true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+timeline_ring_t *timeline_ring_create(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gives the calling thread its ring, on its first event                                              */
+/* return: the ring, or NULL if every ring is taken                                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_ring_t *ring;
+    uint32_t slot;
+
+    if (__atomic_load_n(&timeline_ring_count, __ATOMIC_RELAXED) >= TIMELINE_THREADS) return NULL;
+
+    ring = (timeline_ring_t *)calloc(1, sizeof(timeline_ring_t));
+    if (ring == NULL) return NULL;
+    ring->tid = (pid_t)syscall(SYS_gettid);
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+
+    slot = __atomic_fetch_add(&timeline_ring_count, 1, __ATOMIC_RELAXED);
+    if (slot >= TIMELINE_THREADS) {
+        printf("ERROR: no timeline ring left for thread %s\n", ring->thread_name);
+        free(ring);
+        return NULL;
+    }
+    /* A dump walks the table without a lock, and skips a slot that has been claimed but not yet set */
+    __atomic_store_n(&timeline_rings[slot], ring, __ATOMIC_RELEASE);
+
+    timeline_ring = ring;
+    return ring;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void timeline_request_dump(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* asks the main loop for a dump. Async-signal-safe                                                   */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_dump_pending = 1;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool timeline_dump_requested(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* return: whether a dump has been asked for since the last call                                      */
+/* -------------------------------------------------------------------------------------------------- */
+    if (!timeline_dump_pending) return false;
+    timeline_dump_pending = 0;
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void timeline_thread_name(const timeline_ring_t *ring, char *name, size_t size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the thread's name as it is now, as threads are named after they start, or as it was if it has gone */
+/* -------------------------------------------------------------------------------------------------- */
+    char path[64];
+    FILE *file;
+    size_t len = 0;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)ring->tid);
+    file = fopen(path, "r");
+    if (file != NULL) {
+        if (fgets(name, size, file) != NULL) len = strcspn(name, "\n");
+        fclose(file);
+    }
+    if (len == 0) {
+        snprintf(name, size, "%.15s", ring->thread_name);
+    } else {
+        name[len] = '\0';
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int timeline_dump(const char *path) {
+/* -------------------------------------------------------------------------------------------------- */
+/* writes every ring as Chrome trace event JSON. Safe to call while the rings are being written to    */
+/*   path: the file to write, replaced if it exists                                                   */
+/* return: 0, or -1 with errno set                                                                    */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_record_t *records;
+    timeline_ring_t *ring;
+    timeline_record_t *record;
+    char name[32];
+    uint64_t head, head_after, first, n;
+    uint32_t count, i, depth;
+    bool comma = false;
+    int result = 0;
+    FILE *file;
+
+    records = (timeline_record_t *)malloc(sizeof(((timeline_ring_t *)0)->records));
+    if (records == NULL) return -1;
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        free(records);
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    count = __atomic_load_n(&timeline_ring_count, __ATOMIC_ACQUIRE);
+    if (count > TIMELINE_THREADS) count = TIMELINE_THREADS;
+    for (i = 0; i < count; i++) {
+        ring = __atomic_load_n(&timeline_rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) continue;
+
+        /* Copy first, then keep only what the thread cannot have overwritten while we copied */
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        memcpy(records, ring->records, sizeof(ring->records));
+        head_after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = (head_after + 1 > TIMELINE_EVENTS) ? head_after + 1 - TIMELINE_EVENTS : 0;
+
+        timeline_thread_name(ring, name, sizeof(name));
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                comma ? ",\n" : "", (int)getpid(), (int)ring->tid, name);
+        comma = true;
+
+        /* The oldest events may have lost their begin to the ring wrapping; an unmatched end confuses the viewer */
+        depth = 0;
+        for (n = first; n < head; n++) {
+            record = &records[n & (TIMELINE_EVENTS - 1)];
+            if (record->event >= TIMELINE_EVENT_TYPES) continue;
+            if (record->phase == TIMELINE_END) {
+                if (depth == 0) continue;
+                depth--;
+            } else if (record->phase == TIMELINE_BEGIN) {
+                depth++;
+            }
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d}",
+                    timeline_event_names[record->event], record->phase,
+                    (unsigned long long)(record->timestamp_ns / 1000), (unsigned)(record->timestamp_ns % 1000),
+                    (int)getpid(), (int)ring->tid);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    if (ferror(file)) result = -1;
+    if (fclose(file) != 0) result = -1;
+    free(records);
+
+    return result;
+}
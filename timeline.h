@@ -0,0 +1,111 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: timeline.h                                                                  */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Events kept per thread, a power of 2. At 16 bytes each this is 512kB a thread */
+#define TIMELINE_EVENTS  32768
+#define TIMELINE_THREADS 32
+
+#define TIMELINE_DEFAULT_PATH "longmynd_timeline.json"
+
+/* What is timed, names in timeline.c */
+typedef enum {
+    TIMELINE_USB_TS_READ,
+    TIMELINE_TS_OUTPUT,
+    TIMELINE_TS_PARSE,
+    TIMELINE_TS_PARSE_WAIT,
+    TIMELINE_I2C_READ,
+    TIMELINE_I2C_WRITE,
+    TIMELINE_I2C_CYCLE,
+    TIMELINE_CONFIG_CHANGE,
+    TIMELINE_CONFIG_MUTEX_WAIT,
+    TIMELINE_STATUS_MUTEX_WAIT,
+    TIMELINE_STATUS_OUTPUT,
+    TIMELINE_STATUS_WAIT,
+    TIMELINE_BEEP_PERIOD,
+    TIMELINE_FTDI_OVERRUN,
+    TIMELINE_EVENT_TYPES
+} timeline_event_t;
+
+/* timeline_record_t.phase, as the trace event format has them */
+#define TIMELINE_BEGIN 'B'
+#define TIMELINE_END   'E'
+#define TIMELINE_INSTANT 'i'
+
+typedef struct {
+    uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+    uint16_t event;        /* timeline_event_t */
+    uint8_t phase;
+    uint8_t reserved[5];
+} timeline_record_t;
+
+typedef struct {
+    timeline_record_t records[TIMELINE_EVENTS];
+    uint64_t head;
+    pid_t tid;
+    char thread_name[16];  /* when the ring was made, for a thread gone by the time of the dump */
+} timeline_ring_t;
+
+extern bool timeline_enabled;
+extern __thread timeline_ring_t *timeline_ring;
+
+void timeline_init(void);
+timeline_ring_t *timeline_ring_create(void);
+void timeline_request_dump(void);
+bool timeline_dump_requested(void);
+int timeline_dump(const char *path);
+
+/* -------------------------------------------------------------------------------------------------- */
+static inline void timeline_record(timeline_event_t event, uint8_t phase) {
+/* -------------------------------------------------------------------------------------------------- */
+/* adds an event to the calling thread's ring, when tracing is on: no locks and no system calls       */
+/* -------------------------------------------------------------------------------------------------- */
+    timeline_ring_t *ring = timeline_ring;
+    timeline_record_t *record;
+    struct timespec now;
+
+    if (!timeline_enabled) return;
+    if (ring == NULL) {
+        ring = timeline_ring_create();
+        if (ring == NULL) return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record = &ring->records[ring->head & (TIMELINE_EVENTS - 1)];
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->event = event;
+    record->phase = phase;
+    /* Publish after the record, for a dump from another thread */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void timeline_begin(timeline_event_t event) { timeline_record(event, TIMELINE_BEGIN); }
+static inline void timeline_end(timeline_event_t event) { timeline_record(event, TIMELINE_END); }
+static inline void timeline_instant(timeline_event_t event) { timeline_record(event, TIMELINE_INSTANT); }
+
+#endif
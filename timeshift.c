@@ -0,0 +1,734 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: timeshift.c                                                                 */
+/*    - a memory mapped ring holding the last few minutes of TS, with a PCR index for instant replay  */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "errors.h"
+#include "pcrpts.h"
+#include "web.h"
+#include "timeshift.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define TIMESHIFT_PACKET_SIZE 188
+#define TIMESHIFT_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* PCRs are required at least every 100ms, allow for a few PCR PIDs and random access points */
+#define TIMESHIFT_INDEX_PER_SECOND 64
+
+/* Leave this much of the oldest data alone when replaying, as the writer may be about to reuse it */
+#define TIMESHIFT_GUARD_BYTES (256 * 1024)
+
+/* Replays are sent in the same 7 packet datagrams as the live UDP output */
+#define TIMESHIFT_UDP_CHUNK (7 * TIMESHIFT_PACKET_SIZE)
+#define TIMESHIFT_FILE_CHUNK (348 * TIMESHIFT_PACKET_SIZE)
+
+#define TIMESHIFT_MAX_REPLAYS 4
+
+#define TIMESHIFT_INDEX_FLAG_PCR           0x01
+#define TIMESHIFT_INDEX_FLAG_RANDOM_ACCESS 0x02
+
+typedef struct {
+    uint64_t position;     /* absolute byte position in the stream since start */
+    uint64_t monotonic_ms; /* arrival time */
+    uint64_t pcr;          /* 27MHz, valid if TIMESHIFT_INDEX_FLAG_PCR */
+    uint16_t pid;
+    uint8_t flags;
+} timeshift_index_entry_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    int fd;
+    bool udp;
+    bool realtime;
+    struct sockaddr_in addr;
+} timeshift_replay_t;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+extern uint64_t monotonic_ms(void);
+
+static uint8_t *timeshift_ring = NULL;
+static uint64_t timeshift_capacity;
+static int timeshift_backing_fd = -1;
+
+/* The writer bumps reserved before overwriting old data and committed once the new data is in,   */
+/* so a reader can tell afterwards whether what it copied out was overwritten under it            */
+static uint64_t timeshift_reserved = 0;
+static uint64_t timeshift_committed = 0;
+
+static timeshift_index_entry_t *timeshift_index = NULL;
+static uint32_t timeshift_index_size;
+static uint64_t timeshift_index_count = 0;
+static pthread_mutex_t timeshift_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int timeshift_control_fd = -1;
+static pthread_t timeshift_control_thread;
+static bool timeshift_running = false;
+static uint32_t timeshift_replays_active = 0;
+
+/* Where export may write, empty to refuse exports, and where besides loopback streams may go */
+static char timeshift_export_dir[128];
+static in_addr_t timeshift_stream_allow[TIMESHIFT_MAX_STREAM_ALLOW];
+static uint32_t timeshift_stream_allow_count = 0;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+void timeshift_ts_write(uint8_t *packets, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* appends a run of sync-aligned TS packets to the ring and indexes their PCRs and access points      */
+/* Only called from loop_ts, so there is a single writer                                              */
+/* *packets: the aligned TS packets, as produced by ts_align()                                        */
+/*      len: the length (number of bytes) of the packets, a multiple of 188                           */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t start = timeshift_committed;
+    uint64_t now_ms = monotonic_ms();
+    uint64_t ring_offset;
+    uint32_t first_len;
+    timeshift_index_entry_t *entry;
+    uint8_t *packet;
+    uint8_t flags;
+
+    if (timeshift_ring == NULL || len > timeshift_capacity) return;
+
+    __atomic_store_n(&timeshift_reserved, start + len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    ring_offset = start % timeshift_capacity;
+    first_len = len;
+    if (ring_offset + len > timeshift_capacity) first_len = (uint32_t)(timeshift_capacity - ring_offset);
+    memcpy(&timeshift_ring[ring_offset], packets, first_len);
+    if (first_len < len) memcpy(timeshift_ring, &packets[first_len], len - first_len);
+
+    for (uint32_t offset = 0; offset + TIMESHIFT_PACKET_SIZE <= len; offset += TIMESHIFT_PACKET_SIZE) {
+        packet = &packets[offset];
+
+        /* Only packets with an adaptation field can carry a PCR or random access indicator */
+        if (!((packet[3] & 0x20) && packet[4] != 0)) continue;
+
+        flags = 0;
+        if (PCRAvailable((char *)packet)) flags |= TIMESHIFT_INDEX_FLAG_PCR;
+        if (packet[5] & 0x40) flags |= TIMESHIFT_INDEX_FLAG_RANDOM_ACCESS;
+        if (flags == 0) continue;
+
+        pthread_mutex_lock(&timeshift_index_mutex);
+        entry = &timeshift_index[timeshift_index_count % timeshift_index_size];
+        entry->position = start + offset;
+        entry->monotonic_ms = now_ms;
+        entry->pcr = (flags & TIMESHIFT_INDEX_FLAG_PCR) ? GetPCRFromPacket(packet) : 0;
+        entry->pid = ((packet[1] & 0x1f) << 8) | packet[2];
+        entry->flags = flags;
+        timeshift_index_count++;
+        pthread_mutex_unlock(&timeshift_index_mutex);
+    }
+
+    __atomic_store_n(&timeshift_committed, start + len, __ATOMIC_RELEASE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool timeshift_read(uint64_t position, uint8_t *dest, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* copies data out of the ring                                                                        */
+/*  return: false if the writer has overwritten any of it in the meantime                             */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t ring_offset = position % timeshift_capacity;
+    uint32_t first_len = len;
+
+    if (ring_offset + len > timeshift_capacity) first_len = (uint32_t)(timeshift_capacity - ring_offset);
+    memcpy(dest, &timeshift_ring[ring_offset], first_len);
+    if (first_len < len) memcpy(&dest[first_len], timeshift_ring, len - first_len);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&timeshift_reserved, __ATOMIC_RELAXED) <= position + timeshift_capacity;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t timeshift_oldest_position(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t reserved = __atomic_load_n(&timeshift_reserved, __ATOMIC_ACQUIRE);
+
+    if (reserved + TIMESHIFT_GUARD_BYTES <= timeshift_capacity) return 0;
+    return reserved + TIMESHIFT_GUARD_BYTES - timeshift_capacity;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool timeshift_find_window(uint64_t from_ms, uint64_t to_ms, uint64_t *start, uint64_t *end) {
+/* -------------------------------------------------------------------------------------------------- */
+/* turns a window in monotonic time into ring positions, using only the index                         */
+/* The start is moved back to the nearest random access point so that replay decodes straight away   */
+/*  return: false if none of the window is still in the ring                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t oldest = timeshift_oldest_position();
+    uint64_t first, last, low, high, mid, found, i;
+    bool ok = true;
+
+    pthread_mutex_lock(&timeshift_index_mutex);
+
+    last = timeshift_index_count;
+    first = (last > timeshift_index_size) ? last - timeshift_index_size : 0;
+
+    /* Skip index entries that point at data that has already been overwritten */
+    low = first;
+    high = last;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (timeshift_index[mid % timeshift_index_size].position < oldest) low = mid + 1;
+        else high = mid;
+    }
+    first = low;
+
+    if (first >= last) {
+        ok = false;
+    } else {
+        /* First entry at or after the start of the window */
+        low = first;
+        high = last;
+        while (low < high) {
+            mid = low + (high - low) / 2;
+            if (timeshift_index[mid % timeshift_index_size].monotonic_ms < from_ms) low = mid + 1;
+            else high = mid;
+        }
+        found = (low < last) ? low : last - 1;
+
+        /* Back to the nearest random access point, or forwards if there are none before it */
+        for (i = found + 1; i > first; i--) {
+            if (timeshift_index[(i - 1) % timeshift_index_size].flags & TIMESHIFT_INDEX_FLAG_RANDOM_ACCESS) break;
+        }
+        if (i > first) {
+            found = i - 1;
+        } else {
+            for (i = found; i < last; i++) {
+                if (timeshift_index[i % timeshift_index_size].flags & TIMESHIFT_INDEX_FLAG_RANDOM_ACCESS) {
+                    found = i;
+                    break;
+                }
+            }
+        }
+        *start = timeshift_index[found % timeshift_index_size].position;
+
+        /* End at the first entry after the window, or the live edge */
+        low = found;
+        high = last;
+        while (low < high) {
+            mid = low + (high - low) / 2;
+            if (timeshift_index[mid % timeshift_index_size].monotonic_ms <= to_ms) low = mid + 1;
+            else high = mid;
+        }
+        *end = (low < last) ? timeshift_index[low % timeshift_index_size].position
+                            : __atomic_load_n(&timeshift_committed, __ATOMIC_ACQUIRE);
+
+        if (*end <= *start) ok = false;
+    }
+
+    pthread_mutex_unlock(&timeshift_index_mutex);
+
+    return ok;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t timeshift_position_ms(uint64_t position) {
+/* -------------------------------------------------------------------------------------------------- */
+/* estimates the arrival time of a position by interpolating between index entries, used for pacing */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t first, last, low, high, mid;
+    timeshift_index_entry_t *before, *after;
+    uint64_t result = 0;
+
+    pthread_mutex_lock(&timeshift_index_mutex);
+
+    last = timeshift_index_count;
+    first = (last > timeshift_index_size) ? last - timeshift_index_size : 0;
+
+    low = first;
+    high = last;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (timeshift_index[mid % timeshift_index_size].position <= position) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low > first) {
+        before = &timeshift_index[(low - 1) % timeshift_index_size];
+        result = before->monotonic_ms;
+        if (low < last) {
+            after = &timeshift_index[low % timeshift_index_size];
+            if (after->position > before->position) {
+                result += (after->monotonic_ms - before->monotonic_ms) * (position - before->position)
+                          / (after->position - before->position);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&timeshift_index_mutex);
+
+    return result;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void *timeshift_replay(void *arg) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sends a window out of the ring to a file or UDP destination, in its own thread                     */
+/* -------------------------------------------------------------------------------------------------- */
+    timeshift_replay_t *replay = (timeshift_replay_t *)arg;
+    uint32_t chunk_size = replay->udp ? TIMESHIFT_UDP_CHUNK : TIMESHIFT_FILE_CHUNK;
+    uint8_t *chunk = (uint8_t *)malloc(chunk_size);
+    uint64_t position = replay->start;
+    uint64_t first_ms = timeshift_position_ms(replay->start);
+    uint64_t replay_start_ms = monotonic_ms();
+    uint64_t due_ms, now_ms;
+    uint32_t len;
+    ssize_t ret;
+
+    while (chunk != NULL && position < replay->end && timeshift_running) {
+        len = chunk_size;
+        if (position + len > replay->end) len = (uint32_t)(replay->end - position);
+
+        if (!timeshift_read(position, chunk, len)) {
+            printf("WARNING: timeshift replay overtaken by live data\n");
+            break;
+        }
+
+        if (replay->realtime) {
+            due_ms = replay_start_ms + (timeshift_position_ms(position) - first_ms);
+            now_ms = monotonic_ms();
+            if (due_ms > now_ms) usleep((due_ms - now_ms) * 1000);
+        }
+
+        if (replay->udp) {
+            ret = sendto(replay->fd, chunk, len, 0, (const struct sockaddr *)&replay->addr, sizeof(struct sockaddr));
+        } else {
+            ret = write(replay->fd, chunk, len);
+        }
+        if (ret != (ssize_t)len) {
+            printf("ERROR: timeshift replay write (error: %s)\n", strerror(errno));
+            break;
+        }
+
+        position += len;
+    }
+
+    printf("Flow: Timeshift replay finished, %llu bytes\n", (unsigned long long)(position - replay->start));
+
+    close(replay->fd);
+    free(chunk);
+    free(replay);
+    __atomic_sub_fetch(&timeshift_replays_active, 1, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t timeshift_parse_time(const char *value) {
+/* -------------------------------------------------------------------------------------------------- */
+/* converts a command time, seconds relative to now if <= 0, otherwise UNIX time, to monotonic ms     */
+/* -------------------------------------------------------------------------------------------------- */
+    long long seconds = strtoll(value, NULL, 10);
+    uint64_t now_ms = monotonic_ms();
+    int64_t offset_ms;
+
+    if (seconds <= 0) {
+        offset_ms = seconds * 1000;
+    } else {
+        offset_ms = seconds * 1000 - (int64_t)time(NULL) * 1000;
+    }
+
+    if (offset_ms < 0 && (uint64_t)(-offset_ms) > now_ms) return 0;
+    return now_ms + offset_ms;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool timeshift_export_name_ok(const char *name) {
+/* -------------------------------------------------------------------------------------------------- */
+/* checks an export name is a plain file name, so it cannot reach outside the export directory        */
+/* -------------------------------------------------------------------------------------------------- */
+    return name[0] != '\0' && strchr(name, '/') == NULL && strstr(name, "..") == NULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool timeshift_stream_allowed(struct in_addr addr) {
+/* -------------------------------------------------------------------------------------------------- */
+/* checks a stream target is on loopback or in the allow-list                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    if ((ntohl(addr.s_addr) >> 24) == 127) return true;
+
+    for (uint32_t i = 0; i < timeshift_stream_allow_count; i++) {
+        if (timeshift_stream_allow[i] == addr.s_addr) return true;
+    }
+
+    return false;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t timeshift_command(const char *command, char *reply, size_t reply_size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* runs a control command, see timeshift.h for the syntax                                             */
+/* *command: the command line                                                                         */
+/*   *reply: filled in with a one line reply for the requester                                        */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    char verb[16], from[24], to[24], target[128], port[8], mode[8];
+    char path[256];
+    struct in_addr stream_addr;
+    int fields;
+    uint64_t start = 0, end = 0;
+    timeshift_replay_t *replay = NULL;
+    pthread_t thread;
+
+    fields = sscanf(command, "%15s %23s %23s %127s %7s %7s", verb, from, to, target, port, mode);
+
+    if (timeshift_ring == NULL) {
+        snprintf(reply, reply_size, "ERROR timeshift not enabled");
+        return ERROR_TIMESHIFT_COMMAND;
+    }
+
+    if (fields >= 1 && strcmp(verb, "status") == 0) {
+        uint64_t oldest = timeshift_oldest_position();
+        uint64_t committed = __atomic_load_n(&timeshift_committed, __ATOMIC_ACQUIRE);
+        snprintf(reply, reply_size, "OK span=%llums bytes=%llu",
+                 (unsigned long long)(timeshift_position_ms(committed) - timeshift_position_ms(oldest)),
+                 (unsigned long long)(committed - oldest));
+        return ERROR_NONE;
+    }
+
+    if (fields < 4 || (strcmp(verb, "export") != 0 && strcmp(verb, "stream") != 0)
+        || (strcmp(verb, "stream") == 0 && fields < 5)) {
+        snprintf(reply, reply_size, "ERROR usage: export <from> <to> <path> | stream <from> <to> <ip> <port> [fast] | status");
+        return ERROR_TIMESHIFT_COMMAND;
+    }
+
+    if (strcmp(verb, "export") == 0) {
+        if (timeshift_export_dir[0] == '\0') {
+            snprintf(reply, reply_size, "ERROR export disabled, no export directory configured");
+            return ERROR_TIMESHIFT_COMMAND;
+        }
+        if (!timeshift_export_name_ok(target)) {
+            snprintf(reply, reply_size, "ERROR export name must be a plain file name");
+            return ERROR_TIMESHIFT_COMMAND;
+        }
+        snprintf(path, sizeof(path), "%s/%s", timeshift_export_dir, target);
+    } else {
+        if (inet_aton(target, &stream_addr) == 0) {
+            snprintf(reply, reply_size, "ERROR bad stream address %s", target);
+            return ERROR_TIMESHIFT_COMMAND;
+        }
+        if (!timeshift_stream_allowed(stream_addr)) {
+            snprintf(reply, reply_size, "ERROR stream to %s not allowed", target);
+            return ERROR_TIMESHIFT_COMMAND;
+        }
+    }
+
+    if (__atomic_load_n(&timeshift_replays_active, __ATOMIC_RELAXED) >= TIMESHIFT_MAX_REPLAYS) {
+        snprintf(reply, reply_size, "ERROR too many replays in progress");
+        err=ERROR_TIMESHIFT_COMMAND;
+    }
+
+    if (err==ERROR_NONE && !timeshift_find_window(timeshift_parse_time(from), timeshift_parse_time(to), &start, &end)) {
+        snprintf(reply, reply_size, "ERROR window not in ring");
+        err=ERROR_TIMESHIFT_COMMAND;
+    }
+
+    if (err==ERROR_NONE) {
+        replay = (timeshift_replay_t *)calloc(1, sizeof(timeshift_replay_t));
+        if (replay == NULL) {
+            snprintf(reply, reply_size, "ERROR out of memory");
+            err=ERROR_TIMESHIFT_COMMAND;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        replay->start = start;
+        replay->end = end;
+        if (strcmp(verb, "export") == 0) {
+            replay->udp = false;
+            replay->realtime = false;
+            replay->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+        } else {
+            replay->udp = true;
+            replay->realtime = !(fields >= 6 && strcmp(mode, "fast") == 0);
+            replay->addr.sin_family = AF_INET;
+            replay->addr.sin_port = htons((uint16_t)strtol(port, NULL, 10));
+            replay->addr.sin_addr = stream_addr;
+            replay->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        }
+        if (replay->fd < 0) {
+            snprintf(reply, reply_size, "ERROR cannot open %s: %s", target, strerror(errno));
+            free(replay);
+            err=ERROR_TIMESHIFT_COMMAND;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        __atomic_add_fetch(&timeshift_replays_active, 1, __ATOMIC_RELAXED);
+        if (pthread_create(&thread, NULL, timeshift_replay, replay) != 0) {
+            __atomic_sub_fetch(&timeshift_replays_active, 1, __ATOMIC_RELAXED);
+            close(replay->fd);
+            free(replay);
+            snprintf(reply, reply_size, "ERROR cannot start replay");
+            err=ERROR_TIMESHIFT_COMMAND;
+        } else {
+            pthread_detach(thread);
+            snprintf(reply, reply_size, "OK %s %llu bytes", verb, (unsigned long long)(end - start));
+            printf("Flow: Timeshift %s %s to %s, %llu bytes\n", verb, from, target, (unsigned long long)(end - start));
+        }
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+/* HTTP access: GET /timeshift.ts?from=-120&to=0                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+class TimeshiftHandler : public CivetHandler
+{
+public:
+    bool handleGet(CivetServer *server, struct mg_connection *conn)
+    {
+        (void)server;
+        char from[24] = "-60";
+        char to[24] = "0";
+        uint64_t start, end, position;
+        uint8_t *chunk;
+        uint32_t len;
+
+        web_get_param(conn, "from", from, sizeof(from));
+        web_get_param(conn, "to", to, sizeof(to));
+
+        if (!timeshift_find_window(timeshift_parse_time(from), timeshift_parse_time(to), &start, &end)) {
+            mg_printf(conn, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"
+                            "Window not in time-shift ring\n");
+            return true;
+        }
+
+        chunk = (uint8_t *)malloc(TIMESHIFT_FILE_CHUNK);
+        if (chunk == NULL) return false;
+
+        mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: video/mp2t\r\nCache-Control: no-store\r\n"
+                        "Content-Length: %llu\r\nConnection: close\r\n\r\n", (unsigned long long)(end - start));
+
+        for (position = start; position < end; position += len) {
+            len = TIMESHIFT_FILE_CHUNK;
+            if (position + len > end) len = (uint32_t)(end - position);
+            if (!timeshift_read(position, chunk, len)) break;
+            if (mg_write(conn, chunk, len) <= 0) break;
+        }
+
+        free(chunk);
+        return true;
+    }
+};
+
+static TimeshiftHandler timeshift_http_handler;
+
+/* -------------------------------------------------------------------------------------------------- */
+static void *timeshift_control_loop(void *arg) {
+/* -------------------------------------------------------------------------------------------------- */
+/* listens for commands on the UDP control port and replies to the sender                             */
+/* -------------------------------------------------------------------------------------------------- */
+    (void)arg;
+    char command[256];
+    char reply[256];
+    struct sockaddr_in sender;
+    socklen_t sender_len;
+    ssize_t len;
+
+    while (timeshift_running) {
+        sender_len = sizeof(sender);
+        len = recvfrom(timeshift_control_fd, command, sizeof(command) - 1, 0, (struct sockaddr *)&sender, &sender_len);
+        if (len <= 0) continue; /* timeout, so that we notice shutdown */
+
+        command[len] = '\0';
+        timeshift_command(command, reply, sizeof(reply));
+        strcat(reply, "\n");
+        sendto(timeshift_control_fd, reply, strlen(reply), 0, (struct sockaddr *)&sender, sender_len);
+    }
+
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t timeshift_init(uint32_t seconds, uint32_t mbps, char *backing, char *control_addr, int control_port,
+                       char *export_dir, char *stream_allow) {
+/* -------------------------------------------------------------------------------------------------- */
+/* maps the ring and its index, and starts the control interfaces                                     */
+/*       seconds: how much TS to hold                                                                 */
+/*          mbps: the highest TS rate to size the ring for, in Mbit/s                                 */
+/*      *backing: "mem", "huge" for hugepages, or the path of a file to map                           */
+/* *control_addr: address to listen for commands on, TIMESHIFT_CONTROL_ADDR for loopback only         */
+/*  control_port: UDP port to listen for commands on, 0 for none                                      */
+/*   *export_dir: directory that export writes into, empty to refuse exports                          */
+/* *stream_allow: comma separated addresses streams may go to besides loopback                        */
+/*        return: error code                                                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    size_t map_size;
+    struct sockaddr_in bind_addr;
+    struct timeval timeout;
+    struct in_addr listen_addr;
+    char allow[128];
+    char *allow_saveptr;
+
+    map_size = ((uint64_t)seconds * mbps * 1000000 / 8 + TIMESHIFT_HUGEPAGE_SIZE - 1) & ~((uint64_t)TIMESHIFT_HUGEPAGE_SIZE - 1);
+
+    if (strcmp(backing, TIMESHIFT_BACKING_HUGEPAGE) == 0) {
+        timeshift_ring = (uint8_t *)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (timeshift_ring == MAP_FAILED) {
+            printf("Flow: Timeshift hugepages not available (%s), using normal pages\n", strerror(errno));
+            backing = (char *)TIMESHIFT_BACKING_MEMORY;
+        }
+    }
+    if (strcmp(backing, TIMESHIFT_BACKING_MEMORY) == 0) {
+        timeshift_ring = (uint8_t *)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    } else if (strcmp(backing, TIMESHIFT_BACKING_HUGEPAGE) != 0) {
+        timeshift_backing_fd = open(backing, O_RDWR | O_CREAT, 0644);
+        if (timeshift_backing_fd < 0 || ftruncate(timeshift_backing_fd, map_size) != 0) {
+            printf("ERROR: timeshift backing file %s (error: %s)\n", backing, strerror(errno));
+            err=ERROR_TIMESHIFT_INIT;
+        } else {
+            timeshift_ring = (uint8_t *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                             timeshift_backing_fd, 0);
+        }
+    }
+    if (err==ERROR_NONE && timeshift_ring == MAP_FAILED) {
+        printf("ERROR: timeshift ring mmap (error: %s)\n", strerror(errno));
+        err=ERROR_TIMESHIFT_INIT;
+    }
+    if (timeshift_ring == MAP_FAILED) timeshift_ring = NULL;
+
+    if (err==ERROR_NONE) {
+        timeshift_capacity = map_size;
+        timeshift_index_size = seconds * TIMESHIFT_INDEX_PER_SECOND + 1024;
+        timeshift_index = (timeshift_index_entry_t *)calloc(timeshift_index_size, sizeof(timeshift_index_entry_t));
+        if (timeshift_index == NULL) {
+            printf("ERROR: timeshift index malloc\n");
+            err=ERROR_TIMESHIFT_INIT;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        strncpy(timeshift_export_dir, export_dir, sizeof(timeshift_export_dir) - 1);
+        strncpy(allow, stream_allow, sizeof(allow) - 1);
+        allow[sizeof(allow) - 1] = '\0';
+        timeshift_stream_allow_count = 0;
+        for (char *entry = strtok_r(allow, ",", &allow_saveptr); entry != NULL && err==ERROR_NONE;
+             entry = strtok_r(NULL, ",", &allow_saveptr)) {
+            struct in_addr entry_addr;
+            if (inet_aton(entry, &entry_addr) == 0 || timeshift_stream_allow_count == TIMESHIFT_MAX_STREAM_ALLOW) {
+                printf("ERROR: timeshift stream allow-list entry %s (at most %u addresses)\n", entry, TIMESHIFT_MAX_STREAM_ALLOW);
+                err=ERROR_TIMESHIFT_INIT;
+            } else {
+                timeshift_stream_allow[timeshift_stream_allow_count++] = entry_addr.s_addr;
+            }
+        }
+    }
+
+    if (err==ERROR_NONE && control_port > 0 && inet_aton(control_addr, &listen_addr) == 0) {
+        printf("ERROR: timeshift control address %s\n", control_addr);
+        err=ERROR_TIMESHIFT_INIT;
+    }
+
+    if (err==ERROR_NONE) {
+        timeshift_running = true;
+        web_add_handler("/timeshift.ts", &timeshift_http_handler);
+    }
+
+    if (err==ERROR_NONE && control_port > 0) {
+        timeshift_control_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(&bind_addr, 0, sizeof(bind_addr));
+        bind_addr.sin_family = AF_INET;
+        bind_addr.sin_port = htons(control_port);
+        bind_addr.sin_addr = listen_addr;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 500 * 1000;
+        if (timeshift_control_fd < 0
+            || bind(timeshift_control_fd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) != 0
+            || setsockopt(timeshift_control_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+            printf("ERROR: timeshift control port %i (error: %s)\n", control_port, strerror(errno));
+            err=ERROR_TIMESHIFT_INIT;
+        } else if (pthread_create(&timeshift_control_thread, NULL, timeshift_control_loop, NULL) != 0) {
+            printf("ERROR: timeshift control thread\n");
+            err=ERROR_TIMESHIFT_INIT;
+        }
+        if (err!=ERROR_NONE && timeshift_control_fd >= 0) {
+            close(timeshift_control_fd);
+            timeshift_control_fd = -1;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        printf("Flow: Timeshift ring %zu MB (%u s at %u Mbit/s) in %s\n", map_size / (1024 * 1024), seconds, mbps, backing);
+    } else {
+        printf("ERROR: timeshift init\n");
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t timeshift_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* stops the control port; the ring itself is left mapped as replays may still be reading it         */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (!timeshift_running) return ERROR_NONE;
+
+    timeshift_running = false;
+
+    if (timeshift_control_fd >= 0) {
+        pthread_join(timeshift_control_thread, NULL);
+        close(timeshift_control_fd);
+        timeshift_control_fd = -1;
+    }
+
+    if (timeshift_backing_fd >= 0) {
+        msync(timeshift_ring, timeshift_capacity, MS_ASYNC);
+    }
+
+    return ERROR_NONE;
+}
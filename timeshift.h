@@ -0,0 +1,57 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: timeshift.h                                                                 */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TIMESHIFT_DEFAULT_SECONDS 300
+#define TIMESHIFT_DEFAULT_MBPS    20
+
+/* Backing store for the ring */
+#define TIMESHIFT_BACKING_MEMORY   "mem"
+#define TIMESHIFT_BACKING_HUGEPAGE "huge"
+
+/* The control port only listens on loopback unless another address is given */
+#define TIMESHIFT_CONTROL_ADDR "127.0.0.1"
+
+/* How many addresses, besides loopback, streams can be allowed to */
+#define TIMESHIFT_MAX_STREAM_ALLOW 8
+
+/* Control commands, accepted on MQTT (cmd/longmynd/timeshift) and the UDP control port:             */
+/*   export <from> <to> <name>             write the window to a file in the export directory         */
+/*   stream <from> <to> <ip> <port> [fast] send the window as UDP, at the original pace unless fast   */
+/*   status                                report the span held in the ring                           */
+/* <from> and <to> are seconds relative to now when <= 0 (eg. -120), or UNIX time otherwise.          */
+/* Export names may not contain / or "..", and export is refused when no directory is configured.     */
+/* Streams may only go to loopback or to an address in the allow-list.                                */
+/* Over HTTP the window is served directly as GET /timeshift.ts?from=<from>&to=<to>                   */
+
+uint8_t timeshift_init(uint32_t seconds, uint32_t mbps, char *backing, char *control_addr, int control_port,
+                       char *export_dir, char *stream_allow);
+void timeshift_ts_write(uint8_t *packets, uint32_t len);
+uint8_t timeshift_command(const char *command, char *reply, size_t reply_size);
+uint8_t timeshift_close(void);
+
+#endif
@@ -28,11 +28,21 @@
 #include "ftdi.h"
 #include "ftdi_usb.h"
 #include "ts.h"
+#include "recorder.h"
+#include "timeshift.h"
+#include "hls.h"
+#include "pcrpts.h"
+#include "bbframe.h"
+#include "tsring.h"
+#include "status.h"
 
 #include "libts.h"
 #include "stv0910.h"
-
-#define TS_FRAME_SIZE 20*512 // 512 is base USB FTDI frame
+#include "metrics.h"
+#include "timeline.h"
+#include "capture.h"
+#include "nim_sim.h"
+#include "tsgen.h"
 
 uint8_t *ts_buffer_ptr = NULL;
 bool ts_buffer_waiting;
@@ -53,7 +63,143 @@ static longmynd_ts_parse_buffer_t longmynd_ts_parse_buffer = {
     .signal = PTHREAD_COND_INITIALIZER
 };
 
+/* Partial packet carried between USB transfers by ts_align() */
+static uint8_t ts_align_carry[TS_PACKET_SIZE];
+static uint32_t ts_align_carry_len = 0;
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t ts_align(uint8_t *buffer, uint32_t len, uint8_t *aligned) {
+/* -------------------------------------------------------------------------------------------------- */
+/* strips the 2 FTDI bytes every 512 and re-aligns the TS on the sync byte, for the sinks that need   */
+/* whole packets (recorder, time-shift, HLS, shm). Partial packets are carried over to the next call  */
+/* *buffer: the USB buffer, less its first 2 FTDI bytes                                               */
+/*     len: the length (number of bytes) of the buffer                                                */
+/* *aligned: output buffer, at least len+TS_PACKET_SIZE bytes                                         */
+/*  return: the number of aligned bytes written, always a multiple of TS_PACKET_SIZE                  */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t aligned_len = 0;
+    int32_t remaining_len = len; /* note it is signed so can go negative */
+    uint8_t *data, *sync;
+    uint32_t chunk_len, n;
+
+    while (remaining_len > 0) {
+        data = &buffer[len - remaining_len];
+        chunk_len = (remaining_len > 510) ? 510 : remaining_len;
+        remaining_len -= (remaining_len > 510) ? 512 : remaining_len;
+
+        while (chunk_len > 0) {
+            if (ts_align_carry_len > 0) {
+                n = TS_PACKET_SIZE - ts_align_carry_len;
+                if (n > chunk_len) n = chunk_len;
+                memcpy(&ts_align_carry[ts_align_carry_len], data, n);
+                ts_align_carry_len += n;
+                data += n;
+                chunk_len -= n;
+
+                if (ts_align_carry_len == TS_PACKET_SIZE) {
+                    if (ts_align_carry[0] == TS_HEADER_SYNC) {
+                        memcpy(&aligned[aligned_len], ts_align_carry, TS_PACKET_SIZE);
+                        aligned_len += TS_PACKET_SIZE;
+                        ts_align_carry_len = 0;
+                    } else {
+                        /* Lost sync, slide along to the next sync byte in the carried data */
+                        sync = (uint8_t *)memchr(&ts_align_carry[1], TS_HEADER_SYNC, TS_PACKET_SIZE - 1);
+                        n = (sync == NULL) ? TS_PACKET_SIZE : (uint32_t)(sync - ts_align_carry);
+                        memmove(ts_align_carry, &ts_align_carry[n], TS_PACKET_SIZE - n);
+                        ts_align_carry_len = TS_PACKET_SIZE - n;
+                    }
+                }
+            } else if (data[0] != TS_HEADER_SYNC) {
+                sync = (uint8_t *)memchr(data, TS_HEADER_SYNC, chunk_len);
+                n = (sync == NULL) ? chunk_len : (uint32_t)(sync - data);
+                data += n;
+                chunk_len -= n;
+            } else if (chunk_len >= TS_PACKET_SIZE) {
+                memcpy(&aligned[aligned_len], data, TS_PACKET_SIZE);
+                aligned_len += TS_PACKET_SIZE;
+                data += TS_PACKET_SIZE;
+                chunk_len -= TS_PACKET_SIZE;
+            } else {
+                memcpy(ts_align_carry, data, chunk_len);
+                ts_align_carry_len = chunk_len;
+                chunk_len = 0;
+            }
+        }
+    }
+
+    return aligned_len;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint8_t ts_usb_read(longmynd_config_t *config, uint8_t *buffer, uint16_t *len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* reads the TS endpoint, or the capture being replayed, the simulated NIM or the TS generator in     */
+/* its place, capturing what comes back                                                               */
+/* *buffer: the buffer to collect the ts data into                                                    */
+/*    *len: how many bytes we put into the buffer                                                     */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err;
+
+    if (config->replay_enabled) {
+        err=capture_replay_ts_read(buffer, len, TS_FRAME_SIZE);
+    } else if (config->nim_sim_enabled) {
+        err=nim_sim_ts_read(buffer, len);
+    } else if (config->tsgen_enabled) {
+        err=tsgen_ts_read(buffer, len);
+    } else {
+        err=ftdi_usb_ts_read(buffer, len, TS_FRAME_SIZE);
+    }
+    if (err==ERROR_NONE && config->capture_enabled) capture_ts_write(buffer, *len);
+
+    return err;
+}
 
+/* When ts_ftdi_status() last warned of an overrun, so a burst of them prints one line a second */
+static uint64_t ts_ftdi_overrun_warned_ns = 0;
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t ts_ftdi_status(uint8_t *buffer, uint16_t len, uint64_t read_ns, uint64_t gap_ns) {
+/* -------------------------------------------------------------------------------------------------- */
+/* counts the FTDI line status flags of a TS read. An overrun means TS was lost in the FTDI because   */
+/* the read came too late, so it is timestamped along with how long the read and the gap before took  */
+/* *buffer: the USB buffer, including its FTDI bytes                                                  */
+/*     len: the length (number of bytes) of the buffer                                                */
+/* read_ns: how long the read took                                                                    */
+/*  gap_ns: how long since the read before it finished                                                */
+/*  return: the number of USB packets in the read, each with its own FTDI status bytes                */
+/* -------------------------------------------------------------------------------------------------- */
+    ftdi_ts_status_t ftdi_status;
+    struct timespec now;
+    uint64_t now_ns;
+
+    ftdi_usb_ts_status(buffer, len, &ftdi_status);
+    metric_add(METRIC_FTDI_PACKETS, ftdi_status.packets);
+    if (len <= FTDI_STATUS_BYTES) metric_add(METRIC_FTDI_EMPTY_READS, 1);
+    if (ftdi_status.parity_errors > 0) metric_add(METRIC_FTDI_PARITY_ERRORS, ftdi_status.parity_errors);
+    if (ftdi_status.framing_errors > 0) metric_add(METRIC_FTDI_FRAMING_ERRORS, ftdi_status.framing_errors);
+    if (ftdi_status.breaks > 0) metric_add(METRIC_FTDI_BREAKS, ftdi_status.breaks);
+    if (ftdi_status.fifo_errors > 0) metric_add(METRIC_FTDI_FIFO_ERRORS, ftdi_status.fifo_errors);
+    if (ftdi_status.overruns == 0) return ftdi_status.packets;
+
+    metric_add(METRIC_FTDI_OVERRUNS, ftdi_status.overruns);
+    timeline_instant(TIMELINE_FTDI_OVERRUN);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    metric_set(METRIC_FTDI_LAST_OVERRUN_NANOSECONDS, now_ns);
+    metric_set(METRIC_FTDI_LAST_OVERRUN_READ_NANOSECONDS, read_ns);
+    metric_set(METRIC_FTDI_LAST_OVERRUN_GAP_NANOSECONDS, gap_ns);
+
+    if (now_ns - ts_ftdi_overrun_warned_ns >= 1000000000ULL) {
+        printf("WARNING: FTDI overrun in %u of %u packets, read took %llu us after a %llu us gap\n",
+               ftdi_status.overruns, ftdi_status.packets,
+               (unsigned long long)(read_ns / 1000), (unsigned long long)(gap_ns / 1000));
+        ts_ftdi_overrun_warned_ns = now_ns;
+    }
+
+    return ftdi_status.packets;
+}
 
 /* -------------------------------------------------------------------------------------------------- */
 void *loop_ts(void *arg) {
@@ -66,9 +212,14 @@ void *loop_ts(void *arg) {
     longmynd_status_t *status = thread_vars->status;
 
     uint8_t *buffer;
+    uint8_t *aligned_buffer = NULL;
+    uint32_t aligned_len;
     uint16_t len=0;
+    uint32_t ts_bytes=0;
     uint8_t (*ts_write)(uint8_t*,uint32_t,bool*);
     bool fifo_ready;
+    uint64_t stage_ns;
+    uint64_t read_start_ns, read_end_ns = 0;
 
     *err=ERROR_NONE;
 
@@ -86,31 +237,64 @@ void *loop_ts(void *arg) {
         ts_write = fifo_ts_write;
     }
 
+    if(*err==ERROR_NONE && (config->recorder_enabled || config->timeshift_enabled || config->hls_enabled
+                              || config->tsring_enabled)) {
+        aligned_buffer = (uint8_t*)malloc(TS_FRAME_SIZE + TS_PACKET_SIZE);
+        if(aligned_buffer == NULL)
+        {
+            *err=ERROR_TS_BUFFER_MALLOC;
+        }
+    }
+
+    if(*err==ERROR_NONE && config->recorder_enabled) {
+        *err=recorder_init(config->recorder_path, config->recorder_segment_seconds, config->recorder_segment_mbytes);
+    }
+
+    if(*err==ERROR_NONE && config->tsring_enabled) {
+        *err=tsring_init(config->tsring_name, config->tsring_mbytes);
+    }
+
     while(*err == ERROR_NONE && *thread_vars->main_err_ptr == ERROR_NONE){
         /* If reset flag is active (eg. just started or changed station), then clear out the ts buffer */
         if(config->ts_reset) {
             do {
-                if (*err==ERROR_NONE) *err=ftdi_usb_ts_read(buffer, &len, TS_FRAME_SIZE);
+                if (*err==ERROR_NONE) *err=ts_usb_read(config, buffer, &len);
             } while (*err==ERROR_NONE && len>2);
 
-            pthread_mutex_lock(&status->mutex);
+            status_ts_write_begin(status);
                 
             status->service_name[0] = '\0';
             status->service_provider_name[0] = '\0';
             status->ts_null_percentage = 100;
-            status->ts_packet_count_nolock = 0;
 
             for (int j=0; j<NUM_ELEMENT_STREAMS; j++) {
                 status->ts_elementary_streams[j][0] = 0;
             }
 
-            pthread_mutex_unlock(&status->mutex);
+            status_ts_write_end(status);
+            status_clear_ts_bytes(status);
+
+            ts_align_carry_len = 0;
+            if(config->recorder_enabled) recorder_reset();
+            if(config->hls_enabled) hls_reset();
+            bbframe_reset();
+            if(config->tsring_enabled) tsring_reset();
+            read_end_ns = 0; /* the drain above is not a gap */
 
            config->ts_reset = false; 
         }
         
 
-        *err=ftdi_usb_ts_read(buffer, &len, TS_FRAME_SIZE);
+        read_start_ns=metrics_now_ns();
+        if(read_end_ns != 0) metric_latency_add(METRIC_LATENCY_USB_READ_GAP, read_start_ns - read_end_ns);
+        *err=ts_usb_read(config, buffer, &len);
+        stage_ns=metric_latency(METRIC_LATENCY_USB_READ, read_start_ns);
+        if(*err==ERROR_NONE) {
+            /* The TS in the read, without the status bytes that start each of its USB packets */
+            ts_bytes = len - FTDI_STATUS_BYTES * ts_ftdi_status(buffer, len, stage_ns - read_start_ns,
+                                                                (read_end_ns != 0) ? read_start_ns - read_end_ns : 0);
+        }
+        read_end_ns=stage_ns;
         
         //if(len>2) fprintf(stderr,"len %d\n",len);
         /* if there is ts data then we send it out to the required output. But, we have to lose the first 2 bytes */
@@ -124,14 +308,14 @@ void *loop_ts(void *arg) {
          pthread_mutex_unlock(&status->mutex);
          */
          
-        if(thread_vars->config->ts_use_ip && (status->matype1&0xC0)>>6 == 3)
+        if(thread_vars->config->ts_use_ip && (__atomic_load_n(&status->matype1, __ATOMIC_RELAXED)&0xC0)>>6 == 3)
         {
              
            
             ts_write = udp_ts_write;
             //ts_write = udp_bb_write;
         }
-        if(thread_vars->config->ts_use_ip && (status->matype1&0xC0)>>6 == 1)
+        if(thread_vars->config->ts_use_ip && (__atomic_load_n(&status->matype1, __ATOMIC_RELAXED)&0xC0)>>6 == 1)
         {
             ts_write = udp_bb_write;
         }    
@@ -139,14 +323,38 @@ void *loop_ts(void *arg) {
 
             if(thread_vars->config->ts_use_ip || fifo_ready)
             {
+                stage_ns=metrics_now_ns();
+                timeline_begin(TIMELINE_TS_OUTPUT);
                 *err=ts_write(&buffer[2],len-2,&fifo_ready);
+                timeline_end(TIMELINE_TS_OUTPUT);
+                metric_latency(METRIC_LATENCY_OUTPUT_WRITE, stage_ns);
+                if(*err==ERROR_NONE) metric_add(METRIC_TS_OUTPUT_BYTES, ts_bytes);
             }
             else if(!thread_vars->config->ts_use_ip && !fifo_ready)
             {
+                metric_add(METRIC_TS_OUTPUT_DROPPED_BYTES, ts_bytes);
                 /* Try opening the fifo again */
                 *err=fifo_ts_init(thread_vars->config->ts_fifo_path, &fifo_ready);
             }
 
+            /* In generic continuous mode decapsulate GSE, unless udp_bb_write is already doing it */
+            if(config->gse_enabled && (__atomic_load_n(&status->matype1, __ATOMIC_RELAXED)&0xC0)>>6 == 1 && ts_write != udp_bb_write) {
+                bbframe_usb_write(&buffer[2], len-2, NULL);
+            }
+
+            /* The recorder, time-shift ring, HLS segmenter and shared memory ring take whole, sync-aligned, packets */
+            if(aligned_buffer != NULL) {
+                stage_ns=metrics_now_ns();
+                aligned_len = ts_align(&buffer[2], len-2, aligned_buffer);
+                metric_latency(METRIC_LATENCY_DEFRAME, stage_ns);
+                if(aligned_len > 0) {
+                    if(*err==ERROR_NONE && config->recorder_enabled) *err=recorder_ts_write(aligned_buffer, aligned_len);
+                    if(config->timeshift_enabled) timeshift_ts_write(aligned_buffer, aligned_len);
+                    if(config->hls_enabled) hls_ts_write(aligned_buffer, aligned_len);
+                    if(config->tsring_enabled) tsring_write(aligned_buffer, aligned_len);
+                }
+            }
+
             if(longmynd_ts_parse_buffer.waiting
                 && longmynd_ts_parse_buffer.buffer != NULL
                 && pthread_mutex_trylock(&longmynd_ts_parse_buffer.mutex) == 0)
@@ -157,15 +365,28 @@ void *loop_ts(void *arg) {
                 longmynd_ts_parse_buffer.waiting = false;
 
                 pthread_mutex_unlock(&longmynd_ts_parse_buffer.mutex);
+                metric_add(METRIC_TS_PARSE_HANDOFFS, 1);
+            }
+            else
+            {
+                metric_add(METRIC_TS_PARSE_SKIPPED, 1);
             }
 
-            status->ts_packet_count_nolock += (len-2);
+            status_add_ts_bytes(status, len-2);
+            metric_add(METRIC_USB_TS_BYTES, ts_bytes);
         }
 
     }
 
+    if(config->recorder_enabled) recorder_close();
+    if(config->tsring_enabled) tsring_close();
+
+    free(aligned_buffer);
     free(buffer);
 
+    /* Let the main loop see thread_err straight away */
+    status_notify(status);
+
     return NULL;
 }
 
@@ -189,7 +410,7 @@ static void ts_callback_sdt_service(
     uint8_t *service_name_ptr, uint32_t *service_name_length_ptr
 )
 {
-    pthread_mutex_lock(&ts_longmynd_status->mutex);
+    status_ts_write_begin(ts_longmynd_status);
                 
     memcpy(ts_longmynd_status->service_name, service_name_ptr, *service_name_length_ptr);
     ts_longmynd_status->service_name[*service_name_length_ptr] = '\0';
@@ -197,28 +418,57 @@ static void ts_callback_sdt_service(
     memcpy(ts_longmynd_status->service_provider_name, service_provider_name_ptr, *service_provider_name_length_ptr);
     ts_longmynd_status->service_provider_name[*service_provider_name_length_ptr] = '\0';
 
-    pthread_mutex_unlock(&ts_longmynd_status->mutex);
+    status_ts_write_end(ts_longmynd_status);
+}
+
+/* ISO/IEC 13818-1 stream types: MPEG-1/2, MPEG-4, H.264, H.265, H.266 video */
+static bool ts_stream_type_is_video(uint32_t type)
+{
+    return (type == 0x01 || type == 0x02 || type == 0x10 || type == 0x1B || type == 0x24 || type == 0x33);
+}
+
+/* MPEG-1/2 audio, AAC (ADTS and LATM), and AC-3/E-AC-3 as carried by ATSC */
+static bool ts_stream_type_is_audio(uint32_t type)
+{
+    return (type == 0x03 || type == 0x04 || type == 0x0F || type == 0x11 || type == 0x81 || type == 0x87);
 }
 
 static void ts_callback_pmt_pids(uint32_t *ts_pmt_index_ptr, uint32_t *ts_pmt_es_pid, uint32_t *ts_pmt_es_type)
 {
-    pthread_mutex_lock(&ts_longmynd_status->mutex);
+    /* The first video and audio streams in the PMT are the ones timed and segmented */
+    static uint16_t video_pid;
+    static uint16_t audio_pid;
+
+    status_ts_write_begin(ts_longmynd_status);
 
     ts_longmynd_status->ts_elementary_streams[*ts_pmt_index_ptr][0] = *ts_pmt_es_pid;
     ts_longmynd_status->ts_elementary_streams[*ts_pmt_index_ptr][1] = *ts_pmt_es_type;
 
-    pthread_mutex_unlock(&ts_longmynd_status->mutex);
+    status_ts_write_end(ts_longmynd_status);
+
+    if (*ts_pmt_index_ptr == 0) {
+        video_pid = 0;
+        audio_pid = 0;
+    }
+    if (video_pid == 0 && ts_stream_type_is_video(*ts_pmt_es_type)) {
+        video_pid = *ts_pmt_es_pid;
+        pcrpts_set_pids(video_pid, audio_pid != 0 ? audio_pid : pcrpts_get_audio_pid());
+    }
+    if (audio_pid == 0 && ts_stream_type_is_audio(*ts_pmt_es_type)) {
+        audio_pid = *ts_pmt_es_pid;
+        pcrpts_set_pids(video_pid != 0 ? video_pid : pcrpts_get_video_pid(), audio_pid);
+    }
 }
 
 static void ts_callback_ts_stats(uint32_t *ts_packet_total_count_ptr, uint32_t *ts_null_percentage_ptr)
 {
     if(*ts_packet_total_count_ptr > 0)
     {
-        pthread_mutex_lock(&ts_longmynd_status->mutex);
+        status_ts_write_begin(ts_longmynd_status);
 
         ts_longmynd_status->ts_null_percentage = *ts_null_percentage_ptr;
 
-        pthread_mutex_unlock(&ts_longmynd_status->mutex);
+        status_ts_write_end(ts_longmynd_status);
     }
 }
 
@@ -242,6 +492,7 @@ void *loop_ts_parse(void *arg) {
     longmynd_ts_parse_buffer.buffer = ts_buffer;
 
     struct timespec ts;
+    uint64_t parse_start_ns;
 
     /* Set pthread timer on .signal to use monotonic clock */
     pthread_condattr_t attr;
@@ -256,6 +507,7 @@ void *loop_ts_parse(void *arg) {
     {
         longmynd_ts_parse_buffer.waiting = true;
 
+        timeline_begin(TIMELINE_TS_PARSE_WAIT);
         while(longmynd_ts_parse_buffer.waiting && *thread_vars->main_err_ptr == ERROR_NONE)
         {
             /* Set timer for 100ms */
@@ -266,6 +518,10 @@ void *loop_ts_parse(void *arg) {
             pthread_cond_timedwait(&longmynd_ts_parse_buffer.signal, &longmynd_ts_parse_buffer.mutex, &ts);
         }
 
+        timeline_end(TIMELINE_TS_PARSE_WAIT);
+
+        timeline_begin(TIMELINE_TS_PARSE);
+        parse_start_ns = metrics_now_ns();
         ts_parse(
             &ts_buffer[0], longmynd_ts_parse_buffer.length,
             &ts_callback_sdt_service,
@@ -273,18 +529,16 @@ void *loop_ts_parse(void *arg) {
             &ts_callback_ts_stats,
             false
         );
-
-        pthread_mutex_lock(&ts_longmynd_status->mutex);
-
-        /* Trigger pthread signal */
-        pthread_cond_signal(&ts_longmynd_status->signal);
-
-        pthread_mutex_unlock(&ts_longmynd_status->mutex);
+        metric_latency(METRIC_LATENCY_PARSE, parse_start_ns);
+        timeline_end(TIMELINE_TS_PARSE);
     }
 
     pthread_mutex_unlock(&longmynd_ts_parse_buffer.mutex);
 
     free(ts_buffer);
 
+    /* Let the main loop see thread_err straight away */
+    status_notify(ts_longmynd_status);
+
     return NULL;
 }
@@ -22,8 +22,13 @@
 #ifndef TS_H
 #define TS_H
 
+#include <stdint.h>
+
+#define TS_FRAME_SIZE (20*512) // 512 is base USB FTDI frame
+
 void *loop_ts(void *arg);
 void *loop_ts_parse(void *arg);
+uint32_t ts_align(uint8_t *buffer, uint32_t len, uint8_t *aligned);
 
 #endif
 
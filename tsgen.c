@@ -0,0 +1,543 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsgen.c                                                                     */
+/*    - a TS generator standing in for the TS endpoint, to find the rate the pipeline sustains        */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* Each read is framed as the FTDI frames it, 2 status bytes at the start of every 512, so everything */
+/* after ts_usb_read() runs as it would on the hardware: the output, the recorder, time-shift, HLS    */
+/* and shared memory sinks, and the parser. The stream has a PAT, PMT and SDT, a video PID carrying   */
+/* the PCR with PES headers at 25 frames a second, audio PIDs, and null packets, with continuity      */
+/* counter errors and sync slips thrown in at random. Reads are paced to the rate asked for, so when  */
+/* the pipeline cannot keep up the rate achieved falls short of it; at rate=0 they are not paced at   */
+/* all and the rate achieved is the most the pipeline can take.                                       */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "errors.h"
+#include "libts.h"
+#include "ts.h"
+#include "pcrpts.h"
+#include "metrics.h"
+#include "tsgen.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define TSGEN_MAX_PIDS     16
+
+#define TSGEN_CLOCK_HZ     27000000ULL
+#define TSGEN_PCR_TICKS    (TSGEN_CLOCK_HZ / 50)  /* 20ms */
+#define TSGEN_VIDEO_TICKS  (TSGEN_CLOCK_HZ / 25)  /* a PES header for each frame */
+#define TSGEN_AUDIO_TICKS  (TSGEN_CLOCK_HZ * 1024 / 48000)
+#define TSGEN_PTS_DELAY    (TSGEN_CLOCK_HZ / 2)   /* how far ahead of the PCR the PTS runs */
+/* The rate the stream's clock runs at when the reads are not paced */
+#define TSGEN_UNPACED_MBPS 100
+
+/* Continuity counters: the tables, then the elementary streams */
+#define TSGEN_CC_PAT       0
+#define TSGEN_CC_PMT       1
+#define TSGEN_CC_SDT       2
+#define TSGEN_CC_ES        3
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+    double rate_mbps;
+    uint32_t pids;
+    uint32_t null_percent;
+    uint32_t cc_ppm;
+    uint32_t slip_ppm;
+    uint32_t seconds;
+    uint32_t seed;
+} tsgen_settings_t;
+
+static tsgen_settings_t tsgen_settings;
+static uint64_t tsgen_prng;
+
+/* The packet being sent, which runs over from one 512 byte block into the next */
+static uint8_t tsgen_packet[TS_PACKET_SIZE];
+static uint32_t tsgen_packet_len=0;
+static uint32_t tsgen_packet_sent=0;
+
+/* The TS of the read being built, before it is framed */
+static uint8_t tsgen_read_ts[TSGEN_READ_TS_BYTES];
+
+static uint8_t tsgen_cc[TSGEN_CC_ES+TSGEN_MAX_PIDS];
+static uint64_t tsgen_clock;      /* the stream's 27MHz clock, as the PCR carries it */
+static uint64_t tsgen_clock_step; /* per packet */
+static uint64_t tsgen_next_pcr;
+static uint64_t tsgen_next_pes[TSGEN_MAX_PIDS];
+
+/* Only touched by the TS thread until tsgen_report(), after it has been joined */
+static uint64_t tsgen_packets=0;
+static uint64_t tsgen_nulls=0;
+static uint64_t tsgen_cc_errors=0;
+static uint64_t tsgen_slips=0;
+static uint64_t tsgen_reads=0;
+static uint64_t tsgen_late_reads=0;
+static uint64_t tsgen_bytes=0;
+static uint64_t tsgen_generate_ns=0;
+static uint64_t tsgen_start_ns=0;
+static uint64_t tsgen_last_ns=0;
+static uint64_t tsgen_thread_cpu_start_ns=0;
+static uint64_t tsgen_thread_cpu_ns=0;
+static uint64_t tsgen_process_cpu_start_ns=0;
+static bool tsgen_finished=false;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint32_t tsgen_random(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* xorshift64, as the simulated NIM uses: cheap, and the same stream for the same seed                */
+/* -------------------------------------------------------------------------------------------------- */
+    tsgen_prng ^= tsgen_prng << 13;
+    tsgen_prng ^= tsgen_prng >> 7;
+    tsgen_prng ^= tsgen_prng << 17;
+    return (uint32_t)(tsgen_prng >> 32);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t tsgen_cpu_ns(clockid_t clock) {
+/* -------------------------------------------------------------------------------------------------- */
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static uint64_t tsgen_process_cpu_ns(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000000000ULL
+           + ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1000ULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsgen_header(uint16_t pid, bool start, uint8_t cc_slot, bool adaptation) {
+/* -------------------------------------------------------------------------------------------------- */
+/* starts the next packet, injecting a continuity counter error when one is due                       */
+/* -------------------------------------------------------------------------------------------------- */
+    if ((tsgen_settings.cc_ppm>0) && (tsgen_random()%1000000<tsgen_settings.cc_ppm)) {
+        tsgen_cc[cc_slot]++;
+        tsgen_cc_errors++;
+    }
+
+    tsgen_packet[0]=TS_HEADER_SYNC;
+    tsgen_packet[1]=(start ? 0x40 : 0x00) | (pid>>8);
+    tsgen_packet[2]=pid&0xff;
+    tsgen_packet[3]=(adaptation ? 0x30 : 0x10) | (tsgen_cc[cc_slot]++&0x0f);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsgen_psi(uint16_t pid, uint8_t cc_slot) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a PAT, PMT or SDT section in one packet                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t *s=&tsgen_packet[5];
+    uint32_t len=0;
+    uint32_t crc;
+
+    tsgen_header(pid, true, cc_slot, false);
+    tsgen_packet[4]=0; /* pointer field */
+    memset(s, 0xff, TS_PACKET_SIZE-5);
+
+    if (pid==TS_PID_PAT) {
+        s[len++]=TS_TABLE_PAT; len+=2;
+        s[len++]=0x00; s[len++]=0x01; s[len++]=0xc1; s[len++]=0; s[len++]=0;
+        s[len++]=0x00; s[len++]=0x01;
+        s[len++]=0xe0 | (TSGEN_PID_PMT>>8); s[len++]=TSGEN_PID_PMT&0xff;
+    } else if (pid==TSGEN_PID_PMT) {
+        s[len++]=TS_TABLE_PMT; len+=2;
+        s[len++]=0x00; s[len++]=0x01; s[len++]=0xc1; s[len++]=0; s[len++]=0;
+        s[len++]=0xe0 | (TSGEN_PID_ES>>8); s[len++]=TSGEN_PID_ES&0xff; /* PCR PID */
+        s[len++]=0xf0; s[len++]=0x00;
+        for (uint32_t i=0; i<tsgen_settings.pids; i++) {
+            s[len++]=(i==0) ? 0x1b : 0x0f; /* H.264, then AAC */
+            s[len++]=0xe0 | ((TSGEN_PID_ES+i)>>8); s[len++]=(TSGEN_PID_ES+i)&0xff;
+            s[len++]=0xf0; s[len++]=0x00;
+        }
+    } else {
+        s[len++]=TS_TABLE_SDT; len+=2;
+        s[len++]=0x00; s[len++]=0x01; s[len++]=0xc1; s[len++]=0; s[len++]=0;
+        s[len++]=0x00; s[len++]=0x01; s[len++]=0xff;
+        s[len++]=0x00; s[len++]=0x01; s[len++]=0xfc;
+        s[len++]=0x80; s[len++]=2+3+5+5;
+        s[len++]=0x48; s[len++]=3+5+5;
+        s[len++]=0x01;
+        s[len++]=5; memcpy(&s[len], "TSGEN", 5); len+=5;
+        s[len++]=5; memcpy(&s[len], "BENCH", 5); len+=5;
+    }
+
+    /* section_length counts from after itself to the end of the CRC */
+    s[1]=0xb0 | (((len+4-3)>>8)&0x0f);
+    s[2]=(len+4-3)&0xff;
+    crc=crc32_mpeg2(s, len);
+    s[len++]=crc>>24;
+    s[len++]=crc>>16;
+    s[len++]=crc>>8;
+    s[len++]=crc;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsgen_es(uint32_t index) {
+/* -------------------------------------------------------------------------------------------------- */
+/* a packet of an elementary stream, with the PCR and a PES header when they are due                  */
+/* -------------------------------------------------------------------------------------------------- */
+    bool pcr=(index==0) && (tsgen_clock>=tsgen_next_pcr);
+    bool pes=(tsgen_clock>=tsgen_next_pes[index]);
+    uint8_t *payload=&tsgen_packet[4];
+    uint64_t pcr_base=tsgen_clock/300;
+    uint64_t pts;
+
+    tsgen_header(TSGEN_PID_ES+index, pes, TSGEN_CC_ES+index, pcr);
+    memset(payload, 0xa5, TS_PACKET_SIZE-4);
+
+    if (pcr) {
+        tsgen_packet[4]=7;
+        tsgen_packet[5]=0x10;
+        tsgen_packet[6]=pcr_base>>25;
+        tsgen_packet[7]=pcr_base>>17;
+        tsgen_packet[8]=pcr_base>>9;
+        tsgen_packet[9]=pcr_base>>1;
+        tsgen_packet[10]=((pcr_base&1)<<7) | 0x7e | ((tsgen_clock%300)>>8);
+        tsgen_packet[11]=(tsgen_clock%300)&0xff;
+        payload=&tsgen_packet[12];
+        tsgen_next_pcr+=TSGEN_PCR_TICKS;
+    }
+    if (pes) {
+        pts=tsgen_next_pes[index]+TSGEN_PTS_DELAY;
+        payload[0]=0x00; payload[1]=0x00; payload[2]=0x01;
+        payload[3]=(index==0) ? 0xe0 : 0xc0;
+        payload[4]=0x00; payload[5]=0x00;
+        payload[6]=0x80; payload[7]=0xc0; payload[8]=10;
+        payload[9]=0x30;
+        set_timedts_pts(pts+TSGEN_VIDEO_TICKS, &payload[9]);
+        payload[14]=0x10;
+        set_timedts_pts(pts, &payload[14]);
+        tsgen_next_pes[index]+=(index==0) ? TSGEN_VIDEO_TICKS : TSGEN_AUDIO_TICKS;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsgen_next_packet(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* builds the next packet of the stream into tsgen_packet                                             */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t slot=tsgen_packets%TSGEN_PSI_PACKETS;
+    uint32_t index;
+
+    if (slot==0) tsgen_psi(TS_PID_PAT, TSGEN_CC_PAT);
+    else if (slot==1) tsgen_psi(TSGEN_PID_PMT, TSGEN_CC_PMT);
+    else if (slot==2) tsgen_psi(TS_PID_SDT, TSGEN_CC_SDT);
+    else if (tsgen_random()%100<tsgen_settings.null_percent) {
+        tsgen_packet[0]=TS_HEADER_SYNC;
+        tsgen_packet[1]=TS_PID_NULL>>8;
+        tsgen_packet[2]=TS_PID_NULL&0xff;
+        tsgen_packet[3]=0x10;
+        memset(&tsgen_packet[4], 0xff, TS_PACKET_SIZE-4);
+        tsgen_nulls++;
+    } else {
+        /* Video takes three quarters of the payload, the audio streams share the rest */
+        index=((tsgen_settings.pids==1) || (tsgen_random()%4!=0)) ? 0 : 1+tsgen_random()%(tsgen_settings.pids-1);
+        tsgen_es(index);
+    }
+
+    tsgen_packet_len=TS_PACKET_SIZE;
+    tsgen_packet_sent=0;
+    /* A slip loses the end of the packet, so the next sync byte turns up early */
+    if ((tsgen_settings.slip_ppm>0) && (tsgen_random()%1000000<tsgen_settings.slip_ppm)) {
+        tsgen_packet_len=1+tsgen_random()%(TS_PACKET_SIZE-1);
+        tsgen_slips++;
+    }
+
+    tsgen_packets++;
+    tsgen_clock+=tsgen_clock_step;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void tsgen_ts(uint8_t *ts, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the next bytes of the stream tsgen_init() set up, whose packets run on from one call to the next   */
+/*     *ts: where the TS goes                                                                         */
+/*     len: how many bytes of it                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t offset=0;
+    uint32_t n;
+
+    while (offset<len) {
+        if (tsgen_packet_sent==tsgen_packet_len) tsgen_next_packet();
+        n=tsgen_packet_len-tsgen_packet_sent;
+        if (n>len-offset) n=len-offset;
+        memcpy(&ts[offset], &tsgen_packet[tsgen_packet_sent], n);
+        tsgen_packet_sent+=n;
+        offset+=n;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint32_t tsgen_frame(uint8_t *buffer, uint16_t *len, const uint8_t *ts, uint32_t ts_len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* frames TS into a read as the FTDI delivers it, 2 status bytes at the start of every 512            */
+/* *buffer: the read, at least TS_FRAME_SIZE bytes                                                    */
+/*    *len: set to the length of the read                                                             */
+/*     *ts: the TS to frame                                                                           */
+/*  ts_len: how much TS there is; a read takes up to TSGEN_READ_TS_BYTES of it                        */
+/*  return: how many bytes of the TS went into the read                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint32_t offset=0;
+    uint32_t taken=0;
+    uint32_t n;
+
+    while ((offset<TS_FRAME_SIZE) && (taken<ts_len)) {
+        n=ts_len-taken;
+        if (n>FTDI_PACKET_SIZE-FTDI_STATUS_BYTES) n=FTDI_PACKET_SIZE-FTDI_STATUS_BYTES;
+        buffer[offset++]=0x32; /* modem status */
+        buffer[offset++]=0x60; /* line status: transmitter empty, no errors */
+        memcpy(&buffer[offset], &ts[taken], n);
+        offset+=n;
+        taken+=n;
+    }
+    *len=offset;
+
+    return taken;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+static bool tsgen_number(const char *value, uint32_t *number) {
+/* -------------------------------------------------------------------------------------------------- */
+    char *end;
+    unsigned long parsed;
+
+    errno=0;
+    parsed=strtoul(value, &end, 10);
+    if ((errno!=0) || (end==value) || (*end!='\0') || (parsed>UINT32_MAX)) return false;
+    *number=(uint32_t)parsed;
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t tsgen_init(char *settings) {
+/* -------------------------------------------------------------------------------------------------- */
+/* puts the generator in place of the TS endpoint                                                     */
+/* settings: comma separated key=value pairs, or "on" for the defaults:                               */
+/*             rate=MBPS    the TS rate, which can have decimals; 0 for as fast as it is taken        */
+/*             pids=N       elementary streams, up to 16                                              */
+/*             null=PERCENT of the packets                                                            */
+/*             cc=PPM       continuity counter errors, per million packets                            */
+/*             slip=PPM     packets cut short, per million packets                                    */
+/*             seconds=N    how long to run for, 0 until stopped                                      */
+/*             seed=N       for the choice of packets and errors                                      */
+/*   return: error code                                                                               */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    char copy[128];
+    char *token;
+    char *save;
+    char *value;
+    char *end;
+    bool ok;
+
+    tsgen_settings.rate_mbps=TSGEN_RATE_MBPS;
+    tsgen_settings.pids=TSGEN_PIDS;
+    tsgen_settings.null_percent=TSGEN_NULL_PERCENT;
+    tsgen_settings.cc_ppm=TSGEN_CC_PPM;
+    tsgen_settings.slip_ppm=TSGEN_SLIP_PPM;
+    tsgen_settings.seconds=TSGEN_SECONDS;
+    tsgen_settings.seed=TSGEN_SEED;
+
+    strncpy(copy, settings, sizeof(copy)-1);
+    copy[sizeof(copy)-1]='\0';
+
+    for (token=strtok_r(copy, ",", &save); (token!=NULL) && (err==ERROR_NONE); token=strtok_r(NULL, ",", &save)) {
+        if (0==strcmp(token, "on")) continue;
+
+        value=strchr(token, '=');
+        ok=(value!=NULL);
+        if (ok) {
+            *value++='\0';
+            if (0==strcmp(token, "rate")) {
+                errno=0;
+                tsgen_settings.rate_mbps=strtod(value, &end);
+                ok=(errno==0) && (end!=value) && (*end=='\0') && (tsgen_settings.rate_mbps>=0);
+            }
+            else if (0==strcmp(token, "pids"))    ok=tsgen_number(value, &tsgen_settings.pids) &&
+                                                     (tsgen_settings.pids>=1) && (tsgen_settings.pids<=TSGEN_MAX_PIDS);
+            else if (0==strcmp(token, "null"))    ok=tsgen_number(value, &tsgen_settings.null_percent) &&
+                                                     (tsgen_settings.null_percent<=100);
+            else if (0==strcmp(token, "cc"))      ok=tsgen_number(value, &tsgen_settings.cc_ppm) &&
+                                                     (tsgen_settings.cc_ppm<=1000000);
+            else if (0==strcmp(token, "slip"))    ok=tsgen_number(value, &tsgen_settings.slip_ppm) &&
+                                                     (tsgen_settings.slip_ppm<=1000000);
+            else if (0==strcmp(token, "seconds")) ok=tsgen_number(value, &tsgen_settings.seconds);
+            else if (0==strcmp(token, "seed"))    ok=tsgen_number(value, &tsgen_settings.seed);
+            else ok=false;
+        }
+        if (!ok) {
+            printf("ERROR: TS generator: bad setting %s%s%s\n", token, value!=NULL ? "=" : "", value!=NULL ? value : "");
+            err=ERROR_TSGEN_INIT;
+        }
+    }
+
+    if (err==ERROR_NONE) {
+        tsgen_prng=(tsgen_settings.seed==0) ? 1 : tsgen_settings.seed;
+        tsgen_clock_step=(uint64_t)(TSGEN_CLOCK_HZ*TS_PACKET_SIZE*8
+                                    / (((tsgen_settings.rate_mbps>0) ? tsgen_settings.rate_mbps : TSGEN_UNPACED_MBPS)*1e6));
+        tsgen_clock=TSGEN_CLOCK_HZ; /* clear of 0, so the first PTS are not in the past */
+        tsgen_next_pcr=tsgen_clock;
+        for (uint32_t i=0; i<TSGEN_MAX_PIDS; i++) tsgen_next_pes[i]=tsgen_clock;
+        memset(tsgen_cc, 0, sizeof(tsgen_cc));
+        /* The timing is done on the video and first audio streams, as the PMT would have it */
+        pcrpts_set_pids(TSGEN_PID_ES, (tsgen_settings.pids>1) ? TSGEN_PID_ES+1 : 0);
+        if (tsgen_settings.rate_mbps>0) {
+            printf("Flow: TS generator: %.3f Mbit/s", tsgen_settings.rate_mbps);
+        } else {
+            printf("Flow: TS generator: as fast as the TS thread takes it");
+        }
+        printf(", %u PIDs, %u%% nulls, %u ppm CC errors, %u ppm sync slips, ",
+               tsgen_settings.pids, tsgen_settings.null_percent, tsgen_settings.cc_ppm, tsgen_settings.slip_ppm);
+        if (tsgen_settings.seconds>0) printf("for %u s\n", tsgen_settings.seconds);
+        else printf("until stopped\n");
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t tsgen_ts_read(uint8_t *buffer, uint16_t *len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* the generator's ftdi_usb_ts_read(): a full read of TS, due when the rate asked for says it is      */
+/*  *buffer: the buffer to collect the ts data into                                                   */
+/*     *len: how many bytes we put into the buffer                                                    */
+/*   return: error code, ERROR_TSGEN_END once the time is up                                          */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t now, due, period_ns;
+    struct timespec wake;
+
+    now=metrics_now_ns();
+    if (tsgen_start_ns==0) {
+        tsgen_start_ns=now;
+        tsgen_thread_cpu_start_ns=tsgen_cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+        tsgen_process_cpu_start_ns=tsgen_process_cpu_ns();
+    }
+
+    if (tsgen_finished || ((tsgen_settings.seconds>0) && (now-tsgen_start_ns>=tsgen_settings.seconds*1000000000ULL))) {
+        if (!tsgen_finished) {
+            tsgen_finished=true;
+            tsgen_last_ns=now;
+            printf("Flow: TS generator finished after %llu TS reads\n", (unsigned long long)tsgen_reads);
+        }
+        return ERROR_TSGEN_END;
+    }
+
+    if (tsgen_settings.rate_mbps>0) {
+        period_ns=(uint64_t)(TSGEN_READ_TS_BYTES*8*1000.0/tsgen_settings.rate_mbps);
+        due=tsgen_start_ns+tsgen_reads*period_ns;
+        if (now<due) {
+            wake.tv_sec=due/1000000000ULL;
+            wake.tv_nsec=due%1000000000ULL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL)==EINTR) ;
+            now=metrics_now_ns();
+        } else if (now>due+period_ns) {
+            /* The pipeline took longer than a read's worth of TS over the last one */
+            tsgen_late_reads++;
+        }
+    }
+
+    tsgen_ts(tsgen_read_ts, TSGEN_READ_TS_BYTES);
+    tsgen_frame(buffer, len, tsgen_read_ts, TSGEN_READ_TS_BYTES);
+
+    tsgen_reads++;
+    tsgen_bytes+=TSGEN_READ_TS_BYTES; /* the TS in it, without the status bytes of each USB packet */
+    tsgen_last_ns=metrics_now_ns();
+    tsgen_generate_ns+=tsgen_last_ns-now;
+    tsgen_thread_cpu_ns=tsgen_cpu_ns(CLOCK_THREAD_CPUTIME_ID)-tsgen_thread_cpu_start_ns;
+
+    metric_observe(METRIC_USB_TS_READ_SIZE, *len);
+    metric_add(METRIC_USB_TS_READS, 1);
+
+    return ERROR_NONE;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void tsgen_report(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* prints what the pipeline sustained and where its time went. Once the TS threads have been joined   */
+/* -------------------------------------------------------------------------------------------------- */
+    static const metric_latency_t stages[]={ METRIC_LATENCY_DEFRAME, METRIC_LATENCY_OUTPUT_WRITE,
+                                             METRIC_LATENCY_PARSE };
+    uint64_t elapsed_ns=tsgen_last_ns-tsgen_start_ns;
+    uint64_t output_bytes=metrics_counter_total(METRIC_TS_OUTPUT_BYTES);
+    uint64_t dropped_bytes=metrics_counter_total(METRIC_TS_OUTPUT_DROPPED_BYTES);
+    uint64_t handoffs=metrics_counter_total(METRIC_TS_PARSE_HANDOFFS);
+    uint64_t skipped=metrics_counter_total(METRIC_TS_PARSE_SKIPPED);
+    double seconds=elapsed_ns/1e9;
+    double percent;
+
+    if ((tsgen_reads==0) || (elapsed_ns==0)) {
+        printf("Bench: no TS was generated\n");
+        return;
+    }
+
+    printf("Bench: %.2f s, %llu reads, %llu packets (%llu null): %.3f Mbit/s sustained",
+           seconds, (unsigned long long)tsgen_reads, (unsigned long long)tsgen_packets,
+           (unsigned long long)tsgen_nulls, tsgen_bytes*8/1e6/seconds);
+    if (tsgen_settings.rate_mbps>0) {
+        printf(" of %.3f asked for, %llu reads late\n", tsgen_settings.rate_mbps, (unsigned long long)tsgen_late_reads);
+    } else {
+        printf(", unpaced\n");
+    }
+    printf("Bench: injected %llu CC errors and %llu sync slips\n",
+           (unsigned long long)tsgen_cc_errors, (unsigned long long)tsgen_slips);
+
+    /* CPU time as a share of one core over the run */
+    printf("Bench: CPU, %% of a core: generate %.1f", 100.0*tsgen_generate_ns/elapsed_ns);
+    for (uint32_t i=0; i<sizeof(stages)/sizeof(stages[0]); i++) {
+        printf(", %s %.1f", metrics_latency_stage_name(stages[i]), 100.0*metrics_latency_total_ns(stages[i])/elapsed_ns);
+    }
+    printf(", TS thread %.1f, process %.1f\n", 100.0*tsgen_thread_cpu_ns/elapsed_ns,
+           100.0*(tsgen_process_cpu_ns()-tsgen_process_cpu_start_ns)/elapsed_ns);
+
+    percent=100.0*((double)tsgen_bytes-output_bytes)/tsgen_bytes;
+    printf("Bench: TS output %llu of %llu bytes (%.2f%% lost, %llu dropped with no reader), "
+           "parser took %llu of %llu reads\n",
+           (unsigned long long)output_bytes, (unsigned long long)tsgen_bytes, percent,
+           (unsigned long long)dropped_bytes, (unsigned long long)handoffs, (unsigned long long)(handoffs+skipped));
+}
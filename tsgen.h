@@ -0,0 +1,53 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsgen.h                                                                     */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TSGEN_H
+#define TSGEN_H
+
+#include <stdint.h>
+#include "ts.h"
+#include "ftdi_usb.h"
+
+/* Defaults, each can be changed in the settings string                                               */
+#define TSGEN_RATE_MBPS     10  /* 0 generates as fast as the TS thread takes it                       */
+#define TSGEN_PIDS          2   /* elementary streams: the first is video and carries the PCR          */
+#define TSGEN_NULL_PERCENT  10
+#define TSGEN_CC_PPM        0   /* continuity counter errors, per million packets                      */
+#define TSGEN_SLIP_PPM      0   /* packets cut short, so the sync byte moves, per million packets      */
+#define TSGEN_SECONDS       10  /* 0 runs until stopped                                                */
+#define TSGEN_SEED          1
+
+/* PAT, PMT and SDT are repeated this often, in packets                                               */
+#define TSGEN_PSI_PACKETS   1000
+
+#define TSGEN_PID_PMT       0x1000
+#define TSGEN_PID_ES        0x0100 /* the elementary streams follow on from here */
+
+/* The TS bytes in a full read, less the 2 FTDI bytes in every 512                                    */
+#define TSGEN_READ_TS_BYTES ((TS_FRAME_SIZE / FTDI_PACKET_SIZE) * (FTDI_PACKET_SIZE - FTDI_STATUS_BYTES))
+
+uint8_t tsgen_init(char *settings);
+void tsgen_ts(uint8_t *ts, uint32_t len);
+uint32_t tsgen_frame(uint8_t *buffer, uint16_t *len, const uint8_t *ts, uint32_t ts_len);
+uint8_t tsgen_ts_read(uint8_t *buffer, uint16_t *len);
+void tsgen_report(void);
+
+#endif
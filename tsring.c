@@ -0,0 +1,205 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsring.c                                                                    */
+/*    - publishes the aligned TS into a POSIX shared memory ring for local readers, see tsring.h      */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "errors.h"
+#include "tsring.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define TSRING_PACKET_SIZE 188
+
+static_assert(sizeof(tsring_header_t) == 192, "tsring_header_t layout is part of the client ABI");
+static_assert(sizeof(tsring_batch_t) == 32, "tsring_batch_t layout is part of the client ABI");
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static tsring_header_t *tsring_header = NULL;
+static tsring_batch_t *tsring_batches;
+static uint8_t *tsring_data;
+static size_t tsring_map_size;
+static char tsring_name[128];
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsring_wake(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* bumps the futex sequence and wakes readers, skipping the syscall when nobody is waiting            */
+/* -------------------------------------------------------------------------------------------------- */
+    __atomic_add_fetch(&tsring_header->futex_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tsring_header->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &tsring_header->futex_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void tsring_write(uint8_t *packets, uint32_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* publishes one batch of aligned packets                                                             */
+/* *packets: the aligned TS packets, as produced by ts_align()                                        */
+/*      len: the length (number of bytes) of the packets, a multiple of 188                           */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t position, data_size, offset;
+    uint32_t first_len;
+    tsring_batch_t *batch;
+    struct timespec now;
+
+    if (tsring_header == NULL || len == 0) return;
+
+    data_size = tsring_header->data_size;
+    if (len > data_size) return;
+
+    position = tsring_header->write_index;
+    __atomic_store_n(&tsring_header->write_reserve, position + len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    offset = position % data_size;
+    first_len = len;
+    if (offset + len > data_size) first_len = (uint32_t)(data_size - offset);
+    memcpy(&tsring_data[offset], packets, first_len);
+    if (first_len < len) memcpy(tsring_data, &packets[first_len], len - first_len);
+
+    batch = &tsring_batches[tsring_header->batch_count % tsring_header->batch_slots];
+    batch->position = position;
+    batch->length = len;
+    batch->generation = tsring_header->generation;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    batch->monotonic_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &now);
+    batch->realtime_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    __atomic_store_n(&tsring_header->batch_count, tsring_header->batch_count + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&tsring_header->write_index, position + len, __ATOMIC_RELEASE);
+
+    tsring_wake();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void tsring_reset(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* tells readers that the stream has restarted, eg. on retune                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    if (tsring_header == NULL) return;
+
+    __atomic_add_fetch(&tsring_header->generation, 1, __ATOMIC_RELEASE);
+    tsring_wake();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t tsring_init(char *name, uint32_t mbytes) {
+/* -------------------------------------------------------------------------------------------------- */
+/* creates (or recreates) the shared memory object and its header                                     */
+/*   *name: POSIX shared memory name, eg. /longmynd_ts                                                */
+/*  mbytes: approximate data size, rounded up to a whole number of TSRING_DATA_QUANTUM                */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    uint64_t data_size;
+    uint64_t batch_size = TSRING_BATCH_SLOTS * sizeof(tsring_batch_t);
+    int fd;
+
+    data_size = ((uint64_t)mbytes * 1024 * 1024 + TSRING_DATA_QUANTUM - 1) / TSRING_DATA_QUANTUM * TSRING_DATA_QUANTUM;
+    if (data_size == 0) data_size = TSRING_DATA_QUANTUM;
+    tsring_map_size = TSRING_HEADER_SIZE + batch_size + data_size;
+
+    strncpy(tsring_name, name, sizeof(tsring_name) - 1);
+
+    /* Start from a fresh object, readers still attached to an old one will see it closed */
+    shm_unlink(tsring_name);
+    fd = shm_open(tsring_name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0 || ftruncate(fd, tsring_map_size) != 0) {
+        printf("ERROR: TS ring shm_open %s (error: %s)\n", tsring_name, strerror(errno));
+        err=ERROR_TSRING_INIT;
+    }
+
+    if (err==ERROR_NONE) {
+        tsring_header = (tsring_header_t *)mmap(NULL, tsring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (tsring_header == MAP_FAILED) {
+            printf("ERROR: TS ring mmap (error: %s)\n", strerror(errno));
+            tsring_header = NULL;
+            err=ERROR_TSRING_INIT;
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    if (err==ERROR_NONE) {
+        /* ftruncate has zeroed everything else */
+        tsring_header->header_size = TSRING_HEADER_SIZE;
+        tsring_header->packet_size = TSRING_PACKET_SIZE;
+        tsring_header->batch_offset = TSRING_HEADER_SIZE;
+        tsring_header->batch_slots = TSRING_BATCH_SLOTS;
+        tsring_header->data_offset = TSRING_HEADER_SIZE + batch_size;
+        tsring_header->data_size = data_size;
+        tsring_header->writer_pid = getpid();
+        tsring_header->version = TSRING_VERSION;
+        tsring_header->state = TSRING_STATE_LIVE;
+        tsring_batches = (tsring_batch_t *)((uint8_t *)tsring_header + tsring_header->batch_offset);
+        tsring_data = (uint8_t *)tsring_header + tsring_header->data_offset;
+        /* Readers check the magic last */
+        __atomic_store_n(&tsring_header->magic, TSRING_MAGIC, __ATOMIC_RELEASE);
+
+        printf("Flow: TS ring %s, %llu KB\n", tsring_name, (unsigned long long)(data_size / 1024));
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t tsring_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* marks the ring closed, wakes any readers so they notice, and removes the name                      */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (tsring_header == NULL) return ERROR_NONE;
+
+    __atomic_store_n(&tsring_header->state, TSRING_STATE_CLOSED, __ATOMIC_RELEASE);
+    tsring_wake();
+
+    munmap(tsring_header, tsring_map_size);
+    tsring_header = NULL;
+    shm_unlink(tsring_name);
+
+    return ERROR_NONE;
+}
@@ -0,0 +1,99 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsring.h                                                                    */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TSRING_H
+#define TSRING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Shared memory layout of the TS ring, as published by longmynd -Z and read with tsring_client.h.    */
+/* This header is plain C so that clients can include it.                                            */
+/*                                                                                                    */
+/*   offset 0                   tsring_header_t                                                       */
+/*   offset batch_offset        batch_slots x tsring_batch_t, one per write, indexed batch % slots    */
+/*   offset data_offset         data_size bytes of TS, always whole 188 byte packets                  */
+/*                                                                                                    */
+/* All positions are absolute byte counts since the ring was created; the data for position p is at  */
+/* data_offset + (p % data_size). The writer stores write_reserve before overwriting anything and     */
+/* write_index once the new data is in place, both with release ordering. A reader holding data from */
+/* position p must re-check, with acquire ordering, that write_reserve <= p + data_size once it has   */
+/* finished with it; if not, it has been overrun and the data may be torn.                            */
+/* futex_seq is bumped after every write; readers that have registered in waiters can FUTEX_WAIT on   */
+/* it. generation is bumped whenever the stream restarts (eg. on retune) and the reader must resync.  */
+
+#define TSRING_MAGIC   0x474e5254 /* "TRNG" */
+#define TSRING_VERSION 1
+
+#define TSRING_DEFAULT_NAME    "/longmynd_ts"
+#define TSRING_DEFAULT_MBYTES  16
+
+/* Data size is a whole number of both pages and packets, so the data can be mapped twice back to    */
+/* back and read without wrapping: 47 x 4096 = 1024 x 188                                             */
+#define TSRING_DATA_QUANTUM    (47 * 4096)
+#define TSRING_HEADER_SIZE     4096
+#define TSRING_BATCH_SLOTS     4096
+
+#define TSRING_STATE_LIVE      1
+#define TSRING_STATE_CLOSED    2
+
+typedef struct {
+    /* Fixed at creation */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t packet_size;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t batch_offset;
+    uint32_t batch_slots;
+    uint32_t writer_pid;
+    uint8_t pad0[64 - 48];
+
+    /* Written by longmynd, on its own cache line */
+    uint64_t write_index;
+    uint64_t write_reserve;
+    uint64_t batch_count;
+    uint32_t generation;
+    uint32_t state;
+    uint32_t futex_seq;
+    uint8_t pad1[64 - 36];
+
+    /* Updated by readers */
+    uint32_t waiters;
+    uint8_t pad2[64 - 4];
+} tsring_header_t;
+
+typedef struct {
+    uint64_t position;     /* absolute position of the first byte of the batch */
+    uint32_t length;
+    uint32_t generation;
+    uint64_t monotonic_ns; /* CLOCK_MONOTONIC when the batch arrived over USB */
+    uint64_t realtime_ns;  /* CLOCK_REALTIME, for labelling */
+} tsring_batch_t;
+
+/* Writer side, in longmynd */
+uint8_t tsring_init(char *name, uint32_t mbytes);
+void tsring_write(uint8_t *packets, uint32_t len);
+void tsring_reset(void);
+uint8_t tsring_close(void);
+
+#endif
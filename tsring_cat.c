@@ -0,0 +1,64 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsring_cat.c                                                                */
+/*    - example shared memory TS ring reader, copies the live TS to stdout                            */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "tsring_client.h"
+
+int main(int argc, char *argv[])
+{
+    const char *name = (argc > 1) ? argv[1] : TSRING_DEFAULT_NAME;
+    tsring_reader_t reader;
+    const uint8_t *data;
+    int64_t len;
+    int ret;
+
+    if (tsring_reader_open(&reader, name) != TSRING_OK) {
+        fprintf(stderr, "Failed to attach to TS ring %s\n", name);
+        return 1;
+    }
+
+    for (;;) {
+        len = tsring_reader_peek(&reader, &data);
+        if (len == 0) {
+            if (tsring_reader_wait(&reader, 1000) == TSRING_CLOSED) break;
+            continue;
+        }
+        if (len == TSRING_CLOSED) break;
+        if (len < 0) {
+            fprintf(stderr, "TS ring %s, skipped to live\n", (len == TSRING_RESET) ? "reset" : "overrun");
+            continue;
+        }
+
+        if (write(STDOUT_FILENO, data, len) != len) break;
+
+        ret = tsring_reader_release(&reader, len);
+        if (ret == TSRING_OVERRUN) fprintf(stderr, "TS ring overrun while writing out, output may be damaged\n");
+    }
+
+    fprintf(stderr, "TS ring closed, %llu overruns, %llu bytes lost\n",
+            (unsigned long long)reader.overruns, (unsigned long long)reader.bytes_lost);
+    tsring_reader_close(&reader);
+
+    return 0;
+}
@@ -0,0 +1,249 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsring_client.c                                                             */
+/*    - reader side of the shared memory TS ring, see tsring_client.h                                 */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tsring_client.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+static void tsring_jump_to_live(tsring_reader_t *reader) {
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t write_index = __atomic_load_n(&reader->header->write_index, __ATOMIC_ACQUIRE);
+
+    reader->bytes_lost += write_index - reader->position;
+    reader->position = write_index;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int tsring_reader_open(tsring_reader_t *reader, const char *name) {
+/* -------------------------------------------------------------------------------------------------- */
+/* attaches to the ring and positions the reader at the live edge                                     */
+/*  *reader: the reader state to fill in                                                              */
+/*    *name: the name given to longmynd -Z, eg. /longmynd_ts                                          */
+/*   return: TSRING_OK or TSRING_ERROR                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    struct stat st;
+    tsring_header_t *header;
+    uint64_t data_size, data_offset;
+    uint8_t *data;
+    int fd;
+
+    memset(reader, 0, sizeof(tsring_reader_t));
+
+    /* Read/write as readers register themselves in header->waiters */
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return TSRING_ERROR;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < TSRING_HEADER_SIZE) {
+        close(fd);
+        return TSRING_ERROR;
+    }
+
+    header = (tsring_header_t *)mmap(NULL, TSRING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return TSRING_ERROR;
+    }
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != TSRING_MAGIC || header->version != TSRING_VERSION
+        || header->data_offset + header->data_size > (uint64_t)st.st_size) {
+        munmap(header, TSRING_HEADER_SIZE);
+        close(fd);
+        return TSRING_ERROR;
+    }
+    data_size = header->data_size;
+    data_offset = header->data_offset;
+    munmap(header, TSRING_HEADER_SIZE);
+
+    /* Header and batch table, then the data twice over so that any span up to data_size is contiguous */
+    reader->header_map_size = data_offset;
+    header = (tsring_header_t *)mmap(NULL, data_offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    data = (uint8_t *)mmap(NULL, 2 * data_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (header == MAP_FAILED || data == MAP_FAILED
+        || mmap(data, data_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, data_offset) == MAP_FAILED
+        || mmap(data + data_size, data_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, data_offset) == MAP_FAILED) {
+        if (header != MAP_FAILED) munmap(header, data_offset);
+        if (data != MAP_FAILED) munmap(data, 2 * data_size);
+        close(fd);
+        return TSRING_ERROR;
+    }
+    close(fd);
+
+    reader->header = header;
+    reader->data = data;
+    reader->generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+    reader->position = __atomic_load_n(&header->write_index, __ATOMIC_ACQUIRE);
+
+    return TSRING_OK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int64_t tsring_reader_peek(tsring_reader_t *reader, const uint8_t **data) {
+/* -------------------------------------------------------------------------------------------------- */
+/* gives the data available to the reader, in place                                                   */
+/*  *reader: the reader                                                                               */
+/*    *data: set to point at the next unread byte                                                     */
+/*   return: number of contiguous bytes available (a multiple of 188, may be 0), or TSRING_OVERRUN,   */
+/*           TSRING_RESET or TSRING_CLOSED                                                            */
+/* -------------------------------------------------------------------------------------------------- */
+    tsring_header_t *header = reader->header;
+    uint64_t write_index = __atomic_load_n(&header->write_index, __ATOMIC_ACQUIRE);
+    uint32_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+
+    if (generation != reader->generation) {
+        reader->generation = generation;
+        tsring_jump_to_live(reader);
+        return TSRING_RESET;
+    }
+
+    if (write_index - reader->position > header->data_size) {
+        reader->overruns++;
+        tsring_jump_to_live(reader);
+        return TSRING_OVERRUN;
+    }
+
+    if (write_index == reader->position
+        && __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == TSRING_STATE_CLOSED) {
+        return TSRING_CLOSED;
+    }
+
+    *data = &reader->data[reader->position % header->data_size];
+    return (int64_t)(write_index - reader->position);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int tsring_reader_release(tsring_reader_t *reader, size_t len) {
+/* -------------------------------------------------------------------------------------------------- */
+/* finishes with data returned by tsring_reader_peek, and checks it was not overwritten while in use  */
+/*  *reader: the reader                                                                               */
+/*      len: bytes consumed, normally what tsring_reader_peek returned                                */
+/*   return: TSRING_OK, or TSRING_OVERRUN if the data consumed may have been torn by the writer       */
+/* -------------------------------------------------------------------------------------------------- */
+    uint64_t start = reader->position;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&reader->header->write_reserve, __ATOMIC_RELAXED) > start + reader->header->data_size) {
+        reader->overruns++;
+        tsring_jump_to_live(reader);
+        return TSRING_OVERRUN;
+    }
+
+    reader->position = start + len;
+    return TSRING_OK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int tsring_reader_wait(tsring_reader_t *reader, int timeout_ms) {
+/* -------------------------------------------------------------------------------------------------- */
+/* sleeps until there is something for tsring_reader_peek to report                                   */
+/*     *reader: the reader                                                                            */
+/*  timeout_ms: how long to wait, -1 for ever                                                         */
+/*      return: TSRING_OK, TSRING_TIMEOUT, or TSRING_CLOSED if longmynd has gone                      */
+/* -------------------------------------------------------------------------------------------------- */
+    tsring_header_t *header = reader->header;
+    struct timespec timeout;
+    uint32_t seq;
+    bool ready;
+
+    seq = __atomic_load_n(&header->futex_seq, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    ready = __atomic_load_n(&header->write_index, __ATOMIC_SEQ_CST) != reader->position
+         || __atomic_load_n(&header->generation, __ATOMIC_SEQ_CST) != reader->generation
+         || __atomic_load_n(&header->state, __ATOMIC_SEQ_CST) == TSRING_STATE_CLOSED;
+
+    if (!ready) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        syscall(SYS_futex, &header->futex_seq, FUTEX_WAIT, seq, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+    }
+
+    __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == TSRING_STATE_CLOSED) return TSRING_CLOSED;
+    if (__atomic_load_n(&header->futex_seq, __ATOMIC_ACQUIRE) != seq || ready) return TSRING_OK;
+
+    /* Nothing arrived; a writer that died without closing the ring will never wake us */
+    if (kill((pid_t)header->writer_pid, 0) != 0 && errno == ESRCH) return TSRING_CLOSED;
+    return TSRING_TIMEOUT;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+int tsring_reader_batch_time(tsring_reader_t *reader, uint64_t position, tsring_batch_t *batch) {
+/* -------------------------------------------------------------------------------------------------- */
+/* looks up the batch, and so the arrival timestamps, that a position was written in                  */
+/*  *reader: the reader                                                                               */
+/* position: an absolute stream position, eg. reader->position                                        */
+/*   *batch: filled in with a copy of the batch record                                                */
+/*   return: TSRING_OK, or TSRING_ERROR if the batch is no longer in the table                        */
+/* -------------------------------------------------------------------------------------------------- */
+    tsring_header_t *header = reader->header;
+    tsring_batch_t *batches = (tsring_batch_t *)((uint8_t *)header + header->batch_offset);
+    uint64_t count = __atomic_load_n(&header->batch_count, __ATOMIC_ACQUIRE);
+    uint64_t oldest = (count > header->batch_slots) ? count - header->batch_slots : 0;
+    uint64_t low = oldest, high = count, mid;
+
+    /* Last batch starting at or before the position */
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (batches[mid % header->batch_slots].position <= position) low = mid + 1;
+        else high = mid;
+    }
+    if (low == oldest) return TSRING_ERROR;
+
+    memcpy(batch, &batches[(low - 1) % header->batch_slots], sizeof(tsring_batch_t));
+
+    /* The slot may have been reused while we copied it */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->batch_count, __ATOMIC_RELAXED) - (low - 1) > header->batch_slots) return TSRING_ERROR;
+    if (position >= batch->position + batch->length) return TSRING_ERROR;
+
+    return TSRING_OK;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void tsring_reader_close(tsring_reader_t *reader) {
+/* -------------------------------------------------------------------------------------------------- */
+    if (reader->header == NULL) return;
+
+    munmap((void *)reader->data, 2 * reader->header->data_size);
+    munmap(reader->header, reader->header_map_size);
+    reader->header = NULL;
+}
@@ -0,0 +1,71 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: tsring_client.h                                                             */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TSRING_CLIENT_H
+#define TSRING_CLIENT_H
+
+/* Reader library for the longmynd shared memory TS ring (-Z). Plain C, link with libtsring.a.        */
+/*                                                                                                    */
+/*   tsring_reader_t reader;                                                                          */
+/*   if (tsring_reader_open(&reader, "/longmynd_ts") == TSRING_OK) {                                  */
+/*       for (;;) {                                                                                   */
+/*           const uint8_t *data;                                                                     */
+/*           int64_t len = tsring_reader_peek(&reader, &data);       // contiguous, never wraps       */
+/*           if (len == 0) { tsring_reader_wait(&reader, 1000); continue; }                           */
+/*           if (len < 0) { handle TSRING_RESET / TSRING_OVERRUN, stop on TSRING_CLOSED; continue; }  */
+/*           consume(data, len);                                                                      */
+/*           if (tsring_reader_release(&reader, len) == TSRING_OVERRUN) { discard what was consumed } */
+/*       }                                                                                            */
+/*       tsring_reader_close(&reader);                                                                */
+/*   }                                                                                                */
+/*                                                                                                    */
+/* Any number of readers may attach; the writer never waits for them. A reader that falls more than   */
+/* the ring size behind is told so (TSRING_OVERRUN) and moved to the live edge.                       */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tsring.h"
+
+#define TSRING_OK        0
+#define TSRING_TIMEOUT   1
+#define TSRING_ERROR    -1
+#define TSRING_OVERRUN  -2  /* the reader fell behind and has been moved to the live edge */
+#define TSRING_RESET    -3  /* the stream restarted (eg. retune) and the reader has been moved to it */
+#define TSRING_CLOSED   -4  /* longmynd has stopped, tsring_reader_open() again to reattach */
+
+typedef struct {
+    tsring_header_t *header;
+    const uint8_t *data;     /* the data, mapped twice back to back */
+    size_t header_map_size;
+    uint64_t position;       /* next byte to read */
+    uint32_t generation;
+    uint64_t overruns;
+    uint64_t bytes_lost;
+} tsring_reader_t;
+
+int tsring_reader_open(tsring_reader_t *reader, const char *name);
+int tsring_reader_wait(tsring_reader_t *reader, int timeout_ms);
+int64_t tsring_reader_peek(tsring_reader_t *reader, const uint8_t **data);
+int tsring_reader_release(tsring_reader_t *reader, size_t len);
+int tsring_reader_batch_time(tsring_reader_t *reader, uint64_t position, tsring_batch_t *batch);
+void tsring_reader_close(tsring_reader_t *reader);
+
+#endif
@@ -42,6 +42,7 @@
 #include <unordered_set>
 #include <CivetServer.h>
 #include "pcrpts.h"
+#include "bbframe.h"
 
 using namespace std;
 /* -------------------------------------------------------------------------------------------------- */
@@ -315,129 +316,13 @@ void udp_send_normalize(u_int8_t *b, int len)
     }
 }
 
-#define CRC_POLY 0xAB
-// Reversed
-#define CRC_POLYR 0xD5
-uint8_t m_crc_tab[256];
-void build_crc8_table(void)
-{
-    int r, crc;
-    fprintf(stderr, "Init crc8\n");
-    for (int i = 0; i < 256; i++)
-    {
-        r = i;
-        crc = 0;
-        for (int j = 7; j >= 0; j--)
-        {
-            if ((r & (1 << j) ? 1 : 0) ^ ((crc & 0x80) ? 1 : 0))
-                crc = (crc << 1) ^ CRC_POLYR;
-            else
-                crc <<= 1;
-        }
-        m_crc_tab[i] = crc;
-    }
-}
-
-uint8_t calc_crc8(uint8_t *b, int len)
-{
-    uint8_t crc = 0;
-
-    for (int i = 0; i < len; i++)
-    {
-        crc = m_crc_tab[b[i] ^ crc];
-    }
-    return crc;
-}
-
-#define BBFRAME_MAX_LEN 7274
-void udp_bb_defrag(u_int8_t *b, int len, bool withheader)
+/* -------------------------------------------------------------------------------------------------- */
+static void udp_bb_send_frame(uint8_t *frame, uint32_t len)
 {
-    static unsigned char BBFrame[BBFRAME_MAX_LEN];
-    static int offset = 0;
-    static int dfl = 0;
-    static int count = 0;
-    int end = false;
-    int idx_b = 0;
-
-    if (offset + len > BBFRAME_MAX_LEN)
-    {
-        fprintf(stderr, "bbframe overflow! %d/%d\n", offset, len);
-        offset = 0;
-        return;
-    }
-
-    // if(((b[0]&0xC0)==0x70)&&(b[1]==0x0)) // FixeMe : SHould be better to compute crc to be sure it is a header
-    if ((offset == 0) && (b[0] != 0x72))
-    {
-        fprintf(stderr, "BBFRAME padding ? %x\n", b[0]);
-        return;
-    }
-    if ((offset == 0) && (len >= 10) && (calc_crc8(b, 9) == b[9]))
-    {
-        // offset=0; //Start of bbframe header
-        dfl = (((int)b[4] << 8) + (int)b[5]) / 8 + 10;
-    }
-    if (dfl == 0)
-    {
-        fprintf(stderr, "wrong dfl size %d\n", len);
-
-        /*
-        for(int i=0;i<len;i++)
-        {
-            fprintf(stderr,"%x ",b[i]);
-        }
-        fprintf(stderr,"\n");
-        */
-        return;
-    }
-    if (offset + len < dfl)
-    {
-        // fprintf(stderr,"bbframe # %d : %d/%d\n",count,offset+len,dfl);
-        memcpy(BBFrame + offset, b, len);
-        offset += len;
-        return;
-    }
-
-    if (offset + len == dfl)
-    {
-        memcpy(BBFrame + offset, b, len);
-        fprintf(stderr, "Complete bbframe # %d : %d/%d\n", count, offset + len, dfl);
-        sendto(sockfd_ts, BBFrame, dfl, 0, (const struct sockaddr *)&servaddr_ts, sizeof(struct sockaddr));
-        offset = 0;
-        count++;
-        return;
-    }
-
-    if (offset + len > dfl)
-    {
-        // fprintf(stderr,"------------------------ Partial bbframe # %d : %d/%d\n",count,offset+len,dfl);
-        memcpy(BBFrame + offset, b, dfl - offset);
-        sendto(sockfd_ts, BBFrame, dfl, 0, (const struct sockaddr *)&servaddr_ts, sizeof(struct sockaddr));
-        fprintf(stderr, "First Complete bbframe # %d : %d/%d\n", count, offset + dfl - offset, dfl);
-
-        int size = len - (dfl - offset);
-        /*
-          for(int i=0;i<len;i++)
-        {
-            if(i==dfl-offset) fprintf(stderr,"/////// \n");
-            fprintf(stderr,"%x ",b[i]);
-        }
-        fprintf(stderr,"\n");
-        */
-        int oldoffset = offset;
-        int olddfl = dfl;
-        offset = 0;
-        dfl = 0;
-
-        fprintf(stderr, "Recursive with size %d\n", size);
-        for (int i = 0; i < size; i++)
-        {
-            fprintf(stderr, "%x ", b[i + olddfl - oldoffset]);
-        }
-        fprintf(stderr, "\n");
-
-        udp_bb_defrag(b + olddfl - oldoffset, size, true);
-    }
+    /* -------------------------------------------------------------------------------------------------- */
+    /* forwards one complete BBFRAME, header included, as a single datagram                               */
+    /* -------------------------------------------------------------------------------------------------- */
+    sendto(sockfd_ts, frame, len, 0, (const struct sockaddr *)&servaddr_ts, sizeof(struct sockaddr));
 }
 
 uint8_t udp_ts_write(uint8_t *buffer, uint32_t len, bool *output_ready)
@@ -495,93 +380,37 @@ uint8_t udp_ts_write(uint8_t *buffer, uint32_t len, bool *output_ready)
 uint8_t udp_bb_write(uint8_t *buffer, uint32_t len, bool *output_ready)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* takes a buffer and writes out the contents to udp socket                                           */
+    /* takes a buffer of generic stream and sends each complete BBFRAME out to the udp socket             */
     /* *buffer: the buffer that contains the data to be sent                                              */
     /*     len: the length (number of bytes) of data to be sent                                           */
     /*  return: error code                                                                                */
     /* -------------------------------------------------------------------------------------------------- */
     (void)output_ready;
-    uint8_t err = ERROR_NONE;
-    int32_t remaining_len; /* note it is signed so can go negative */
-    uint32_t write_size;
-
-    remaining_len = len;
 
-    /* we need to loop round sending 510 byte chunks so that we can skip the 2 extra bytes put in by */
-    /* the FTDI chip every 512 bytes of USB message */
-    // fprintf(stderr,"bbframe %d\n",len);
-    while (remaining_len > 0)
-    {
-        if (remaining_len > 510)
-        {
-            /* calculate where to start in the buffer and how many bytes to send */
-            write_size = 510;
-
-            udp_bb_defrag(&buffer[len - remaining_len], write_size, true);
-            // sendto(sockfd_ts, &buffer[len-remaining_len], write_size, 0,(const struct sockaddr *) &servaddr_ts,  sizeof(struct sockaddr));
-            remaining_len -= 512;
-        }
-        else
-        {
-            write_size = remaining_len;
-            udp_bb_defrag(&buffer[len - remaining_len], write_size, true);
-            // sendto(sockfd_ts, &buffer[len-remaining_len], write_size, 0,(const struct sockaddr *) &servaddr_ts,  sizeof(struct sockaddr));
-            remaining_len -= write_size; /* should be 0 if all went well */
-        }
-    }
-
-    /* if someting went bad with our calcs, remaining will not be 0 */
-    if ((err == ERROR_NONE) && (remaining_len != 0))
-    {
-        printf("ERROR: UDP socket write incorrect number of bytes\n");
-        err = ERROR_UDP_WRITE;
-    }
-
-    if (err != ERROR_NONE)
-        printf("ERROR: UDP socket ts write\n");
-
-    return err;
+    return bbframe_usb_write(buffer, len, udp_bb_send_frame);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
-uint8_t udp_status_write(uint8_t message, uint32_t data, bool *output_ready)
+uint8_t udp_status_send(const struct iovec *iov, int iovcnt, bool *output_ready)
 {
     /* -------------------------------------------------------------------------------------------------- */
-    /* takes a buffer and writes out the contents to udp socket                                           */
-    /* *buffer: the buffer that contains the data to be sent                                              */
-    /*     len: the length (number of bytes) of data to be sent                                           */
-    /*  return: error code                                                                                */
+    /* sends one status frame as a single datagram                                                        */
+    /*    *iov: the frame, as its header then the body shared with the other sinks                        */
+    /*  iovcnt: number of parts                                                                           */
+    /*  return: error code, ERROR_STATUS_DROPPED if the datagram could not be sent                        */
     /* -------------------------------------------------------------------------------------------------- */
-    (void)output_ready;
-    uint8_t err = ERROR_NONE;
-    char status_message[30];
-
-    /* WARNING: This currently prints as signed integer (int32_t), even though function appears to expect unsigned (uint32_t) */
-    sprintf(status_message, "$%i,%i\n", message, data);
-
-    sendto(sockfd_status, status_message, strlen(status_message), 0, (const struct sockaddr *)&servaddr_status, sizeof(struct sockaddr));
-
-    return err;
-}
+    struct msghdr msg;
 
-/* -------------------------------------------------------------------------------------------------- */
-uint8_t udp_status_string_write(uint8_t message, char *data, bool *output_ready)
-{
-    /* -------------------------------------------------------------------------------------------------- */
-    /* takes a buffer and writes out the contents to udp socket                                           */
-    /* *buffer: the buffer that contains the data to be sent                                              */
-    /*     len: the length (number of bytes) of data to be sent                                           */
-    /*  return: error code                                                                                */
-    /* -------------------------------------------------------------------------------------------------- */
     (void)output_ready;
-    uint8_t err = ERROR_NONE;
-    char status_message[5 + 128];
-
-    sprintf(status_message, "$%i,%s\n", message, data);
 
-    sendto(sockfd_status, status_message, strlen(status_message), 0, (const struct sockaddr *)&servaddr_status, sizeof(struct sockaddr));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &servaddr_status;
+    msg.msg_namelen = sizeof(servaddr_status);
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
 
-    return err;
+    /* A datagram that could not be sent, eg. for lack of buffers, means the next one goes in full */
+    return (sendmsg(sockfd_status, &msg, 0) < 0) ? ERROR_STATUS_DROPPED : ERROR_NONE;
 }
 
 CivetServer *server; // <-- C++ style start
@@ -597,7 +426,6 @@ static uint8_t udp_init(struct sockaddr_in *servaddr_ptr, int *sockfd_ptr, char
     uint8_t err = ERROR_NONE;
 
     printf("Flow: UDP Init\n");
-    build_crc8_table();
     /* Creat the socket  for IPv4 and UDP */
     if ((*sockfd_ptr = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
     {
@@ -24,12 +24,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 uint8_t udp_status_init(char *udp_ip, int udp_port);
 uint8_t udp_ts_init(char *udp_ip, int udp_port);
 
-uint8_t udp_status_write(uint8_t message, uint32_t data, bool *output_ready);
-uint8_t udp_status_string_write(uint8_t message, char *data, bool *output_ready);
+uint8_t udp_status_send(const struct iovec *iov, int iovcnt, bool *output_ready);
 uint8_t udp_ts_write(uint8_t *buffer, uint32_t len, bool *output_ready);
 uint8_t udp_bb_write(uint8_t *buffer, uint32_t len, bool *output_ready);
 uint8_t udp_close(void);
@@ -0,0 +1,128 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: web.c                                                                       */
+/*    - the embedded HTTP server, which other modules register their handlers with                    */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- INCLUDES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include "errors.h"
+#include "web.h"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- DEFINES ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+#define WEB_NUM_THREADS "4"
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- GLOBALS ------------------------------------------------------------------------ */
+/* -------------------------------------------------------------------------------------------------- */
+
+static CivetServer *web_server = NULL;
+
+/* -------------------------------------------------------------------------------------------------- */
+/* ----------------- ROUTINES ----------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t web_init(int port) {
+/* -------------------------------------------------------------------------------------------------- */
+/* starts the embedded HTTP server                                                                    */
+/*    port: the TCP port to listen on                                                                 */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    uint8_t err=ERROR_NONE;
+    char port_str[8];
+
+    printf("Flow: Web Init on port %i\n", port);
+
+    snprintf(port_str, sizeof(port_str), "%i", port);
+    const char *options[] = {
+        "listening_ports", port_str,
+        "num_threads", WEB_NUM_THREADS,
+        NULL
+    };
+
+    try {
+        web_server = new CivetServer(options);
+    } catch (...) {
+        web_server = NULL;
+    }
+
+    if (web_server == NULL) {
+        printf("ERROR: Failed to start web server on port %i\n", port);
+        err=ERROR_WEB_INIT;
+    }
+
+    return err;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool web_is_enabled(void) {
+/* -------------------------------------------------------------------------------------------------- */
+    return (web_server != NULL);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+void web_add_handler(const char *uri, CivetHandler *handler) {
+/* -------------------------------------------------------------------------------------------------- */
+/* registers a handler for a URI, quietly does nothing if the web server is not enabled               */
+/* -------------------------------------------------------------------------------------------------- */
+    if (web_server != NULL) {
+        web_server->addHandler(uri, handler);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+bool web_get_param(struct mg_connection *conn, const char *name, char *value, size_t value_size) {
+/* -------------------------------------------------------------------------------------------------- */
+/* fetches a query string parameter into a C string                                                   */
+/*  return: true if the parameter was present                                                         */
+/* -------------------------------------------------------------------------------------------------- */
+    std::string param;
+
+    if (!CivetServer::getParam(conn, name, param)) return false;
+
+    strncpy(value, param.c_str(), value_size - 1);
+    value[value_size - 1] = '\0';
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+uint8_t web_close(void) {
+/* -------------------------------------------------------------------------------------------------- */
+/* stops the web server, waiting for any handlers in progress                                         */
+/*  return: error code                                                                                */
+/* -------------------------------------------------------------------------------------------------- */
+    if (web_server != NULL) {
+        printf("Flow: Web Close\n");
+        delete web_server;
+        web_server = NULL;
+    }
+
+    return ERROR_NONE;
+}
@@ -0,0 +1,35 @@
+/* -------------------------------------------------------------------------------------------------- */
+/* The LongMynd receiver: web.h                                                                       */
+/* Copyright 2024 Heather Lomond                                                                      */
+/* -------------------------------------------------------------------------------------------------- */
+/*
+    This file is part of longmynd.
+
+    Longmynd is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Longmynd is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with longmynd.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WEB_H
+#define WEB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <CivetServer.h>
+
+uint8_t web_init(int port);
+bool web_is_enabled(void);
+void web_add_handler(const char *uri, CivetHandler *handler);
+bool web_get_param(struct mg_connection *conn, const char *name, char *value, size_t value_size);
+uint8_t web_close(void);
+
+#endif